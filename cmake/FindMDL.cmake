@@ -6,6 +6,7 @@
 # MDL_INCLUDE_DIR
 # MDL_SHARED_LIB
 # MDL_LIB_DIR
+# MDL_DISTILLER_PLUGIN (optional)
 #
 
 find_path(MDL_INCLUDE_DIR
@@ -31,6 +32,11 @@ find_library(MDL_SHARED_LIB
 
 get_filename_component(MDL_LIB_DIR ${MDL_SHARED_LIB} DIRECTORY)
 
+find_file(MDL_DISTILLER_PLUGIN
+  NAMES mdl_distiller${CMAKE_SHARED_LIBRARY_SUFFIX} mdl_distiller.so
+  HINTS ${MDL_LIB_DIR}
+)
+
 include(FindPackageHandleStandardArgs)
 find_package_handle_standard_args(MDL
   DEFAULT_MSG
@@ -39,4 +45,4 @@ find_package_handle_standard_args(MDL
   MDL_LIB_DIR
 )
 
-mark_as_advanced(MDL_INCLUDE_DIR MDL_SHARED_LIB MDL_LIB_DIR)
+mark_as_advanced(MDL_INCLUDE_DIR MDL_SHARED_LIB MDL_LIB_DIR MDL_DISTILLER_PLUGIN)
@@ -193,6 +193,20 @@ namespace gtl
     CGPU_IMAGE_FORMAT_D16_UNORM_S8_UINT = 128,
     CGPU_IMAGE_FORMAT_D24_UNORM_S8_UINT = 129,
     CGPU_IMAGE_FORMAT_D32_SFLOAT_S8_UINT = 130,
+    CGPU_IMAGE_FORMAT_BC1_RGB_UNORM_BLOCK = 131,
+    CGPU_IMAGE_FORMAT_BC1_RGB_SRGB_BLOCK = 132,
+    CGPU_IMAGE_FORMAT_BC1_RGBA_UNORM_BLOCK = 133,
+    CGPU_IMAGE_FORMAT_BC1_RGBA_SRGB_BLOCK = 134,
+    CGPU_IMAGE_FORMAT_BC2_UNORM_BLOCK = 135,
+    CGPU_IMAGE_FORMAT_BC2_SRGB_BLOCK = 136,
+    CGPU_IMAGE_FORMAT_BC3_UNORM_BLOCK = 137,
+    CGPU_IMAGE_FORMAT_BC3_SRGB_BLOCK = 138,
+    CGPU_IMAGE_FORMAT_BC4_UNORM_BLOCK = 139,
+    CGPU_IMAGE_FORMAT_BC4_SNORM_BLOCK = 140,
+    CGPU_IMAGE_FORMAT_BC5_UNORM_BLOCK = 141,
+    CGPU_IMAGE_FORMAT_BC5_SNORM_BLOCK = 142,
+    CGPU_IMAGE_FORMAT_BC6H_UFLOAT_BLOCK = 143,
+    CGPU_IMAGE_FORMAT_BC6H_SFLOAT_BLOCK = 144,
     CGPU_IMAGE_FORMAT_BC7_UNORM_BLOCK = 145,
     CGPU_IMAGE_FORMAT_BC7_SRGB_BLOCK = 146,
     CGPU_IMAGE_FORMAT_G8B8G8R8_422_UNORM = 1000156000,
@@ -296,6 +310,7 @@ namespace gtl
     uint32_t height;
     bool is3d = false;
     uint32_t depth = 1;
+    uint32_t mipLevelCount = 1;
     CgpuImageFormat format = CGPU_IMAGE_FORMAT_R8G8B8A8_UNORM;
     CgpuImageUsageFlags usage = CGPU_IMAGE_USAGE_FLAG_TRANSFER_DST | CGPU_IMAGE_USAGE_FLAG_SAMPLED;
     const char* debugName = nullptr;
@@ -548,6 +563,7 @@ namespace gtl
     uint32_t maxRayDispatchInvocationCount;
     uint32_t shaderGroupHandleAlignment;
     uint32_t maxRayHitAttributeSize;
+    uint64_t deviceLocalMemorySize; // of the largest device-local heap
   };
 
   struct CgpuWaitSemaphoreInfo
@@ -571,6 +587,7 @@ namespace gtl
     uint32_t texelExtentX;
     uint32_t texelExtentY;
     uint32_t texelExtentZ;
+    uint32_t mipLevel = 0;
   };
 
   bool cgpuInitialize(
@@ -590,6 +607,9 @@ namespace gtl
     CgpuDevice device
   );
 
+  // Shaders, pipelines, buffers, images and samplers may be created and destroyed from multiple
+  // threads concurrently, as long as a single object is not accessed by two threads at once. All
+  // other functions require external synchronization.
   bool cgpuCreateShader(
     CgpuDevice device,
     CgpuShaderCreateInfo createInfo,
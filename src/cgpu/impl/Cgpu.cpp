@@ -93,6 +93,7 @@ namespace gtl
     uint32_t          width;
     uint32_t          height;
     uint32_t          depth;
+    uint32_t          mipLevelCount;
     VkImageLayout     layout;
     VkAccessFlags2KHR accessMask;
   };
@@ -645,6 +646,19 @@ namespace gtl
     const VkPhysicalDeviceLimits* limits = &deviceProperties.properties.limits;
     idevice->properties = cgpuTranslatePhysicalDeviceProperties(limits, &subgroupProperties, &asProperties, &rtPipelineProperties);
 
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(idevice->physicalDevice, &memoryProperties);
+
+    idevice->properties.deviceLocalMemorySize = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+    {
+      const VkMemoryHeap& heap = memoryProperties.memoryHeaps[i];
+      if ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && heap.size > idevice->properties.deviceLocalMemorySize)
+      {
+        idevice->properties.deviceLocalMemorySize = heap.size;
+      }
+    }
+
     uint32_t extensionCount;
     vkEnumerateDeviceExtensionProperties(idevice->physicalDevice, nullptr, &extensionCount, nullptr);
 
@@ -903,7 +917,7 @@ namespace gtl
         .samplerAnisotropy = VK_TRUE,
         .textureCompressionETC2 = VK_FALSE,
         .textureCompressionASTC_LDR = VK_FALSE,
-        .textureCompressionBC = VK_FALSE,
+        .textureCompressionBC = idevice->features.textureCompressionBC,
         .occlusionQueryPrecise = VK_FALSE,
         .pipelineStatisticsQuery = VK_FALSE,
         .vertexPipelineStoresAndAtomics = VK_FALSE,
@@ -1386,8 +1400,11 @@ namespace gtl
     CGPU_RESOLVE_OR_RETURN_IMAGE({ handle }, iimage);
 
     // FIXME: check device support
+    bool isBlockCompressed = createInfo.format >= CGPU_IMAGE_FORMAT_BC1_RGB_UNORM_BLOCK &&
+                             createInfo.format <= CGPU_IMAGE_FORMAT_BC7_SRGB_BLOCK;
+
     VkImageTiling vkImageTiling = VK_IMAGE_TILING_OPTIMAL;
-    if (!createInfo.is3d && ((createInfo.usage & CGPU_IMAGE_USAGE_FLAG_TRANSFER_SRC) | (createInfo.usage & CGPU_IMAGE_USAGE_FLAG_TRANSFER_DST)))
+    if (!createInfo.is3d && !isBlockCompressed && createInfo.mipLevelCount == 1 && ((createInfo.usage & CGPU_IMAGE_USAGE_FLAG_TRANSFER_SRC) | (createInfo.usage & CGPU_IMAGE_USAGE_FLAG_TRANSFER_DST)))
     {
       vkImageTiling = VK_IMAGE_TILING_LINEAR;
     }
@@ -1403,7 +1420,7 @@ namespace gtl
         .height = createInfo.height,
         .depth = createInfo.is3d ? createInfo.depth : 1,
       },
-      .mipLevels = 1,
+      .mipLevels = createInfo.mipLevelCount,
       .arrayLayers = 1,
       .samples = VK_SAMPLE_COUNT_1_BIT,
       .tiling = vkImageTiling,
@@ -1457,7 +1474,7 @@ namespace gtl
       .subresourceRange = {
       .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
         .baseMipLevel = 0,
-        .levelCount = 1,
+        .levelCount = createInfo.mipLevelCount,
         .baseArrayLayer = 0,
         .layerCount = 1,
       },
@@ -1484,6 +1501,7 @@ namespace gtl
     iimage->width = createInfo.width;
     iimage->height = createInfo.height;
     iimage->depth = createInfo.is3d ? createInfo.depth : 1;
+    iimage->mipLevelCount = createInfo.mipLevelCount;
     iimage->layout = imageCreateInfo.initialLayout;
     iimage->accessMask = 0;
 
@@ -2663,7 +2681,7 @@ cleanup_fail:
         VkImageSubresourceRange range = {
           .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
           .baseMipLevel = 0,
-          .levelCount = 1,
+          .levelCount = iimage->mipLevelCount,
           .baseArrayLayer = 0,
           .layerCount = 1
         };
@@ -2964,7 +2982,7 @@ cleanup_fail:
       VkImageSubresourceRange range = {
         .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
         .baseMipLevel = 0,
-        .levelCount = 1,
+        .levelCount = iimage->mipLevelCount,
         .baseArrayLayer = 0,
         .layerCount = 1
       };
@@ -3004,7 +3022,7 @@ cleanup_fail:
 
     VkImageSubresourceLayers layers = {
       .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-      .mipLevel = 0,
+      .mipLevel = desc->mipLevel,
       .baseArrayLayer = 0,
       .layerCount = 1,
     };
@@ -3142,7 +3160,7 @@ cleanup_fail:
       VkImageSubresourceRange range = {
         .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
         .baseMipLevel = 0,
-        .levelCount = 1,
+        .levelCount = iimage->mipLevelCount,
         .baseArrayLayer = 0,
         .layerCount = 1
       };
@@ -20,6 +20,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <atomic>
 #include <vector>
 
 namespace gtl
@@ -40,4 +41,42 @@ namespace gtl
     std::vector<uint32_t> m_versions;
     std::vector<uint32_t> m_freeList;
   };
+
+  // Same as GbHandleStore, but safe to use from multiple threads. Freed indices are kept in a
+  // lock-free list, and versions are stored in pages that are never moved. Allocation fails
+  // with an invalid (zero) handle if MAX_HANDLE_COUNT is exceeded.
+  class GbConcurrentHandleStore
+  {
+  public:
+    constexpr static uint32_t PAGE_SIZE = 1024;
+    constexpr static uint32_t MAX_PAGE_COUNT = 4096;
+    constexpr static uint32_t MAX_HANDLE_COUNT = PAGE_SIZE * MAX_PAGE_COUNT;
+
+  public:
+    GbConcurrentHandleStore();
+
+    ~GbConcurrentHandleStore();
+
+    uint64_t allocateHandle();
+
+    bool isHandleValid(uint64_t handle) const;
+
+    void freeHandle(uint64_t handle);
+
+  private:
+    struct Page
+    {
+      std::atomic<uint32_t> versions[PAGE_SIZE];
+      std::atomic<uint32_t> nextFreeIndices[PAGE_SIZE]; // offset by one, zero terminates
+    };
+
+    Page* getPage(uint32_t index) const;
+
+    Page* getOrCreatePage(uint32_t index);
+
+  private:
+    std::atomic<uint32_t> m_maxIndex = 0;
+    std::atomic<uint64_t> m_freeListHead = 0; // ABA tag in upper bits, index + 1 in lower bits
+    std::atomic<Page*> m_pages[MAX_PAGE_COUNT];
+  };
 }
@@ -20,19 +20,53 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <assert.h>
+#include <atomic>
 
-#include "SmallVector.h"
 #include "HandleStore.h"
 
 namespace gtl
 {
+  // Objects are stored in pages of C elements which are never moved, so that pointers stay
+  // valid and allocation, lookup and freeing can happen concurrently.
   template<typename T, uint32_t C>
   class GbLinearDataStore
   {
   public:
+    constexpr static uint32_t MAX_PAGE_COUNT = 4096;
+
+  public:
+    GbLinearDataStore()
+    {
+      for (std::atomic<T*>& page : m_pages)
+      {
+        page.store(nullptr, std::memory_order_relaxed);
+      }
+    }
+
+    ~GbLinearDataStore()
+    {
+      for (std::atomic<T*>& page : m_pages)
+      {
+        delete[] page.load(std::memory_order_relaxed);
+      }
+    }
+
     uint64_t allocate()
     {
-      return m_handleStore.allocateHandle();
+      uint64_t handle = m_handleStore.allocateHandle();
+      if (!handle)
+      {
+        return 0;
+      }
+
+      if (!getOrCreatePage(uint32_t(handle)))
+      {
+        assert(false);
+        m_handleStore.freeHandle(handle);
+        return 0;
+      }
+
+      return handle;
     }
 
     void free(uint64_t handle)
@@ -51,17 +85,46 @@ namespace gtl
       }
 
       uint32_t index = uint32_t(handle);
-      if (index >= m_objects.size())
+
+      T* page = getOrCreatePage(index);
+      if (!page)
       {
-        m_objects.resize(index + 1);
+        assert(false);
+        return false;
       }
 
-      *object = &m_objects[index];
+      *object = &page[index % C];
       return true;
     }
 
   private:
-    GbHandleStore m_handleStore;
-    GbSmallVector<T, C> m_objects;
+    T* getOrCreatePage(uint32_t index)
+    {
+      uint32_t pageIndex = index / C;
+
+      if (pageIndex >= MAX_PAGE_COUNT)
+      {
+        return nullptr;
+      }
+
+      T* page = m_pages[pageIndex].load(std::memory_order_acquire);
+      if (page)
+      {
+        return page;
+      }
+
+      T* newPage = new T[C]();
+      if (m_pages[pageIndex].compare_exchange_strong(page, newPage, std::memory_order_acq_rel, std::memory_order_acquire))
+      {
+        return newPage;
+      }
+
+      delete[] newPage;
+      return page;
+    }
+
+  private:
+    GbConcurrentHandleStore m_handleStore;
+    std::atomic<T*> m_pages[MAX_PAGE_COUNT];
   };
 }
@@ -67,4 +67,127 @@ namespace gtl
     m_versions[index]++;
     m_freeList.push_back(index);
   }
+
+  GbConcurrentHandleStore::GbConcurrentHandleStore()
+  {
+    for (std::atomic<Page*>& page : m_pages)
+    {
+      page.store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  GbConcurrentHandleStore::~GbConcurrentHandleStore()
+  {
+    for (std::atomic<Page*>& page : m_pages)
+    {
+      delete page.load(std::memory_order_relaxed);
+    }
+  }
+
+  uint64_t GbConcurrentHandleStore::allocateHandle()
+  {
+    // Pop from the free list. The tag is incremented on every change of the head, so that
+    // a head that has been popped and pushed again in the meantime is not mistaken for the
+    // one we read.
+    uint64_t head = m_freeListHead.load(std::memory_order_acquire);
+
+    while (uint32_t(head) != 0)
+    {
+      uint32_t index = uint32_t(head) - 1;
+      Page* page = getPage(index);
+
+      uint32_t next = page->nextFreeIndices[index % PAGE_SIZE].load(std::memory_order_relaxed);
+      uint64_t newHead = (((head >> 32ul) + 1) << 32ul) | next;
+
+      if (m_freeListHead.compare_exchange_weak(head, newHead, std::memory_order_acquire, std::memory_order_acquire))
+      {
+        uint32_t version = page->versions[index % PAGE_SIZE].load(std::memory_order_relaxed);
+
+        return (uint64_t(version) << 32ul) | index;
+      }
+    }
+
+    uint32_t index = m_maxIndex.fetch_add(1, std::memory_order_relaxed);
+
+    Page* page = getOrCreatePage(index);
+    if (!page)
+    {
+      assert(false);
+      return 0;
+    }
+
+    uint32_t version = 1;
+    page->versions[index % PAGE_SIZE].store(version, std::memory_order_release);
+
+    return (uint64_t(version) << 32ul) | index;
+  }
+
+  bool GbConcurrentHandleStore::isHandleValid(uint64_t handle) const
+  {
+    uint32_t index = uint32_t(handle);
+    uint32_t version = uint32_t(handle >> 32ul);
+
+    if (version == 0 || index >= MAX_HANDLE_COUNT)
+    {
+      return false;
+    }
+
+    const Page* page = getPage(index);
+
+    return page && page->versions[index % PAGE_SIZE].load(std::memory_order_acquire) == version;
+  }
+
+  void GbConcurrentHandleStore::freeHandle(uint64_t handle)
+  {
+    uint32_t index = uint32_t(handle);
+    assert(index < m_maxIndex.load(std::memory_order_relaxed));
+
+    Page* page = getPage(index);
+    assert(page);
+
+    // A handle that is freed twice would be pushed to the free list twice, corrupting it.
+    [[maybe_unused]] uint32_t prevVersion = page->versions[index % PAGE_SIZE].fetch_add(1, std::memory_order_release);
+    assert(prevVersion == uint32_t(handle >> 32ul) && "handle invalid or freed twice");
+
+    uint64_t head = m_freeListHead.load(std::memory_order_relaxed);
+    uint64_t newHead;
+
+    do
+    {
+      page->nextFreeIndices[index % PAGE_SIZE].store(uint32_t(head), std::memory_order_relaxed);
+      newHead = (((head >> 32ul) + 1) << 32ul) | (index + 1);
+    }
+    while (!m_freeListHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  GbConcurrentHandleStore::Page* GbConcurrentHandleStore::getPage(uint32_t index) const
+  {
+    return m_pages[index / PAGE_SIZE].load(std::memory_order_acquire);
+  }
+
+  GbConcurrentHandleStore::Page* GbConcurrentHandleStore::getOrCreatePage(uint32_t index)
+  {
+    uint32_t pageIndex = index / PAGE_SIZE;
+
+    if (pageIndex >= MAX_PAGE_COUNT)
+    {
+      return nullptr;
+    }
+
+    Page* page = m_pages[pageIndex].load(std::memory_order_acquire);
+    if (page)
+    {
+      return page;
+    }
+
+    // Another thread may be creating the same page; only one of them wins.
+    Page* newPage = new Page();
+    if (m_pages[pageIndex].compare_exchange_strong(page, newPage, std::memory_order_acq_rel, std::memory_order_acquire))
+    {
+      return newPage;
+    }
+
+    delete newPage;
+    return page;
+  }
 }
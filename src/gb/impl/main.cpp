@@ -0,0 +1,200 @@
+//
+// Copyright (C) 2023 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <gtl/gb/HandleStore.h>
+#include <gtl/gb/LinearDataStore.h>
+
+using namespace gtl;
+
+TEST_CASE("HandleStore.Sequential")
+{
+  GbHandleStore store;
+
+  uint64_t handle1 = store.allocateHandle();
+  uint64_t handle2 = store.allocateHandle();
+  CHECK(handle1 != handle2);
+  CHECK(store.isHandleValid(handle1));
+  CHECK(store.isHandleValid(handle2));
+
+  store.freeHandle(handle1);
+  CHECK(!store.isHandleValid(handle1));
+  CHECK(store.isHandleValid(handle2));
+
+  // Index is reused with a new version
+  uint64_t handle3 = store.allocateHandle();
+  CHECK(uint32_t(handle3) == uint32_t(handle1));
+  CHECK(handle3 != handle1);
+  CHECK(store.isHandleValid(handle3));
+  CHECK(!store.isHandleValid(handle1));
+
+  CHECK(!store.isHandleValid(0));
+}
+
+TEST_CASE("ConcurrentHandleStore.Sequential")
+{
+  GbConcurrentHandleStore store;
+
+  uint64_t handle1 = store.allocateHandle();
+  uint64_t handle2 = store.allocateHandle();
+  CHECK(handle1 != handle2);
+  CHECK(store.isHandleValid(handle1));
+  CHECK(store.isHandleValid(handle2));
+
+  store.freeHandle(handle1);
+  CHECK(!store.isHandleValid(handle1));
+
+  uint64_t handle3 = store.allocateHandle();
+  CHECK(uint32_t(handle3) == uint32_t(handle1));
+  CHECK(handle3 != handle1);
+  CHECK(store.isHandleValid(handle3));
+
+  CHECK(!store.isHandleValid(0));
+  CHECK(!store.isHandleValid((1ull << 32ull) | GbConcurrentHandleStore::MAX_HANDLE_COUNT));
+}
+
+TEST_CASE("ConcurrentHandleStore.Stress")
+{
+  constexpr uint32_t THREAD_COUNT = 8;
+  constexpr uint32_t ITERATION_COUNT = 20000;
+  constexpr uint32_t LIVE_HANDLE_COUNT = 64;
+
+  GbConcurrentHandleStore store;
+
+  std::vector<std::vector<uint64_t>> liveHandles(THREAD_COUNT);
+  std::vector<uint32_t> errorCounts(THREAD_COUNT, 0);
+  std::vector<uint32_t> maxIndices(THREAD_COUNT, 0);
+
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < THREAD_COUNT; t++)
+  {
+    threads.emplace_back([&, t]()
+    {
+      std::vector<uint64_t>& handles = liveHandles[t];
+      uint32_t& errorCount = errorCounts[t];
+      uint32_t& maxIndex = maxIndices[t];
+
+      for (uint32_t i = 0; i < ITERATION_COUNT; i++)
+      {
+        // Alternate between growing and shrinking the live set to exercise the free list.
+        bool allocate = handles.size() < LIVE_HANDLE_COUNT && ((i / LIVE_HANDLE_COUNT) % 2) == 0;
+
+        if (allocate || handles.empty())
+        {
+          uint64_t handle = store.allocateHandle();
+          if (!store.isHandleValid(handle))
+          {
+            errorCount++;
+          }
+          maxIndex = std::max(maxIndex, uint32_t(handle));
+          handles.push_back(handle);
+        }
+        else
+        {
+          uint64_t handle = handles.back();
+          handles.pop_back();
+
+          store.freeHandle(handle);
+
+          // Another thread may reuse the index, but never with the same version.
+          if (store.isHandleValid(handle))
+          {
+            errorCount++;
+          }
+        }
+      }
+    });
+  }
+
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+
+  for (uint32_t errorCount : errorCounts)
+  {
+    CHECK(errorCount == 0);
+  }
+
+  // Live handles must be valid and refer to distinct indices.
+  std::unordered_set<uint32_t> liveIndices;
+  for (const std::vector<uint64_t>& handles : liveHandles)
+  {
+    for (uint64_t handle : handles)
+    {
+      CHECK(store.isHandleValid(handle));
+      CHECK(liveIndices.insert(uint32_t(handle)).second);
+    }
+  }
+
+  // Freed indices are reused, so no more indices are created than the threads can hold at once.
+  uint32_t maxIndex = *std::max_element(maxIndices.begin(), maxIndices.end());
+  CHECK(maxIndex < THREAD_COUNT * LIVE_HANDLE_COUNT);
+}
+
+TEST_CASE("LinearDataStore.StablePointers")
+{
+  constexpr uint32_t THREAD_COUNT = 8;
+  constexpr uint32_t OBJECT_COUNT = 1000;
+
+  GbLinearDataStore<uint64_t, 16> store;
+
+  std::vector<std::vector<std::pair<uint64_t, uint64_t*>>> objects(THREAD_COUNT);
+
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < THREAD_COUNT; t++)
+  {
+    threads.emplace_back([&, t]()
+    {
+      for (uint32_t i = 0; i < OBJECT_COUNT; i++)
+      {
+        uint64_t handle = store.allocate();
+
+        uint64_t* object = nullptr;
+        if (store.get(handle, &object))
+        {
+          *object = handle;
+        }
+        objects[t].push_back({ handle, object });
+      }
+    });
+  }
+
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+
+  for (const auto& threadObjects : objects)
+  {
+    for (const auto& [handle, ptr] : threadObjects)
+    {
+      uint64_t* object = nullptr;
+      REQUIRE(store.get(handle, &object));
+      CHECK(object == ptr);
+      CHECK(*object == handle);
+    }
+  }
+}
@@ -38,7 +38,9 @@ namespace gtl
 
     bool stageToBuffer(const uint8_t* src, uint64_t size, CgpuBuffer dst, uint64_t dstOffset = 0);
 
-    bool stageToImage(const uint8_t* src, uint64_t size, CgpuImage dst, uint32_t width, uint32_t height, uint32_t depth = 1);
+    // Block-compressed images are staged in rows of blocks; 'blockHeight' is 4 for BCn formats.
+    bool stageToImage(const uint8_t* src, uint64_t size, CgpuImage dst, uint32_t width, uint32_t height, uint32_t depth = 1,
+                      uint32_t mipLevel = 0, uint32_t blockHeight = 1);
 
   private:
     using CopyFunc = std::function<bool(uint64_t srcOffset, uint64_t dstOffset, uint64_t size)>;
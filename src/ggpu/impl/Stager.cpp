@@ -155,9 +155,10 @@ fail:
     return stage(src, size, copyFunc);
   }
 
-  bool GgpuStager::stageToImage(const uint8_t* src, uint64_t size, CgpuImage dst, uint32_t width, uint32_t height, uint32_t depth)
+  bool GgpuStager::stageToImage(const uint8_t* src, uint64_t size, CgpuImage dst, uint32_t width, uint32_t height, uint32_t depth,
+                                uint32_t mipLevel, uint32_t blockHeight)
   {
-    uint32_t rowCount = height;
+    uint32_t rowCount = (height + blockHeight - 1) / blockHeight;
     uint64_t rowSize = size / rowCount;
 
     if (rowSize > BUFFER_HALF_SIZE)
@@ -185,15 +186,20 @@ fail:
       uint32_t remainingRowCount = rowCount - rowsStaged;
       uint32_t copyRowCount = std::min(remainingRowCount, maxCopyRowCount);
 
-      auto copyFunc = [this, dst, rowsStaged, width, depth, copyRowCount](uint64_t srcOffset, [[maybe_unused]] uint64_t dstOffset, [[maybe_unused]] uint64_t size) {
+      // The last row of blocks may extend past the image.
+      uint32_t texelOffsetY = rowsStaged * blockHeight;
+      uint32_t texelExtentY = std::min(copyRowCount * blockHeight, height - texelOffsetY);
+
+      auto copyFunc = [this, dst, texelOffsetY, texelExtentY, width, depth, mipLevel](uint64_t srcOffset, [[maybe_unused]] uint64_t dstOffset, [[maybe_unused]] uint64_t size) {
         CgpuBufferImageCopyDesc desc;
         desc.bufferOffset = srcOffset;
         desc.texelOffsetX = 0;
         desc.texelExtentX = width;
-        desc.texelOffsetY = rowsStaged;
-        desc.texelExtentY = copyRowCount;
+        desc.texelOffsetY = texelOffsetY;
+        desc.texelExtentY = texelExtentY;
         desc.texelOffsetZ = 0;
         desc.texelExtentZ = depth;
+        desc.mipLevel = mipLevel;
 
         return cgpuCmdCopyBufferToImage(
           m_commandBuffers[m_writeableHalf],
@@ -129,10 +129,67 @@ namespace gtl
     const std::vector<GiVertex>&      vertices;
   };
 
+  enum class GiPreviewSurfaceInput
+  {
+    DiffuseColor,
+    EmissiveColor,
+    SpecularColor,
+    Metallic,
+    Roughness,
+    Clearcoat,
+    ClearcoatRoughness,
+    Opacity,
+    Normal,
+    COUNT
+  };
+
+  enum class GiTextureChannel
+  {
+    R, G, B, A, Rgb
+  };
+
+  enum class GiTextureWrapMode
+  {
+    Black, Clamp, Repeat, Mirror
+  };
+
+  // A UsdUVTexture node connected to a UsdPreviewSurface input. Texture coordinates are the
+  // mesh's default ones.
+  struct GiPreviewSurfaceTexture
+  {
+    float             bias[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    GiTextureChannel  channel = GiTextureChannel::Rgb;
+    std::string       filePath; // empty if the input is not textured
+    float             scale[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    bool              sRgb = false;
+    GiTextureWrapMode wrapS = GiTextureWrapMode::Repeat;
+    GiTextureWrapMode wrapT = GiTextureWrapMode::Repeat;
+  };
+
+  // Parameters of a UsdPreviewSurface network. Defaults are the ones of the specification.
+  struct GiPreviewSurfaceDesc
+  {
+    float                   clearcoat = 0.0f;
+    float                   clearcoatRoughness = 0.01f;
+    float                   diffuseColor[3] = { 0.18f, 0.18f, 0.18f };
+    float                   emissiveColor[3] = { 0.0f, 0.0f, 0.0f };
+    float                   ior = 1.5f;
+    float                   metallic = 0.0f;
+    float                   normal[3] = { 0.0f, 0.0f, 1.0f };
+    float                   opacity = 1.0f;
+    float                   opacityThreshold = 0.0f;
+    float                   roughness = 0.5f;
+    float                   specularColor[3] = { 0.0f, 0.0f, 0.0f };
+    GiPreviewSurfaceTexture textures[size_t(GiPreviewSurfaceInput::COUNT)];
+    bool                    useSpecularWorkflow = false;
+  };
+
   struct GiRenderSettings
   {
+    bool     asyncShaderCompilation; // render with a fallback material while shaders compile
     bool     clippingPlanes;
     bool     depthOfField;
+    bool     distilledMaterials; // preview shading with simplified MDL materials, if available
     bool     domeLightCameraVisible;
     bool     filterImportanceSampling;
     bool     jitteredSampling;
@@ -142,10 +199,12 @@ namespace gtl
     uint32_t maxVolumeWalkLength;
     uint32_t mediumStackSize;
     bool     nextEventEstimation;
+    bool     previewSurfaceFastPath; // shade UsdPreviewSurface materials without MDL
     bool     progressiveAccumulation;
     uint32_t rrBounceOffset;
     float    rrInvMinTermProb;
     uint32_t spp;
+    uint32_t textureMemoryBudget; // in MiB; unreferenced textures are evicted above it, 0 for automatic
   };
 
   struct GiAovBinding
@@ -164,14 +223,27 @@ namespace gtl
     GiScene*                  scene;
   };
 
+  enum class GiShaderOptimization
+  {
+    None,
+    Performance,
+    Size
+  };
+
   struct GiInitParams
   {
     std::string_view shaderPath;
     std::string_view mdlRuntimePath;
     const std::vector<std::string>& mdlSearchPaths;
     const std::shared_ptr<void/*MaterialX::Document*/> mtlxStdLib;
+    bool mdlClassCompilation = false;
+    std::string_view mdlDistillTarget; // e.g. 'ue4' or 'transmissive_pbr'; empty to disable distilling
+    GiShaderOptimization shaderOptimization = GiShaderOptimization::None;
+    bool textureCompression = false; // only used if the device supports BCn formats
+    std::string_view textureCachePath; // for compressed textures; empty to disable the disk cache
   };
 
+  // Textures are read from multiple threads, so implementations must be thread-safe.
   class GiAssetReader
   {
   public:
@@ -182,27 +254,42 @@ namespace gtl
     virtual ~GiAssetReader() = default;
   };
 
+  // Starts loading the MDL runtime on a background thread, which giInitialize joins after creating
+  // the device instead of loading the runtime itself. Optional; must precede giInitialize.
+  void giPreloadMdlRuntime(std::string_view mdlRuntimePath);
+
   GiStatus giInitialize(const GiInitParams& params);
   void giTerminate();
 
   void giRegisterAssetReader(GiAssetReader* reader);
 
   GiMaterial* giCreateMaterialFromMtlxStr(const char* name, const char* mtlxSrc);
-  GiMaterial* giCreateMaterialFromMtlxDoc(const char* name, const std::shared_ptr<void/*MaterialX::Document*/> doc);
+  // 'previewSurface' is optional. If given, the material can be rendered without MDL (see GiRenderSettings).
+  GiMaterial* giCreateMaterialFromMtlxDoc(const char* name,
+                                          const std::shared_ptr<void/*MaterialX::Document*/> doc,
+                                          const GiPreviewSurfaceDesc* previewSurface);
   GiMaterial* giCreateMaterialFromMdlFile(const char* name, const char* filePath, const char* subIdentifier);
   void giDestroyMaterial(GiMaterial* mat);
+  // Takes over the parameters of 'paramMat' if it only differs in parameter values (requires
+  // class compilation). Only argument blocks are updated in that case; 'paramMat' can be destroyed.
+  bool giUpdateMaterialParameters(GiMaterial* mat, GiMaterial* paramMat);
 
   GiMesh* giCreateMesh(GiScene* scene, const GiMeshDesc& desc);
   void giSetMeshTransform(GiMesh* mesh, const float* mat4x4);
   void giSetMeshInstanceTransforms(GiMesh* mesh, uint32_t count, const float (*transforms)[4][4]);
+  // The mesh keeps the material alive until it is assigned another one or destroyed.
   void giSetMeshMaterial(GiMesh* mesh, const GiMaterial* mat);
   void giSetMeshVisibility(GiMesh* mesh, bool visible);
   void giDestroyMesh(GiMesh* mesh);
 
   GiStatus giRender(const GiRenderParams& params);
+  // True while materials are compiled in the background and rendered with a fallback material.
+  bool giAreShadersPending(const GiScene* scene);
 
   GiScene* giCreateScene();
   void giDestroyScene(GiScene* scene);
+  // Number of hit groups compiled for the scene so far, for diagnostics.
+  uint64_t giGetHitGroupCompileCount(const GiScene* scene);
 
   GiSphereLight* giCreateSphereLight(GiScene* scene);
   void giDestroySphereLight(GiScene* scene, GiSphereLight* light);
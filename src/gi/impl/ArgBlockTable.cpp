@@ -0,0 +1,110 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "ArgBlockTable.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+namespace gtl
+{
+  uint32_t GiArgBlockTable::addBlock(const uint8_t* data, uint32_t size)
+  {
+    uint32_t offset = uint32_t(m_data.size());
+    assert((offset % BLOCK_ALIGNMENT) == 0);
+
+    // Padding is zero-initialized and never written, so word-wise diffs don't see garbage.
+    uint32_t paddedSize = (size + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+    m_data.resize(offset + paddedSize, 0);
+
+    if (size > 0)
+    {
+      memcpy(&m_data[offset], data, size);
+    }
+
+    m_blocks.push_back(Range{ .offset = offset, .size = size });
+
+    return uint32_t(m_blocks.size() - 1);
+  }
+
+  bool GiArgBlockTable::updateBlock(uint32_t blockIndex, const uint8_t* data, uint32_t size, std::vector<Range>& dirtyRanges)
+  {
+    assert(blockIndex < m_blocks.size());
+    const Range& block = m_blocks[blockIndex];
+
+    if (size != block.size)
+    {
+      return false;
+    }
+
+    uint8_t* blockData = &m_data[block.offset];
+
+    for (uint32_t wordOffset = 0; wordOffset < size; wordOffset += WORD_SIZE)
+    {
+      uint32_t byteCount = std::min(WORD_SIZE, size - wordOffset);
+
+      if (memcmp(&blockData[wordOffset], &data[wordOffset], byteCount) == 0)
+      {
+        continue;
+      }
+
+      memcpy(&blockData[wordOffset], &data[wordOffset], byteCount);
+
+      // Ranges cover whole words; the last word of a block may extend into its padding.
+      uint32_t offset = block.offset + wordOffset;
+
+      if (!dirtyRanges.empty())
+      {
+        Range& lastRange = dirtyRanges.back();
+        uint32_t lastRangeEnd = lastRange.offset + lastRange.size;
+
+        if (offset >= lastRangeEnd && (offset - lastRangeEnd) <= RANGE_MERGE_DISTANCE)
+        {
+          lastRange.size = offset + WORD_SIZE - lastRange.offset;
+          continue;
+        }
+      }
+
+      dirtyRanges.push_back(Range{ .offset = offset, .size = WORD_SIZE });
+    }
+
+    return true;
+  }
+
+  uint32_t GiArgBlockTable::blockCount() const
+  {
+    return uint32_t(m_blocks.size());
+  }
+
+  uint32_t GiArgBlockTable::blockOffset(uint32_t blockIndex) const
+  {
+    assert(blockIndex < m_blocks.size());
+    return m_blocks[blockIndex].offset;
+  }
+
+  uint32_t GiArgBlockTable::blockSize(uint32_t blockIndex) const
+  {
+    assert(blockIndex < m_blocks.size());
+    return m_blocks[blockIndex].size;
+  }
+
+  const std::vector<uint8_t>& GiArgBlockTable::data() const
+  {
+    return m_data;
+  }
+}
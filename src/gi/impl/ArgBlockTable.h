@@ -0,0 +1,65 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+namespace gtl
+{
+  // Packs the MDL argument blocks of all class-compiled materials into a single buffer.
+  // When blocks are rewritten after parameter edits, the changed byte ranges are
+  // reported so that only these have to be uploaded.
+  class GiArgBlockTable
+  {
+  public:
+    // Large enough for any type read from an argument block (see mdl_interface.glsl).
+    constexpr static uint32_t BLOCK_ALIGNMENT = 16;
+    // Granularity of the shader-side reads.
+    constexpr static uint32_t WORD_SIZE = 4;
+    // Changed words this close to each other are uploaded as one range.
+    constexpr static uint32_t RANGE_MERGE_DISTANCE = 64;
+
+    struct Range
+    {
+      uint32_t offset;
+      uint32_t size;
+    };
+
+  public:
+    // Returns the block index.
+    uint32_t addBlock(const uint8_t* data, uint32_t size);
+
+    // Overwrites a block with data of the same size. Changed ranges (in table space)
+    // are appended to 'dirtyRanges'. Returns false if the size does not match.
+    bool updateBlock(uint32_t blockIndex, const uint8_t* data, uint32_t size, std::vector<Range>& dirtyRanges);
+
+  public:
+    uint32_t blockCount() const;
+
+    uint32_t blockOffset(uint32_t blockIndex) const;
+
+    uint32_t blockSize(uint32_t blockIndex) const;
+
+    const std::vector<uint8_t>& data() const;
+
+  private:
+    std::vector<Range> m_blocks;
+    std::vector<uint8_t> m_data;
+  };
+}
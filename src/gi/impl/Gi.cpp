@@ -20,11 +20,14 @@
 #endif
 
 #include "Gi.h"
+#include "ArgBlockTable.h"
 #include "TextureManager.h"
 #include "Turbo.h"
 #include "AssetReader.h"
 #include "GlslShaderGen.h"
 #include "MeshProcessing.h"
+#include "PreviewSurface.h"
+#include "StageTimeline.h"
 #include "interface/rp_main.h"
 
 #include <stdlib.h>
@@ -35,10 +38,14 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <algorithm>
+#include <bit>
 #include <fstream>
 #include <atomic>
+#include <chrono>
 #include <optional>
 #include <mutex>
+#include <future>
+#include <functional>
 #include <assert.h>
 
 #include <gtl/ggpu/Stager.h>
@@ -68,9 +75,56 @@ namespace mx = MaterialX;
 namespace gtl
 {
   constexpr static const float BYTES_TO_MIB = 1.0f / (1024.0f * 1024.0f);
+  constexpr static const uint32_t MIN_TEXTURE_ARRAY_CAPACITY = 16;
+
+  constexpr static const uint32_t SHADER_BUILD_TIMELINE_INTERVAL_COUNT = 10;
+
+  // Share of device-local memory that unreferenced textures may occupy if no budget is set.
+  constexpr static const uint64_t AUTO_TEXTURE_MEMORY_BUDGET_DIVISOR = 4;
+
+  // Shades meshes whose materials are still being compiled. Does not read scene data, as mesh
+  // payloads are laid out for the actual material.
+  constexpr static const char* FALLBACK_MATERIAL_MTLX = R"(
+    <?xml version="1.0"?>
+    <materialx version="1.38">
+      <UsdPreviewSurface name="gi_SR_fallback" type="surfaceshader">
+        <input name="diffuseColor" type="color3" value="0.18, 0.18, 0.18" />
+      </UsdPreviewSurface>
+      <surfacematerial name="gi_MAT_fallback" type="material">
+        <input name="surfaceshader" type="surfaceshader" nodename="gi_SR_fallback" />
+      </surfacematerial>
+    </materialx>
+  )";
 
   namespace rp = shader_interface::rp_main;
 
+  // Hit groups of UsdPreviewSurface materials on the fast path share the preview_surface.glsl
+  // ubershaders. These describe their properties in place of a compiled MDL material.
+  static const McMaterial PREVIEW_SURFACE_OPAQUE_MATERIAL = {
+    .hasBackfaceBsdf = false,
+    .hasBackfaceEdf = false,
+    .hasVolumeAbsorptionCoeff = false,
+    .hasVolumeScatteringCoeff = false,
+    .hasCutoutTransparency = false,
+    .isEmissive = true,
+    .isThinWalled = false,
+    .directionalBias = 0.0f,
+    .requiresSceneTransforms = false,
+    .cameraPositionSceneDataIndex = 0
+  };
+
+  static const McMaterial PREVIEW_SURFACE_CUTOUT_MATERIAL = [] {
+    McMaterial material = PREVIEW_SURFACE_OPAQUE_MATERIAL;
+    material.hasCutoutTransparency = true;
+    return material;
+  }();
+
+  constexpr static const char* PREVIEW_SURFACE_GLSL = "#include \"preview_surface.glsl\"\n";
+
+  // Not produced by McHashMaterial in practice; the material pointer of the key is null.
+  constexpr static const uint64_t PREVIEW_SURFACE_OPAQUE_HASH = 0x5053555246414345ull;
+  constexpr static const uint64_t PREVIEW_SURFACE_CUTOUT_HASH = 0x5053435554535546ull;
+
   class McRuntime;
 
   struct GiGpuBufferView
@@ -94,26 +148,151 @@ namespace gtl
     CgpuTlas   tlas;
   };
 
+  struct GiMaterialArgBlocks
+  {
+    int32_t  shadingBlockIndex = -1;
+    uint32_t shadingLayoutId = 0;
+    int32_t  opacityBlockIndex = -1;
+    uint32_t opacityLayoutId = 0;
+    uint32_t paramVersion = 0;
+    bool isPreviewSurface = false; // packed by giPackPreviewSurface instead of MDL
+  };
+
+  struct GiHitGroupKey
+  {
+    uint64_t materialHash;
+    const GiMaterial* material; // only set for materials with argument blocks, as these are never shared
+
+    bool operator==(const GiHitGroupKey& other) const = default;
+  };
+
+  struct GiHitGroupKeyHasher
+  {
+    size_t operator()(const GiHitGroupKey& key) const
+    {
+      return size_t(key.materialHash) ^ std::hash<const GiMaterial*>{}(key.material);
+    }
+  };
+
+  // Hit shader inputs that are not derived from the material.
+  struct GiHitShaderInputs
+  {
+    uint32_t aovMask;
+    uint32_t mediumStackSize;
+    bool nextEventEstimation;
+    uint32_t texCapacity2d;
+    uint32_t texCapacity3d;
+
+    bool operator==(const GiHitShaderInputs& other) const = default;
+  };
+
+  struct GiHitShaderArtifacts
+  {
+    GiGlslShaderGen::MaterialGenInfo genInfo;
+    std::vector<CgpuImage> images2d;
+    std::vector<CgpuImage> images3d;
+    std::vector<GiTextureUsage> textureUsages; // parallel to genInfo.textureDescriptions; empty for MDL materials
+    CgpuShader shader;
+    CgpuShader shadowShader; // any hit only
+  };
+
+  // Generated code, textures and shaders of a unique material. These are kept across shader
+  // cache rebuilds so that only added or changed materials need to be compiled.
+  struct GiHitGroupArtifacts
+  {
+    GiHitShaderArtifacts closestHit;
+    std::optional<GiHitShaderArtifacts> anyHit;
+    std::optional<GiHitShaderInputs> shaderInputs; // unset if no shaders have been created yet
+    std::vector<uint64_t> shaderIds; // for finding shaders affected by shader file changes
+    uint32_t paramVersion = 0; // of the argument blocks
+    uint32_t generation = 0; // of the last shader cache that used the artifacts
+  };
+
+  struct GiHitGroupCache
+  {
+    std::unordered_map<GiHitGroupKey, GiHitGroupArtifacts, GiHitGroupKeyHasher> entries;
+    uint32_t generation = 0;
+    uint32_t texCapacity2d = 0;
+    uint32_t texCapacity3d = 0;
+    std::atomic_uint64_t compileCount = 0; // of hit groups, for diagnostics
+  };
+
+  // Per hit group, copied to the BLAS payloads of instances (see rp::BlasPayload).
+  struct GiHitGroupResourceOffsets
+  {
+    uint32_t textureIndexOffsets[2] = { 0, 0 };
+    int32_t argBlockOffsets[2] = { -1, -1 };
+  };
+
+  // Hit group pair of the RT pipeline. Either of a single unique material, or shared by all
+  // UsdPreviewSurface materials on the fast path.
+  struct GiHitGroupShaders
+  {
+    CgpuShader closestHitShader;
+    CgpuShader anyHitShader;
+    CgpuShader anyHitShadowShader;
+    std::vector<uint64_t> shaderIds;
+  };
+
+  enum class GiShaderBuildStage : uint32_t
+  {
+    Codegen, // MDL to GLSL
+    Compile, // stitching & GLSL to SPIR-V
+    Module   // shader module creation
+  };
+
+  struct GiPipelineHitGroup
+  {
+    GiHitGroupArtifacts* artifacts;
+    const McMaterial* mcMat;
+    const char* debugName;
+    bool isPreviewSurface; // argument blocks are per material, not part of the artifacts
+  };
+
   struct GiShaderCache
   {
     uint32_t                       aovMask;
+    CgpuBuffer                     argBlockBuffer;
+    GiArgBlockTable                argBlocks;
+    bool                           distilledMaterials;
     bool                           domeLightCameraVisible;
-    std::vector<CgpuShader>        hitShaders;
-    std::vector<CgpuImage>         images2d;
-    std::vector<CgpuImage>         images3d;
-    std::vector<const GiMaterial*> materials;
+    uint32_t                       fallbackHitGroup; // for meshes with materials not in this cache
+    uint32_t                       hitGroupGeneration;
+    std::vector<uint32_t>          hitGroupPipelineIndices; // per unique hit group, index of pipeline hit group pair
+    std::vector<GiHitGroupResourceOffsets> hitGroupResourceOffsets;
+    std::vector<CgpuImage>         images2d; // owned by the scene's hit group cache
+    std::vector<CgpuImage>         images3d; // owned by the scene's hit group cache
+    std::vector<const GiMaterial*> materials; // retained
+    std::vector<uint32_t>          materialHitGroups; // per material, index of unique hit group pair
+    std::vector<GiMaterialArgBlocks> materialArgBlocks;
     std::vector<CgpuShader>        missShaders;
     CgpuPipeline                   pipeline;
     bool                           hasPipelineClosestHitShader = false;
     bool                           hasPipelineAnyHitShader = false;
     CgpuShader                     rgenShader;
     bool                           resetSampleOffset = true;
+    uint32_t                       texCapacity2d;
+    uint32_t                       texCapacity3d;
   };
 
   struct GiMaterial
   {
     McMaterial* mcMat;
     std::string name;
+    std::optional<GiPreviewSurfaceDesc> previewSurface; // set if the fast path can shade the material
+    uint32_t paramVersion = 0;
+    mutable std::atomic<uint32_t> refCount = 1; // user handle, meshes and shader caches
+  };
+
+  // Builds a shader cache on a worker thread. The stager and texture manager may only be used by
+  // the render thread, so the worker queues such work as tasks, which giRender runs.
+  struct GiShaderCacheBuild
+  {
+    std::vector<const GiMaterial*> materials; // retained
+    std::future<GiShaderCache*> result;
+    std::mutex taskMutex;
+    std::vector<std::packaged_task<bool()>> tasks;
+    std::atomic_bool cancelled = false;
   };
 
   struct GiMesh
@@ -190,10 +369,13 @@ namespace gtl
     GiDomeLight* domeLight = nullptr; // weak ptr
     glm::vec4 backgroundColor = glm::vec4(-1.0f); // used to initialize fallback dome light
     CgpuImage fallbackDomeLightTexture;
+    CgpuImage fallbackTexture3d; // for unused 3D texture array elements
     std::unordered_set<GiMesh*> meshes;
     std::mutex mutex;
     GiSceneDirtyFlags dirtyFlags = GiSceneDirtyFlags::All;
     GiShaderCache* shaderCache = nullptr;
+    GiShaderCacheBuild* shaderCacheBuild = nullptr;
+    GiHitGroupCache hitGroupCache;
     GiBvh* bvh = nullptr;
     GiRenderParams oldRenderParams = {};
     CgpuBuffer aovDefaultValues;
@@ -214,31 +396,48 @@ namespace gtl
   CgpuDevice s_device;
   CgpuPhysicalDeviceFeatures s_deviceFeatures;
   CgpuPhysicalDeviceProperties s_deviceProperties;
+  bool s_textureCompression = false;
   CgpuSampler s_texSampler;
   std::unique_ptr<GgpuStager> s_stager;
   std::unique_ptr<GgpuDelayedResourceDestroyer> s_delayedResourceDestroyer;
   std::unique_ptr<GiGlslShaderGen> s_shaderGen;
   std::unique_ptr<McRuntime> s_mcRuntime;
+  std::future<McRuntime*> s_mcRuntimeFuture;
+  std::string s_mcRuntimeFuturePath;
   std::unique_ptr<McFrontend> s_mcFrontend;
   std::unique_ptr<GiMmapAssetReader> s_mmapAssetReader;
   std::unique_ptr<GiAggregateAssetReader> s_aggregateAssetReader;
   std::unique_ptr<GiTextureManager> s_texSys;
   std::atomic_bool s_forceShaderCacheInvalid = false;
   std::atomic_bool s_resetSampleOffset = false;
+  GiMaterial* s_fallbackMaterial = nullptr;
+  std::atomic_uint32_t s_pendingShaderCacheBuildCount = 0;
 
 #ifdef GI_SHADER_HOTLOADING
+  std::mutex s_changedShaderFilesMutex;
+  std::vector<fs::path> s_changedShaderFiles;
+
   class ShaderFileListener : public efsw::FileWatchListener
   {
   public:
-    void handleFileAction([[maybe_unused]] efsw::WatchID watchId, [[maybe_unused]] const std::string& dir,
-                          [[maybe_unused]] const std::string& filename, efsw::Action action,
-                          [[maybe_unused]] std::string oldFilename) override
+    void handleFileAction([[maybe_unused]] efsw::WatchID watchId, const std::string& dir,
+                          const std::string& filename, efsw::Action action,
+                          std::string oldFilename) override
     {
       switch (action)
       {
+      case efsw::Actions::Add:
       case efsw::Actions::Delete:
       case efsw::Actions::Modified:
       case efsw::Actions::Moved:
+        {
+          std::lock_guard guard(s_changedShaderFilesMutex);
+          s_changedShaderFiles.push_back(fs::path(dir) / filename);
+          if (!oldFilename.empty())
+          {
+            s_changedShaderFiles.push_back(fs::path(dir) / oldFilename);
+          }
+        }
         s_forceShaderCacheInvalid = true;
         s_resetSampleOffset = true;
         break;
@@ -283,6 +482,16 @@ namespace gtl
     }
   }
 
+  const char* _GetShaderOptimizationName(GiShaderOptimization optimization)
+  {
+    switch (optimization)
+    {
+    case GiShaderOptimization::Performance: return "performance";
+    case GiShaderOptimization::Size: return "size";
+    default: return "none";
+    }
+  }
+
   void _PrintInitInfo(const GiInitParams& params)
   {
     GB_LOG("gatling {}.{}.{} built against MaterialX {}.{}.{}", GI_VERSION_MAJOR, GI_VERSION_MINOR, GI_VERSION_PATCH,
@@ -290,6 +499,11 @@ namespace gtl
     GB_LOG("> shader path: \"{}\"", params.shaderPath);
     GB_LOG("> MDL runtime path: \"{}\"", params.mdlRuntimePath);
     GB_LOG("> MDL search paths: {}", params.mdlSearchPaths);
+    GB_LOG("> MDL class compilation: {}", params.mdlClassCompilation);
+    GB_LOG("> MDL distilling target: {}", params.mdlDistillTarget.empty() ? "none" : params.mdlDistillTarget);
+    GB_LOG("> shader optimization: {}", _GetShaderOptimizationName(params.shaderOptimization));
+    GB_LOG("> texture compression: {}", params.textureCompression);
+    GB_LOG("> texture cache path: \"{}\"", params.textureCachePath);
   }
 
   void _EncodeRenderBufferAsHeatmap(GiRenderBuffer* renderBuffer)
@@ -310,6 +524,41 @@ namespace gtl
     }
   }
 
+  McRuntime* _giTakePreloadedMdlRuntime(std::string_view mdlRuntimePath)
+  {
+    if (!s_mcRuntimeFuture.valid())
+    {
+      return nullptr;
+    }
+
+    McRuntime* runtime = s_mcRuntimeFuture.get();
+    if (runtime && s_mcRuntimeFuturePath != mdlRuntimePath)
+    {
+      GB_WARN("preloaded MDL runtime path differs - reloading");
+      delete runtime;
+      runtime = nullptr;
+    }
+
+    return runtime;
+  }
+
+  void giPreloadMdlRuntime(std::string_view mdlRuntimePath)
+  {
+    if (s_mcRuntimeFuture.valid() || s_mcRuntime)
+    {
+      return;
+    }
+
+    // The MDL SDK logs through our logger.
+    gbLogInit();
+
+    s_mcRuntimeFuturePath = mdlRuntimePath;
+    s_mcRuntimeFuture = std::async(std::launch::async, []()
+    {
+      return McLoadRuntime(s_mcRuntimeFuturePath);
+    });
+  }
+
   GiStatus giInitialize(const GiInitParams& params)
   {
 #ifdef NDEBUG
@@ -360,16 +609,28 @@ namespace gtl
 
     s_delayedResourceDestroyer = std::make_unique<GgpuDelayedResourceDestroyer>(s_device);
 
-    s_mcRuntime = std::unique_ptr<McRuntime>(McLoadRuntime(params.mdlRuntimePath));
+    // Loading the MDL SDK takes a while, so it overlaps with device creation if preloaded.
+    s_mcRuntime = std::unique_ptr<McRuntime>(_giTakePreloadedMdlRuntime(params.mdlRuntimePath));
+    if (!s_mcRuntime)
+    {
+      s_mcRuntime = std::unique_ptr<McRuntime>(McLoadRuntime(params.mdlRuntimePath));
+    }
     if (!s_mcRuntime)
     {
       goto fail;
     }
 
-    s_mcFrontend = std::make_unique<McFrontend>(params.mdlSearchPaths, mtlxStdLib, *s_mcRuntime);
+    s_mcFrontend = std::make_unique<McFrontend>(params.mdlSearchPaths, mtlxStdLib, *s_mcRuntime, params.mdlClassCompilation, params.mdlDistillTarget);
+
+    s_fallbackMaterial = giCreateMaterialFromMtlxStr("__gi_fallback", FALLBACK_MATERIAL_MTLX);
+    if (!s_fallbackMaterial)
+    {
+      goto fail;
+    }
+    s_fallbackMaterial->previewSurface = GiPreviewSurfaceDesc{}; // same defaults as the MaterialX document
 
     s_shaderGen = std::make_unique<GiGlslShaderGen>();
-    if (!s_shaderGen->init(shaderPath, *s_mcRuntime))
+    if (!s_shaderGen->init(shaderPath, *s_mcRuntime, params.shaderOptimization))
     {
       goto fail;
     }
@@ -378,7 +639,14 @@ namespace gtl
     s_aggregateAssetReader = std::make_unique<GiAggregateAssetReader>();
     s_aggregateAssetReader->addAssetReader(s_mmapAssetReader.get());
 
-    s_texSys = std::make_unique<GiTextureManager>(s_device, *s_aggregateAssetReader, *s_stager);
+    s_textureCompression = params.textureCompression && s_deviceFeatures.textureCompressionBC;
+    if (params.textureCompression && !s_textureCompression)
+    {
+      GB_WARN("texture compression requested but not supported by device");
+    }
+
+    s_texSys = std::make_unique<GiTextureManager>(s_device, *s_aggregateAssetReader, *s_stager,
+                                                  s_textureCompression, params.textureCachePath);
 
 #ifdef GI_SHADER_HOTLOADING
     s_fileWatcher = std::make_unique<efsw::FileWatcher>();
@@ -437,8 +705,17 @@ fail:
       cgpuTerminate();
       s_cgpuInitialized = false;
     }
+    if (s_fallbackMaterial)
+    {
+      giDestroyMaterial(s_fallbackMaterial);
+      s_fallbackMaterial = nullptr;
+    }
     s_mcFrontend.reset();
     s_mcRuntime.reset();
+    if (s_mcRuntimeFuture.valid())
+    {
+      delete s_mcRuntimeFuture.get(); // preloaded, but never initialized
+    }
   }
 
   void giRegisterAssetReader(GiAssetReader* reader)
@@ -460,7 +737,9 @@ fail:
     };
   }
 
-  GiMaterial* giCreateMaterialFromMtlxDoc(const char* name, const std::shared_ptr<void/*MaterialX::Document*/> doc)
+  GiMaterial* giCreateMaterialFromMtlxDoc(const char* name,
+                                          const std::shared_ptr<void/*MaterialX::Document*/> doc,
+                                          const GiPreviewSurfaceDesc* previewSurface)
   {
     mx::DocumentPtr resolvedDoc = std::static_pointer_cast<mx::Document>(doc);
     if (!doc)
@@ -468,16 +747,25 @@ fail:
       return nullptr;
     }
 
+    // Also compiled for materials the fast path can shade: the fast path is a render setting that can
+    // be toggled at any time, and acceleration structures and mesh primvars depend on MDL properties.
     McMaterial* mcMat = s_mcFrontend->createFromMtlxDoc(resolvedDoc);
     if (!mcMat)
     {
       return nullptr;
     }
 
-    return new GiMaterial {
+    GiMaterial* mat = new GiMaterial {
       .mcMat = mcMat,
       .name = name
     };
+
+    if (previewSurface)
+    {
+      mat->previewSurface = *previewSurface;
+    }
+
+    return mat;
   }
 
   GiMaterial* giCreateMaterialFromMdlFile(const char* name, const char* filePath, const char* subIdentifier)
@@ -494,12 +782,68 @@ fail:
     };
   }
 
-  void giDestroyMaterial(GiMaterial* mat)
+  void _giRetainMaterial(const GiMaterial* mat)
   {
+    mat->refCount++;
+  }
+
+  // Materials stay alive while meshes, shader caches or shader cache builds reference them.
+  void _giReleaseMaterial(const GiMaterial* mat)
+  {
+    if (--mat->refCount > 0)
+    {
+      return;
+    }
+
     delete mat->mcMat;
     delete mat;
   }
 
+  void giDestroyMaterial(GiMaterial* mat)
+  {
+    _giReleaseMaterial(mat);
+  }
+
+  bool giUpdateMaterialParameters(GiMaterial* mat, GiMaterial* paramMat)
+  {
+    // Asynchronous shader cache builds read material parameters. The caller falls back to a new material.
+    if (s_pendingShaderCacheBuildCount > 0)
+    {
+      return false;
+    }
+
+    if (!McMaterialsShareClass(*mat->mcMat, *paramMat->mcMat))
+    {
+      return false;
+    }
+
+    // Preview renders shade the distilled variants, so they need to share their class as well.
+    const McMaterial* distilledMat = mat->mcMat->distilledMaterial.get();
+    const McMaterial* distilledParamMat = paramMat->mcMat->distilledMaterial.get();
+    if (bool(distilledMat) != bool(distilledParamMat) ||
+        (distilledMat && !McMaterialsShareClass(*distilledMat, *distilledParamMat)))
+    {
+      return false;
+    }
+
+    // The fast path shares the textures and hit group of a material across parameter edits.
+    if (mat->previewSurface.has_value() != paramMat->previewSurface.has_value())
+    {
+      return false;
+    }
+    if (mat->previewSurface && !giPreviewSurfacesShareHitGroup(*mat->previewSurface, *paramMat->previewSurface, s_textureCompression))
+    {
+      return false;
+    }
+
+    // Shader caches notice the version change and regenerate the argument blocks on the next render.
+    std::swap(mat->mcMat, paramMat->mcMat);
+    std::swap(mat->previewSurface, paramMat->previewSurface);
+    mat->paramVersion++;
+
+    return true;
+  }
+
   uint64_t giAlignBuffer(uint64_t alignment, uint64_t bufferSize, uint64_t* totalSize)
   {
     if (bufferSize == 0)
@@ -562,6 +906,11 @@ fail:
 
   void giSetMeshMaterial(GiMesh* mesh, const GiMaterial* mat)
   {
+    if (mesh->material == mat)
+    {
+      return;
+    }
+
     McMaterial* newMcMat = mat->mcMat;
     McMaterial* oldMcMat = mesh->material ? mesh->material->mcMat : nullptr;
 
@@ -594,6 +943,14 @@ fail:
       }
     }
 
+    // Meshes keep their material alive, so that it can be destroyed by its owner before
+    // all meshes have been assigned a new one.
+    _giRetainMaterial(mat);
+    if (mesh->material)
+    {
+      _giReleaseMaterial(mesh->material);
+    }
+
     mesh->material = mat;
 
     GiScene* scene = mesh->scene;
@@ -625,6 +982,11 @@ fail:
       gpuData.reset();
     }
 
+    if (mesh->material)
+    {
+      _giReleaseMaterial(mesh->material);
+    }
+
     GiScene* scene = mesh->scene;
     {
       std::lock_guard guard(scene->mutex);
@@ -660,20 +1022,16 @@ fail:
       // Find material for SBT index (FIXME: find a better solution)
       const GiMaterial* material = mesh->material;
 
-      uint32_t materialIndex = UINT32_MAX;
+      // Materials that are not part of the shader cache yet are still being compiled.
+      uint32_t hitGroupIndex = shaderCache->fallbackHitGroup;
       for (uint32_t i = 0; i < shaderCache->materials.size(); i++)
       {
           if (shaderCache->materials[i] == material)
           {
-              materialIndex = i;
+              hitGroupIndex = shaderCache->materialHitGroups[i];
               break;
           }
       }
-      if (materialIndex == UINT32_MAX)
-      {
-          GB_ERROR("invalid BLAS material");
-          continue;
-      }
 
       // Build mesh BLAS & buffers if they don't exist yet
       if (!mesh->gpuData.has_value())
@@ -929,8 +1287,6 @@ fail:
 
         // Build BLAS
         {
-          const GiMaterial* material = shaderCache->materials[materialIndex];
-
           bool blasCreated = cgpuCreateBlas(s_device, {
                                               .vertexBuffer = tmpPositionBuffer,
                                               .indexBuffer = tmpIndexBuffer,
@@ -1010,6 +1366,15 @@ fail_cleanup:
       totalIndicesSize += mesh->cpuData.faceCount * sizeof(uint32_t) * 3;
       totalVerticesSize += mesh->cpuData.vertexCount * sizeof(rp::FVertex);
 
+      const GiHitGroupResourceOffsets& resourceOffsets = shaderCache->hitGroupResourceOffsets[hitGroupIndex];
+
+      rp::BlasPayload payload = data->payload;
+      for (uint32_t slot = 0; slot < 2; slot++)
+      {
+        payload.textureIndexOffsets[slot] = resourceOffsets.textureIndexOffsets[slot];
+        payload.argBlockOffsets[slot] = resourceOffsets.argBlockOffsets[slot];
+      }
+
       int instanceId = 0;
       for (const glm::mat3x4& t : mesh->instanceTransforms)
       {
@@ -1018,12 +1383,12 @@ fail_cleanup:
 
         CgpuBlasInstance blasInstance;
         blasInstance.as = data->blas;
-        blasInstance.hitGroupIndex = materialIndex * 2; // always two hit groups per material: regular & shadow
+        blasInstance.hitGroupIndex = shaderCache->hitGroupPipelineIndices[hitGroupIndex] * 2; // always two hit groups per material: regular & shadow
         blasInstance.instanceCustomIndex = uint32_t(blasPayloads.size());
         memcpy(blasInstance.transform, glm::value_ptr(transform), sizeof(float) * 12);
 
         blasInstances.push_back(blasInstance);
-        blasPayloads.push_back(data->payload);
+        blasPayloads.push_back(payload);
         instanceIds.push_back(instanceId++);
       }
     }
@@ -1148,319 +1513,915 @@ cleanup:
     delete bvh;
   }
 
-  GiShaderCache* _giCreateShaderCache(const GiRenderParams& params)
+  void _giDestroyHitGroupShaders(GiHitGroupArtifacts& artifacts)
   {
-    const GiRenderSettings& renderSettings = params.renderSettings;
-    GiScene* scene = params.scene;
-
-    uint32_t aovMask = 0;
-    for (const GiAovBinding& binding : params.aovBindings)
+    for (GiHitShaderArtifacts* shaderArtifacts : { &artifacts.closestHit, artifacts.anyHit ? &*artifacts.anyHit : nullptr })
     {
-      if (binding.aovId == GiAovId::ClockCycles && !s_deviceFeatures.shaderClock)
+      if (!shaderArtifacts)
       {
-        GB_ERROR("clock cycles AOV misses device feature - ignoring");
         continue;
       }
-
-      aovMask |= (1 << int(binding.aovId));
+      if (shaderArtifacts->shader.handle)
+      {
+        cgpuDestroyShader(s_device, shaderArtifacts->shader);
+        shaderArtifacts->shader.handle = 0;
+      }
+      if (shaderArtifacts->shadowShader.handle)
+      {
+        cgpuDestroyShader(s_device, shaderArtifacts->shadowShader);
+        shaderArtifacts->shadowShader.handle = 0;
+      }
     }
+    artifacts.shaderInputs.reset();
+  }
 
-    std::set<const GiMaterial*> materialSet;
-    for (auto* m : scene->meshes)
+  void _giDestroyHitGroupArtifacts(GiHitGroupArtifacts& artifacts)
+  {
+    _giDestroyHitGroupShaders(artifacts);
+
+    for (GiHitShaderArtifacts* shaderArtifacts : { &artifacts.closestHit, artifacts.anyHit ? &*artifacts.anyHit : nullptr })
     {
-      if (!m->material)
+      if (!shaderArtifacts)
       {
-        assert(false);
-        GB_ERROR("coding error: mesh without material!");
-        return nullptr;
+        continue;
       }
-      materialSet.insert(m->material);
+
+      s_texSys->releaseImages(shaderArtifacts->images2d);
+      s_texSys->releaseImages(shaderArtifacts->images3d);
+
+      s_shaderGen->releaseMaterialArgBlockLayout(shaderArtifacts->genInfo.argBlockLayoutId);
+      shaderArtifacts->genInfo.argBlockLayoutId = 0;
     }
+  }
 
-    std::vector<const GiMaterial*> materials(materialSet.begin(), materialSet.end());
+  void _giClearHitGroupCache(GiHitGroupCache& cache)
+  {
+    for (auto& [key, artifacts] : cache.entries)
+    {
+      _giDestroyHitGroupArtifacts(artifacts);
+    }
+    cache.entries.clear();
+  }
 
-    GB_LOG("material count: {}", materials.size());
-    GB_LOG("creating shader cache..");
-    fflush(stdout);
+  // Texture arrays grow in powers of two and never shrink, so that added or removed textures rarely
+  // change the hit shader inputs. Unused array elements are bound to fallback textures.
+  uint32_t _giGetTextureArrayCapacity(uint32_t textureCount, uint32_t prevCapacity)
+  {
+    if (textureCount <= prevCapacity)
+    {
+      return prevCapacity;
+    }
+    return std::bit_ceil(std::max(textureCount, MIN_TEXTURE_ARRAY_CAPACITY));
+  }
 
-    GiShaderCache* cache = nullptr;
-    CgpuPipeline pipeline;
-    CgpuShader rgenShader;
-    std::vector<CgpuShader> missShaders;
-    std::vector<CgpuShader> hitShaders;
-    std::vector<CgpuImage> images2d;
-    std::vector<CgpuImage> images3d;
-    std::vector<CgpuRtHitGroup> hitGroups;
-    std::vector<McTextureDescription> textureDescriptions;
-    bool hasPipelineClosestHitShader = false;
-    bool hasPipelineAnyHitShader = false;
+  // Runs work that requires the stager or the texture manager. If the shader cache is built
+  // asynchronously, the work is handed to the render thread and this function blocks.
+  bool _giRunOnRenderThread(GiShaderCacheBuild* build, std::function<bool()> func)
+  {
+    if (!build)
+    {
+      return func();
+    }
+
+    std::packaged_task<bool()> task(std::move(func));
+    std::future<bool> result = task.get_future();
+    {
+      std::lock_guard guard(build->taskMutex);
+      build->tasks.push_back(std::move(task));
+    }
+    return result.get();
+  }
 
-    uint32_t diskLightCount = scene->diskLights.elementCount();
-    uint32_t distantLightCount = scene->distantLights.elementCount();
-    uint32_t rectLightCount = scene->rectLights.elementCount();
-    uint32_t sphereLightCount = scene->sphereLights.elementCount();
-    uint32_t totalLightCount = diskLightCount + distantLightCount + rectLightCount + sphereLightCount;
+  void _giRunShaderCacheBuildTasks(GiShaderCacheBuild& build)
+  {
+    std::vector<std::packaged_task<bool()>> tasks;
+    {
+      std::lock_guard guard(build.taskMutex);
+      tasks.swap(build.tasks);
+    }
+
+    for (std::packaged_task<bool()>& task : tasks)
+    {
+      task();
+    }
+  }
+
+  size_t _giGetHitGroupSourceSize(const GiHitGroupArtifacts& artifacts)
+  {
+    size_t size = artifacts.closestHit.genInfo.glslSource.size();
+    if (artifacts.anyHit)
+    {
+      size += artifacts.anyHit->genInfo.glslSource.size();
+    }
+    return size;
+  }
+
+  // Distilled materials are only used for preview rendering; final frames use the full material.
+  const McMaterial& _giGetShadingMcMaterial(const GiMaterial* material, bool distilledMaterials)
+  {
+    const McMaterial* mcMat = material->mcMat;
+    return (distilledMaterials && mcMat->distilledMaterial) ? *mcMat->distilledMaterial : *mcMat;
+  }
+
+  GiStageTimeline::Scope _giTimeStage(GiStageTimeline& timeline, GiShaderBuildStage stage)
+  {
+    return GiStageTimeline::Scope(timeline, uint32_t(stage));
+  }
 
-    bool nextEventEstimation = (renderSettings.nextEventEstimation && totalLightCount > 0);
+  // Stitches the final GLSL, compiles it to SPIR-V and creates the shader modules of a hit group.
+  // Safe to call concurrently, as shader module creation is thread-safe (see Cgpu.h).
+  bool _giCreateHitGroupShaders(const GiHitShaderInputs& shaderInputs,
+                                const GiPipelineHitGroup& pipelineHitGroup,
+                                GiStageTimeline& timeline,
+                                GiHitGroupShaders& shaders)
+  {
+    const McMaterial* mcMat = pipelineHitGroup.mcMat;
+    const GiHitGroupArtifacts& artifacts = *pipelineHitGroup.artifacts;
+    const char* debugName = pipelineHitGroup.debugName;
 
     GiGlslShaderGen::CommonShaderParams commonParams = {
-      .aovMask = aovMask,
-      .diskLightCount = diskLightCount,
-      .distantLightCount = distantLightCount,
-      .mediumStackSize = renderSettings.mediumStackSize,
-      .rectLightCount = rectLightCount,
-      .sphereLightCount = sphereLightCount,
-      .texCount2d = 2, // +1 fallback and +1 real dome light
-      .texCount3d = 0
+      .aovMask = shaderInputs.aovMask,
+      .mediumStackSize = shaderInputs.mediumStackSize,
+      .texCount2d = shaderInputs.texCapacity2d,
+      .texCount3d = shaderInputs.texCapacity3d
     };
 
-    uint32_t& texCount2d = commonParams.texCount2d;
-    uint32_t& texCount3d = commonParams.texCount3d;
+    auto sceneDataCount = uint32_t(mcMat->sceneDataNames.size())
+      - int(bool(mcMat->cameraPositionSceneDataIndex));
 
-    // Create per-material closest-hit shaders.
-    //
-    // This is done in multiple phases: first, GLSL is generated from MDL, and
-    // texture information is extracted. The information is then used to generated
-    // the descriptor sets for the pipeline. Lastly, the GLSL is stiched, #defines
-    // are added, and the code is compiled to SPIR-V.
+    auto createShader = [&](const std::vector<uint8_t>& spv, CgpuShaderStageFlags stageFlags, CgpuShader& shader)
     {
-      // 1. Generate GLSL from MDL
-      struct HitShaderCompInfo
-      {
-        GiGlslShaderGen::MaterialGenInfo genInfo;
-        uint32_t texOffset2d = 0;
-        uint32_t texOffset3d = 0;
-        std::vector<uint8_t> spv;
-        std::vector<uint8_t> shadowSpv;
-      };
-      struct HitGroupCompInfo
-      {
-        HitShaderCompInfo closestHitInfo;
-        std::optional<HitShaderCompInfo> anyHitInfo;
-      };
+      auto scope = _giTimeStage(timeline, GiShaderBuildStage::Module);
 
-      std::vector<HitGroupCompInfo> hitGroupCompInfos;
-      hitGroupCompInfos.resize(materials.size());
+      return cgpuCreateShader(s_device, {
+                                .size = spv.size(),
+                                .source = spv.data(),
+                                .stageFlags = stageFlags,
+                                .debugName = debugName
+                              }, &shader);
+    };
 
-      std::atomic_bool threadWorkFailed = false;
-#pragma omp parallel for
-      for (int i = 0; i < int(hitGroupCompInfos.size()); i++)
-      {
-        const McMaterial* material = materials[i]->mcMat;
+    // Closest hit
+    {
+      const GiGlslShaderGen::MaterialGenInfo& genInfo = artifacts.closestHit.genInfo;
 
-        HitGroupCompInfo groupInfo;
-        {
-          GiGlslShaderGen::MaterialGenInfo genInfo;
-          if (!s_shaderGen->generateMaterialShadingGenInfo(*material, genInfo))
-          {
-            threadWorkFailed = true;
-            continue;
-          }
+      GiGlslShaderGen::ClosestHitShaderParams hitParams = {
+        .baseFileName = "rp_main.chit",
+        .commonParams = commonParams,
+        .debugName = debugName,
+        .directionalBias = mcMat->directionalBias,
+        .enableSceneTransforms = mcMat->requiresSceneTransforms,
+        .cameraPositionSceneDataIndex = mcMat->cameraPositionSceneDataIndex,
+        .hasArgBlock = pipelineHitGroup.isPreviewSurface || !genInfo.argBlock.empty(),
+        .hasBackfaceBsdf = mcMat->hasBackfaceBsdf,
+        .hasBackfaceEdf = mcMat->hasBackfaceEdf,
+        .hasCutoutTransparency = mcMat->hasCutoutTransparency,
+        .hasVolumeAbsorptionCoeff = mcMat->hasVolumeAbsorptionCoeff,
+        .hasVolumeScatteringCoeff = mcMat->hasVolumeScatteringCoeff,
+        .isEmissive = mcMat->isEmissive,
+        .isThinWalled = mcMat->isThinWalled,
+        .nextEventEstimation = shaderInputs.nextEventEstimation,
+        .sceneDataCount = sceneDataCount,
+        .shadingGlsl = genInfo.glslSource
+      };
 
-          HitShaderCompInfo hitInfo;
-          hitInfo.genInfo = genInfo;
-          groupInfo.closestHitInfo = hitInfo;
-        }
-        if (material->hasCutoutTransparency)
-        {
-          GiGlslShaderGen::MaterialGenInfo genInfo;
-          if (!s_shaderGen->generateMaterialOpacityGenInfo(*material, genInfo))
-          {
-            threadWorkFailed = true;
-            continue;
-          }
+      std::vector<uint8_t> spv;
+      {
+        auto scope = _giTimeStage(timeline, GiShaderBuildStage::Compile);
 
-          HitShaderCompInfo hitInfo;
-          hitInfo.genInfo = genInfo;
-          groupInfo.anyHitInfo = hitInfo;
+        uint64_t shaderId;
+        if (!s_shaderGen->generateClosestHitSpirv(hitParams, spv, &shaderId))
+        {
+          return false;
         }
-
-        hitGroupCompInfos[i] = groupInfo;
+        shaders.shaderIds.push_back(shaderId);
       }
-      if (threadWorkFailed)
+
+      if (!createShader(spv, CGPU_SHADER_STAGE_FLAG_CLOSEST_HIT, shaders.closestHitShader))
       {
-        goto cleanup;
+        return false;
       }
+    }
 
-      // 2. Sum up texture resources & calculate per-material index offsets.
-      for (HitGroupCompInfo& groupInfo : hitGroupCompInfos)
-      {
-        HitShaderCompInfo& closestHitShaderCompInfo = groupInfo.closestHitInfo;
-        closestHitShaderCompInfo.texOffset2d = texCount2d;
-        closestHitShaderCompInfo.texOffset3d = texCount3d;
+    // Any hit
+    if (artifacts.anyHit)
+    {
+      const GiGlslShaderGen::MaterialGenInfo& genInfo = artifacts.anyHit->genInfo;
 
-        for (const McTextureDescription& tr : closestHitShaderCompInfo.genInfo.textureDescriptions)
-        {
-          (tr.is3dImage ? texCount3d : texCount2d)++;
-          textureDescriptions.push_back(tr);
-        }
+      GiGlslShaderGen::AnyHitShaderParams hitParams = {
+        .baseFileName = "rp_main.ahit",
+        .commonParams = commonParams,
+        .debugName = debugName,
+        .enableSceneTransforms = mcMat->requiresSceneTransforms,
+        .cameraPositionSceneDataIndex = mcMat->cameraPositionSceneDataIndex,
+        .hasArgBlock = pipelineHitGroup.isPreviewSurface || !genInfo.argBlock.empty(),
+        .opacityEvalGlsl = genInfo.glslSource,
+        .sceneDataCount = sceneDataCount
+      };
+
+      for (bool shadowTest : { false, true })
+      {
+        hitParams.shadowTest = shadowTest;
 
-        if (groupInfo.anyHitInfo)
+        std::vector<uint8_t> spv;
         {
-          HitShaderCompInfo& anyHitShaderCompInfo = *groupInfo.anyHitInfo;
-          anyHitShaderCompInfo.texOffset2d = texCount2d;
-          anyHitShaderCompInfo.texOffset3d = texCount3d;
+          auto scope = _giTimeStage(timeline, GiShaderBuildStage::Compile);
 
-          for (const McTextureDescription& tr : anyHitShaderCompInfo.genInfo.textureDescriptions)
+          uint64_t shaderId;
+          if (!s_shaderGen->generateAnyHitSpirv(hitParams, spv, &shaderId))
           {
-            (tr.is3dImage ? texCount3d : texCount2d)++;
-            textureDescriptions.push_back(tr);
+            return false;
           }
+          shaders.shaderIds.push_back(shaderId);
+        }
 
-          hasPipelineAnyHitShader |= true;
+        CgpuShader& shader = shadowTest ? shaders.anyHitShadowShader : shaders.anyHitShader;
+        if (!createShader(spv, CGPU_SHADER_STAGE_FLAG_ANY_HIT, shader))
+        {
+          return false;
         }
       }
+    }
 
-      hasPipelineClosestHitShader = hitGroupCompInfos.size() > 0;
+    return true;
+  }
 
-      // 3. Generate final hit shader GLSL sources.
-      threadWorkFailed = false;
-#pragma omp parallel for
-      for (int i = 0; i < int(hitGroupCompInfos.size()); i++)
-      {
-        const McMaterial* material = materials[i]->mcMat;
-
-        auto sceneDataCount = uint32_t(material->sceneDataNames.size())
-          - int(bool(material->cameraPositionSceneDataIndex));
-
-        HitGroupCompInfo& compInfo = hitGroupCompInfos[i];
-
-        // Closest hit
-        {
-          GiGlslShaderGen::ClosestHitShaderParams hitParams = {
-            .baseFileName = "rp_main.chit",
-            .commonParams = commonParams,
-            .directionalBias = material->directionalBias,
-            .enableSceneTransforms = material->requiresSceneTransforms,
-            .cameraPositionSceneDataIndex = material->cameraPositionSceneDataIndex,
-            .hasBackfaceBsdf = material->hasBackfaceBsdf,
-            .hasBackfaceEdf = material->hasBackfaceEdf,
-            .hasCutoutTransparency = material->hasCutoutTransparency,
-            .hasVolumeAbsorptionCoeff = material->hasVolumeAbsorptionCoeff,
-            .hasVolumeScatteringCoeff = material->hasVolumeScatteringCoeff,
-            .isEmissive = material->isEmissive,
-            .isThinWalled = material->isThinWalled,
-            .nextEventEstimation = nextEventEstimation,
-            .sceneDataCount = sceneDataCount,
-            .shadingGlsl = compInfo.closestHitInfo.genInfo.glslSource,
-            .textureIndexOffset2d = compInfo.closestHitInfo.texOffset2d,
-            .textureIndexOffset3d = compInfo.closestHitInfo.texOffset3d
-          };
+  void _giDestroyHitGroupShaders(const GiHitGroupShaders& shaders)
+  {
+    for (CgpuShader shader : { shaders.closestHitShader, shaders.anyHitShader, shaders.anyHitShadowShader })
+    {
+      if (shader.handle)
+      {
+        cgpuDestroyShader(s_device, shader);
+      }
+    }
+  }
+
+  void _giReplaceHitGroupShaders(GiHitGroupArtifacts& artifacts, const GiHitGroupShaders& shaders,
+                                 const GiHitShaderInputs& shaderInputs)
+  {
+    _giDestroyHitGroupShaders(artifacts);
+
+    artifacts.closestHit.shader = shaders.closestHitShader;
+    if (artifacts.anyHit)
+    {
+      artifacts.anyHit->shader = shaders.anyHitShader;
+      artifacts.anyHit->shadowShader = shaders.anyHitShadowShader;
+    }
+    artifacts.shaderIds = shaders.shaderIds;
+    artifacts.shaderInputs = shaderInputs;
+  }
+
+  // The fallback material is always part of the shader cache. 'build' is null for synchronous builds.
+  GiShaderCache* _giCreateShaderCache(const GiRenderParams& params,
+                                      const std::vector<const GiMaterial*>& sceneMaterials,
+                                      GiShaderCacheBuild* build)
+  {
+    const GiRenderSettings& renderSettings = params.renderSettings;
+    GiScene* scene = params.scene;
+
+    uint32_t aovMask = 0;
+    for (const GiAovBinding& binding : params.aovBindings)
+    {
+      if (binding.aovId == GiAovId::ClockCycles && !s_deviceFeatures.shaderClock)
+      {
+        GB_ERROR("clock cycles AOV misses device feature - ignoring");
+        continue;
+      }
+
+      aovMask |= (1 << int(binding.aovId));
+    }
+
+    std::vector<const GiMaterial*> materials = sceneMaterials;
+    if (std::find(materials.begin(), materials.end(), s_fallbackMaterial) == materials.end())
+    {
+      materials.push_back(s_fallbackMaterial);
+    }
+
+    // UsdPreviewSurface materials can be shaded by a native GLSL implementation, which saves
+    // MDL code generation and gives all of them a single hit group.
+    bool previewSurfaceFastPath = renderSettings.previewSurfaceFastPath;
+
+    auto usesPreviewSurfaceFastPath = [&](const GiMaterial* material) {
+      return previewSurfaceFastPath && material->previewSurface.has_value();
+    };
+
+    bool distilledMaterials = renderSettings.distilledMaterials;
+
+    auto getMcMaterial = [&](const GiMaterial* material) -> const McMaterial& {
+      return _giGetShadingMcMaterial(material, distilledMaterials);
+    };
+
+    // Materials that compile to identical code (e.g. the same network bound to different prims)
+    // share a hit group, which keeps the pipeline and the SBT small.
+    std::vector<const GiMaterial*> uniqueMaterials;
+    std::vector<uint32_t> materialHitGroups(materials.size());
+    {
+      std::unordered_map<uint64_t, std::vector<uint32_t>> hashBuckets;
+
+      for (size_t i = 0; i < materials.size(); i++)
+      {
+        // Fast path materials already share their shaders, but each has its own argument block.
+        if (usesPreviewSurfaceFastPath(materials[i]))
+        {
+          materialHitGroups[i] = uint32_t(uniqueMaterials.size());
+          uniqueMaterials.push_back(materials[i]);
+          continue;
+        }
+
+        const McMaterial& mcMat = getMcMaterial(materials[i]);
+
+        std::vector<uint32_t>& bucket = hashBuckets[McHashMaterial(mcMat)];
+
+        auto it = std::find_if(bucket.begin(), bucket.end(), [&](uint32_t uniqueIndex) {
+          return McMaterialsAreIdentical(getMcMaterial(uniqueMaterials[uniqueIndex]), mcMat);
+        });
+
+        if (it != bucket.end())
+        {
+          materialHitGroups[i] = *it;
+          continue;
+        }
+
+        uint32_t uniqueIndex = uint32_t(uniqueMaterials.size());
+        uniqueMaterials.push_back(materials[i]);
+        bucket.push_back(uniqueIndex);
+        materialHitGroups[i] = uniqueIndex;
+      }
+    }
+
+    GB_LOG("material count: {} ({} unique)", materials.size(), uniqueMaterials.size());
+    GB_DEBUG("MDL database elements: {}", s_mcRuntime->getMdlElementCount());
+    GB_LOG("creating shader cache{}..", build ? " asynchronously" : "");
+    fflush(stdout);
 
-          if (!s_shaderGen->generateClosestHitSpirv(hitParams, compInfo.closestHitInfo.spv))
+    GiHitGroupCache& hitGroupCache = scene->hitGroupCache;
+    uint32_t generation = ++hitGroupCache.generation;
+
+    GiShaderCache* cache = nullptr;
+    CgpuPipeline pipeline;
+    CgpuShader rgenShader;
+    std::vector<CgpuShader> missShaders;
+    std::vector<CgpuImage> images2d;
+    std::vector<CgpuImage> images3d;
+    std::vector<CgpuRtHitGroup> hitGroups;
+    std::vector<GiHitGroupArtifacts*> hitGroupArtifacts(uniqueMaterials.size());
+    std::vector<GiHitGroupResourceOffsets> hitGroupResourceOffsets(uniqueMaterials.size());
+    std::vector<GiPipelineHitGroup> pipelineHitGroups;
+    std::vector<uint32_t> hitGroupPipelineIndices(uniqueMaterials.size());
+    GiArgBlockTable argBlocks;
+    CgpuBuffer argBlockBuffer;
+    std::vector<GiMaterialArgBlocks> materialArgBlocks(materials.size());
+    uint32_t texCount2d = 2; // +1 fallback and +1 real dome light
+    uint32_t texCount3d = 0;
+    bool hasPipelineClosestHitShader = false;
+    bool hasPipelineAnyHitShader = false;
+
+    // Light counts are passed as push constants, so shaders don't depend on them.
+    bool nextEventEstimation = renderSettings.nextEventEstimation;
+
+    GiGlslShaderGen::CommonShaderParams commonParams = {
+      .aovMask = aovMask,
+      .mediumStackSize = renderSettings.mediumStackSize,
+      .texCount2d = 0, // texture array sizes, set below
+      .texCount3d = 0
+    };
+
+    // Create per-material hit shaders.
+    //
+    // Generated code, textures and shaders are kept per unique material in the scene's hit group
+    // cache. Texture and argument block offsets are passed in the BLAS payloads, and texture
+    // arrays grow in powers of two, so that the shaders of a material don't depend on other
+    // materials. Rebuilds therefore only generate and compile code for added or changed materials.
+    {
+      // 1. Look up known materials. Generate GLSL from MDL for the others, and compile it right
+      //    away. Each material passes through code generation, stitching, compilation and shader
+      //    module creation independently of the others; textures are loaded afterwards.
+      std::vector<GiHitGroupKey> hitGroupKeys(uniqueMaterials.size());
+      std::vector<uint32_t> newHitGroups;
+      uint32_t knownTexCount2d = texCount2d;
+      uint32_t knownTexCount3d = texCount3d;
+
+      for (uint32_t i = 0; i < uniqueMaterials.size(); i++)
+      {
+        const GiMaterial* material = uniqueMaterials[i];
+        const McMaterial& mcMat = getMcMaterial(material);
+
+        GiHitGroupKey& key = hitGroupKeys[i];
+        if (usesPreviewSurfaceFastPath(material))
+        {
+          key.materialHash = giHashPreviewSurface(*material->previewSurface);
+          key.material = material;
+        }
+        else
+        {
+          key.materialHash = McHashMaterial(mcMat);
+          key.material = McMaterialHasParameters(mcMat) ? material : nullptr;
+        }
+
+        auto it = hitGroupCache.entries.find(key);
+        if (it == hitGroupCache.entries.end())
+        {
+          newHitGroups.push_back(i);
+          continue;
+        }
+
+        GiHitGroupArtifacts& artifacts = it->second;
+        hitGroupArtifacts[i] = &artifacts;
+
+        for (const GiHitShaderArtifacts* shaderArtifacts : { &artifacts.closestHit, artifacts.anyHit ? &*artifacts.anyHit : nullptr })
+        {
+          if (shaderArtifacts)
+          {
+            knownTexCount2d += uint32_t(shaderArtifacts->images2d.size());
+            knownTexCount3d += uint32_t(shaderArtifacts->images3d.size());
+          }
+        }
+      }
+
+      // Hit shaders depend on the texture array capacities, which are only known once the
+      // textures of all materials have been laid out. New hit groups are compiled against the
+      // current capacities right away if their textures fit. The others, and known hit groups
+      // with outdated shaders, are compiled in step 3.
+      GiHitShaderInputs speculativeShaderInputs = {
+        .aovMask = aovMask,
+        .mediumStackSize = renderSettings.mediumStackSize,
+        .nextEventEstimation = nextEventEstimation,
+        .texCapacity2d = _giGetTextureArrayCapacity(knownTexCount2d, std::max(hitGroupCache.texCapacity2d, MIN_TEXTURE_ARRAY_CAPACITY)),
+        .texCapacity3d = _giGetTextureArrayCapacity(knownTexCount3d, std::max(hitGroupCache.texCapacity3d, MIN_TEXTURE_ARRAY_CAPACITY))
+      };
+
+      // Upper bounds of the texture counts, which grow as code is generated for new materials.
+      std::atomic_uint32_t reservedTexCount2d = knownTexCount2d;
+      std::atomic_uint32_t reservedTexCount3d = knownTexCount3d;
+
+      GiStageTimeline timeline({ "codegen", "compile", "module" });
+
+      auto codeGenStartTime = std::chrono::steady_clock::now();
+
+      std::vector<GiHitGroupArtifacts> newArtifacts(newHitGroups.size());
+      std::vector<GiHitGroupShaders> speculativeShaders(newHitGroups.size());
+
+      std::atomic_bool threadWorkFailed = false;
+#pragma omp parallel for schedule(dynamic)
+      for (int i = 0; i < int(newHitGroups.size()); i++)
+      {
+        if (threadWorkFailed || (build && build->cancelled))
+        {
+          threadWorkFailed = true;
+          continue;
+        }
+
+        const GiMaterial* material = uniqueMaterials[newHitGroups[i]];
+        const McMaterial* mcMat = &getMcMaterial(material);
+
+        GiHitGroupArtifacts& artifacts = newArtifacts[i];
+        artifacts.paramVersion = material->paramVersion;
+
+        // Only textures and the argument block; the shaders are shared.
+        if (usesPreviewSurfaceFastPath(material))
+        {
+          auto scope = _giTimeStage(timeline, GiShaderBuildStage::Codegen);
+
+          GiGlslShaderGen::MaterialGenInfo& genInfo = artifacts.closestHit.genInfo;
+          genInfo.argBlockLayoutId = 0;
+
+          std::vector<std::string> texturePaths;
+          giPackPreviewSurface(*material->previewSurface, genInfo.argBlock, texturePaths,
+                               &artifacts.closestHit.textureUsages, s_textureCompression);
+
+          for (size_t t = 0; t < texturePaths.size(); t++)
+          {
+            genInfo.textureDescriptions.push_back(McTextureDescription{
+              .binding = uint32_t(t),
+              .is3dImage = false,
+              .isFloat = false,
+              .filePath = texturePaths[t]
+            });
+          }
+
+          reservedTexCount2d += uint32_t(texturePaths.size());
+          continue;
+        }
+
+        {
+          auto scope = _giTimeStage(timeline, GiShaderBuildStage::Codegen);
+
+          if (!s_shaderGen->generateMaterialShadingGenInfo(*mcMat, artifacts.closestHit.genInfo))
           {
             threadWorkFailed = true;
             continue;
           }
+
+          if (mcMat->hasCutoutTransparency)
+          {
+            artifacts.anyHit = GiHitShaderArtifacts{};
+
+            if (!s_shaderGen->generateMaterialOpacityGenInfo(*mcMat, artifacts.anyHit->genInfo))
+            {
+              threadWorkFailed = true;
+              continue;
+            }
+          }
         }
 
-        // Any hit
-        if (compInfo.anyHitInfo)
-        {
-          GiGlslShaderGen::AnyHitShaderParams hitParams = {
-            .baseFileName = "rp_main.ahit",
-            .commonParams = commonParams,
-            .enableSceneTransforms = material->requiresSceneTransforms,
-            .cameraPositionSceneDataIndex = material->cameraPositionSceneDataIndex,
-            .opacityEvalGlsl = compInfo.anyHitInfo->genInfo.glslSource,
-            .sceneDataCount = sceneDataCount,
-            .textureIndexOffset2d = compInfo.anyHitInfo->texOffset2d,
-            .textureIndexOffset3d = compInfo.anyHitInfo->texOffset3d
+        size_t sourceSize = _giGetHitGroupSourceSize(artifacts);
+        if (mcMat == material->mcMat)
+        {
+          GB_DEBUG("> material {}: {} bytes of GLSL", material->name, sourceSize);
+        }
+        else
+        {
+          // For comparison, the code of the full material may still be in the hit group cache.
+          const McMaterial& fullMcMat = *material->mcMat;
+          GiHitGroupKey fullKey = {
+            .materialHash = McHashMaterial(fullMcMat),
+            .material = McMaterialHasParameters(fullMcMat) ? material : nullptr
           };
 
-          hitParams.shadowTest = false;
-          if (!s_shaderGen->generateAnyHitSpirv(hitParams, compInfo.anyHitInfo->spv))
+          auto fullIt = hitGroupCache.entries.find(fullKey);
+          if (fullIt != hitGroupCache.entries.end())
           {
-            threadWorkFailed = true;
-            continue;
+            GB_DEBUG("> material {}: {} bytes of distilled GLSL (full: {} bytes)", material->name, sourceSize,
+                     _giGetHitGroupSourceSize(fullIt->second));
           }
+          else
+          {
+            GB_DEBUG("> material {}: {} bytes of distilled GLSL", material->name, sourceSize);
+          }
+        }
 
-          hitParams.shadowTest = true;
-          if (!s_shaderGen->generateAnyHitSpirv(hitParams, compInfo.anyHitInfo->shadowSpv))
+        // Each texture description results in at most one image.
+        uint32_t newTexCount2d = 0;
+        uint32_t newTexCount3d = 0;
+        for (const GiHitShaderArtifacts* shaderArtifacts : { &artifacts.closestHit, artifacts.anyHit ? &*artifacts.anyHit : nullptr })
+        {
+          if (!shaderArtifacts)
           {
-            threadWorkFailed = true;
             continue;
           }
+
+          for (const McTextureDescription& textureDescription : shaderArtifacts->genInfo.textureDescriptions)
+          {
+            (textureDescription.is3dImage ? newTexCount3d : newTexCount2d)++;
+          }
+        }
+
+        uint32_t reservedCount2d = (reservedTexCount2d += newTexCount2d);
+        uint32_t reservedCount3d = (reservedTexCount3d += newTexCount3d);
+
+        if (reservedCount2d > speculativeShaderInputs.texCapacity2d ||
+            reservedCount3d > speculativeShaderInputs.texCapacity3d)
+        {
+          continue;
+        }
+
+        GiPipelineHitGroup pipelineHitGroup = {
+          .artifacts = &artifacts,
+          .mcMat = mcMat,
+          .debugName = material->name.c_str(),
+          .isPreviewSurface = false
+        };
+
+        if (!_giCreateHitGroupShaders(speculativeShaderInputs, pipelineHitGroup, timeline, speculativeShaders[i]))
+        {
+          threadWorkFailed = true;
         }
       }
       if (threadWorkFailed)
       {
+        for (const GiHitGroupShaders& shaders : speculativeShaders)
+        {
+          _giDestroyHitGroupShaders(shaders);
+        }
+        for (GiHitGroupArtifacts& artifacts : newArtifacts)
+        {
+          _giDestroyHitGroupArtifacts(artifacts); // argument block layouts
+        }
         goto cleanup;
       }
 
-      // 4. Compile the shaders to SPIV-V. (FIXME: multithread - beware of shared cgpu resource stores)
-      hitShaders.reserve(hitGroupCompInfos.size());
-      hitGroups.reserve(hitGroupCompInfos.size() * 2);
+      uint32_t speculativeCompileCount = 0;
+      for (size_t i = 0; i < speculativeShaders.size(); i++)
+      {
+        // Preview surfaces and hit groups whose textures did not fit are compiled in step 3.
+        if (!speculativeShaders[i].closestHitShader.handle)
+        {
+          continue;
+        }
+
+        _giReplaceHitGroupShaders(newArtifacts[i], speculativeShaders[i], speculativeShaderInputs);
+        speculativeCompileCount++;
+      }
+
+      hitGroupCache.compileCount += speculativeCompileCount;
 
-      for (int i = 0; i < int(hitGroupCompInfos.size()); i++)
+      std::chrono::duration<float, std::milli> codeGenDuration = std::chrono::steady_clock::now() - codeGenStartTime;
+      GB_LOG("> generated GLSL for {} new materials and compiled {} hit groups in {:.2f}ms", newHitGroups.size(),
+             speculativeCompileCount, codeGenDuration.count());
+
+      bool texturesLoaded = _giRunOnRenderThread(build, [&]()
       {
-        const HitGroupCompInfo& compInfo = hitGroupCompInfos[i];
+        // BSDF lookup tables are shared by all materials; their images are only uploaded once.
+        uint32_t prevPayloadUploadCount = s_texSys->getPayloadUploadCount();
 
-        // regular hit group
+        // Textures of all new materials are loaded at once so that they can be decoded in parallel.
+        std::vector<GiTextureLoadRequest> loadRequests;
+        auto addLoadRequest = [&](GiHitShaderArtifacts& shaderArtifacts)
         {
-          CgpuShader closestHitShader;
-          {
-            const std::vector<uint8_t>& spv = compInfo.closestHitInfo.spv;
+          loadRequests.push_back(GiTextureLoadRequest{
+            .textureDescriptions = shaderArtifacts.genInfo.textureDescriptions,
+            .textureUsages = shaderArtifacts.textureUsages,
+            .images2d = shaderArtifacts.images2d,
+            .images3d = shaderArtifacts.images3d
+          });
+        };
 
-            if (!cgpuCreateShader(s_device, {
-                                    .size = spv.size(),
-                                    .source = spv.data(),
-                                    .stageFlags = CGPU_SHADER_STAGE_FLAG_CLOSEST_HIT
-                                  }, &closestHitShader))
-            {
-              goto cleanup;
-            }
+        for (GiHitGroupArtifacts& artifacts : newArtifacts)
+        {
+          addLoadRequest(artifacts.closestHit);
 
-            hitShaders.push_back(closestHitShader);
+          if (artifacts.anyHit)
+          {
+            addLoadRequest(*artifacts.anyHit);
           }
+        }
 
-          CgpuShader anyHitShader;
-          if (compInfo.anyHitInfo)
+        if (!s_texSys->loadTextureDescriptions(loadRequests))
+        {
+          for (GiHitGroupArtifacts& artifacts : newArtifacts)
           {
-            const std::vector<uint8_t>& spv = compInfo.anyHitInfo->spv;
+            _giDestroyHitGroupArtifacts(artifacts);
+          }
+          return false;
+        }
 
-            if (!cgpuCreateShader(s_device, {
-                                    .size = spv.size(),
-                                    .source = spv.data(),
-                                    .stageFlags = CGPU_SHADER_STAGE_FLAG_ANY_HIT
-                                  }, &anyHitShader))
-            {
-              goto cleanup;
-            }
+        for (size_t i = 0; i < newArtifacts.size(); i++)
+        {
+          GiHitGroupArtifacts& artifacts = newArtifacts[i];
+          uint32_t hitGroupIndex = newHitGroups[i];
 
-            hitShaders.push_back(anyHitShader);
+          auto [it, inserted] = hitGroupCache.entries.try_emplace(hitGroupKeys[hitGroupIndex], std::move(artifacts));
+          if (!inserted)
+          {
+            _giDestroyHitGroupArtifacts(artifacts); // hash collision
           }
 
-          CgpuRtHitGroup hitGroup;
-          hitGroup.closestHitShader = closestHitShader;
-          hitGroup.anyHitShader = anyHitShader;
-          hitGroups.push_back(hitGroup);
+          hitGroupArtifacts[hitGroupIndex] = &it->second;
         }
 
-        // shadow hit group
+        GB_DEBUG("> uploaded {} binary payload images", s_texSys->getPayloadUploadCount() - prevPayloadUploadCount);
+
+        const GiTextureCacheStats& cacheStats = s_texSys->getCacheStats();
+        GB_DEBUG("> texture cache: {} hits, {} misses, {} evictions, {} images resident ({:.2f} MiB)",
+                 cacheStats.hitCount, cacheStats.missCount, cacheStats.evictionCount, cacheStats.residentCount,
+                 cacheStats.residentBytes / (1024.0f * 1024.0f));
+        return true;
+      });
+
+      if (!texturesLoaded)
+      {
+        goto cleanup;
+      }
+
+      // 2. Lay out textures & argument blocks. Regenerate argument blocks that are out of date.
+      //    Assign hit groups to the pipeline.
+      std::vector<GiMaterialArgBlocks> hitGroupArgBlocks(uniqueMaterials.size());
+
+      int32_t previewSurfacePipelineIndices[2] = { -1, -1 }; // opaque, cutout
+
+      auto getPreviewSurfacePipelineIndex = [&](bool hasCutout)
+      {
+        int32_t& pipelineIndex = previewSurfacePipelineIndices[hasCutout ? 1 : 0];
+        if (pipelineIndex >= 0)
+        {
+          return uint32_t(pipelineIndex);
+        }
+
+        GiHitGroupKey key = {
+          .materialHash = hasCutout ? PREVIEW_SURFACE_CUTOUT_HASH : PREVIEW_SURFACE_OPAQUE_HASH,
+          .material = nullptr
+        };
+
+        auto [it, inserted] = hitGroupCache.entries.try_emplace(key);
+        GiHitGroupArtifacts& artifacts = it->second;
+
+        if (inserted)
+        {
+          artifacts.closestHit.genInfo.glslSource = PREVIEW_SURFACE_GLSL;
+
+          if (hasCutout)
+          {
+            artifacts.anyHit = GiHitShaderArtifacts{};
+            artifacts.anyHit->genInfo.glslSource = PREVIEW_SURFACE_GLSL;
+          }
+        }
+
+        pipelineIndex = int32_t(pipelineHitGroups.size());
+        pipelineHitGroups.push_back(GiPipelineHitGroup{
+          .artifacts = &artifacts,
+          .mcMat = hasCutout ? &PREVIEW_SURFACE_CUTOUT_MATERIAL : &PREVIEW_SURFACE_OPAQUE_MATERIAL,
+          .debugName = hasCutout ? "UsdPreviewSurfaceCutout" : "UsdPreviewSurface",
+          .isPreviewSurface = true
+        });
+        return uint32_t(pipelineIndex);
+      };
+
+      for (uint32_t i = 0; i < uniqueMaterials.size(); i++)
+      {
+        const GiMaterial* material = uniqueMaterials[i];
+        GiHitGroupArtifacts& artifacts = *hitGroupArtifacts[i];
+
+        if (usesPreviewSurfaceFastPath(material))
+        {
+          const GiPreviewSurfaceDesc& desc = *material->previewSurface;
+
+          if (artifacts.paramVersion != material->paramVersion)
+          {
+            std::vector<std::string> texturePaths;
+            giPackPreviewSurface(desc, artifacts.closestHit.genInfo.argBlock, texturePaths, nullptr, s_textureCompression);
+            artifacts.paramVersion = material->paramVersion;
+          }
+
+          hitGroupPipelineIndices[i] = getPreviewSurfacePipelineIndex(giPreviewSurfaceHasCutout(desc));
+        }
+        else
         {
-          CgpuShader anyHitShader;
+          hitGroupPipelineIndices[i] = uint32_t(pipelineHitGroups.size());
+          pipelineHitGroups.push_back(GiPipelineHitGroup{
+            .artifacts = &artifacts,
+            .mcMat = &getMcMaterial(material),
+            .debugName = material->name.c_str(),
+            .isPreviewSurface = false
+          });
+        }
 
-          if (compInfo.anyHitInfo)
+        if (hitGroupKeys[i].material && artifacts.paramVersion != material->paramVersion)
+        {
+          for (GiHitShaderArtifacts* shaderArtifacts : { &artifacts.closestHit, artifacts.anyHit ? &*artifacts.anyHit : nullptr })
           {
-            const std::vector<uint8_t>& spv = compInfo.anyHitInfo->shadowSpv;
+            if (!shaderArtifacts || shaderArtifacts->genInfo.argBlock.empty())
+            {
+              continue;
+            }
 
-            if (!cgpuCreateShader(s_device, {
-                                    .size = spv.size(),
-                                    .source = spv.data(),
-                                    .stageFlags = CGPU_SHADER_STAGE_FLAG_ANY_HIT
-                                  }, &anyHitShader))
+            GiGlslShaderGen::MaterialGenInfo& genInfo = shaderArtifacts->genInfo;
+            if (!s_shaderGen->generateMaterialArgBlock(getMcMaterial(material), genInfo.argBlockLayoutId, genInfo.argBlock))
             {
               goto cleanup;
             }
+          }
+
+          artifacts.paramVersion = material->paramVersion;
+        }
+
+        GiHitGroupResourceOffsets& resourceOffsets = hitGroupResourceOffsets[i];
+
+        auto addResources = [&](const GiHitShaderArtifacts& shaderArtifacts, uint32_t slot, int32_t& argBlockIndex)
+        {
+          resourceOffsets.textureIndexOffsets[slot] = texCount2d | (texCount3d << 16);
 
-            hitShaders.push_back(anyHitShader);
+          images2d.insert(images2d.end(), shaderArtifacts.images2d.begin(), shaderArtifacts.images2d.end());
+          images3d.insert(images3d.end(), shaderArtifacts.images3d.begin(), shaderArtifacts.images3d.end());
+          texCount2d += uint32_t(shaderArtifacts.images2d.size());
+          texCount3d += uint32_t(shaderArtifacts.images3d.size());
+
+          const std::vector<uint8_t>& argBlock = shaderArtifacts.genInfo.argBlock;
+          if (argBlock.empty())
+          {
+            return;
           }
 
-          CgpuRtHitGroup hitGroup;
-          hitGroup.anyHitShader = anyHitShader;
-          hitGroups.push_back(hitGroup);
+          uint32_t blockIndex = argBlocks.addBlock(argBlock.data(), uint32_t(argBlock.size()));
+          argBlockIndex = int32_t(blockIndex);
+          resourceOffsets.argBlockOffsets[slot] = int32_t(argBlocks.blockOffset(blockIndex));
+        };
+
+        GiMaterialArgBlocks& argBlocksInfo = hitGroupArgBlocks[i];
+        argBlocksInfo.shadingLayoutId = artifacts.closestHit.genInfo.argBlockLayoutId;
+        addResources(artifacts.closestHit, rp::MDL_RESOURCE_SLOT_SHADING, argBlocksInfo.shadingBlockIndex);
+
+        if (artifacts.anyHit)
+        {
+          argBlocksInfo.opacityLayoutId = artifacts.anyHit->genInfo.argBlockLayoutId;
+          addResources(*artifacts.anyHit, rp::MDL_RESOURCE_SLOT_OPACITY, argBlocksInfo.opacityBlockIndex);
+        }
+
+        // The ubershaders read opacity from the same argument block and textures.
+        if (usesPreviewSurfaceFastPath(material))
+        {
+          argBlocksInfo.isPreviewSurface = true;
+          resourceOffsets.textureIndexOffsets[rp::MDL_RESOURCE_SLOT_OPACITY] = resourceOffsets.textureIndexOffsets[rp::MDL_RESOURCE_SLOT_SHADING];
+          resourceOffsets.argBlockOffsets[rp::MDL_RESOURCE_SLOT_OPACITY] = resourceOffsets.argBlockOffsets[rp::MDL_RESOURCE_SLOT_SHADING];
+        }
+      }
+
+      for (const GiPipelineHitGroup& pipelineHitGroup : pipelineHitGroups)
+      {
+        hasPipelineAnyHitShader |= pipelineHitGroup.artifacts->anyHit.has_value();
+      }
+
+      hasPipelineClosestHitShader = pipelineHitGroups.size() > 0;
+
+      // Class-compiled materials are never deduplicated, so each argument block belongs to one material.
+      for (size_t i = 0; i < materials.size(); i++)
+      {
+        materialArgBlocks[i] = hitGroupArgBlocks[materialHitGroups[i]];
+        materialArgBlocks[i].paramVersion = materials[i]->paramVersion;
+      }
+
+      if (texCount2d > UINT16_MAX || texCount3d > UINT16_MAX)
+      {
+        GB_ERROR("texture count exceeds limit of {}", UINT16_MAX);
+        goto cleanup;
+      }
+
+      // Keeps the speculative capacities if the textures fit, so that no shaders are recompiled.
+      commonParams.texCount2d = _giGetTextureArrayCapacity(texCount2d, speculativeShaderInputs.texCapacity2d);
+      commonParams.texCount3d = _giGetTextureArrayCapacity(texCount3d, speculativeShaderInputs.texCapacity3d);
+
+      // 3. Compile hit groups without up-to-date shaders. These are the UsdPreviewSurface
+      //    ubershaders on first use, new hit groups whose textures did not fit, known hit groups
+      //    with changed inputs, and all hit groups if the texture array capacities have grown.
+      GiHitShaderInputs shaderInputs = {
+        .aovMask = aovMask,
+        .mediumStackSize = renderSettings.mediumStackSize,
+        .nextEventEstimation = nextEventEstimation,
+        .texCapacity2d = commonParams.texCount2d,
+        .texCapacity3d = commonParams.texCount3d
+      };
+
+      if (build && build->cancelled)
+      {
+        goto cleanup;
+      }
+
+      std::vector<uint32_t> staleHitGroups;
+      for (uint32_t i = 0; i < pipelineHitGroups.size(); i++)
+      {
+        const std::optional<GiHitShaderInputs>& oldShaderInputs = pipelineHitGroups[i].artifacts->shaderInputs;
+
+        if (!oldShaderInputs || *oldShaderInputs != shaderInputs)
+        {
+          staleHitGroups.push_back(i);
+        }
+      }
+
+      std::vector<GiHitGroupShaders> hitGroupShaders(staleHitGroups.size());
+
+      threadWorkFailed = false;
+#pragma omp parallel for schedule(dynamic)
+      for (int i = 0; i < int(staleHitGroups.size()); i++)
+      {
+        const GiPipelineHitGroup& pipelineHitGroup = pipelineHitGroups[staleHitGroups[i]];
+
+        if (!_giCreateHitGroupShaders(shaderInputs, pipelineHitGroup, timeline, hitGroupShaders[i]))
+        {
+          threadWorkFailed = true;
+        }
+      }
+      if (threadWorkFailed)
+      {
+        for (const GiHitGroupShaders& shaders : hitGroupShaders)
+        {
+          _giDestroyHitGroupShaders(shaders);
         }
+        goto cleanup;
+      }
+
+      // 4. Replace outdated shader modules.
+      for (size_t i = 0; i < staleHitGroups.size(); i++)
+      {
+        GiHitGroupArtifacts& artifacts = *pipelineHitGroups[staleHitGroups[i]].artifacts;
+        _giReplaceHitGroupShaders(artifacts, hitGroupShaders[i], shaderInputs);
+      }
+
+      hitGroupCache.compileCount += staleHitGroups.size();
+
+      GB_LOG("> compiled {} of {} hit groups after texture layout", staleHitGroups.size(), pipelineHitGroups.size());
+
+      GB_DEBUG("> build stage utilization in {:.2f}ms (average workers per {} intervals):", timeline.durationMs(),
+               SHADER_BUILD_TIMELINE_INTERVAL_COUNT);
+      for (const std::string& line : timeline.formatUtilization(SHADER_BUILD_TIMELINE_INTERVAL_COUNT))
+      {
+        GB_DEBUG(">   {}", line);
+      }
+
+      // 5. Set up hit groups. There are always two per material: regular & shadow.
+      hitGroups.reserve(pipelineHitGroups.size() * 2);
+
+      for (const GiPipelineHitGroup& pipelineHitGroup : pipelineHitGroups)
+      {
+        const GiHitGroupArtifacts* artifacts = pipelineHitGroup.artifacts;
+
+        CgpuRtHitGroup hitGroup;
+        hitGroup.closestHitShader = artifacts->closestHit.shader;
+        hitGroup.anyHitShader = artifacts->anyHit ? artifacts->anyHit->shader : CgpuShader{};
+        hitGroups.push_back(hitGroup);
+
+        CgpuRtHitGroup shadowHitGroup;
+        shadowHitGroup.anyHitShader = artifacts->anyHit ? artifacts->anyHit->shadowShader : CgpuShader{};
+        hitGroups.push_back(shadowHitGroup);
       }
     }
 
@@ -1472,7 +2433,7 @@ cleanup:
         .depthOfField = renderSettings.depthOfField,
         .filterImportanceSampling = renderSettings.filterImportanceSampling,
         .jitteredSampling = renderSettings.jitteredSampling,
-        .materialCount = uint32_t(materials.size()),
+        .materialCount = uint32_t(pipelineHitGroups.size()),
         .nextEventEstimation = nextEventEstimation,
         .progressiveAccumulation = renderSettings.progressiveAccumulation,
         .reorderInvocations = s_deviceFeatures.rayTracingInvocationReorder
@@ -1544,17 +2505,35 @@ cleanup:
       }
     }
 
-    // Upload textures.
-    if (textureDescriptions.size() > 0 && !s_texSys->loadTextureDescriptions(textureDescriptions, images2d, images3d))
+    // Upload argument blocks.
+    if (!argBlocks.data().empty())
     {
-      goto cleanup;
+      const std::vector<uint8_t>& argBlockData = argBlocks.data();
+
+      if (!cgpuCreateBuffer(s_device, {
+                              .usage = CGPU_BUFFER_USAGE_FLAG_STORAGE_BUFFER | CGPU_BUFFER_USAGE_FLAG_TRANSFER_DST,
+                              .memoryProperties = CGPU_MEMORY_PROPERTY_FLAG_DEVICE_LOCAL,
+                              .size = argBlockData.size(),
+                              .debugName = "ArgBlocks"
+                            }, &argBlockBuffer))
+      {
+        goto cleanup;
+      }
+
+      bool argBlocksStaged = _giRunOnRenderThread(build, [&]()
+      {
+        return s_stager->stageToBuffer(argBlockData.data(), argBlockData.size(), argBlockBuffer) && s_stager->flush();
+      });
+
+      if (!argBlocksStaged)
+      {
+        goto cleanup;
+      }
     }
-    assert(images2d.size() == (texCount2d - 2));
-    assert(images3d.size() == texCount3d);
 
     // Create RT pipeline.
     {
-      GB_LOG("creating RT pipeline..");
+      GB_LOG("creating RT pipeline with {} hit groups..", hitGroups.size());
       fflush(stdout);
 
       if (!cgpuCreateRtPipeline(s_device, {
@@ -1571,26 +2550,48 @@ cleanup:
 
     cache = new GiShaderCache;
     cache->aovMask = aovMask;
+    cache->argBlockBuffer = argBlockBuffer;
+    cache->argBlocks = std::move(argBlocks);
+    cache->distilledMaterials = distilledMaterials;
     cache->domeLightCameraVisible = renderSettings.domeLightCameraVisible;
-    cache->hitShaders = std::move(hitShaders);
+    cache->fallbackHitGroup = materialHitGroups[std::find(materials.begin(), materials.end(), s_fallbackMaterial) - materials.begin()];
+    cache->hitGroupGeneration = generation;
+    cache->hitGroupPipelineIndices = std::move(hitGroupPipelineIndices);
+    cache->hitGroupResourceOffsets = std::move(hitGroupResourceOffsets);
     cache->images2d = std::move(images2d);
     cache->images3d = std::move(images3d);
     cache->materials.resize(materials.size());
     for (uint32_t i = 0; i < cache->materials.size(); i++)
     {
+      _giRetainMaterial(materials[i]);
       cache->materials[i] = materials[i];
     }
+    cache->materialHitGroups = std::move(materialHitGroups);
+    cache->materialArgBlocks = std::move(materialArgBlocks);
     cache->missShaders = missShaders;
     cache->pipeline = pipeline;
     cache->rgenShader = rgenShader;
     cache->hasPipelineClosestHitShader = hasPipelineClosestHitShader;
     cache->hasPipelineAnyHitShader = hasPipelineAnyHitShader;
+    cache->texCapacity2d = commonParams.texCount2d;
+    cache->texCapacity3d = commonParams.texCount3d;
+
+    hitGroupCache.texCapacity2d = commonParams.texCount2d;
+    hitGroupCache.texCapacity3d = commonParams.texCount3d;
+
+    // Mark artifacts as used. Unused ones are evicted once the shader cache is in use.
+    for (GiHitGroupArtifacts* artifacts : hitGroupArtifacts)
+    {
+      artifacts->generation = generation;
+    }
+    for (const GiPipelineHitGroup& pipelineHitGroup : pipelineHitGroups)
+    {
+      pipelineHitGroup.artifacts->generation = generation;
+    }
 
 cleanup:
     if (!cache)
     {
-      s_texSys->destroyUncachedImages(images2d);
-      s_texSys->destroyUncachedImages(images3d);
       if (rgenShader.handle)
       {
         cgpuDestroyShader(s_device, rgenShader);
@@ -1599,35 +2600,242 @@ cleanup:
       {
         cgpuDestroyShader(s_device, shader);
       }
-      for (CgpuShader shader : hitShaders)
-      {
-        cgpuDestroyShader(s_device, shader);
-      }
       if (pipeline.handle)
       {
         cgpuDestroyPipeline(s_device, pipeline);
       }
+      if (argBlockBuffer.handle)
+      {
+        cgpuDestroyBuffer(s_device, argBlockBuffer);
+      }
     }
     return cache;
   }
 
   void _giDestroyShaderCache(GiShaderCache* cache)
   {
-    s_texSys->destroyUncachedImages(cache->images2d);
-    s_texSys->destroyUncachedImages(cache->images3d);
     cgpuDestroyShader(s_device, cache->rgenShader);
     for (CgpuShader shader : cache->missShaders)
     {
       cgpuDestroyShader(s_device, shader);
     }
-    for (CgpuShader shader : cache->hitShaders)
+    cgpuDestroyPipeline(s_device, cache->pipeline);
+    if (cache->argBlockBuffer.handle)
     {
-      cgpuDestroyShader(s_device, shader);
+      cgpuDestroyBuffer(s_device, cache->argBlockBuffer);
+    }
+    for (const GiMaterial* material : cache->materials)
+    {
+      _giReleaseMaterial(material);
     }
-    cgpuDestroyPipeline(s_device, cache->pipeline);
     delete cache;
   }
 
+  // Replaces the scene's shader cache. Hit group artifacts that the new cache doesn't use are
+  // destroyed, unless they may still be needed by a shader cache that is being built.
+  void _giSetShaderCache(GiScene* scene, GiShaderCache* cache, bool evictUnusedHitGroups)
+  {
+    if (scene->shaderCache)
+    {
+      _giDestroyShaderCache(scene->shaderCache);
+    }
+    scene->shaderCache = cache;
+
+    scene->dirtyFlags |= GiSceneDirtyFlags::DirtyFramebuffer | GiSceneDirtyFlags::DirtyBvh; // SBT
+
+    if (!cache || !evictUnusedHitGroups || scene->shaderCacheBuild)
+    {
+      return;
+    }
+
+    GiHitGroupCache& hitGroupCache = scene->hitGroupCache;
+
+    for (auto it = hitGroupCache.entries.begin(); it != hitGroupCache.entries.end();)
+    {
+      if (it->second.generation == cache->hitGroupGeneration)
+      {
+        ++it;
+        continue;
+      }
+
+      _giDestroyHitGroupArtifacts(it->second);
+      it = hitGroupCache.entries.erase(it);
+    }
+  }
+
+  bool _giCollectSceneMaterials(const GiScene* scene, std::vector<const GiMaterial*>& materials)
+  {
+    std::set<const GiMaterial*> materialSet;
+    for (auto* m : scene->meshes)
+    {
+      if (!m->material)
+      {
+        assert(false);
+        GB_ERROR("coding error: mesh without material!");
+        return false;
+      }
+      materialSet.insert(m->material);
+    }
+
+    materials.assign(materialSet.begin(), materialSet.end());
+    return true;
+  }
+
+  void _giStartShaderCacheBuild(GiScene* scene, const GiRenderParams& params, const std::vector<const GiMaterial*>& materials)
+  {
+    assert(!scene->shaderCacheBuild);
+
+    GiShaderCacheBuild* build = new GiShaderCacheBuild;
+    build->materials = materials;
+    for (const GiMaterial* material : materials)
+    {
+      _giRetainMaterial(material);
+    }
+
+    s_pendingShaderCacheBuildCount++;
+
+    build->result = std::async(std::launch::async, [params, build]()
+    {
+      return _giCreateShaderCache(params, build->materials, build);
+    });
+
+    scene->shaderCacheBuild = build;
+  }
+
+  // Blocks until the pending shader cache build has completed, and uses its result unless cancelled.
+  void _giFinishShaderCacheBuild(GiScene* scene)
+  {
+    GiShaderCacheBuild* build = scene->shaderCacheBuild;
+
+    while (build->result.wait_for(std::chrono::milliseconds(1)) != std::future_status::ready)
+    {
+      _giRunShaderCacheBuildTasks(*build);
+    }
+
+    GiShaderCache* cache = build->result.get();
+    bool cancelled = build->cancelled;
+
+    for (const GiMaterial* material : build->materials)
+    {
+      _giReleaseMaterial(material);
+    }
+
+    delete build;
+    scene->shaderCacheBuild = nullptr;
+    s_pendingShaderCacheBuildCount--;
+
+    if (cancelled)
+    {
+      if (cache)
+      {
+        _giDestroyShaderCache(cache);
+      }
+      return;
+    }
+
+    if (!cache)
+    {
+      GB_ERROR("failed to build shader cache; keeping previous one");
+      return;
+    }
+
+    _giSetShaderCache(scene, cache, true);
+  }
+
+  void _giCancelShaderCacheBuild(GiScene* scene)
+  {
+    if (!scene->shaderCacheBuild)
+    {
+      return;
+    }
+
+    scene->shaderCacheBuild->cancelled = true;
+    _giFinishShaderCacheBuild(scene);
+  }
+
+  bool _giUpdateArgBlock(GiShaderCache* cache,
+                         const McMaterial& material,
+                         int32_t blockIndex,
+                         uint32_t layoutId,
+                         std::vector<GiArgBlockTable::Range>& dirtyRanges)
+  {
+    if (blockIndex < 0)
+    {
+      return true; // instance-compiled, or no parameters
+    }
+
+    std::vector<uint8_t> argBlock;
+    if (!s_shaderGen->generateMaterialArgBlock(material, layoutId, argBlock))
+    {
+      return false;
+    }
+
+    return cache->argBlocks.updateBlock(uint32_t(blockIndex), argBlock.data(), uint32_t(argBlock.size()), dirtyRanges);
+  }
+
+  // Parameter edits of class-compiled materials (see giUpdateMaterialParameters) don't require
+  // new shaders; we only rewrite the bytes of the argument blocks that changed.
+  GiSceneDirtyFlags _giUpdateArgBlocks(GiShaderCache* cache)
+  {
+    GiSceneDirtyFlags flags = {};
+
+    std::vector<GiArgBlockTable::Range> dirtyRanges;
+
+    for (size_t i = 0; i < cache->materials.size(); i++)
+    {
+      const GiMaterial* material = cache->materials[i];
+      GiMaterialArgBlocks& materialArgBlock = cache->materialArgBlocks[i];
+
+      if (materialArgBlock.paramVersion == material->paramVersion)
+      {
+        continue;
+      }
+
+      materialArgBlock.paramVersion = material->paramVersion;
+
+      bool updated;
+      if (materialArgBlock.isPreviewSurface)
+      {
+        std::vector<uint8_t> argBlock;
+        std::vector<std::string> texturePaths;
+        giPackPreviewSurface(*material->previewSurface, argBlock, texturePaths, nullptr, s_textureCompression);
+
+        updated = cache->argBlocks.updateBlock(uint32_t(materialArgBlock.shadingBlockIndex), argBlock.data(), uint32_t(argBlock.size()), dirtyRanges);
+      }
+      else
+      {
+        const McMaterial& mcMat = _giGetShadingMcMaterial(material, cache->distilledMaterials);
+
+        updated = _giUpdateArgBlock(cache, mcMat, materialArgBlock.shadingBlockIndex, materialArgBlock.shadingLayoutId, dirtyRanges) &&
+                  _giUpdateArgBlock(cache, mcMat, materialArgBlock.opacityBlockIndex, materialArgBlock.opacityLayoutId, dirtyRanges);
+      }
+
+      if (!updated)
+      {
+        GB_DEBUG("argument blocks of material {} can not be updated; rebuilding shaders", material->name);
+        return GiSceneDirtyFlags::DirtyRtPipeline;
+      }
+    }
+
+    const std::vector<uint8_t>& argBlockData = cache->argBlocks.data();
+
+    for (const GiArgBlockTable::Range& range : dirtyRanges)
+    {
+      if (!s_stager->stageToBuffer(&argBlockData[range.offset], range.size, cache->argBlockBuffer, range.offset))
+      {
+        GB_ERROR("failed to stage argument block");
+        return GiSceneDirtyFlags::DirtyRtPipeline;
+      }
+    }
+
+    if (!dirtyRanges.empty())
+    {
+      flags |= GiSceneDirtyFlags::DirtyFramebuffer;
+    }
+
+    return flags;
+  }
+
   GiSceneDirtyFlags _CalcDirtyFlagsForRenderParams(const GiRenderParams& a/*new*/,
                                                    const GiRenderParams& b/*old*/)
   {
@@ -1697,8 +2905,10 @@ cleanup:
       flags |= GiSceneDirtyFlags::DirtyRtPipelineRgen;
     }
 
-    if (ra.mediumStackSize != rb.mediumStackSize ||
-        ra.nextEventEstimation != rb.nextEventEstimation)
+    if (ra.distilledMaterials != rb.distilledMaterials ||
+        ra.mediumStackSize != rb.mediumStackSize ||
+        ra.nextEventEstimation != rb.nextEventEstimation ||
+        ra.previewSurfaceFastPath != rb.previewSurfaceFastPath)
     {
       flags |= GiSceneDirtyFlags::DirtyRtPipeline;
     }
@@ -1713,10 +2923,64 @@ cleanup:
     GiScene* scene = params.scene;
     const GiRenderSettings& renderSettings = params.renderSettings;
 
+    // Without an explicit budget, unreferenced textures may occupy a share of device memory.
+    uint64_t textureMemoryBudget = uint64_t(renderSettings.textureMemoryBudget) * 1024 * 1024;
+    if (textureMemoryBudget == 0)
+    {
+      textureMemoryBudget = s_deviceProperties.deviceLocalMemorySize / AUTO_TEXTURE_MEMORY_BUDGET_DIVISOR;
+    }
+    s_texSys->setMemoryBudget(textureMemoryBudget);
+
+    // Switch to the shader cache of a completed asynchronous build. Without asynchronous
+    // compilation, we wait for it.
+    if (GiShaderCacheBuild* build = scene->shaderCacheBuild; build)
+    {
+      _giRunShaderCacheBuildTasks(*build);
+
+      if (!renderSettings.asyncShaderCompilation ||
+          build->result.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+      {
+        _giFinishShaderCacheBuild(scene);
+      }
+    }
+
+    // Set if shader inputs other than the scene's materials changed.
+    bool shaderCacheOutdated = false;
+
     if (s_forceShaderCacheInvalid)
     {
+      _giCancelShaderCacheBuild(scene);
+
+      std::vector<fs::path> changedFiles;
+#ifdef GI_SHADER_HOTLOADING
+      {
+        std::lock_guard guard(s_changedShaderFilesMutex);
+        changedFiles.swap(s_changedShaderFiles);
+      }
+#endif
+
+      // Only hit groups that depend on the changed files are recompiled. The remaining shaders
+      // of the pipeline are requested again, but are served from the compiler's result cache
+      // unless they depend on the changed files as well.
+      std::unordered_set<uint64_t> dependentShaderIds = s_shaderGen->invalidateShaderFiles(changedFiles);
+
+      uint32_t outdatedHitGroupCount = 0;
+      for (auto& [key, artifacts] : scene->hitGroupCache.entries)
+      {
+        bool isDependent = std::any_of(artifacts.shaderIds.begin(), artifacts.shaderIds.end(),
+          [&](uint64_t id) { return dependentShaderIds.count(id) > 0; });
+
+        if (isDependent && artifacts.shaderInputs)
+        {
+          artifacts.shaderInputs.reset(); // recompile, but keep generated code & textures
+          outdatedHitGroupCount++;
+        }
+      }
+
+      GB_DEBUG("shader files changed, recompiling {} hit groups", outdatedHitGroupCount);
       scene->dirtyFlags |= GiSceneDirtyFlags::DirtyRtPipeline | GiSceneDirtyFlags::DirtyFramebuffer;
       s_forceShaderCacheInvalid = false;
+      shaderCacheOutdated = true;
     }
 
     if (s_resetSampleOffset)
@@ -1730,16 +2994,57 @@ cleanup:
       scene->dirtyFlags |= flags;
 
       scene->oldRenderParams = params;
+
+      shaderCacheOutdated |= bool(flags & GiSceneDirtyFlags::DirtyRtPipeline);
     }
 
-    if (!scene->shaderCache || bool(scene->dirtyFlags & GiSceneDirtyFlags::DirtyRtPipeline))
+    if (scene->shaderCache && shaderCacheOutdated)
     {
-      if (scene->shaderCache) _giDestroyShaderCache(scene->shaderCache);
+      _giCancelShaderCacheBuild(scene);
+      _giSetShaderCache(scene, nullptr, false);
+    }
+
+    if (scene->shaderCache && !bool(scene->dirtyFlags & GiSceneDirtyFlags::DirtyRtPipeline))
+    {
+      scene->dirtyFlags |= _giUpdateArgBlocks(scene->shaderCache);
+    }
+
+    // Material changes while a build is pending are picked up by the next build.
+    if (!scene->shaderCache ||
+        (bool(scene->dirtyFlags & GiSceneDirtyFlags::DirtyRtPipeline) && !scene->shaderCacheBuild))
+    {
+      std::vector<const GiMaterial*> materials;
+      if (!_giCollectSceneMaterials(scene, materials))
+      {
+        return GiStatus::Error;
+      }
+
+      if (!renderSettings.asyncShaderCompilation)
+      {
+        _giSetShaderCache(scene, _giCreateShaderCache(params, materials, nullptr), true);
+      }
+      else
+      {
+        // Until the scene's materials are compiled, render with the fallback material only.
+        if (!scene->shaderCache)
+        {
+          _giCancelShaderCacheBuild(scene);
+          _giSetShaderCache(scene, _giCreateShaderCache(params, {}, nullptr), false);
+        }
 
-      scene->shaderCache = _giCreateShaderCache(params);
+        if (scene->shaderCache)
+        {
+          _giStartShaderCacheBuild(scene, params, materials);
+        }
+      }
 
       scene->dirtyFlags &= ~GiSceneDirtyFlags::DirtyRtPipeline;
-      scene->dirtyFlags |= GiSceneDirtyFlags::DirtyFramebuffer | GiSceneDirtyFlags::DirtyBvh; // SBT
+    }
+
+    if (!scene->shaderCache)
+    {
+      GB_ERROR("{}:{}: no shader cache!", __FILE__, __LINE__);
+      return GiStatus::Error;
     }
 
     if (!scene->bvh || bool(scene->dirtyFlags & GiSceneDirtyFlags::DirtyBvh))
@@ -1832,7 +3137,7 @@ cleanup:
       if (scene->domeLightTexture.handle &&
           scene->domeLightTexture.handle != scene->fallbackDomeLightTexture.handle)
       {
-        s_texSys->evictAndDestroyCachedImage(scene->domeLightTexture);
+        s_texSys->releaseImage(scene->domeLightTexture);
         scene->domeLightTexture.handle = 0;
       }
       scene->domeLight = nullptr;
@@ -1910,6 +3215,11 @@ cleanup:
     glm::vec3 domeLightEmissionMultiplier = scene->domeLight ? scene->domeLight->baseEmission : glm::vec3(1.0f);
     uint32_t domeLightDiffuseSpecularPacked = glm::packHalf2x16(scene->domeLight ? glm::vec2(scene->domeLight->diffuse, scene->domeLight->specular) : glm::vec2(1.0f));
 
+    // 16 bits per light type
+    auto packLightCounts = [](uint32_t countLow, uint32_t countHigh) {
+      return std::min(countLow, 0xFFFFu) | (std::min(countHigh, 0xFFFFu) << 16);
+    };
+
     rp::PushConstants pushData = {
       .cameraPosition                 = glm::make_vec3(params.camera.position),
       .imageDims                      = ((imageHeight << 16) | imageWidth),
@@ -1929,7 +3239,9 @@ cleanup:
       .lightIntensityMultiplier       = renderSettings.lightIntensityMultiplier,
       .clipRangePacked                = glm::packHalf2x16(glm::vec2(params.camera.clipStart, params.camera.clipEnd)),
       .sensorExposure                 = params.camera.exposure,
-      .maxVolumeWalkLength            = renderSettings.maxVolumeWalkLength
+      .maxVolumeWalkLength            = renderSettings.maxVolumeWalkLength,
+      .sphereAndDistantLightCounts    = packLightCounts(scene->sphereLights.elementCount(), scene->distantLights.elementCount()),
+      .rectAndDiskLightCounts         = packLightCounts(scene->rectLights.elementCount(), scene->diskLights.elementCount())
     };
 
     std::vector<CgpuBufferBinding> buffers;
@@ -1945,6 +3257,11 @@ cleanup:
     buffers.push_back({ .binding = rp::BINDING_INDEX_AOV_CLEAR_VALUES_F, .buffer = scene->aovDefaultValues });
     buffers.push_back({ .binding = rp::BINDING_INDEX_AOV_CLEAR_VALUES_I, .buffer = scene->aovDefaultValues });
 
+    if (shaderCache->argBlockBuffer.handle)
+    {
+      buffers.push_back({ .binding = rp::BINDING_INDEX_ARG_BLOCKS, .buffer = shaderCache->argBlockBuffer });
+    }
+
     std::array<uint32_t, size_t(GiAovId::COUNT)> aovBindingIndices = {
       rp::BINDING_INDEX_AOV_COLOR,
       rp::BINDING_INDEX_AOV_NORMAL,
@@ -1969,7 +3286,7 @@ cleanup:
       buffers.push_back({ .binding = bindingIndex, .buffer = binding.renderBuffer->deviceMem });
     }
 
-    size_t imageCount = shaderCache->images2d.size() + shaderCache->images3d.size() + 2/* dome lights */;
+    size_t imageCount = shaderCache->texCapacity2d + shaderCache->texCapacity3d;
 
     std::vector<CgpuImageBinding> images;
     images.reserve(imageCount);
@@ -1979,15 +3296,18 @@ cleanup:
     images.push_back({ .binding = rp::BINDING_INDEX_TEXTURES_2D, .image = scene->fallbackDomeLightTexture, .index = 0 });
     images.push_back({ .binding = rp::BINDING_INDEX_TEXTURES_2D, .image = scene->domeLightTexture,         .index = 1 });
 
-    for (uint32_t i = 0; i < shaderCache->images2d.size(); i++)
+    // Texture arrays are larger than needed; the remaining elements are bound to fallback textures.
+    for (uint32_t i = 0; i < shaderCache->texCapacity2d - 2/* dome lights */; i++)
     {
       images.push_back({ .binding = rp::BINDING_INDEX_TEXTURES_2D,
-                         .image = shaderCache->images2d[i],
+                         .image = i < shaderCache->images2d.size() ? shaderCache->images2d[i] : scene->fallbackDomeLightTexture,
                          .index = 2/* dome lights */ + i });
     }
-    for (uint32_t i = 0; i < shaderCache->images3d.size(); i++)
+    for (uint32_t i = 0; i < shaderCache->texCapacity3d; i++)
     {
-      images.push_back({ .binding = rp::BINDING_INDEX_TEXTURES_3D, .image = shaderCache->images3d[i], .index = i });
+      images.push_back({ .binding = rp::BINDING_INDEX_TEXTURES_3D,
+                         .image = i < shaderCache->images3d.size() ? shaderCache->images3d[i] : scene->fallbackTexture3d,
+                         .index = i });
     }
 
     CgpuTlasBinding as = { .binding = rp::BINDING_INDEX_SCENE_AS, .as = bvh->tlas };
@@ -2126,6 +3446,11 @@ cleanup:
     return result;
   }
 
+  bool giAreShadersPending(const GiScene* scene)
+  {
+    return scene->shaderCacheBuild || bool(scene->dirtyFlags & GiSceneDirtyFlags::DirtyRtPipeline);
+  }
+
   GiScene* giCreateScene()
   {
     CgpuImage fallbackDomeLightTexture;
@@ -2134,18 +3459,31 @@ cleanup:
       return nullptr;
     }
 
+    CgpuImage fallbackTexture3d;
+    if (!cgpuCreateImage(s_device, { .width = 1, .height = 1, .is3d = true, .depth = 1 }, &fallbackTexture3d))
+    {
+      cgpuDestroyImage(s_device, fallbackDomeLightTexture);
+      return nullptr;
+    }
+
+    // Never sampled, but has to be initialized for binding.
+    uint8_t fallbackTexel[4] = { 0, 0, 0, 0 };
+    s_stager->stageToImage(fallbackTexel, sizeof(fallbackTexel), fallbackTexture3d, 1, 1, 1);
+
     GiScene* scene = new GiScene{
       .sphereLights = GgpuDenseDataStore(s_device, *s_stager, *s_delayedResourceDestroyer, sizeof(rp::SphereLight), 64),
       .distantLights = GgpuDenseDataStore(s_device, *s_stager, *s_delayedResourceDestroyer, sizeof(rp::DistantLight), 64),
       .rectLights = GgpuDenseDataStore(s_device, *s_stager, *s_delayedResourceDestroyer, sizeof(rp::RectLight), 64),
       .diskLights = GgpuDenseDataStore(s_device, *s_stager, *s_delayedResourceDestroyer, sizeof(rp::DiskLight), 64),
       .fallbackDomeLightTexture = fallbackDomeLightTexture,
+      .fallbackTexture3d = fallbackTexture3d,
     };
     return scene;
   }
 
   void giDestroyScene(GiScene* scene)
   {
+    _giCancelShaderCacheBuild(scene);
     if (scene->bvh)
     {
       _giDestroyBvh(scene->bvh);
@@ -2154,9 +3492,10 @@ cleanup:
     {
       _giDestroyShaderCache(scene->shaderCache);
     }
+    _giClearHitGroupCache(scene->hitGroupCache);
     if (scene->domeLight)
     {
-      s_texSys->evictAndDestroyCachedImage(scene->domeLightTexture);
+      s_texSys->releaseImage(scene->domeLightTexture);
       scene->domeLightTexture.handle = 0;
     }
     if (scene->aovDefaultValues.handle)
@@ -2164,9 +3503,15 @@ cleanup:
       cgpuDestroyBuffer(s_device, scene->aovDefaultValues);
     }
     cgpuDestroyImage(s_device, scene->fallbackDomeLightTexture);
+    cgpuDestroyImage(s_device, scene->fallbackTexture3d);
     delete scene;
   }
 
+  uint64_t giGetHitGroupCompileCount(const GiScene* scene)
+  {
+    return scene->hitGroupCache.compileCount;
+  }
+
   GiSphereLight* giCreateSphereLight(GiScene* scene)
   {
     std::lock_guard guard(scene->mutex);
@@ -16,17 +16,81 @@
 //
 
 #include "GlslShaderCompiler.h"
+#include "ShaderSourceCache.h"
+#include "SpirvOptimizer.h"
 
 #include <glslang/Public/ShaderLang.h>
 #include <glslang/Public/ResourceLimits.h>
 #include <SPIRV/GlslangToSpv.h>
 
+#include <stdlib.h>
+#include <cassert>
 #include <fstream>
+
+#include <gtl/gb/Fmt.h>
 #include <gtl/gb/Log.h>
 
 namespace
 {
-  using ShaderStage = gtl::GiGlslShaderCompiler::ShaderStage;
+  using namespace gtl;
+  using ShaderStage = GiGlslShaderCompiler::ShaderStage;
+
+  const char* ENVVAR_SPIRV_REPORT_FILE = "GATLING_SPIRV_REPORT_FILE";
+
+  // Hit shaders of removed materials are not evicted explicitly, so the results are bounded.
+  constexpr static const uint64_t MAX_RESULT_BYTES = 64 * 1024 * 1024;
+
+  std::mutex s_reportFileMutex;
+
+  uint64_t _Fnv1a(std::string_view str, uint64_t hash = 0xcbf29ce484222325ull)
+  {
+    for (char c : str)
+    {
+      hash ^= uint64_t(uint8_t(c));
+      hash *= 0x100000001b3ull;
+    }
+    return hash;
+  }
+
+  const char* _GetStageName(ShaderStage stage)
+  {
+    switch (stage)
+    {
+    case ShaderStage::AnyHit:     return "anyhit";
+    case ShaderStage::ClosestHit: return "closesthit";
+    case ShaderStage::Compute:    return "compute";
+    case ShaderStage::Miss:       return "miss";
+    case ShaderStage::RayGen:     return "raygen";
+    default:
+      assert(false);
+      return "unknown";
+    }
+  }
+
+  std::string _EscapeJsonString(std::string_view str)
+  {
+    std::string result;
+    result.reserve(str.size());
+    for (char c : str)
+    {
+      if (c == '"' || c == '\\')
+      {
+        result.push_back('\\');
+      }
+      else if (uint8_t(c) < 0x20)
+      {
+        continue;
+      }
+      result.push_back(c);
+    }
+    return result;
+  }
+
+  std::string _GetDependencyName(const fs::path& shaderPath, const fs::path& filePath)
+  {
+    fs::path relativePath = filePath.is_absolute() ? filePath.lexically_relative(shaderPath) : filePath;
+    return relativePath.lexically_normal().generic_string();
+  }
 
   EShLanguage _GetGlslangShaderLanguage(ShaderStage stage)
   {
@@ -50,10 +114,21 @@ namespace gtl
   {
   private:
     fs::path m_rootPath;
+    std::shared_ptr<GiShaderSourceCache> m_sourceCache;
+    GiShaderDependencyGraph* m_dependencyGraph;
+    std::vector<std::string>* m_includedFiles;
 
   public:
-    _FileIncluder(const fs::path& rootPath)
+    // Files included by the shader source itself are appended to includedFiles, nested
+    // includes are recorded as edges of the dependency graph. Both are optional.
+    _FileIncluder(const fs::path& rootPath,
+                  std::shared_ptr<GiShaderSourceCache> sourceCache,
+                  GiShaderDependencyGraph* dependencyGraph = nullptr,
+                  std::vector<std::string>* includedFiles = nullptr)
       : m_rootPath(rootPath)
+      , m_sourceCache(sourceCache)
+      , m_dependencyGraph(dependencyGraph)
+      , m_includedFiles(includedFiles)
     {
     }
 
@@ -66,24 +141,33 @@ namespace gtl
     }
 
     IncludeResult* includeLocal(const char* headerName,
-                                [[maybe_unused]] const char* includerName,
-                                [[maybe_unused]] size_t inclusionDepth) override
+                                const char* includerName,
+                                size_t inclusionDepth) override
     {
       fs::path filePath = m_rootPath / headerName;
 
-      std::ifstream fileStream(filePath.c_str(), std::ios_base::binary | std::ios_base::ate);
-      if (!fileStream.is_open())
+      // Recorded before loading so that fixing a missing include triggers a recompilation.
+      std::string dependencyName = _GetDependencyName(m_rootPath, headerName);
+      if (inclusionDepth <= 1 && m_includedFiles)
+      {
+        m_includedFiles->push_back(dependencyName);
+      }
+      else if (inclusionDepth > 1 && m_dependencyGraph)
+      {
+        m_dependencyGraph->addInclude(_GetDependencyName(m_rootPath, includerName), dependencyName);
+      }
+
+      GiShaderSourceCache::Source source = m_sourceCache->get(filePath);
+      if (!source)
       {
         std::string pathStr = filePath.string();
         GB_ERROR("failed to find shader include '{}'", pathStr);
         return nullptr;
       }
 
-      size_t textLength = fileStream.tellg();
-      char* text = new char[textLength];
-      fileStream.seekg(0, std::ios::beg);
-      fileStream.read(text, textLength);
-      return new IncludeResult(headerName, text, textLength, text);
+      // The result references the cached text; the handle keeps it alive until released.
+      auto* sourceHandle = new GiShaderSourceCache::Source(std::move(source));
+      return new IncludeResult(headerName, (*sourceHandle)->data(), (*sourceHandle)->size(), sourceHandle);
     }
 
     void releaseInclude(IncludeResult* result) override
@@ -92,13 +176,18 @@ namespace gtl
       {
         return;
       }
-      delete[] static_cast<char*>(result->userData);
+      delete static_cast<GiShaderSourceCache::Source*>(result->userData);
       delete result;
     }
   };
 
-  GiGlslShaderCompiler::GiGlslShaderCompiler(const fs::path& shaderPath)
-    : m_fileIncluder(std::make_shared<_FileIncluder>(shaderPath))
+  GiGlslShaderCompiler::GiGlslShaderCompiler(const fs::path& shaderPath,
+                                             std::shared_ptr<GiShaderSourceCache> sourceCache,
+                                             GiShaderOptimization optimization)
+    : m_shaderPath(shaderPath)
+    , m_sourceCache(sourceCache)
+    , m_optimization(optimization)
+    , m_reportFilePath(getenv(ENVVAR_SPIRV_REPORT_FILE) ? getenv(ENVVAR_SPIRV_REPORT_FILE) : "")
   {
     // glslang requires this static initialization, however it internally
     // ref-counts and is thread-safe. The return value seems to be unused.
@@ -113,7 +202,194 @@ namespace gtl
 
   bool GiGlslShaderCompiler::compileGlslToSpv(ShaderStage stage,
                                                std::string_view source,
-                                               std::vector<uint8_t>& spv)
+                                               std::string_view debugName,
+                                               std::vector<uint8_t>& spv,
+                                               const std::vector<fs::path>& sourceFiles,
+                                               GiShaderDependencyGraph::ShaderId* shaderId)
+  {
+    // Optimization is expensive, so results are kept for subsequent shader cache rebuilds.
+    // They are keyed by the preprocessed source to not serve stale results after edits of
+    // included files. Sources failing to preprocess are compiled for the error log.
+    std::string preprocessedSource;
+    bool cacheResult = m_optimization != GiShaderOptimization::None &&
+                       preprocessGlsl(stage, source, preprocessedSource);
+
+    // The stitched source identifies the shader in the dependency graph.
+    _ResultKey key = {
+      .stage = stage,
+      .sourceHash = _Fnv1a(source),
+      .preprocessedHash = _Fnv1a(preprocessedSource),
+      .preprocessedHash2 = std::hash<std::string_view>{}(preprocessedSource)
+    };
+
+    if (shaderId)
+    {
+      *shaderId = getShaderId(key);
+    }
+
+    if (cacheResult)
+    {
+      std::lock_guard guard(m_resultMutex);
+
+      auto it = m_results.find(key);
+      if (it != m_results.end())
+      {
+        m_resultLru.splice(m_resultLru.begin(), m_resultLru, it->second.lruIt);
+        spv = it->second.spv;
+        return true;
+      }
+    }
+
+    std::vector<std::string> dependencies;
+    dependencies.reserve(sourceFiles.size());
+    for (const fs::path& sourceFile : sourceFiles)
+    {
+      dependencies.push_back(_GetDependencyName(m_shaderPath, sourceFile));
+    }
+
+    std::vector<uint8_t> unoptimizedSpv;
+    bool success = compileGlslToUnoptimizedSpv(stage, source, unoptimizedSpv, dependencies);
+
+    // Also for failed compilations, so that fixing the error triggers a recompilation.
+    m_dependencyGraph.setShaderFiles(getShaderId(key), dependencies);
+
+    if (!success)
+    {
+      return false;
+    }
+
+    if (!cacheResult)
+    {
+      spv = std::move(unoptimizedSpv);
+      reportStats(stage, debugName, spv, spv);
+      return true;
+    }
+
+    if (!giOptimizeSpirv(m_optimization, unoptimizedSpv, spv))
+    {
+      GB_WARN("failed to optimize shader {} - using unoptimized SPIR-V", debugName);
+      spv = unoptimizedSpv;
+    }
+
+    reportStats(stage, debugName, unoptimizedSpv, spv);
+
+    std::lock_guard guard(m_resultMutex);
+
+    // Other threads may have compiled the same shader in the meantime.
+    auto [it, inserted] = m_results.try_emplace(key);
+    if (inserted)
+    {
+      it->second.lruIt = m_resultLru.insert(m_resultLru.begin(), key);
+    }
+    else
+    {
+      m_resultBytes -= it->second.spv.size();
+    }
+
+    it->second.spv = spv;
+    m_resultBytes += spv.size();
+
+    evictResults();
+
+    return true;
+  }
+
+  void GiGlslShaderCompiler::evictResults()
+  {
+    // The most recent result is kept, even if it exceeds the limit by itself.
+    while (m_resultBytes > MAX_RESULT_BYTES && m_resultLru.size() > 1)
+    {
+      auto it = m_results.find(m_resultLru.back());
+      assert(it != m_results.end());
+
+      m_resultBytes -= it->second.spv.size();
+      m_results.erase(it);
+      m_resultLru.pop_back();
+    }
+  }
+
+  std::unordered_set<GiShaderDependencyGraph::ShaderId> GiGlslShaderCompiler::invalidateFiles(const std::vector<fs::path>& files)
+  {
+    std::unordered_set<GiShaderDependencyGraph::ShaderId> shaderIds;
+
+    for (const fs::path& file : files)
+    {
+      std::unordered_set<GiShaderDependencyGraph::ShaderId> dependentIds =
+        m_dependencyGraph.findDependentShaders(_GetDependencyName(m_shaderPath, file));
+
+      shaderIds.insert(dependentIds.begin(), dependentIds.end());
+    }
+
+    std::lock_guard guard(m_resultMutex);
+
+    for (auto it = m_results.begin(); it != m_results.end();)
+    {
+      if (shaderIds.count(getShaderId(it->first)) == 0)
+      {
+        ++it;
+        continue;
+      }
+
+      m_resultBytes -= it->second.spv.size();
+      m_resultLru.erase(it->second.lruIt);
+      it = m_results.erase(it);
+    }
+
+    return shaderIds;
+  }
+
+  GiShaderDependencyGraph::ShaderId GiGlslShaderCompiler::getShaderId(const _ResultKey& key)
+  {
+    return _Fnv1a(_GetStageName(key.stage), key.sourceHash);
+  }
+
+  void GiGlslShaderCompiler::reportStats(ShaderStage stage,
+                                         std::string_view debugName,
+                                         const std::vector<uint8_t>& spvBefore,
+                                         const std::vector<uint8_t>& spvAfter)
+  {
+    GiSpirvStats statsBefore, statsAfter;
+    if (!giGetSpirvStats(spvBefore, statsBefore) || !giGetSpirvStats(spvAfter, statsAfter))
+    {
+      GB_ERROR("invalid SPIR-V for shader {}", debugName);
+      return;
+    }
+
+    const char* stageName = _GetStageName(stage);
+
+    GB_DEBUG("SPIR-V {} ({}): {} -> {} instructions, {} -> {} functions, {} -> {} bytes", debugName, stageName,
+      statsBefore.instructionCount, statsAfter.instructionCount, statsBefore.functionCount, statsAfter.functionCount,
+      statsBefore.moduleSize, statsAfter.moduleSize);
+
+    if (m_reportFilePath.empty())
+    {
+      return;
+    }
+
+    // One JSON object per line.
+    std::string line = GB_FMT("{{\"name\":\"{}\",\"stage\":\"{}\","
+      "\"before\":{{\"instructions\":{},\"functions\":{},\"bytes\":{}}},"
+      "\"after\":{{\"instructions\":{},\"functions\":{},\"bytes\":{}}}}}\n",
+      _EscapeJsonString(debugName), stageName,
+      statsBefore.instructionCount, statsBefore.functionCount, statsBefore.moduleSize,
+      statsAfter.instructionCount, statsAfter.functionCount, statsAfter.moduleSize);
+
+    std::lock_guard guard(s_reportFileMutex);
+
+    std::ofstream stream(m_reportFilePath, std::ios::out | std::ios::app);
+    if (!stream.is_open())
+    {
+      GB_ERROR("unable to write SPIR-V report file {}", m_reportFilePath);
+      return;
+    }
+
+    stream << line;
+  }
+
+  bool GiGlslShaderCompiler::compileGlslToUnoptimizedSpv(ShaderStage stage,
+                                                          std::string_view source,
+                                                          std::vector<uint8_t>& spv,
+                                                          std::vector<std::string>& includedFiles)
   {
     EShLanguage language = _GetGlslangShaderLanguage(stage);
 
@@ -136,7 +412,9 @@ namespace gtl
     int defaultVersion = 450; // Will be overriden by #version in source.
     bool forwardCompatible = false;
 
-    bool success = shader.parse(resourceLimits, defaultVersion, forwardCompatible, messages, *m_fileIncluder);
+    _FileIncluder fileIncluder(m_shaderPath, m_sourceCache, &m_dependencyGraph, &includedFiles);
+
+    bool success = shader.parse(resourceLimits, defaultVersion, forwardCompatible, messages, fileIncluder);
     if (!success)
     {
       const char* msgDesc = "failed to compile shader";
@@ -170,4 +448,38 @@ namespace gtl
     glslang::GlslangToSpv(*intermediate, *reinterpret_cast<std::vector<unsigned int>*>(&spv), &spvOptions);
     return true;
   }
+
+  bool GiGlslShaderCompiler::preprocessGlsl(ShaderStage stage,
+                                             std::string_view source,
+                                             std::string& output)
+  {
+    EShLanguage language = _GetGlslangShaderLanguage(stage);
+
+    glslang::TShader shader(language);
+
+    const char* sources[] = { source.data() };
+    const int sourceLengths[] = { static_cast<int>(source.length()) };
+    shader.setStringsWithLengths(sources, sourceLengths, 1);
+    shader.setEnvClient(glslang::EShClientVulkan, glslang::EshTargetClientVersion::EShTargetVulkan_1_1);
+    shader.setEnvTarget(glslang::EShTargetLanguage::EShTargetSpv, glslang::EShTargetLanguageVersion::EShTargetSpv_1_4);
+    shader.setEnvInput(glslang::EShSourceGlsl, language, glslang::EShClient::EShClientVulkan, 450);
+
+    EShMessages messages = static_cast<EShMessages>(EShMsgVulkanRules | EShMsgSpvRules);
+
+    const TBuiltInResource* resourceLimits = GetDefaultResources();
+    int defaultVersion = 450;
+    bool forceDefaultVersionAndProfile = false;
+    bool forwardCompatible = false;
+
+    _FileIncluder fileIncluder(m_shaderPath, m_sourceCache);
+
+    if (!shader.preprocess(resourceLimits, defaultVersion, ENoProfile, forceDefaultVersionAndProfile,
+                           forwardCompatible, messages, &output, fileIncluder))
+    {
+      GB_ERROR("failed to preprocess shader: {}", shader.getInfoLog());
+      return false;
+    }
+
+    return true;
+  }
 }
@@ -18,13 +18,25 @@
 #pragma once
 
 #include <vector>
+#include <memory>
+#include <string>
 #include <string_view>
 #include <filesystem>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <Gi.h>
+
+#include "ShaderDependencyGraph.h"
 
 namespace fs = std::filesystem;
 
 namespace gtl
 {
+  class GiShaderSourceCache;
+
   class GiGlslShaderCompiler
   {
   public:
@@ -38,16 +50,79 @@ namespace gtl
     };
 
   public:
-    GiGlslShaderCompiler(const fs::path& shaderPath);
+    GiGlslShaderCompiler(const fs::path& shaderPath,
+                         std::shared_ptr<GiShaderSourceCache> sourceCache,
+                         GiShaderOptimization optimization);
 
     ~GiGlslShaderCompiler();
 
   public:
+    // The debug name identifies the shader in the SPIR-V statistics report, which is
+    // logged and, if GATLING_SPIRV_REPORT_FILE is set, appended to that file as JSON.
+    // Source files are the shader files the source was stitched from; together with the
+    // files included during compilation, they are recorded as the shader's dependencies.
     bool compileGlslToSpv(ShaderStage stage,
                           std::string_view source,
-                          std::vector<uint8_t>& spv);
+                          std::string_view debugName,
+                          std::vector<uint8_t>& spv,
+                          const std::vector<fs::path>& sourceFiles = {},
+                          GiShaderDependencyGraph::ShaderId* shaderId = nullptr);
+
+    // Evicts the results of shaders depending on any of the changed files and returns
+    // their IDs. The files are expected to be relative to the shader directory.
+    std::unordered_set<GiShaderDependencyGraph::ShaderId> invalidateFiles(const std::vector<fs::path>& files);
+
+    // Resolves includes and macros only; used for benchmarking and result cache keys.
+    bool preprocessGlsl(ShaderStage stage,
+                        std::string_view source,
+                        std::string& output);
 
   private:
-    std::shared_ptr<class _FileIncluder> m_fileIncluder;
+    bool compileGlslToUnoptimizedSpv(ShaderStage stage,
+                                     std::string_view source,
+                                     std::vector<uint8_t>& spv,
+                                     std::vector<std::string>& includedFiles);
+
+    void reportStats(ShaderStage stage,
+                     std::string_view debugName,
+                     const std::vector<uint8_t>& spvBefore,
+                     const std::vector<uint8_t>& spvAfter);
+
+  private:
+    struct _ResultKey
+    {
+      ShaderStage stage;
+      uint64_t sourceHash;
+      uint64_t preprocessedHash;
+      uint64_t preprocessedHash2;
+
+      bool operator==(const _ResultKey& other) const = default;
+    };
+
+    struct _ResultKeyHasher
+    {
+      size_t operator()(const _ResultKey& key) const { return size_t(key.preprocessedHash); }
+    };
+
+    struct _Result
+    {
+      std::vector<uint8_t> spv;
+      std::list<_ResultKey>::iterator lruIt;
+    };
+
+    static GiShaderDependencyGraph::ShaderId getShaderId(const _ResultKey& key);
+
+    // Drops the least recently used results above the size limit. Requires the result mutex.
+    void evictResults();
+
+    fs::path m_shaderPath;
+    std::shared_ptr<GiShaderSourceCache> m_sourceCache;
+    GiShaderOptimization m_optimization;
+    std::string m_reportFilePath;
+    std::mutex m_resultMutex;
+    std::unordered_map<_ResultKey, _Result, _ResultKeyHasher> m_results;
+    std::list<_ResultKey> m_resultLru; // most recently used first
+    uint64_t m_resultBytes = 0;
+    GiShaderDependencyGraph m_dependencyGraph;
   };
 }
@@ -18,6 +18,7 @@
 #include "GlslShaderGen.h"
 #include "GlslShaderCompiler.h"
 #include "GlslStitcher.h"
+#include "ShaderSourceCache.h"
 
 #include <gtl/mc/Material.h>
 #include <gtl/mc/Runtime.h>
@@ -34,7 +35,7 @@ namespace gtl
 {
   class McRuntime;
 
-  bool GiGlslShaderGen::init(std::string_view shaderPath, McRuntime& mcRuntime)
+  bool GiGlslShaderGen::init(std::string_view shaderPath, McRuntime& mcRuntime, GiShaderOptimization shaderOptimization)
   {
     m_shaderPath = fs::path(shaderPath);
 
@@ -44,34 +45,34 @@ namespace gtl
       return false;
     }
 
-    m_shaderCompiler = std::make_shared<GiGlslShaderCompiler>(m_shaderPath);
+    m_sourceCache = std::make_shared<GiShaderSourceCache>();
+    m_shaderCompiler = std::make_shared<GiGlslShaderCompiler>(m_shaderPath, m_sourceCache, shaderOptimization);
 
     return true;
   }
 
+  std::unordered_set<uint64_t> GiGlslShaderGen::invalidateShaderFiles(const std::vector<fs::path>& changedFiles)
+  {
+    m_sourceCache->clear();
+
+    return m_shaderCompiler->invalidateFiles(changedFiles);
+  }
+
   void _sgGenerateCommonDefines(GiGlslStitcher& stitcher, const GiGlslShaderGen::CommonShaderParams& params)
   {
 #if defined(NDEBUG)
     stitcher.appendDefine("NDEBUG");
 #endif
 
-    uint32_t totalLightCount = params.diskLightCount + params.distantLightCount +
-                               params.rectLightCount + params.sphereLightCount;
-
     stitcher.appendDefine("AOV_MASK", (int) params.aovMask);
     stitcher.appendDefine("TEXTURE_COUNT_2D", (int32_t) params.texCount2d);
     stitcher.appendDefine("TEXTURE_COUNT_3D", (int32_t) params.texCount3d);
-    stitcher.appendDefine("SPHERE_LIGHT_COUNT", (int32_t) params.sphereLightCount);
-    stitcher.appendDefine("DISTANT_LIGHT_COUNT", (int32_t) params.distantLightCount);
-    stitcher.appendDefine("RECT_LIGHT_COUNT", (int32_t) params.rectLightCount);
-    stitcher.appendDefine("DISK_LIGHT_COUNT", (int32_t) params.diskLightCount);
-    stitcher.appendDefine("TOTAL_LIGHT_COUNT", (int32_t) totalLightCount);
     stitcher.appendDefine("MEDIUM_STACK_SIZE", (int32_t) params.mediumStackSize);
   }
 
   bool GiGlslShaderGen::generateRgenSpirv(std::string_view fileName, const RaygenShaderParams& params, std::vector<uint8_t>& spv)
   {
-    GiGlslStitcher stitcher;
+    GiGlslStitcher stitcher(*m_sourceCache);
     stitcher.appendVersion();
 
     if (params.reorderInvocations)
@@ -122,12 +123,12 @@ namespace gtl
     }
 
     std::string source = stitcher.source();
-    return m_shaderCompiler->compileGlslToSpv(GiGlslShaderCompiler::ShaderStage::RayGen, source, spv);
+    return m_shaderCompiler->compileGlslToSpv(GiGlslShaderCompiler::ShaderStage::RayGen, source, fileName, spv, { filePath });
   }
 
   bool GiGlslShaderGen::generateMissSpirv(std::string_view fileName, const MissShaderParams& params, std::vector<uint8_t>& spv)
   {
-    GiGlslStitcher stitcher;
+    GiGlslStitcher stitcher(*m_sourceCache);
     stitcher.appendVersion();
 
     _sgGenerateCommonDefines(stitcher, params.commonParams);
@@ -144,7 +145,7 @@ namespace gtl
     }
 
     std::string source = stitcher.source();
-    return m_shaderCompiler->compileGlslToSpv(GiGlslShaderCompiler::ShaderStage::Miss, source, spv);
+    return m_shaderCompiler->compileGlslToSpv(GiGlslShaderCompiler::ShaderStage::Miss, source, fileName, spv, { filePath });
   }
 
   bool _MakeMaterialGenInfo(const McGlslGenResult& codeGenResult,
@@ -172,7 +173,9 @@ namespace gtl
 
     genInfo = GiGlslShaderGen::MaterialGenInfo {
       .glslSource = glslSource,
-      .textureDescriptions = textureDescriptions
+      .textureDescriptions = textureDescriptions,
+      .argBlock = codeGenResult.argBlock,
+      .argBlockLayoutId = codeGenResult.argBlockLayoutId
     };
 
     return true;
@@ -219,18 +222,30 @@ namespace gtl
     return _MakeMaterialGenInfo(genResult, material.resourcePathPrefix, m_shaderPath, genInfo);
   }
 
-  bool GiGlslShaderGen::generateClosestHitSpirv(const ClosestHitShaderParams& params, std::vector<uint8_t>& spv)
+  bool GiGlslShaderGen::generateMaterialArgBlock(const McMaterial& material, uint32_t argBlockLayoutId, std::vector<uint8_t>& argBlock)
+  {
+    return m_mcBackend->genArgBlock(*material.mdlMaterial, argBlockLayoutId, argBlock);
+  }
+
+  void GiGlslShaderGen::releaseMaterialArgBlockLayout(uint32_t argBlockLayoutId)
   {
-    GiGlslStitcher stitcher;
+    m_mcBackend->releaseArgBlockLayout(argBlockLayoutId);
+  }
+
+  bool GiGlslShaderGen::generateClosestHitSpirv(const ClosestHitShaderParams& params, std::vector<uint8_t>& spv, uint64_t* shaderId)
+  {
+    GiGlslStitcher stitcher(*m_sourceCache);
     stitcher.appendVersion();
 
     _sgGenerateCommonDefines(stitcher, params.commonParams);
 
-    stitcher.appendDefine("TEXTURE_INDEX_OFFSET_2D", (int32_t) params.textureIndexOffset2d);
-    stitcher.appendDefine("TEXTURE_INDEX_OFFSET_3D", (int32_t) params.textureIndexOffset3d);
     stitcher.appendDefine("MEDIUM_DIRECTIONAL_BIAS", params.directionalBias);
     stitcher.appendDefine("SCENE_DATA_COUNT", (int32_t) params.sceneDataCount);
 
+    if (params.hasArgBlock)
+    {
+      stitcher.appendDefine("MDL_ARG_BLOCKS");
+    }
     if (params.hasBackfaceBsdf)
     {
       stitcher.appendDefine("HAS_BACKFACE_BSDF");
@@ -281,20 +296,22 @@ namespace gtl
     stitcher.replaceFirst("#pragma mdl_generated_code", params.shadingGlsl);
 
     std::string source = stitcher.source();
-    return m_shaderCompiler->compileGlslToSpv(GiGlslShaderCompiler::ShaderStage::ClosestHit, source, spv);
+    return m_shaderCompiler->compileGlslToSpv(GiGlslShaderCompiler::ShaderStage::ClosestHit, source, params.debugName, spv, { filePath }, shaderId);
   }
 
-  bool GiGlslShaderGen::generateAnyHitSpirv(const AnyHitShaderParams& params, std::vector<uint8_t>& spv)
+  bool GiGlslShaderGen::generateAnyHitSpirv(const AnyHitShaderParams& params, std::vector<uint8_t>& spv, uint64_t* shaderId)
   {
-    GiGlslStitcher stitcher;
+    GiGlslStitcher stitcher(*m_sourceCache);
     stitcher.appendVersion();
 
     _sgGenerateCommonDefines(stitcher, params.commonParams);
 
-    stitcher.appendDefine("TEXTURE_INDEX_OFFSET_2D", (int32_t) params.textureIndexOffset2d);
-    stitcher.appendDefine("TEXTURE_INDEX_OFFSET_3D", (int32_t) params.textureIndexOffset3d);
     stitcher.appendDefine("SCENE_DATA_COUNT", (int32_t) params.sceneDataCount);
 
+    if (params.hasArgBlock)
+    {
+      stitcher.appendDefine("MDL_ARG_BLOCKS");
+    }
     if (params.shadowTest)
     {
       stitcher.appendDefine("SHADOW_TEST");
@@ -317,6 +334,6 @@ namespace gtl
     stitcher.replaceFirst("#pragma mdl_generated_code", params.opacityEvalGlsl);
 
     std::string source = stitcher.source();
-    return m_shaderCompiler->compileGlslToSpv(GiGlslShaderCompiler::ShaderStage::AnyHit, source, spv);
+    return m_shaderCompiler->compileGlslToSpv(GiGlslShaderCompiler::ShaderStage::AnyHit, source, params.debugName, spv, { filePath }, shaderId);
   }
 }
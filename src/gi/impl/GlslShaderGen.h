@@ -23,9 +23,12 @@
 #include <string>
 #include <memory>
 #include <filesystem>
+#include <unordered_set>
 
 #include <gtl/mc/Backend.h>
 
+#include <Gi.h>
+
 namespace fs = std::filesystem;
 
 namespace gtl
@@ -34,31 +37,41 @@ namespace gtl
   class McRuntime;
   class McBackend;
   class GiGlslShaderCompiler;
+  class GiShaderSourceCache;
 
   class GiGlslShaderGen
   {
   public:
-    bool init(std::string_view shaderPath, McRuntime& runtime);
+    bool init(std::string_view shaderPath, McRuntime& runtime, GiShaderOptimization shaderOptimization);
+
+    // Drops cached shader sources so that changed files are read again, and evicts the
+    // compilation results of all shaders that depend on the changed files. Returns the IDs
+    // of these shaders, as assigned by the generate*Spirv functions.
+    std::unordered_set<uint64_t> invalidateShaderFiles(const std::vector<fs::path>& changedFiles);
 
   public:
     struct MaterialGenInfo
     {
       std::string glslSource;
       std::vector<McTextureDescription> textureDescriptions;
+      std::vector<uint8_t> argBlock;
+      uint32_t argBlockLayoutId = 0;
     };
 
     bool generateMaterialShadingGenInfo(const McMaterial& material, MaterialGenInfo& genInfo);
     bool generateMaterialOpacityGenInfo(const McMaterial& material, MaterialGenInfo& genInfo);
 
+    // For materials that share their class with the material the layout was generated for.
+    bool generateMaterialArgBlock(const McMaterial& material, uint32_t argBlockLayoutId, std::vector<uint8_t>& argBlock);
+
+    // Each layout of a generated MaterialGenInfo has to be released once it is no longer used.
+    void releaseMaterialArgBlockLayout(uint32_t argBlockLayoutId);
+
   public:
     struct CommonShaderParams
     {
       uint32_t aovMask;
-      uint32_t diskLightCount;
-      uint32_t distantLightCount;
       uint32_t mediumStackSize;
-      uint32_t rectLightCount;
-      uint32_t sphereLightCount;
       uint32_t texCount2d;
       uint32_t texCount3d;
     };
@@ -86,9 +99,11 @@ namespace gtl
     {
       std::string_view baseFileName;
       CommonShaderParams commonParams;
+      std::string_view debugName;
       float directionalBias;
       bool enableSceneTransforms;
       int cameraPositionSceneDataIndex;
+      bool hasArgBlock;
       bool hasBackfaceBsdf;
       bool hasBackfaceEdf;
       bool hasCutoutTransparency;
@@ -99,31 +114,30 @@ namespace gtl
       bool nextEventEstimation;
       uint32_t sceneDataCount;
       std::string_view shadingGlsl;
-      uint32_t textureIndexOffset2d;
-      uint32_t textureIndexOffset3d;
     };
 
     struct AnyHitShaderParams
     {
       std::string_view baseFileName;
       CommonShaderParams commonParams;
+      std::string_view debugName;
       bool enableSceneTransforms;
       int cameraPositionSceneDataIndex;
+      bool hasArgBlock;
       std::string_view opacityEvalGlsl;
       uint32_t sceneDataCount;
       bool shadowTest;
-      uint32_t textureIndexOffset2d;
-      uint32_t textureIndexOffset3d;
     };
 
     bool generateRgenSpirv(std::string_view fileName, const RaygenShaderParams& params, std::vector<uint8_t>& spv);
     bool generateMissSpirv(std::string_view fileName, const MissShaderParams& params, std::vector<uint8_t>& spv);
-    bool generateClosestHitSpirv(const ClosestHitShaderParams& params, std::vector<uint8_t>& spv);
-    bool generateAnyHitSpirv(const AnyHitShaderParams& params, std::vector<uint8_t>& spv);
+    bool generateClosestHitSpirv(const ClosestHitShaderParams& params, std::vector<uint8_t>& spv, uint64_t* shaderId = nullptr);
+    bool generateAnyHitSpirv(const AnyHitShaderParams& params, std::vector<uint8_t>& spv, uint64_t* shaderId = nullptr);
 
   private:
     std::shared_ptr<McBackend> m_mcBackend;
     std::shared_ptr<GiGlslShaderCompiler> m_shaderCompiler;
+    std::shared_ptr<GiShaderSourceCache> m_sourceCache;
     fs::path m_shaderPath;
   };
 }
@@ -17,91 +17,129 @@
 
 #include "GlslStitcher.h"
 
-#include <string>
-#include <fstream>
+#include <limits>
 
-namespace detail
-{
-  bool readTextFromFile(const fs::path& filePath, std::string& text)
-  {
-    std::ifstream file(filePath, std::ios_base::in | std::ios_base::binary);
-    if (!file.is_open())
-    {
-      return false;
-    }
-    file.seekg(0, std::ios_base::end);
-    text.resize(file.tellg(), ' ');
-    file.seekg(0, std::ios_base::beg);
-    file.read(&text[0], text.size());
-    return file.good();
-  }
-}
+#include <gtl/gb/Fmt.h>
 
 namespace gtl
 {
-  GiGlslStitcher::GiGlslStitcher()
+  GiGlslStitcher::GiGlslStitcher(GiShaderSourceCache& sourceCache)
+    : m_sourceCache(sourceCache)
   {
-    // Full float precision so that we don't cut off epsilons
-    m_source.precision(std::numeric_limits<float>::max_digits10);
-    // Ensure no integer literals are emitted for floats
-    m_source.setf(std::ios::fixed | std::ios::showpoint);
   }
 
   void GiGlslStitcher::appendVersion()
   {
-    m_source << "#version 460 core\n";
+    appendString("#version 460 core\n");
   }
 
   void GiGlslStitcher::appendDefine(std::string_view name)
   {
-    m_source << "#define " << name << "\n";
+    appendString(GB_FMT("#define {}\n", name));
   }
 
   void GiGlslStitcher::appendDefine(std::string_view name, int32_t value)
   {
-    m_source << "#define " << name << " " << value << "\n";
+    appendString(GB_FMT("#define {} {}\n", name, value));
   }
 
   void GiGlslStitcher::appendDefine(std::string_view name, float value)
   {
-    m_source << "#define " << name << " " << value << "\n";
+    // Full float precision so that we don't cut off epsilons. Fixed notation ensures
+    // that no integer literals are emitted for floats.
+    appendString(GB_FMT("#define {} {:.{}f}\n", name, value, std::numeric_limits<float>::max_digits10));
   }
 
   void GiGlslStitcher::appendString(std::string_view value)
   {
-    m_source << value;
+    m_pending.append(value);
+    m_copiedByteCount += value.size();
   }
 
-  bool GiGlslStitcher::appendSourceFile(fs::path path)
+  bool GiGlslStitcher::appendSourceFile(const fs::path& path)
   {
-    std::string text;
-    if (!detail::readTextFromFile(path, text))
+    GiShaderSourceCache::Source source = m_sourceCache.get(path);
+    if (!source)
     {
       return false;
     }
 
-    appendString(text);
+    flushPending();
+    m_segments.push_back(Segment{ .storage = source, .offset = 0, .length = source->size() });
     return true;
   }
 
   bool GiGlslStitcher::replaceFirst(std::string_view substring, std::string_view replacement)
   {
-    std::string tmp = m_source.str();
+    flushPending();
 
-    size_t location = tmp.find(substring);
-    if (location == std::string::npos)
+    for (size_t i = 0; i < m_segments.size(); i++)
     {
-      return false;
-    }
+      Segment segment = m_segments[i];
 
-    tmp.replace(location, substring.length(), replacement);
+      std::string_view text = std::string_view(*segment.storage).substr(segment.offset, segment.length);
 
-    m_source = std::stringstream(tmp);
-    return true;
+      size_t location = text.find(substring);
+      if (location == std::string_view::npos)
+      {
+        continue;
+      }
+
+      Segment prefix{ .storage = segment.storage, .offset = segment.offset, .length = location };
+
+      auto replacementStorage = std::make_shared<const std::string>(replacement);
+      m_copiedByteCount += replacement.size();
+      Segment middle{ .storage = replacementStorage, .offset = 0, .length = replacement.size() };
+
+      size_t suffixOffset = location + substring.size();
+      Segment suffix{ .storage = segment.storage, .offset = segment.offset + suffixOffset, .length = segment.length - suffixOffset };
+
+      m_segments[i] = prefix;
+      m_segments.insert(m_segments.begin() + i + 1, { middle, suffix });
+      return true;
+    }
+
+    return false;
   }
 
   std::string GiGlslStitcher::source()
   {
-    return m_source.str();
+    flushPending();
+
+    size_t totalLength = 0;
+    for (const Segment& segment : m_segments)
+    {
+      totalLength += segment.length;
+    }
+
+    std::string result;
+    result.reserve(totalLength);
+
+    for (const Segment& segment : m_segments)
+    {
+      result.append(*segment.storage, segment.offset, segment.length);
+    }
+
+    m_copiedByteCount += totalLength;
+    return result;
+  }
+
+  uint64_t GiGlslStitcher::copiedByteCount() const
+  {
+    return m_copiedByteCount;
+  }
+
+  void GiGlslStitcher::flushPending()
+  {
+    if (m_pending.empty())
+    {
+      return;
+    }
+
+    size_t length = m_pending.size();
+    auto storage = std::make_shared<const std::string>(std::move(m_pending));
+    m_segments.push_back(Segment{ .storage = storage, .offset = 0, .length = length });
+
+    m_pending.clear();
   }
 }
@@ -20,16 +20,21 @@
 #include <stdint.h>
 #include <string_view>
 #include <filesystem>
-#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ShaderSourceCache.h"
 
 namespace fs = std::filesystem;
 
 namespace gtl
 {
+  // Assembles shader sources from segments. Source files are referenced from the
+  // source cache instead of being copied, and replacements split segments in place.
   class GiGlslStitcher
   {
   public:
-    GiGlslStitcher();
+    explicit GiGlslStitcher(GiShaderSourceCache& sourceCache);
 
     void appendVersion();
 
@@ -39,13 +44,31 @@ namespace gtl
 
     void appendString(std::string_view value);
 
-    bool appendSourceFile(fs::path path);
+    bool appendSourceFile(const fs::path& path);
 
+    // The substring must not span multiple appended pieces.
     bool replaceFirst(std::string_view substring, std::string_view replacement);
 
     std::string source();
 
+  public:
+    // Bytes copied so far, including the final assembly by source().
+    uint64_t copiedByteCount() const;
+
+  private:
+    struct Segment
+    {
+      GiShaderSourceCache::Source storage;
+      size_t offset;
+      size_t length;
+    };
+
+    void flushPending();
+
   private:
-    std::stringstream m_source;
+    GiShaderSourceCache& m_sourceCache;
+    std::vector<Segment> m_segments;
+    std::string m_pending;
+    uint64_t m_copiedByteCount = 0;
   };
 }
@@ -0,0 +1,216 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "PreviewSurface.h"
+
+#include "interface/rp_main.h"
+
+#include <algorithm>
+#include <functional>
+#include <string_view>
+#include <string.h>
+
+namespace gtl
+{
+  namespace rp = shader_interface::rp_main;
+
+  static_assert(uint32_t(GiPreviewSurfaceInput::COUNT) == rp::PREVIEW_SURFACE_INPUT_COUNT);
+
+  void _giWriteWord(std::vector<uint8_t>& argBlock, uint32_t offset, const void* value)
+  {
+    memcpy(&argBlock[offset], value, sizeof(uint32_t));
+  }
+
+  void _giWriteFloats(std::vector<uint8_t>& argBlock, uint32_t offset, const float* values, uint32_t count)
+  {
+    memcpy(&argBlock[offset], values, sizeof(float) * count);
+  }
+
+  uint32_t _giGetTextureChannel(GiTextureChannel channel)
+  {
+    switch (channel)
+    {
+    case GiTextureChannel::R: return rp::PREVIEW_SURFACE_CHANNEL_R;
+    case GiTextureChannel::G: return rp::PREVIEW_SURFACE_CHANNEL_G;
+    case GiTextureChannel::B: return rp::PREVIEW_SURFACE_CHANNEL_B;
+    case GiTextureChannel::A: return rp::PREVIEW_SURFACE_CHANNEL_A;
+    default: return rp::PREVIEW_SURFACE_CHANNEL_RGB;
+    }
+  }
+
+  // Inputs reading a single channel can use single-channel textures. Float inputs only read
+  // the red channel of RGB textures, and the normal input ignores the channel.
+  GiTextureUsage _giGetTextureUsage(GiPreviewSurfaceInput input, GiTextureChannel channel)
+  {
+    if (input == GiPreviewSurfaceInput::Normal)
+    {
+      return GiTextureUsage::Normal;
+    }
+
+    bool isColorInput = input == GiPreviewSurfaceInput::DiffuseColor ||
+                        input == GiPreviewSurfaceInput::EmissiveColor ||
+                        input == GiPreviewSurfaceInput::SpecularColor;
+
+    if (channel == GiTextureChannel::R || (channel == GiTextureChannel::Rgb && !isColorInput))
+    {
+      return GiTextureUsage::Scalar;
+    }
+
+    return GiTextureUsage::Color;
+  }
+
+  // Values of TEX_WRAP_* (see mdl_types.glsl). 'black' maps to clip, which returns zero.
+  uint32_t _giGetTextureWrapMode(GiTextureWrapMode mode)
+  {
+    switch (mode)
+    {
+    case GiTextureWrapMode::Black: return 3;
+    case GiTextureWrapMode::Clamp: return 0;
+    case GiTextureWrapMode::Mirror: return 2;
+    default: return 1;
+    }
+  }
+
+  void giPackPreviewSurface(const GiPreviewSurfaceDesc& desc,
+                            std::vector<uint8_t>& argBlock,
+                            std::vector<std::string>& texturePaths,
+                            std::vector<GiTextureUsage>* textureUsages,
+                            bool twoChannelNormals)
+  {
+    argBlock.assign(rp::PREVIEW_SURFACE_ARG_BLOCK_SIZE, 0);
+    texturePaths.clear();
+
+    std::vector<GiTextureUsage> usages;
+
+    _giWriteFloats(argBlock, rp::PREVIEW_SURFACE_OFFSET_DIFFUSE_COLOR, desc.diffuseColor, 3);
+    _giWriteFloats(argBlock, rp::PREVIEW_SURFACE_OFFSET_ROUGHNESS, &desc.roughness, 1);
+    _giWriteFloats(argBlock, rp::PREVIEW_SURFACE_OFFSET_EMISSIVE_COLOR, desc.emissiveColor, 3);
+    _giWriteFloats(argBlock, rp::PREVIEW_SURFACE_OFFSET_METALLIC, &desc.metallic, 1);
+    _giWriteFloats(argBlock, rp::PREVIEW_SURFACE_OFFSET_SPECULAR_COLOR, desc.specularColor, 3);
+    _giWriteFloats(argBlock, rp::PREVIEW_SURFACE_OFFSET_CLEARCOAT, &desc.clearcoat, 1);
+    _giWriteFloats(argBlock, rp::PREVIEW_SURFACE_OFFSET_NORMAL, desc.normal, 3);
+    _giWriteFloats(argBlock, rp::PREVIEW_SURFACE_OFFSET_CLEARCOAT_ROUGHNESS, &desc.clearcoatRoughness, 1);
+    _giWriteFloats(argBlock, rp::PREVIEW_SURFACE_OFFSET_OPACITY, &desc.opacity, 1);
+    _giWriteFloats(argBlock, rp::PREVIEW_SURFACE_OFFSET_OPACITY_THRESHOLD, &desc.opacityThreshold, 1);
+    _giWriteFloats(argBlock, rp::PREVIEW_SURFACE_OFFSET_IOR, &desc.ior, 1);
+
+    uint32_t flags = desc.useSpecularWorkflow ? rp::PREVIEW_SURFACE_FLAG_SPECULAR_WORKFLOW : 0;
+    _giWriteWord(argBlock, rp::PREVIEW_SURFACE_OFFSET_FLAGS, &flags);
+
+    for (uint32_t i = 0; i < rp::PREVIEW_SURFACE_INPUT_COUNT; i++)
+    {
+      const GiPreviewSurfaceTexture& texture = desc.textures[i];
+      if (texture.filePath.empty())
+      {
+        continue;
+      }
+
+      auto pathIt = std::find(texturePaths.begin(), texturePaths.end(), texture.filePath);
+      uint32_t textureIndex = uint32_t(pathIt - texturePaths.begin()) + 1;
+
+      GiTextureUsage usage = _giGetTextureUsage(GiPreviewSurfaceInput(i), texture.channel);
+
+      if (pathIt == texturePaths.end())
+      {
+        texturePaths.push_back(texture.filePath);
+        usages.push_back(usage);
+      }
+      else if (usages[textureIndex - 1] != usage)
+      {
+        usages[textureIndex - 1] = GiTextureUsage::Color; // keeps all channels
+      }
+
+      uint32_t info = (textureIndex & rp::PREVIEW_SURFACE_TEXTURE_INDEX_MASK) |
+                      (_giGetTextureChannel(texture.channel) << rp::PREVIEW_SURFACE_TEXTURE_CHANNEL_SHIFT) |
+                      (_giGetTextureWrapMode(texture.wrapS) << rp::PREVIEW_SURFACE_TEXTURE_WRAP_S_SHIFT) |
+                      (_giGetTextureWrapMode(texture.wrapT) << rp::PREVIEW_SURFACE_TEXTURE_WRAP_T_SHIFT) |
+                      (texture.sRgb ? rp::PREVIEW_SURFACE_TEXTURE_FLAG_SRGB : 0);
+
+      uint32_t bindingOffset = rp::PREVIEW_SURFACE_OFFSET_TEXTURES + i * rp::PREVIEW_SURFACE_TEXTURE_STRIDE;
+      _giWriteFloats(argBlock, bindingOffset + rp::PREVIEW_SURFACE_TEXTURE_OFFSET_SCALE, texture.scale, 4);
+      _giWriteFloats(argBlock, bindingOffset + rp::PREVIEW_SURFACE_TEXTURE_OFFSET_BIAS, texture.bias, 4);
+      _giWriteWord(argBlock, bindingOffset + rp::PREVIEW_SURFACE_TEXTURE_OFFSET_INFO, &info);
+    }
+
+    // Usages are only final once all inputs have been visited.
+    const GiPreviewSurfaceTexture& normalTexture = desc.textures[size_t(GiPreviewSurfaceInput::Normal)];
+    if (twoChannelNormals && !normalTexture.filePath.empty())
+    {
+      size_t pathIndex = std::find(texturePaths.begin(), texturePaths.end(), normalTexture.filePath) - texturePaths.begin();
+
+      if (usages[pathIndex] == GiTextureUsage::Normal)
+      {
+        uint32_t infoOffset = rp::PREVIEW_SURFACE_OFFSET_TEXTURES + uint32_t(GiPreviewSurfaceInput::Normal) * rp::PREVIEW_SURFACE_TEXTURE_STRIDE +
+                              rp::PREVIEW_SURFACE_TEXTURE_OFFSET_INFO;
+
+        uint32_t info;
+        memcpy(&info, &argBlock[infoOffset], sizeof(uint32_t));
+        info |= rp::PREVIEW_SURFACE_TEXTURE_FLAG_RECONSTRUCT_Z;
+        _giWriteWord(argBlock, infoOffset, &info);
+      }
+    }
+
+    if (textureUsages)
+    {
+      *textureUsages = std::move(usages);
+    }
+  }
+
+  uint64_t giHashPreviewSurface(const GiPreviewSurfaceDesc& desc)
+  {
+    std::vector<uint8_t> argBlock;
+    std::vector<std::string> texturePaths;
+    giPackPreviewSurface(desc, argBlock, texturePaths);
+
+    std::hash<std::string_view> hasher;
+    uint64_t hash = hasher(std::string_view((const char*) argBlock.data(), argBlock.size()));
+
+    for (const std::string& path : texturePaths)
+    {
+      hash ^= hasher(path) + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+    }
+
+    return hash;
+  }
+
+  bool giPreviewSurfaceHasCutout(const GiPreviewSurfaceDesc& desc)
+  {
+    const GiPreviewSurfaceTexture& opacityTexture = desc.textures[size_t(GiPreviewSurfaceInput::Opacity)];
+
+    return desc.opacity < 1.0f || !opacityTexture.filePath.empty();
+  }
+
+  bool giPreviewSurfacesShareHitGroup(const GiPreviewSurfaceDesc& a,
+                                      const GiPreviewSurfaceDesc& b,
+                                      bool twoChannelNormals)
+  {
+    if (giPreviewSurfaceHasCutout(a) != giPreviewSurfaceHasCutout(b))
+    {
+      return false;
+    }
+
+    std::vector<uint8_t> argBlock;
+    std::vector<std::string> texturePathsA;
+    std::vector<std::string> texturePathsB;
+    std::vector<GiTextureUsage> textureUsagesA;
+    std::vector<GiTextureUsage> textureUsagesB;
+    giPackPreviewSurface(a, argBlock, texturePathsA, &textureUsagesA, twoChannelNormals);
+    giPackPreviewSurface(b, argBlock, texturePathsB, &textureUsagesB, twoChannelNormals);
+
+    return texturePathsA == texturePathsB && textureUsagesA == textureUsagesB;
+  }
+}
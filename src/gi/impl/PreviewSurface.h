@@ -0,0 +1,54 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <Gi.h>
+
+#include "TextureUsage.h"
+
+namespace gtl
+{
+  // Writes the argument block read by preview_surface.glsl. Texture files are listed in
+  // 'texturePaths'; a file used by multiple inputs is only listed once. The indices in the
+  // argument block are one-based, with zero denoting an untextured input.
+  //
+  // 'textureUsages' receives how each file is read. If 'twoChannelNormals' is set, the shader
+  // reconstructs the Z component of normal maps, which may then be stored as BC5.
+  void giPackPreviewSurface(const GiPreviewSurfaceDesc& desc,
+                            std::vector<uint8_t>& argBlock,
+                            std::vector<std::string>& texturePaths,
+                            std::vector<GiTextureUsage>* textureUsages = nullptr,
+                            bool twoChannelNormals = false);
+
+  // Hash of the packed representation.
+  uint64_t giHashPreviewSurface(const GiPreviewSurfaceDesc& desc);
+
+  // Returns true if the opacity input requires an any hit shader.
+  bool giPreviewSurfaceHasCutout(const GiPreviewSurfaceDesc& desc);
+
+  // Returns true if both materials use the same hit group and textures, so that only the
+  // argument block differs between them. Textures must also be read in the same way, since
+  // their usage determines how they are loaded.
+  bool giPreviewSurfacesShareHitGroup(const GiPreviewSurfaceDesc& a,
+                                      const GiPreviewSurfaceDesc& b,
+                                      bool twoChannelNormals = false);
+}
@@ -0,0 +1,91 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include "ShaderDependencyGraph.h"
+
+namespace gtl
+{
+  void GiShaderDependencyGraph::setShaderFiles(ShaderId shader, const std::vector<std::string>& files)
+  {
+    std::lock_guard guard(m_mutex);
+
+    std::vector<std::string>& shaderFiles = m_shaderFiles[shader];
+
+    for (const std::string& file : shaderFiles)
+    {
+      m_fileShaders[file].erase(shader);
+    }
+
+    shaderFiles = files;
+
+    for (const std::string& file : shaderFiles)
+    {
+      m_fileShaders[file].insert(shader);
+    }
+  }
+
+  void GiShaderDependencyGraph::addInclude(std::string_view includerFile, std::string_view includedFile)
+  {
+    std::lock_guard guard(m_mutex);
+
+    m_includers[std::string(includedFile)].insert(std::string(includerFile));
+  }
+
+  std::unordered_set<GiShaderDependencyGraph::ShaderId> GiShaderDependencyGraph::findDependentShaders(std::string_view file) const
+  {
+    std::lock_guard guard(m_mutex);
+
+    std::unordered_set<ShaderId> shaders;
+
+    // Walk up the include edges; the visited set also guards against include cycles.
+    std::unordered_set<std::string> visitedFiles;
+    std::vector<std::string> pendingFiles = { std::string(file) };
+
+    while (!pendingFiles.empty())
+    {
+      std::string currentFile = std::move(pendingFiles.back());
+      pendingFiles.pop_back();
+
+      if (!visitedFiles.insert(currentFile).second)
+      {
+        continue;
+      }
+
+      if (auto it = m_fileShaders.find(currentFile); it != m_fileShaders.end())
+      {
+        shaders.insert(it->second.begin(), it->second.end());
+      }
+
+      if (auto it = m_includers.find(currentFile); it != m_includers.end())
+      {
+        pendingFiles.insert(pendingFiles.end(), it->second.begin(), it->second.end());
+      }
+    }
+
+    return shaders;
+  }
+
+  void GiShaderDependencyGraph::clear()
+  {
+    std::lock_guard guard(m_mutex);
+
+    m_includers.clear();
+    m_fileShaders.clear();
+    m_shaderFiles.clear();
+  }
+}
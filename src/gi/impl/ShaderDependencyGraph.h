@@ -0,0 +1,55 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace gtl
+{
+  // Records which source files compiled shaders consist of and which files these include,
+  // so that a changed file only invalidates the shaders that depend on it, directly or through
+  // any chain of includes. File names are relative to the shader directory. Thread-safe.
+  class GiShaderDependencyGraph
+  {
+  public:
+    using ShaderId = uint64_t;
+
+  public:
+    // Replaces the files that the shader's source consists of or includes at the top level.
+    void setShaderFiles(ShaderId shader, const std::vector<std::string>& files);
+
+    void addInclude(std::string_view includerFile, std::string_view includedFile);
+
+    std::unordered_set<ShaderId> findDependentShaders(std::string_view file) const;
+
+    void clear();
+
+  private:
+    mutable std::mutex m_mutex;
+    std::unordered_map<std::string, std::unordered_set<std::string>> m_includers; // by included file
+    std::unordered_map<std::string, std::unordered_set<ShaderId>> m_fileShaders;
+    std::unordered_map<ShaderId, std::vector<std::string>> m_shaderFiles;
+  };
+}
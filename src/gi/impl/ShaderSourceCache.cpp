@@ -0,0 +1,80 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "ShaderSourceCache.h"
+
+#include <fstream>
+#include <mutex>
+
+namespace
+{
+  bool _ReadTextFromFile(const fs::path& filePath, std::string& text)
+  {
+    std::ifstream file(filePath, std::ios_base::in | std::ios_base::binary);
+    if (!file.is_open())
+    {
+      return false;
+    }
+    file.seekg(0, std::ios_base::end);
+    text.resize(file.tellg(), ' ');
+    file.seekg(0, std::ios_base::beg);
+    file.read(&text[0], text.size());
+    return file.good();
+  }
+}
+
+namespace gtl
+{
+  GiShaderSourceCache::Source GiShaderSourceCache::get(const fs::path& filePath)
+  {
+    std::string key = filePath.lexically_normal().string();
+
+    {
+      std::shared_lock lock(m_mutex);
+
+      auto it = m_sources.find(key);
+      if (it != m_sources.end())
+      {
+        return it->second;
+      }
+    }
+
+    // Concurrent misses may read the same file more than once; the first insertion wins.
+    auto text = std::make_shared<std::string>();
+    m_fileReadCount++;
+
+    if (!_ReadTextFromFile(filePath, *text))
+    {
+      return nullptr;
+    }
+
+    std::unique_lock lock(m_mutex);
+    auto [it, inserted] = m_sources.try_emplace(std::move(key), std::move(text));
+    return it->second;
+  }
+
+  void GiShaderSourceCache::clear()
+  {
+    std::unique_lock lock(m_mutex);
+    m_sources.clear();
+  }
+
+  uint64_t GiShaderSourceCache::fileReadCount() const
+  {
+    return m_fileReadCount;
+  }
+}
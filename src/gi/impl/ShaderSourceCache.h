@@ -0,0 +1,54 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+namespace gtl
+{
+  // Thread-safe cache of shader source files. Entries are immutable and shared, so
+  // callers may keep using them after the cache has been cleared (e.g. on hot reload).
+  class GiShaderSourceCache
+  {
+  public:
+    using Source = std::shared_ptr<const std::string>;
+
+  public:
+    // Returns nullptr if the file can not be read.
+    Source get(const fs::path& filePath);
+
+    void clear();
+
+  public:
+    // Number of files read from disk since construction.
+    uint64_t fileReadCount() const;
+
+  private:
+    std::shared_mutex m_mutex;
+    std::unordered_map<std::string, Source> m_sources;
+    std::atomic_uint64_t m_fileReadCount = 0;
+  };
+}
@@ -0,0 +1,117 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "SpirvOptimizer.h"
+
+#include <spirv-tools/optimizer.hpp>
+
+#include <string.h>
+#include <assert.h>
+
+#include <gtl/gb/Log.h>
+
+namespace
+{
+  const uint32_t SPIRV_MAGIC = 0x07230203;
+  const uint32_t SPIRV_HEADER_WORD_COUNT = 5;
+  const uint32_t SPIRV_OP_FUNCTION = 54;
+}
+
+namespace gtl
+{
+  bool giGetSpirvStats(const std::vector<uint8_t>& spv, GiSpirvStats& stats)
+  {
+    stats = GiSpirvStats{ .instructionCount = 0, .functionCount = 0, .moduleSize = uint32_t(spv.size()) };
+
+    if ((spv.size() % sizeof(uint32_t)) != 0)
+    {
+      return false;
+    }
+
+    size_t wordCount = spv.size() / sizeof(uint32_t);
+    if (wordCount < SPIRV_HEADER_WORD_COUNT)
+    {
+      return false;
+    }
+
+    std::vector<uint32_t> words(wordCount);
+    memcpy(words.data(), spv.data(), spv.size());
+
+    if (words[0] != SPIRV_MAGIC)
+    {
+      return false;
+    }
+
+    for (size_t i = SPIRV_HEADER_WORD_COUNT; i < wordCount;)
+    {
+      uint32_t instructionWordCount = words[i] >> 16;
+      uint32_t opcode = words[i] & 0xFFFF;
+
+      if (instructionWordCount == 0 || (i + instructionWordCount) > wordCount)
+      {
+        return false;
+      }
+
+      stats.instructionCount++;
+      stats.functionCount += uint32_t(opcode == SPIRV_OP_FUNCTION);
+
+      i += instructionWordCount;
+    }
+
+    return true;
+  }
+
+  bool giOptimizeSpirv(GiShaderOptimization optimization,
+                       const std::vector<uint8_t>& spv,
+                       std::vector<uint8_t>& optimizedSpv)
+  {
+    assert(optimization != GiShaderOptimization::None);
+
+    // Matches the glslang target environment (Vulkan 1.1, SPIR-V 1.4).
+    spvtools::Optimizer optimizer(SPV_ENV_VULKAN_1_1_SPIRV_1_4);
+
+    optimizer.SetMessageConsumer([](spv_message_level_t level, [[maybe_unused]] const char* source,
+                                    [[maybe_unused]] const spv_position_t& position, const char* message) {
+      if (level <= SPV_MSG_ERROR)
+      {
+        GB_ERROR("SPIR-V optimizer: {}", message);
+      }
+    });
+
+    if (optimization == GiShaderOptimization::Size)
+    {
+      optimizer.RegisterSizePasses();
+    }
+    else
+    {
+      optimizer.RegisterPerformancePasses();
+    }
+
+    std::vector<uint32_t> words(spv.size() / sizeof(uint32_t));
+    memcpy(words.data(), spv.data(), words.size() * sizeof(uint32_t));
+
+    std::vector<uint32_t> optimizedWords;
+    if (!optimizer.Run(words.data(), words.size(), &optimizedWords))
+    {
+      return false;
+    }
+
+    optimizedSpv.resize(optimizedWords.size() * sizeof(uint32_t));
+    memcpy(optimizedSpv.data(), optimizedWords.data(), optimizedSpv.size());
+    return true;
+  }
+}
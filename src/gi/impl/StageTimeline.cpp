@@ -0,0 +1,127 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include "StageTimeline.h"
+
+#include <algorithm>
+#include <assert.h>
+
+#include <gtl/gb/Fmt.h>
+
+namespace gtl
+{
+  using FloatMs = std::chrono::duration<float, std::milli>;
+
+  GiStageTimeline::GiStageTimeline(std::vector<std::string> stageNames)
+    : m_stageNames(std::move(stageNames))
+    , m_intervals(m_stageNames.size())
+  {
+  }
+
+  void GiStageTimeline::record(uint32_t stage, Clock::time_point start, Clock::time_point end)
+  {
+    assert(stage < m_intervals.size());
+
+    std::lock_guard guard(m_mutex);
+    m_intervals[stage].push_back(Interval{ .start = start, .end = end });
+    m_start = std::min(m_start, start);
+    m_end = std::max(m_end, end);
+  }
+
+  GiStageTimeline::Scope::Scope(GiStageTimeline& timeline, uint32_t stage)
+    : m_timeline(timeline)
+    , m_stage(stage)
+    , m_start(Clock::now())
+  {
+  }
+
+  GiStageTimeline::Scope::~Scope()
+  {
+    m_timeline.record(m_stage, m_start, Clock::now());
+  }
+
+  float GiStageTimeline::durationMs() const
+  {
+    std::lock_guard guard(m_mutex);
+    return (m_start < m_end) ? FloatMs(m_end - m_start).count() : 0.0f;
+  }
+
+  float GiStageTimeline::busyMs(uint32_t stage) const
+  {
+    std::lock_guard guard(m_mutex);
+
+    float busy = 0.0f;
+    for (const Interval& interval : m_intervals[stage])
+    {
+      busy += FloatMs(interval.end - interval.start).count();
+    }
+    return busy;
+  }
+
+  std::vector<float> GiStageTimeline::utilization(uint32_t stage, uint32_t intervalCount) const
+  {
+    std::lock_guard guard(m_mutex);
+
+    std::vector<float> result(intervalCount, 0.0f);
+    if (m_start >= m_end || intervalCount == 0)
+    {
+      return result;
+    }
+
+    float intervalMs = FloatMs(m_end - m_start).count() / float(intervalCount);
+
+    // Distribute the busy time of each recorded interval over the overlapped timeline intervals.
+    for (const Interval& interval : m_intervals[stage])
+    {
+      float startMs = FloatMs(interval.start - m_start).count();
+      float endMs = FloatMs(interval.end - m_start).count();
+
+      uint32_t first = std::min(uint32_t(startMs / intervalMs), intervalCount - 1);
+      uint32_t last = std::min(uint32_t(endMs / intervalMs), intervalCount - 1);
+
+      for (uint32_t i = first; i <= last; i++)
+      {
+        float overlapStart = std::max(startMs, float(i) * intervalMs);
+        float overlapEnd = std::min(endMs, float(i + 1) * intervalMs);
+        result[i] += std::max(overlapEnd - overlapStart, 0.0f) / intervalMs;
+      }
+    }
+
+    return result;
+  }
+
+  std::vector<std::string> GiStageTimeline::formatUtilization(uint32_t intervalCount) const
+  {
+    std::vector<std::string> lines;
+    lines.reserve(m_stageNames.size());
+
+    for (uint32_t stage = 0; stage < m_stageNames.size(); stage++)
+    {
+      std::string line = GB_FMT("{}: busy {:.2f}ms |", m_stageNames[stage], busyMs(stage));
+
+      for (float workerCount : utilization(stage, intervalCount))
+      {
+        line += GB_FMT(" {:.1f}", workerCount);
+      }
+
+      lines.push_back(std::move(line));
+    }
+
+    return lines;
+  }
+}
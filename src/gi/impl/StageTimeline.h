@@ -0,0 +1,80 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace gtl
+{
+  // Records when worker threads were busy with the stages of a pipelined build, so that
+  // the utilization of each stage can be inspected over time. Thread-safe.
+  class GiStageTimeline
+  {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit GiStageTimeline(std::vector<std::string> stageNames);
+
+  public:
+    void record(uint32_t stage, Clock::time_point start, Clock::time_point end);
+
+    // Times the lifetime of the scope.
+    class Scope
+    {
+    public:
+      Scope(GiStageTimeline& timeline, uint32_t stage);
+
+      ~Scope();
+
+    private:
+      GiStageTimeline& m_timeline;
+      uint32_t m_stage;
+      Clock::time_point m_start;
+    };
+
+  public:
+    float durationMs() const;
+
+    float busyMs(uint32_t stage) const;
+
+    // Average number of workers in the stage, for equally long intervals from the first
+    // recorded start to the last recorded end.
+    std::vector<float> utilization(uint32_t stage, uint32_t intervalCount) const;
+
+    // One line per stage, e.g. "codegen: busy 120.00ms | 3.9 4.0 2.1 0.0".
+    std::vector<std::string> formatUtilization(uint32_t intervalCount) const;
+
+  private:
+    struct Interval
+    {
+      Clock::time_point start;
+      Clock::time_point end;
+    };
+
+    std::vector<std::string> m_stageNames;
+    mutable std::mutex m_mutex;
+    std::vector<std::vector<Interval>> m_intervals;
+    Clock::time_point m_start = Clock::time_point::max();
+    Clock::time_point m_end = Clock::time_point::min();
+  };
+}
@@ -0,0 +1,166 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "TextureCache.h"
+
+#include <assert.h>
+
+namespace gtl
+{
+  GiTextureCache::GiTextureCache(uint64_t budgetBytes, DestroyFunc destroyFunc)
+    : m_budgetBytes(budgetBytes)
+    , m_destroyFunc(std::move(destroyFunc))
+  {
+  }
+
+  GiTextureCache::~GiTextureCache()
+  {
+    assert(m_entries.empty());
+  }
+
+  uint64_t GiTextureCache::acquire(const std::string& key)
+  {
+    auto handleIt = m_handles.find(key);
+    if (handleIt == m_handles.end())
+    {
+      m_stats.missCount++;
+      return 0;
+    }
+
+    uint64_t handle = handleIt->second;
+    Entry& entry = m_entries.at(handle);
+
+    if (entry.refCount == 0)
+    {
+      m_lru.erase(entry.lruIt);
+    }
+    entry.refCount++;
+
+    m_stats.hitCount++;
+    return handle;
+  }
+
+  void GiTextureCache::insert(const std::string& key, uint64_t handle, uint64_t sizeBytes)
+  {
+    assert(!m_handles.count(key));
+    assert(!m_entries.count(handle));
+
+    evict(sizeBytes);
+
+    m_handles[key] = handle;
+    m_entries[handle] = Entry{ .keys = { key }, .sizeBytes = sizeBytes, .refCount = 1 };
+
+    m_stats.residentBytes += sizeBytes;
+    m_stats.residentCount++;
+  }
+
+  void GiTextureCache::addKey(const std::string& key, uint64_t handle)
+  {
+    auto [handleIt, inserted] = m_handles.try_emplace(key, handle);
+    if (!inserted)
+    {
+      assert(handleIt->second == handle);
+      return;
+    }
+
+    m_entries.at(handle).keys.push_back(key);
+  }
+
+  bool GiTextureCache::release(uint64_t handle)
+  {
+    auto entryIt = m_entries.find(handle);
+    if (entryIt == m_entries.end())
+    {
+      return false;
+    }
+
+    Entry& entry = entryIt->second;
+    assert(entry.refCount > 0);
+
+    if (--entry.refCount == 0)
+    {
+      entry.lruIt = m_lru.insert(m_lru.begin(), handle);
+      evict(0);
+    }
+
+    return true;
+  }
+
+  bool GiTextureCache::contains(uint64_t handle) const
+  {
+    return m_entries.count(handle) > 0;
+  }
+
+  bool GiTextureCache::containsKey(const std::string& key) const
+  {
+    return m_handles.count(key) > 0;
+  }
+
+  void GiTextureCache::setBudget(uint64_t budgetBytes)
+  {
+    m_budgetBytes = budgetBytes;
+    evict(0);
+  }
+
+  void GiTextureCache::clear()
+  {
+    for (const auto& [handle, entry] : m_entries)
+    {
+      m_destroyFunc(handle);
+    }
+    m_entries.clear();
+    m_handles.clear();
+    m_lru.clear();
+
+    m_stats.residentBytes = 0;
+    m_stats.residentCount = 0;
+  }
+
+  const GiTextureCacheStats& GiTextureCache::stats() const
+  {
+    return m_stats;
+  }
+
+  void GiTextureCache::evict(uint64_t requiredBytes)
+  {
+    if (m_budgetBytes == 0)
+    {
+      return;
+    }
+
+    while (!m_lru.empty() && (m_stats.residentBytes + requiredBytes) > m_budgetBytes)
+    {
+      uint64_t handle = m_lru.back();
+      m_lru.pop_back();
+
+      auto entryIt = m_entries.find(handle);
+      const Entry& entry = entryIt->second;
+
+      m_stats.residentBytes -= entry.sizeBytes;
+      m_stats.residentCount--;
+      m_stats.evictionCount++;
+
+      for (const std::string& key : entry.keys)
+      {
+        m_handles.erase(key);
+      }
+      m_entries.erase(entryIt);
+
+      m_destroyFunc(handle);
+    }
+  }
+}
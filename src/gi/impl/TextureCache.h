@@ -0,0 +1,97 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gtl
+{
+  struct GiTextureCacheStats
+  {
+    uint64_t hitCount = 0;
+    uint64_t missCount = 0;
+    uint64_t evictionCount = 0;
+    uint64_t residentBytes = 0;
+    uint32_t residentCount = 0;
+  };
+
+  // Reference-counted cache of images, identified by opaque handles and reachable under one or more
+  // keys (e.g. a file path and a content hash). Images without references stay
+  // resident until the memory budget is exceeded; they are then evicted in least recently released
+  // order. Referenced images are never evicted, so the budget may be exceeded temporarily.
+  class GiTextureCache
+  {
+  public:
+    using DestroyFunc = std::function<void(uint64_t handle)>;
+
+  public:
+    // A budget of zero disables eviction.
+    GiTextureCache(uint64_t budgetBytes, DestroyFunc destroyFunc);
+
+    ~GiTextureCache();
+
+    // Returns the handle of the image and adds a reference to it, or 0 if not cached.
+    uint64_t acquire(const std::string& key);
+
+    // Adds an image with a single reference. Unreferenced images are evicted to make room for it.
+    void insert(const std::string& key, uint64_t handle, uint64_t sizeBytes);
+
+    // Makes a cached image reachable under an additional key. Does not add a reference.
+    void addKey(const std::string& key, uint64_t handle);
+
+    // Removes a reference. Returns false if the image is not cached.
+    bool release(uint64_t handle);
+
+    bool contains(uint64_t handle) const;
+
+    bool containsKey(const std::string& key) const;
+
+    void setBudget(uint64_t budgetBytes);
+
+    // Destroys all images, including referenced ones.
+    void clear();
+
+  public:
+    const GiTextureCacheStats& stats() const;
+
+  private:
+    struct Entry
+    {
+      std::vector<std::string> keys;
+      uint64_t sizeBytes;
+      uint32_t refCount;
+      std::list<uint64_t>::iterator lruIt; // only valid if unreferenced
+    };
+
+  private:
+    void evict(uint64_t requiredBytes);
+
+  private:
+    uint64_t m_budgetBytes;
+    DestroyFunc m_destroyFunc;
+    std::unordered_map<std::string, uint64_t> m_handles;
+    std::unordered_map<uint64_t, Entry> m_entries;
+    std::list<uint64_t> m_lru; // unreferenced images, most recently released first
+    GiTextureCacheStats m_stats;
+  };
+}
@@ -0,0 +1,428 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "TextureLoader.h"
+#include "Gi.h"
+
+#include <gtl/gb/Fmt.h>
+#include <gtl/gb/Log.h>
+#include <gtl/imgio/Imgio.h>
+#include <gtl/imgio/Mipmaps.h>
+
+#include <string.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+  using namespace gtl;
+
+  constexpr static const float BYTES_TO_MIB = 1.0f / (1024.0f * 1024.0f);
+  constexpr static const ImgioMipFilter MIP_FILTER = ImgioMipFilter::Kaiser;
+  constexpr static const ImgioMipFilter MIP_FILTER_HDR = ImgioMipFilter::Box; // avoid ringing around highlights
+
+  constexpr static const uint32_t BC_CACHE_MAGIC = 0x31434247; // 'GBC1'
+  constexpr static const uint32_t BC_CACHE_VERSION = 1;
+
+  struct _BcCacheHeader
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t blockFormat;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+  };
+
+  bool _IsHdrFormat(ImgioFormat format)
+  {
+    return format == ImgioFormat::RGBA16_FLOAT || format == ImgioFormat::RGBA32_FLOAT;
+  }
+
+  ImgioBlockFormat _GetBlockFormat(bool isHdr, GiTextureUsage usage)
+  {
+    switch (usage)
+    {
+    case GiTextureUsage::Normal: return ImgioBlockFormat::BC5;
+    case GiTextureUsage::Scalar: return ImgioBlockFormat::BC4;
+    default: return isHdr ? ImgioBlockFormat::BC6H : ImgioBlockFormat::BC7;
+    }
+  }
+
+  uint32_t _GetLevelExtent(uint32_t extent, uint32_t level)
+  {
+    return std::max(1u, extent >> level);
+  }
+
+  bool _ReadCacheFile(const fs::path& path, GiDecodedTexture& texture)
+  {
+    std::ifstream stream(path, std::ios::in | std::ios::binary);
+    if (!stream.is_open())
+    {
+      return false;
+    }
+
+    _BcCacheHeader header;
+    if (!stream.read((char*) &header, sizeof(header)) ||
+        header.magic != BC_CACHE_MAGIC ||
+        header.version != BC_CACHE_VERSION ||
+        header.blockFormat > uint32_t(ImgioBlockFormat::BC7) ||
+        header.levelCount == 0)
+    {
+      return false;
+    }
+
+    ImgioBlockFormat blockFormat = ImgioBlockFormat(header.blockFormat);
+    texture.format = blockFormat == ImgioBlockFormat::BC6H ? ImgioFormat::RGBA16_FLOAT : ImgioFormat::RGBA8_UNORM;
+    texture.blockFormat = blockFormat;
+    texture.levels.resize(header.levelCount);
+
+    for (uint32_t i = 0; i < header.levelCount; i++)
+    {
+      GiTextureLevel& level = texture.levels[i];
+      level.width = _GetLevelExtent(header.width, i);
+      level.height = _GetLevelExtent(header.height, i);
+      level.data.resize(ImgioGetBlockCompressedSize(blockFormat, level.width, level.height));
+
+      if (!stream.read((char*) level.data.data(), level.data.size()))
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  void _WriteCacheFile(const fs::path& path, const GiDecodedTexture& texture)
+  {
+    std::error_code errorCode;
+    fs::create_directories(path.parent_path(), errorCode);
+
+    // Write to a temporary file first so that concurrent readers never see partial data.
+    fs::path tmpPath = path;
+    tmpPath += GB_FMT(".{}.tmp", std::hash<std::thread::id>{}(std::this_thread::get_id()));
+
+    {
+      std::ofstream stream(tmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+      if (!stream.is_open())
+      {
+        GB_WARN("unable to write texture cache file {}", tmpPath.string());
+        return;
+      }
+
+      _BcCacheHeader header = {
+        .magic = BC_CACHE_MAGIC,
+        .version = BC_CACHE_VERSION,
+        .blockFormat = uint32_t(*texture.blockFormat),
+        .width = texture.levels[0].width,
+        .height = texture.levels[0].height,
+        .levelCount = uint32_t(texture.levels.size())
+      };
+      stream.write((const char*) &header, sizeof(header));
+
+      for (const GiTextureLevel& level : texture.levels)
+      {
+        stream.write((const char*) level.data.data(), level.data.size());
+      }
+
+      if (!stream.good())
+      {
+        stream.close();
+        fs::remove(tmpPath, errorCode);
+        return;
+      }
+    }
+
+    fs::rename(tmpPath, path, errorCode);
+    if (errorCode)
+    {
+      fs::remove(tmpPath, errorCode);
+    }
+  }
+
+  void _AppendLevel(GiDecodedTexture& texture, ImgioImage& image, std::optional<ImgioBlockFormat> blockFormat)
+  {
+    GiTextureLevel& level = texture.levels.emplace_back();
+    level.width = image.width;
+    level.height = image.height;
+
+    if (blockFormat)
+    {
+      ImgioEncodeBlocks(image, *blockFormat, level.data);
+    }
+    else
+    {
+      level.data = std::move(image.data);
+      level.data.resize(image.size);
+    }
+  }
+
+  void _ProcessImage(ImgioImage& image, const GiTextureDecodeParams& params, GiDecodedTexture& texture)
+  {
+    // By MDL's default gamma rule, 8-bit images are sRGB-encoded and wider formats are linear.
+    // Filtering happens in linear space either way.
+    bool isHdr = _IsHdrFormat(image.format);
+    bool isSrgb = image.format == ImgioFormat::RGBA8_UNORM && params.usage == GiTextureUsage::Color;
+
+    bool compress = params.compress && !params.is3dImage;
+
+    texture.format = image.format;
+    texture.blockFormat = compress ? std::make_optional(_GetBlockFormat(isHdr, params.usage)) : std::nullopt;
+
+    std::vector<ImgioImage> mipLevels;
+    if (!params.is3dImage)
+    {
+      ImgioGenerateMipChain(image, isHdr ? MIP_FILTER_HDR : MIP_FILTER, isSrgb, mipLevels);
+    }
+
+    texture.levels.reserve(mipLevels.size() + 1);
+
+    _AppendLevel(texture, image, texture.blockFormat);
+
+    for (ImgioImage& level : mipLevels)
+    {
+      _AppendLevel(texture, level, texture.blockFormat);
+    }
+  }
+}
+
+namespace gtl
+{
+  std::string giCanonicalizeTexturePath(const char* filePath)
+  {
+    fs::path path(filePath);
+
+    std::error_code errorCode;
+    fs::path canonicalPath = fs::weakly_canonical(path, errorCode);
+
+    return (errorCode ? path.lexically_normal() : canonicalPath).string();
+  }
+
+  uint64_t giHashTextureContent(const void* data, size_t size)
+  {
+    const uint8_t* bytes = (const uint8_t*) data;
+
+    // Processes 8 bytes per multiplication; unlike FNV-1a, fast enough to not show up next to decoding.
+    uint64_t hash = 0xcbf29ce484222325ull ^ (uint64_t(size) * 0x9e3779b97f4a7c15ull);
+
+    auto mix = [&hash](uint64_t word)
+    {
+      hash ^= word;
+      hash *= 0x9e3779b97f4a7c15ull;
+      hash ^= hash >> 32;
+    };
+
+    size_t offset = 0;
+    for (; offset + sizeof(uint64_t) <= size; offset += sizeof(uint64_t))
+    {
+      uint64_t word;
+      memcpy(&word, &bytes[offset], sizeof(word));
+      mix(word);
+    }
+
+    if (offset < size)
+    {
+      uint64_t word = 0;
+      memcpy(&word, &bytes[offset], size - offset);
+      mix(word);
+    }
+
+    // MurmurHash3 finalizer
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+  }
+
+  bool giDecodeTexture(GiAssetReader& assetReader,
+                       const char* filePath,
+                       const GiTextureDecodeParams& params,
+                       GiDecodedTexture& texture,
+                       const std::function<bool(uint64_t contentHash)>& skipFunc)
+  {
+    GiAsset* asset = assetReader.open(filePath);
+    if (!asset)
+    {
+      return false;
+    }
+
+    size_t size = assetReader.size(asset);
+    void* data = assetReader.data(asset);
+    if (!data)
+    {
+      assetReader.close(asset);
+      return false;
+    }
+
+    texture.contentHash = giHashTextureContent(data, size);
+    texture.levels.clear();
+
+    if (skipFunc && skipFunc(texture.contentHash))
+    {
+      assetReader.close(asset);
+      return true;
+    }
+
+    bool compress = params.compress && !params.is3dImage;
+
+    // Cache entries are keyed by content so that edited files are re-encoded.
+    fs::path cacheFilePath;
+    if (compress && !params.diskCachePath.empty())
+    {
+      cacheFilePath = fs::path(params.diskCachePath) / GB_FMT("{:016x}-{}.bc", texture.contentHash, int(params.usage));
+    }
+
+    bool cacheHit = !cacheFilePath.empty() && _ReadCacheFile(cacheFilePath, texture);
+    if (!cacheHit)
+    {
+      texture.levels.clear(); // may be partially read
+    }
+
+    ImgioImage image;
+    bool loadResult = cacheHit || ImgioLoadImage(data, size, &image) == ImgioError::None;
+
+    assetReader.close(asset);
+
+    if (!loadResult)
+    {
+      return false;
+    }
+
+    if (cacheHit)
+    {
+      GB_LOG("read compressed image \"{}\" from cache", filePath);
+      return true;
+    }
+
+    GB_LOG("read image \"{}\" ({:.2f} MiB)", filePath, image.size * BYTES_TO_MIB);
+
+    _ProcessImage(image, params, texture);
+
+    if (!cacheFilePath.empty())
+    {
+      _WriteCacheFile(cacheFilePath, texture);
+    }
+
+    return true;
+  }
+
+  uint64_t giGetDecodedTextureSize(const GiDecodedTexture& texture)
+  {
+    uint64_t size = 0;
+    for (const GiTextureLevel& level : texture.levels)
+    {
+      size += level.data.size();
+    }
+    return size;
+  }
+
+  void giRunTexturePipeline(size_t count,
+                            uint64_t maxInFlightBytes,
+                            const std::function<uint64_t(size_t index)>& decodeFunc,
+                            const std::function<void(size_t index)>& consumeFunc)
+  {
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<size_t> decodedIndices; // decoded but not consumed
+    std::vector<uint64_t> decodedSizes(count);
+    uint64_t inFlightBytes = 0;
+    size_t nextIndex = 0;
+    size_t consumedCount = 0;
+
+    auto decode = [&](std::unique_lock<std::mutex>& lock)
+    {
+      size_t index = nextIndex++;
+
+      lock.unlock();
+      uint64_t size = decodeFunc(index);
+      lock.lock();
+
+      decodedSizes[index] = size;
+      inFlightBytes += size;
+      decodedIndices.push_back(index);
+      condition.notify_all();
+    };
+
+#pragma omp parallel
+    {
+#ifdef _OPENMP
+      bool isCallingThread = omp_get_thread_num() == 0;
+#else
+      bool isCallingThread = true;
+#endif
+
+      std::unique_lock lock(mutex);
+
+      if (isCallingThread)
+      {
+        // Consume results as they arrive; decode ourselves instead of idling.
+        while (consumedCount < count)
+        {
+          if (!decodedIndices.empty())
+          {
+            size_t index = decodedIndices.front();
+            decodedIndices.pop_front();
+
+            lock.unlock();
+            consumeFunc(index);
+            lock.lock();
+
+            inFlightBytes -= decodedSizes[index];
+            consumedCount++;
+            condition.notify_all();
+          }
+          else if (nextIndex < count)
+          {
+            decode(lock);
+          }
+          else
+          {
+            condition.wait(lock, [&]() { return !decodedIndices.empty(); });
+          }
+        }
+      }
+      else
+      {
+        while (true)
+        {
+          condition.wait(lock, [&]() { return nextIndex >= count || inFlightBytes < maxInFlightBytes; });
+
+          if (nextIndex >= count)
+          {
+            break;
+          }
+
+          decode(lock);
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,85 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <gtl/imgio/Image.h>
+#include <gtl/imgio/BlockCompression.h>
+
+#include "TextureUsage.h"
+
+namespace gtl
+{
+  class GiAssetReader;
+
+  struct GiTextureLevel
+  {
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> data;
+  };
+
+  // CPU-side result of loading a file texture, ready to be staged level by level.
+  struct GiDecodedTexture
+  {
+    uint64_t contentHash; // of the file, computed while it is mapped
+    ImgioFormat format; // of uncompressed levels
+    std::optional<ImgioBlockFormat> blockFormat; // set if block-compressed
+    std::vector<GiTextureLevel> levels;
+  };
+
+  struct GiTextureDecodeParams
+  {
+    bool is3dImage = false; // 3D images have no mip chain and are never compressed
+    bool compress = false;
+    GiTextureUsage usage = GiTextureUsage::Color;
+    std::string_view diskCachePath; // for compressed textures; empty to disable the disk cache
+  };
+
+  // Resolves relative components and symlinks of files on disk, so that different references to the
+  // same file compare equal. Other paths (e.g. into packages) are only normalized lexically.
+  std::string giCanonicalizeTexturePath(const char* filePath);
+
+  uint64_t giHashTextureContent(const void* data, size_t size);
+
+  // Reads, decodes and mipmaps (or block-compresses) a texture. Safe to call concurrently if the
+  // asset reader is. If 'skipFunc' returns true for the content hash, decoding is skipped and the
+  // texture has no levels.
+  bool giDecodeTexture(GiAssetReader& assetReader,
+                       const char* filePath,
+                       const GiTextureDecodeParams& params,
+                       GiDecodedTexture& texture,
+                       const std::function<bool(uint64_t contentHash)>& skipFunc = nullptr);
+
+  uint64_t giGetDecodedTextureSize(const GiDecodedTexture& texture);
+
+  // Runs 'decodeFunc' for all indices on worker threads and 'consumeFunc' on the calling thread in
+  // order of completion, so that decoding overlaps consumption (e.g. uploads). 'decodeFunc' returns
+  // the size of its result; workers stall while more than 'maxInFlightBytes' have been decoded but
+  // not consumed. Without OpenMP, textures are decoded and consumed one after another.
+  void giRunTexturePipeline(size_t count,
+                            uint64_t maxInFlightBytes,
+                            const std::function<uint64_t(size_t index)>& decodeFunc,
+                            const std::function<void(size_t index)>& consumeFunc);
+}
@@ -19,93 +19,155 @@
 #include "Gi.h"
 
 #include <gtl/mc/Backend.h>
+#include <gtl/gb/Fmt.h>
 #include <gtl/gb/Log.h>
 #include <gtl/ggpu/Stager.h>
-#include <gtl/imgio/Imgio.h>
 
 #include <assert.h>
 #include <string.h>
 #include <inttypes.h>
 
+#include <mutex>
+#include <unordered_set>
+
 namespace
 {
   using namespace gtl;
 
   constexpr static const float BYTES_TO_MIB = 1.0f / (1024.0f * 1024.0f);
+  constexpr static const uint32_t BC_BLOCK_HEIGHT = 4;
+  // Decoded textures waiting for upload; bounds memory if decoding outpaces staging.
+  constexpr static const uint64_t MAX_IN_FLIGHT_BYTES = 256 * 1024 * 1024;
 
-  bool _ReadImage(const char* filePath, GiAssetReader& assetReader, ImgioImage* img)
+  CgpuImageFormat _GetImageFormat(ImgioFormat format)
   {
-    GiAsset* asset = assetReader.open(filePath);
-    if (!asset)
+    switch (format)
     {
-      return false;
+    case ImgioFormat::RGBA16_UNORM: return CGPU_IMAGE_FORMAT_R16G16B16A16_UNORM;
+    case ImgioFormat::RGBA16_FLOAT: return CGPU_IMAGE_FORMAT_R16G16B16A16_SFLOAT;
+    case ImgioFormat::RGBA32_FLOAT: return CGPU_IMAGE_FORMAT_R32G32B32A32_SFLOAT;
+    default: return CGPU_IMAGE_FORMAT_R8G8B8A8_UNORM;
     }
+  }
 
-    size_t size = assetReader.size(asset);
-    void* data = assetReader.data(asset);
-
-    bool loadResult = data && ImgioLoadImage(data, size, img) == ImgioError::None;
+  // Keys of BSDF lookup tables are content hashes, which may collide.
+  bool _BsdfDataMatches(const McTextureDescription& a, const McTextureDescription& b)
+  {
+    return a.is3dImage == b.is3dImage &&
+           a.isFloat == b.isFloat &&
+           a.width == b.width &&
+           a.height == b.height &&
+           a.depth == b.depth &&
+           a.data == b.data;
+  }
 
-    assetReader.close(asset);
-    return loadResult;
+  CgpuImageFormat _GetBlockImageFormat(ImgioBlockFormat format)
+  {
+    switch (format)
+    {
+    case ImgioBlockFormat::BC1: return CGPU_IMAGE_FORMAT_BC1_RGBA_UNORM_BLOCK;
+    case ImgioBlockFormat::BC4: return CGPU_IMAGE_FORMAT_BC4_UNORM_BLOCK;
+    case ImgioBlockFormat::BC5: return CGPU_IMAGE_FORMAT_BC5_UNORM_BLOCK;
+    case ImgioBlockFormat::BC6H: return CGPU_IMAGE_FORMAT_BC6H_UFLOAT_BLOCK;
+    default: return CGPU_IMAGE_FORMAT_BC7_UNORM_BLOCK;
+    }
   }
+
+  struct _ImageSlot
+  {
+    std::vector<CgpuImage>* images;
+    size_t index;
+  };
+
+  // A file texture that is not cached under its path yet. Descriptions referencing the same file
+  // share one job.
+  struct _FileTextureJob
+  {
+    const char* filePath;
+    std::string pathKey;
+    GiTextureDecodeParams decodeParams;
+    std::vector<_ImageSlot> slots;
+    bool decodeResult = false;
+    bool deferred = false; // content is provided by another image
+  };
 }
 
 namespace gtl
 {
-  GiTextureManager::GiTextureManager(CgpuDevice device, GiAssetReader& assetReader, GgpuStager& stager)
+  GiTextureManager::GiTextureManager(CgpuDevice device,
+                                     GiAssetReader& assetReader,
+                                     GgpuStager& stager,
+                                     bool compressTextures,
+                                     std::string_view diskCachePath)
     : m_device(device)
     , m_assetReader(assetReader)
     , m_stager(stager)
+    , m_compressTextures(compressTextures)
+    , m_diskCachePath(diskCachePath)
+    , m_imageCache(0, [device](uint64_t handle) { cgpuDestroyImage(device, CgpuImage{ .handle = handle }); })
   {
   }
 
   GiTextureManager::~GiTextureManager()
   {
-    assert(m_imageCache.empty());
+    assert(m_bsdfDataCache.empty());
   }
 
   void GiTextureManager::destroy()
   {
-    for (const auto& pathImagePair : m_imageCache)
+    m_imageCache.clear();
+
+    for (const auto& [key, entry] : m_bsdfDataCache)
     {
-      cgpuDestroyImage(m_device, pathImagePair.second);
+      cgpuDestroyImage(m_device, entry.image);
     }
-    m_imageCache.clear();
+    m_bsdfDataCache.clear();
   }
 
-  bool GiTextureManager::loadTextureFromFilePath(const char* filePath, CgpuImage& image, bool is3dImage, bool flushImmediately)
+  bool GiTextureManager::loadTextureFromFilePath(const char* filePath,
+                                                 CgpuImage& image,
+                                                 bool is3dImage,
+                                                 bool flushImmediately,
+                                                 GiTextureUsage usage)
   {
-    auto cacheResult = m_imageCache.find(filePath);
-    if (cacheResult != m_imageCache.end())
+    GiTextureDecodeParams decodeParams = getDecodeParams(is3dImage, usage);
+    std::string pathKey = getPathKey(filePath, decodeParams);
+
+    uint64_t cachedHandle = m_imageCache.acquire(pathKey);
+    if (cachedHandle != 0)
     {
-      image = cacheResult->second;
+      image.handle = cachedHandle;
       return true;
     }
 
-    ImgioImage imageData;
-    if (!_ReadImage(filePath, m_assetReader, &imageData))
+    // Byte-identical files share an image, so only decode if the content is not cached yet.
+    auto skipFunc = [&](uint64_t contentHash)
+    {
+      return m_imageCache.containsKey(getContentKey(contentHash, decodeParams));
+    };
+
+    GiDecodedTexture texture;
+    if (!giDecodeTexture(m_assetReader, filePath, decodeParams, texture, skipFunc))
     {
       return false;
     }
 
-    GB_LOG("read image \"{}\" ({:.2f} MiB)", filePath, imageData.size * BYTES_TO_MIB);
+    std::string contentKey = getContentKey(texture.contentHash, decodeParams);
 
-    CgpuImageCreateInfo createInfo = {
-      .width = imageData.width,
-      .height = imageData.height,
-      .is3d = is3dImage,
-      .debugName = filePath
-    };
-    bool creationSuccessful = cgpuCreateImage(m_device, createInfo, &image) &&
-                              m_stager.stageToImage(&imageData.data[0], imageData.size, image, imageData.width, imageData.height, 1);
+    if (texture.levels.empty())
+    {
+      image.handle = m_imageCache.acquire(contentKey);
+      m_imageCache.addKey(pathKey, image.handle);
+      return true;
+    }
 
-    if (!creationSuccessful)
+    if (!uploadTexture(filePath, texture, is3dImage, image))
     {
       return false;
     }
 
-    m_imageCache[filePath] = image;
+    m_imageCache.insert(contentKey, image.handle, giGetDecodedTextureSize(texture));
+    m_imageCache.addKey(pathKey, image.handle);
 
     if (flushImmediately)
     {
@@ -115,131 +177,352 @@ namespace gtl
     return true;
   }
 
-  bool GiTextureManager::loadTextureDescriptions(const std::vector<McTextureDescription>& textureDescriptions,
-                                                 std::vector<CgpuImage>& images2d,
-                                                 std::vector<CgpuImage>& images3d)
+  bool GiTextureManager::loadTextureDescriptions(const std::vector<GiTextureLoadRequest>& requests)
   {
-    size_t texCount = textureDescriptions.size();
+    std::vector<_FileTextureJob> jobs;
+    std::unordered_map<std::string, size_t> jobIndices;
 
-    if (texCount == 0)
+    // Cached images and binary payloads are resolved right away; file textures are collected
+    // so that they can be decoded in parallel.
+    for (const GiTextureLoadRequest& request : requests)
     {
+      const std::vector<McTextureDescription>& textureDescriptions = request.textureDescriptions;
+      const std::vector<GiTextureUsage>& textureUsages = request.textureUsages;
+
+      size_t texCount = textureDescriptions.size();
+
+      request.images2d.reserve(texCount);
+      request.images3d.reserve(texCount);
+
+      for (size_t i = 0; i < texCount; i++)
+      {
+        const McTextureDescription& textureResource = textureDescriptions[i];
+
+        std::vector<CgpuImage>& imageVector = textureResource.is3dImage ? request.images3d : request.images2d;
+
+        const char* filePath = textureResource.filePath.c_str();
+        if (strcmp(filePath, "") == 0)
+        {
+          CgpuImage image;
+          if (!loadPayloadTexture(textureResource, i, image))
+          {
+            return false;
+          }
+
+          if (image.handle)
+          {
+            imageVector.push_back(image);
+          }
+          continue;
+        }
+
+        GiTextureUsage usage = i < textureUsages.size() ? textureUsages[i] : GiTextureUsage::Color;
+
+        GiTextureDecodeParams decodeParams = getDecodeParams(textureResource.is3dImage, usage);
+        std::string pathKey = getPathKey(filePath, decodeParams);
+
+        uint64_t cachedHandle = m_imageCache.acquire(pathKey);
+        if (cachedHandle != 0)
+        {
+          imageVector.push_back(CgpuImage{ .handle = cachedHandle });
+          continue;
+        }
+
+        auto [jobIt, inserted] = jobIndices.try_emplace(pathKey, jobs.size());
+        if (inserted)
+        {
+          jobs.push_back(_FileTextureJob{
+            .filePath = filePath,
+            .pathKey = std::move(pathKey),
+            .decodeParams = decodeParams
+          });
+        }
+
+        jobs[jobIt->second].slots.push_back(_ImageSlot{ .images = &imageVector, .index = imageVector.size() });
+        imageVector.push_back(CgpuImage{}); // set once decoded
+      }
+    }
+
+    if (jobs.empty())
+    {
+      m_stager.flush();
       return true;
     }
 
-    GB_LOG("staging {} images", texCount);
+    GB_LOG("loading {} images", jobs.size());
 
-    images2d.reserve(texCount);
-    images3d.reserve(texCount);
+    std::vector<GiDecodedTexture> decodedTextures(jobs.size());
+    bool uploadFailed = false;
 
-    bool result;
+    // Guards the image cache, which workers query while the calling thread inserts uploaded images.
+    std::mutex cacheMutex;
+    // Content claimed by a job of this batch; other jobs with the same content wait for its upload.
+    std::unordered_set<std::string> claimedContentKeys;
 
-    for (size_t i = 0; i < texCount; i++)
+    auto decodeFunc = [&](size_t i) -> uint64_t
     {
-      fflush(stdout);
-      CgpuImage image;
+      _FileTextureJob& job = jobs[i];
 
-      auto& textureResource = textureDescriptions[i];
-      auto& payload = textureResource.data;
+      auto skipFunc = [&](uint64_t contentHash)
+      {
+        std::string contentKey = getContentKey(contentHash, job.decodeParams);
 
-      CgpuImageCreateInfo createInfo;
-      createInfo.is3d = textureResource.is3dImage;
-      createInfo.format = textureResource.isFloat ? CGPU_IMAGE_FORMAT_R32_SFLOAT : CGPU_IMAGE_FORMAT_R8G8B8A8_UNORM;
-      createInfo.usage = CGPU_IMAGE_USAGE_FLAG_SAMPLED | CGPU_IMAGE_USAGE_FLAG_TRANSFER_DST;
+        std::lock_guard lock(cacheMutex);
+        return m_imageCache.containsKey(contentKey) || !claimedContentKeys.insert(contentKey).second;
+      };
 
-      auto& imageVector = createInfo.is3d ? images3d : images2d;
+      GiDecodedTexture& texture = decodedTextures[i];
+      job.decodeResult = giDecodeTexture(m_assetReader, job.filePath, job.decodeParams, texture, skipFunc);
+      job.deferred = job.decodeResult && texture.levels.empty();
+      return giGetDecodedTextureSize(texture);
+    };
+
+    auto uploadFunc = [&](size_t i)
+    {
+      const _FileTextureJob& job = jobs[i];
+      GiDecodedTexture texture = std::move(decodedTextures[i]);
+
+      if (uploadFailed || job.deferred)
+      {
+        return;
+      }
 
-      const char* filePath = textureResource.filePath.c_str();
-      if (strcmp(filePath, "") == 0)
+      CgpuImage image;
+      if (!job.decodeResult)
       {
-        uint64_t payloadSize = payload.size();
-        if (payloadSize == 0)
+        GB_ERROR("failed to read image from path {}", job.filePath);
+
+        for (const _ImageSlot& slot : job.slots)
         {
-          GB_ERROR("image {} has no payload", i);
-          continue;
+          if (!createFallbackImage(job.decodeParams.is3dImage, image))
+          {
+            uploadFailed = true;
+            return;
+          }
+          (*slot.images)[slot.index] = image;
         }
+        return;
+      }
 
-        GB_LOG("image {} has binary payload of {:.2f} MiB", i, payloadSize * BYTES_TO_MIB);
+      if (!uploadTexture(job.filePath, texture, job.decodeParams.is3dImage, image))
+      {
+        uploadFailed = true;
+        return;
+      }
+
+      std::lock_guard lock(cacheMutex);
 
-        createInfo.width = textureResource.width;
-        createInfo.height = textureResource.height;
-        createInfo.depth = textureResource.depth;
+      m_imageCache.insert(getContentKey(texture.contentHash, job.decodeParams), image.handle, giGetDecodedTextureSize(texture));
+      m_imageCache.addKey(job.pathKey, image.handle);
 
-        if (!cgpuCreateImage(m_device, createInfo, &image))
-          return false;
+      for (size_t s = 0; s < job.slots.size(); s++)
+      {
+        const _ImageSlot& slot = job.slots[s];
+        (*slot.images)[slot.index].handle = (s == 0) ? image.handle : m_imageCache.acquire(job.pathKey);
+      }
+    };
 
-        result = m_stager.stageToImage(payload.data(), payloadSize, image, createInfo.width, createInfo.height, createInfo.depth);
-        if (!result) return false;
+    giRunTexturePipeline(jobs.size(), MAX_IN_FLIGHT_BYTES, decodeFunc, uploadFunc);
 
-        imageVector.push_back(image);
+    // Jobs with duplicate content share the image uploaded for another path. If that image is gone
+    // (failed to upload or evicted meanwhile), the texture is loaded again.
+    for (size_t i = 0; i < jobs.size() && !uploadFailed; i++)
+    {
+      const _FileTextureJob& job = jobs[i];
+      if (!job.deferred)
+      {
         continue;
       }
 
-      if (loadTextureFromFilePath(filePath, image, textureResource.is3dImage, false))
+      for (const _ImageSlot& slot : job.slots)
       {
-        imageVector.push_back(image);
-        continue;
+        CgpuImage& image = (*slot.images)[slot.index];
+
+        if (!loadTextureFromFilePath(job.filePath, image, job.decodeParams.is3dImage, false, job.decodeParams.usage) &&
+            !createFallbackImage(job.decodeParams.is3dImage, image))
+        {
+          uploadFailed = true;
+          break;
+        }
       }
+    }
+
+    m_stager.flush();
 
-      GB_ERROR("failed to read image {} from path {}", i, filePath);
-      createInfo.width = 1;
-      createInfo.height = 1;
-      createInfo.depth = 1;
+    return !uploadFailed;
+  }
 
-      if (!cgpuCreateImage(m_device, createInfo, &image))
-        return false;
+  GiTextureDecodeParams GiTextureManager::getDecodeParams(bool is3dImage, GiTextureUsage usage) const
+  {
+    return GiTextureDecodeParams{
+      .is3dImage = is3dImage,
+      .compress = m_compressTextures && !is3dImage,
+      .usage = usage,
+      .diskCachePath = m_diskCachePath
+    };
+  }
+
+  std::string GiTextureManager::getPathKey(const char* filePath, const GiTextureDecodeParams& decodeParams) const
+  {
+    return GB_FMT("{}#{}", giCanonicalizeTexturePath(filePath), getKeySuffix(decodeParams));
+  }
 
-      uint8_t black[4] = { 0, 0, 0, 0 };
-      result = m_stager.stageToImage(black, 4, image, 1, 1, 1);
-      if (!result) return false;
+  std::string GiTextureManager::getContentKey(uint64_t contentHash, const GiTextureDecodeParams& decodeParams) const
+  {
+    return GB_FMT("{:016x}#{}", contentHash, getKeySuffix(decodeParams));
+  }
+
+  std::string GiTextureManager::getKeySuffix(const GiTextureDecodeParams& decodeParams) const
+  {
+    // The same file is filtered and encoded differently depending on how it is sampled.
+    return GB_FMT("{}{}{}", int(decodeParams.usage), decodeParams.compress ? "c" : "", decodeParams.is3dImage ? "3" : "");
+  }
+
+  bool GiTextureManager::uploadTexture(const char* filePath, const GiDecodedTexture& texture, bool is3dImage, CgpuImage& image)
+  {
+    const GiTextureLevel& baseLevel = texture.levels[0];
 
-      imageVector.push_back(image);
+    CgpuImageCreateInfo createInfo = {
+      .width = baseLevel.width,
+      .height = baseLevel.height,
+      .is3d = is3dImage,
+      .mipLevelCount = uint32_t(texture.levels.size()),
+      .format = texture.blockFormat ? _GetBlockImageFormat(*texture.blockFormat) : _GetImageFormat(texture.format),
+      .debugName = filePath
+    };
+    if (!cgpuCreateImage(m_device, createInfo, &image))
+    {
+      return false;
     }
 
-    m_stager.flush();
+    uint32_t blockHeight = texture.blockFormat ? BC_BLOCK_HEIGHT : 1;
+
+    for (uint32_t i = 0; i < texture.levels.size(); i++)
+    {
+      const GiTextureLevel& level = texture.levels[i];
+
+      if (!m_stager.stageToImage(level.data.data(), level.data.size(), image, level.width, level.height, 1, i, blockHeight))
+      {
+        cgpuDestroyImage(m_device, image);
+        return false;
+      }
+    }
 
     return true;
   }
 
-  void GiTextureManager::destroyUncachedImages(const std::vector<CgpuImage>& images)
+  bool GiTextureManager::loadPayloadTexture(const McTextureDescription& textureResource, size_t index, CgpuImage& image)
   {
-    for (CgpuImage image : images)
+    image.handle = 0;
+
+    const auto& payload = textureResource.data;
+
+    uint64_t payloadSize = payload.size();
+    if (payloadSize == 0)
     {
-      bool isCached = false;
+      GB_ERROR("image {} has no payload", index);
+      return true;
+    }
 
-      for (const auto& pathImagePair : m_imageCache)
-      {
-        CgpuImage cachedImage = pathImagePair.second;
+    uint64_t bsdfDataKey = textureResource.bsdfDataKey;
+    if (bsdfDataKey != 0)
+    {
+      auto [begin, end] = m_bsdfDataCache.equal_range(bsdfDataKey);
 
-        if (cachedImage.handle == image.handle)
+      for (auto it = begin; it != end; ++it)
+      {
+        if (_BsdfDataMatches(it->second.description, textureResource))
         {
-          isCached = true;
-          break;
+          image = it->second.image;
+          return true;
         }
       }
+    }
 
-      if (!isCached)
-      {
-        cgpuDestroyImage(m_device, image);
-      }
+    GB_LOG("image {} has binary payload of {:.2f} MiB", index, payloadSize * BYTES_TO_MIB);
+
+    CgpuImageCreateInfo createInfo = {
+      .width = textureResource.width,
+      .height = textureResource.height,
+      .is3d = textureResource.is3dImage,
+      .depth = textureResource.depth,
+      .format = textureResource.isFloat ? CGPU_IMAGE_FORMAT_R32_SFLOAT : CGPU_IMAGE_FORMAT_R8G8B8A8_UNORM
+    };
+    if (!cgpuCreateImage(m_device, createInfo, &image))
+    {
+      return false;
+    }
+
+    if (!m_stager.stageToImage(payload.data(), payloadSize, image, createInfo.width, createInfo.height, createInfo.depth))
+    {
+      return false;
     }
+
+    m_payloadUploadCount++;
+
+    if (bsdfDataKey != 0)
+    {
+      m_bsdfDataCache.emplace(bsdfDataKey, BsdfDataEntry{ textureResource, image });
+    }
+
+    return true;
   }
 
-  void GiTextureManager::evictAndDestroyCachedImage(CgpuImage image)
+  bool GiTextureManager::createFallbackImage(bool is3dImage, CgpuImage& image)
   {
-    for (auto it = m_imageCache.begin(); it != m_imageCache.end(); it++)
+    CgpuImageCreateInfo createInfo = {
+      .width = 1,
+      .height = 1,
+      .is3d = is3dImage
+    };
+    if (!cgpuCreateImage(m_device, createInfo, &image))
     {
-      if (it->second.handle != image.handle)
-      {
-        continue;
-      }
+      return false;
+    }
 
-      m_imageCache.erase(it);
+    uint8_t black[4] = { 0, 0, 0, 0 };
+    return m_stager.stageToImage(black, 4, image, 1, 1, 1);
+  }
 
-      cgpuDestroyImage(m_device, image);
+  void GiTextureManager::releaseImages(const std::vector<CgpuImage>& images)
+  {
+    for (CgpuImage image : images)
+    {
+      releaseImage(image);
+    }
+  }
 
+  void GiTextureManager::releaseImage(CgpuImage image)
+  {
+    // Handles are unset if loading was aborted.
+    if (!image.handle || m_imageCache.release(image.handle))
+    {
       return;
     }
 
-    assert(false);
+    for (const auto& [key, entry] : m_bsdfDataCache)
+    {
+      if (entry.image.handle == image.handle)
+      {
+        return;
+      }
+    }
+
+    cgpuDestroyImage(m_device, image);
+  }
+
+  void GiTextureManager::setMemoryBudget(uint64_t budgetBytes)
+  {
+    m_imageCache.setBudget(budgetBytes);
+  }
+
+  const GiTextureCacheStats& GiTextureManager::getCacheStats() const
+  {
+    return m_imageCache.stats();
+  }
+
+  uint32_t GiTextureManager::getPayloadUploadCount() const
+  {
+    return m_payloadUploadCount;
   }
 }
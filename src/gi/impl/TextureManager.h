@@ -19,44 +19,102 @@
 
 #include <unordered_map>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <gtl/cgpu/Cgpu.h>
 #include <gtl/mc/Backend.h>
 
+#include "TextureCache.h"
+#include "TextureLoader.h"
+#include "TextureUsage.h"
+
 namespace gtl
 {
   class GgpuStager;
   class GiAssetReader;
 
+  struct GiTextureLoadRequest
+  {
+    const std::vector<gtl::McTextureDescription>& textureDescriptions;
+    const std::vector<GiTextureUsage>& textureUsages; // empty or parallel to 'textureDescriptions'
+    std::vector<CgpuImage>& images2d;
+    std::vector<CgpuImage>& images3d;
+  };
+
   class GiTextureManager
   {
   public:
-    GiTextureManager(CgpuDevice device, GiAssetReader& assetReader, gtl::GgpuStager& stager);
+    // If 'compressTextures' is set, 2D file textures are block-compressed on the CPU according to their
+    // usage. Encoded mip chains are cached in 'diskCachePath' unless it is empty.
+    GiTextureManager(CgpuDevice device,
+                     GiAssetReader& assetReader,
+                     gtl::GgpuStager& stager,
+                     bool compressTextures = false,
+                     std::string_view diskCachePath = {});
 
     ~GiTextureManager();
 
     void destroy();
 
   public:
+    // Images loaded from files are reference-counted; every successful load must be paired with a release.
     bool loadTextureFromFilePath(const char* filePath,
                                  CgpuImage& image,
                                  bool is3dImage = false,
-                                 bool flushImmediately = true);
+                                 bool flushImmediately = true,
+                                 GiTextureUsage usage = GiTextureUsage::Color);
+
+    // File textures of all requests are decoded on worker threads and uploaded as they complete.
+    // On failure, images that could not be loaded have unset handles.
+    bool loadTextureDescriptions(const std::vector<GiTextureLoadRequest>& requests);
+
+    // Releases file images and destroys all others (e.g. binary payloads).
+    void releaseImages(const std::vector<CgpuImage>& images);
+
+    void releaseImage(CgpuImage image);
+
+    // Unreferenced images are evicted once the budget is exceeded. Zero means unlimited.
+    void setMemoryBudget(uint64_t budgetBytes);
+
+    const GiTextureCacheStats& getCacheStats() const;
+
+    // Number of images uploaded from binary payloads (e.g. BSDF lookup tables).
+    uint32_t getPayloadUploadCount() const;
+
+  private:
+    GiTextureDecodeParams getDecodeParams(bool is3dImage, GiTextureUsage usage) const;
+
+    // Images are cached under their canonical path and under their content hash, so that different
+    // references to a file and byte-identical copies of it share one image.
+    std::string getPathKey(const char* filePath, const GiTextureDecodeParams& decodeParams) const;
+
+    std::string getContentKey(uint64_t contentHash, const GiTextureDecodeParams& decodeParams) const;
+
+    std::string getKeySuffix(const GiTextureDecodeParams& decodeParams) const;
 
-    bool loadTextureDescriptions(const std::vector<gtl::McTextureDescription>& textureDescriptions,
-                              std::vector<CgpuImage>& images2d,
-                              std::vector<CgpuImage>& images3d);
+    bool uploadTexture(const char* filePath, const GiDecodedTexture& texture, bool is3dImage, CgpuImage& image);
 
-    void destroyUncachedImages(const std::vector<CgpuImage>& images);
+    // Returns an unset handle if the description has no payload.
+    bool loadPayloadTexture(const gtl::McTextureDescription& textureResource, size_t index, CgpuImage& image);
 
-    void evictAndDestroyCachedImage(CgpuImage image);
+    bool createFallbackImage(bool is3dImage, CgpuImage& image);
 
   private:
     CgpuDevice m_device;
     GiAssetReader& m_assetReader;
     gtl::GgpuStager& m_stager;
-    // FIXME: implement a proper CPU and GPU-aware cache with eviction strategy
-    std::unordered_map<std::string, CgpuImage> m_imageCache;
+    bool m_compressTextures;
+    std::string m_diskCachePath;
+    GiTextureCache m_imageCache;
+    struct BsdfDataEntry
+    {
+      gtl::McTextureDescription description;
+      CgpuImage image;
+    };
+    // BSDF lookup tables are identical for most materials and are kept until destruction.
+    // Keys only select candidates; payloads are compared before an image is shared.
+    std::unordered_multimap<uint64_t, BsdfDataEntry> m_bsdfDataCache;
+    uint32_t m_payloadUploadCount = 0;
   };
 }
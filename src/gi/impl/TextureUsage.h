@@ -0,0 +1,29 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+namespace gtl
+{
+  // How a texture is read by shaders, which determines its block-compressed format.
+  enum class GiTextureUsage
+  {
+    Color,  // BC7, or BC6H for HDR images
+    Normal, // BC5; the Z component is reconstructed by the shader
+    Scalar  // BC4; only the red channel is read
+  };
+}
@@ -0,0 +1,1250 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#if defined (_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <MaterialXCore/Document.h>
+#include <MaterialXFormat/Util.h>
+
+#include <gtl/gb/Fmt.h>
+#include <gtl/gb/Log.h>
+#include <gtl/ggpu/Stager.h>
+
+#include "ArgBlockTable.h"
+#include "AssetReader.h"
+#include "GlslShaderCompiler.h"
+#include "GlslStitcher.h"
+#include "PreviewSurface.h"
+#include "ShaderDependencyGraph.h"
+#include "ShaderSourceCache.h"
+#include "SpirvOptimizer.h"
+#include "StageTimeline.h"
+#include "TextureCache.h"
+#include "TextureLoader.h"
+#include "TextureManager.h"
+
+#include "interface/rp_main.h"
+
+namespace mx = MaterialX;
+using namespace gtl;
+
+namespace
+{
+  const static int BENCHMARK_MATERIAL_COUNT = 1000;
+  const static int HIT_GROUP_CACHE_MATERIAL_COUNT = 8;
+  const static int BENCHMARK_TEXTURE_REPETITIONS = 64;
+  const static int BSDF_DATA_MATERIAL_COUNT = 16;
+
+  std::vector<uint8_t> _MakeBlock(uint32_t size, uint8_t seed)
+  {
+    std::vector<uint8_t> data(size);
+    for (uint32_t i = 0; i < size; i++)
+    {
+      data[i] = uint8_t(seed + i);
+    }
+    return data;
+  }
+
+  void _WriteFloat(std::vector<uint8_t>& data, uint32_t offset, float value)
+  {
+    memcpy(&data[offset], &value, sizeof(value));
+  }
+
+  float _ReadFloat(const std::vector<uint8_t>& data, uint32_t offset)
+  {
+    float value;
+    memcpy(&value, &data[offset], sizeof(value));
+    return value;
+  }
+
+  uint32_t _ReadUint(const std::vector<uint8_t>& data, uint32_t offset)
+  {
+    uint32_t value;
+    memcpy(&value, &data[offset], sizeof(value));
+    return value;
+  }
+
+  const char* SPIRV_TEST_SHADER = R"(#version 460 core
+layout(local_size_x = 64) in;
+layout(binding = 0, std430) buffer Data { float values[]; };
+
+float scale(float x, float s) { return x * s; }
+float offset(float x) { return x + 1.0; }
+
+void main()
+{
+  uint i = gl_GlobalInvocationID.x;
+  float unused = scale(values[i], 3.0);
+  values[i] = offset(scale(values[i], 2.0));
+}
+)";
+
+  const char* INCLUDE_TEST_SHADER = R"(#version 460 core
+#extension GL_GOOGLE_include_directive : require
+layout(local_size_x = 64) in;
+layout(binding = 0, std430) buffer Data { float values[]; };
+
+#include "scale.glsl"
+
+void main()
+{
+  uint i = gl_GlobalInvocationID.x;
+  values[i] = scale(values[i]);
+}
+)";
+
+  void _WriteTextFile(const fs::path& filePath, std::string_view text)
+  {
+    std::ofstream stream(filePath, std::ios::out | std::ios::trunc);
+    stream << text;
+  }
+
+  std::string _MakeDiffuseMdl(float r, float g, float b)
+  {
+    return GB_FMT("mdl 1.7;\n"
+                  "import ::df::*;\n"
+                  "export material test_material() = material(\n"
+                  "  surface: material_surface(\n"
+                  "    scattering: df::diffuse_reflection_bsdf(tint: color({}, {}, {}))\n"
+                  "  )\n"
+                  ");\n", r, g, b);
+  }
+
+  std::vector<uint8_t> _MakeSpirv(const std::vector<uint32_t>& words)
+  {
+    std::vector<uint8_t> spv(words.size() * sizeof(uint32_t));
+    memcpy(spv.data(), words.data(), spv.size());
+    return spv;
+  }
+
+  // Stand-in for MDL-generated code of a typical size.
+  std::string _MakeMdlGlsl()
+  {
+    std::string glsl;
+    for (int i = 0; i < 500; i++)
+    {
+      glsl += GB_FMT("float mdl_generated_func_{}(float x) {{ return x * {}.0; }}\n", i, i);
+    }
+    return glsl;
+  }
+
+  uint64_t _GetPeakRss()
+  {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return uint64_t(usage.ru_maxrss);
+#else
+    return uint64_t(usage.ru_maxrss) * 1024; // in KiB
+#endif
+#endif
+  }
+
+  void _WriteFile(const fs::path& path, std::string_view content)
+  {
+    std::ofstream stream(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    stream.write(content.data(), content.size());
+  }
+
+  // Hands out image handles and records their destruction in place of a GPU device.
+  struct _MockImageAllocator
+  {
+    uint64_t nextHandle = 1;
+    std::vector<uint64_t> destroyedHandles;
+
+    uint64_t allocate()
+    {
+      return nextHandle++;
+    }
+
+    GiTextureCache::DestroyFunc destroyFunc()
+    {
+      return [this](uint64_t handle) { destroyedHandles.push_back(handle); };
+    }
+  };
+}
+
+TEST_CASE("ArgBlockTable.Layout")
+{
+  GiArgBlockTable table;
+
+  std::vector<uint8_t> block0 = _MakeBlock(20, 1);
+  std::vector<uint8_t> block2 = _MakeBlock(7, 50);
+  std::vector<uint8_t> block3 = _MakeBlock(16, 100);
+
+  CHECK_EQ(table.addBlock(block0.data(), uint32_t(block0.size())), 0);
+  CHECK_EQ(table.addBlock(nullptr, 0), 1);
+  CHECK_EQ(table.addBlock(block2.data(), uint32_t(block2.size())), 2);
+  CHECK_EQ(table.addBlock(block3.data(), uint32_t(block3.size())), 3);
+
+  CHECK_EQ(table.blockCount(), 4);
+
+  CHECK_EQ(table.blockOffset(0), 0);
+  CHECK_EQ(table.blockOffset(1), 32);
+  CHECK_EQ(table.blockOffset(2), 32);
+  CHECK_EQ(table.blockOffset(3), 48);
+
+  CHECK_EQ(table.blockSize(0), 20);
+  CHECK_EQ(table.blockSize(1), 0);
+  CHECK_EQ(table.blockSize(2), 7);
+  CHECK_EQ(table.blockSize(3), 16);
+
+  const std::vector<uint8_t>& data = table.data();
+  REQUIRE_EQ(data.size(), 64);
+
+  CHECK_EQ(memcmp(&data[0], block0.data(), block0.size()), 0);
+  CHECK_EQ(memcmp(&data[32], block2.data(), block2.size()), 0);
+  CHECK_EQ(memcmp(&data[48], block3.data(), block3.size()), 0);
+
+  for (uint32_t i = 20; i < 32; i++)
+  {
+    CHECK_EQ(data[i], 0);
+  }
+  for (uint32_t i = 39; i < 48; i++)
+  {
+    CHECK_EQ(data[i], 0);
+  }
+}
+
+TEST_CASE("ArgBlockTable.UpdateUnchanged")
+{
+  GiArgBlockTable table;
+
+  std::vector<uint8_t> block = _MakeBlock(40, 7);
+  uint32_t blockIndex = table.addBlock(block.data(), uint32_t(block.size()));
+
+  std::vector<GiArgBlockTable::Range> dirtyRanges;
+  CHECK(table.updateBlock(blockIndex, block.data(), uint32_t(block.size()), dirtyRanges));
+  CHECK(dirtyRanges.empty());
+}
+
+TEST_CASE("ArgBlockTable.UpdateSingleValue")
+{
+  GiArgBlockTable table;
+
+  std::vector<uint8_t> block0 = _MakeBlock(24, 0);
+  std::vector<uint8_t> block1 = _MakeBlock(24, 0);
+  table.addBlock(block0.data(), uint32_t(block0.size()));
+  uint32_t blockIndex = table.addBlock(block1.data(), uint32_t(block1.size()));
+
+  _WriteFloat(block1, 8, 0.25f);
+
+  std::vector<GiArgBlockTable::Range> dirtyRanges;
+  REQUIRE(table.updateBlock(blockIndex, block1.data(), uint32_t(block1.size()), dirtyRanges));
+
+  REQUIRE_EQ(dirtyRanges.size(), 1);
+  CHECK_EQ(dirtyRanges[0].offset, 32 + 8);
+  CHECK_EQ(dirtyRanges[0].size, 4);
+
+  CHECK_EQ(memcmp(&table.data()[32], block1.data(), block1.size()), 0);
+}
+
+TEST_CASE("ArgBlockTable.UpdateMergesRanges")
+{
+  GiArgBlockTable table;
+
+  std::vector<uint8_t> block = _MakeBlock(512, 3);
+  uint32_t blockIndex = table.addBlock(block.data(), uint32_t(block.size()));
+
+  // Close to each other: one range.
+  _WriteFloat(block, 0, 1.0f);
+  _WriteFloat(block, 12, 2.0f);
+  // Far away: separate ranges.
+  _WriteFloat(block, 200, 3.0f);
+  _WriteFloat(block, 508, 4.0f);
+
+  std::vector<GiArgBlockTable::Range> dirtyRanges;
+  REQUIRE(table.updateBlock(blockIndex, block.data(), uint32_t(block.size()), dirtyRanges));
+
+  REQUIRE_EQ(dirtyRanges.size(), 3);
+  CHECK_EQ(dirtyRanges[0].offset, 0);
+  CHECK_EQ(dirtyRanges[0].size, 16);
+  CHECK_EQ(dirtyRanges[1].offset, 200);
+  CHECK_EQ(dirtyRanges[1].size, 4);
+  CHECK_EQ(dirtyRanges[2].offset, 508);
+  CHECK_EQ(dirtyRanges[2].size, 4);
+}
+
+TEST_CASE("ArgBlockTable.UpdateSizeMismatch")
+{
+  GiArgBlockTable table;
+
+  std::vector<uint8_t> block = _MakeBlock(16, 0);
+  uint32_t blockIndex = table.addBlock(block.data(), uint32_t(block.size()));
+
+  std::vector<uint8_t> biggerBlock = _MakeBlock(32, 1);
+
+  std::vector<GiArgBlockTable::Range> dirtyRanges;
+  CHECK_FALSE(table.updateBlock(blockIndex, biggerBlock.data(), uint32_t(biggerBlock.size()), dirtyRanges));
+  CHECK(dirtyRanges.empty());
+  CHECK_EQ(memcmp(table.data().data(), block.data(), block.size()), 0);
+}
+
+TEST_CASE("GlslStitcher.ReplaceFirst")
+{
+  GiShaderSourceCache sourceCache;
+  GiGlslStitcher stitcher(sourceCache);
+
+  stitcher.appendString("a\n#pragma placeholder\nb\n");
+  stitcher.appendDefine("X", 1);
+  stitcher.appendDefine("Y", 0.5f);
+
+  CHECK(stitcher.replaceFirst("#pragma placeholder", "replaced"));
+  CHECK_FALSE(stitcher.replaceFirst("#pragma placeholder", "replaced"));
+
+  CHECK_EQ(stitcher.source(), "a\nreplaced\nb\n#define X 1\n#define Y 0.500000000\n");
+}
+
+TEST_CASE("GlslStitcher.Benchmark")
+{
+  gbLogInit();
+
+  auto sourceCache = std::make_shared<GiShaderSourceCache>();
+  GiGlslShaderCompiler compiler(GI_SHADER_SOURCE_DIR, sourceCache, GiShaderOptimization::None);
+
+  fs::path closestHitPath = fs::path(GI_SHADER_SOURCE_DIR) / "rp_main.chit";
+  std::string mdlGlsl = _MakeMdlGlsl();
+
+  uint64_t copiedByteCount = 0;
+  uint64_t sourceByteCount = 0;
+
+  auto startTime = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < BENCHMARK_MATERIAL_COUNT; i++)
+  {
+    GiGlslStitcher stitcher(*sourceCache);
+    stitcher.appendVersion();
+    stitcher.appendDefine("TEXTURE_INDEX_OFFSET_2D", i);
+    stitcher.appendDefine("TEXTURE_INDEX_OFFSET_3D", 0);
+    stitcher.appendDefine("MEDIUM_DIRECTIONAL_BIAS", 0.0f);
+    stitcher.appendDefine("SCENE_DATA_COUNT", 0);
+    REQUIRE(stitcher.appendSourceFile(closestHitPath));
+    REQUIRE(stitcher.replaceFirst("#pragma mdl_generated_code", mdlGlsl));
+
+    std::string source = stitcher.source();
+
+    std::string preprocessedSource;
+    REQUIRE(compiler.preprocessGlsl(GiGlslShaderCompiler::ShaderStage::ClosestHit, source, preprocessedSource));
+
+    copiedByteCount += stitcher.copiedByteCount();
+    sourceByteCount += source.size();
+  }
+
+  std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - startTime;
+  MESSAGE("stitched and preprocessed ", BENCHMARK_MATERIAL_COUNT, " shaders in ", duration.count(), "ms");
+  MESSAGE("stitcher copied ", copiedByteCount, " bytes for ", sourceByteCount, " bytes of source");
+  MESSAGE("read ", sourceCache->fileReadCount(), " files from disk");
+
+  // Each source is copied once for the replacement and once for the final assembly.
+  CHECK_LE(copiedByteCount, sourceByteCount * 2);
+  // Includes are only read once, not per material.
+  CHECK_LT(sourceCache->fileReadCount(), 32);
+}
+
+TEST_CASE("PreviewSurface.Packing")
+{
+  namespace rp = shader_interface::rp_main;
+
+  GiPreviewSurfaceDesc desc;
+  desc.diffuseColor[1] = 0.5f;
+  desc.roughness = 0.25f;
+  desc.opacityThreshold = 0.5f;
+  desc.useSpecularWorkflow = true;
+
+  GiPreviewSurfaceTexture& diffuseTexture = desc.textures[size_t(GiPreviewSurfaceInput::DiffuseColor)];
+  diffuseTexture.filePath = "albedo.png";
+  diffuseTexture.sRgb = true;
+  diffuseTexture.scale[0] = 2.0f;
+
+  GiPreviewSurfaceTexture& roughnessTexture = desc.textures[size_t(GiPreviewSurfaceInput::Roughness)];
+  roughnessTexture.filePath = "orm.png";
+  roughnessTexture.channel = GiTextureChannel::G;
+  roughnessTexture.wrapS = GiTextureWrapMode::Mirror;
+  roughnessTexture.wrapT = GiTextureWrapMode::Black;
+
+  GiPreviewSurfaceTexture& metallicTexture = desc.textures[size_t(GiPreviewSurfaceInput::Metallic)];
+  metallicTexture.filePath = "orm.png";
+  metallicTexture.channel = GiTextureChannel::B;
+
+  std::vector<uint8_t> argBlock;
+  std::vector<std::string> texturePaths;
+  giPackPreviewSurface(desc, argBlock, texturePaths);
+
+  REQUIRE(argBlock.size() == rp::PREVIEW_SURFACE_ARG_BLOCK_SIZE);
+  CHECK(argBlock.size() == 512);
+
+  CHECK(_ReadFloat(argBlock, rp::PREVIEW_SURFACE_OFFSET_DIFFUSE_COLOR + 4) == 0.5f);
+  CHECK(_ReadFloat(argBlock, rp::PREVIEW_SURFACE_OFFSET_ROUGHNESS) == 0.25f);
+  CHECK(_ReadFloat(argBlock, rp::PREVIEW_SURFACE_OFFSET_OPACITY) == 1.0f);
+  CHECK(_ReadFloat(argBlock, rp::PREVIEW_SURFACE_OFFSET_OPACITY_THRESHOLD) == 0.5f);
+  CHECK(_ReadFloat(argBlock, rp::PREVIEW_SURFACE_OFFSET_IOR) == 1.5f);
+  CHECK(_ReadFloat(argBlock, rp::PREVIEW_SURFACE_OFFSET_NORMAL + 8) == 1.0f);
+  CHECK(_ReadUint(argBlock, rp::PREVIEW_SURFACE_OFFSET_FLAGS) == rp::PREVIEW_SURFACE_FLAG_SPECULAR_WORKFLOW);
+
+  // Shared files are only listed once
+  REQUIRE(texturePaths.size() == 2);
+  CHECK(texturePaths[0] == "albedo.png");
+  CHECK(texturePaths[1] == "orm.png");
+
+  auto readInfo = [&](GiPreviewSurfaceInput input) {
+    uint32_t offset = rp::PREVIEW_SURFACE_OFFSET_TEXTURES + uint32_t(input) * rp::PREVIEW_SURFACE_TEXTURE_STRIDE;
+    return _ReadUint(argBlock, offset + rp::PREVIEW_SURFACE_TEXTURE_OFFSET_INFO);
+  };
+
+  uint32_t diffuseInfo = readInfo(GiPreviewSurfaceInput::DiffuseColor);
+  CHECK((diffuseInfo & rp::PREVIEW_SURFACE_TEXTURE_INDEX_MASK) == 1);
+  CHECK(((diffuseInfo >> rp::PREVIEW_SURFACE_TEXTURE_CHANNEL_SHIFT) & 0x7) == rp::PREVIEW_SURFACE_CHANNEL_RGB);
+  CHECK((diffuseInfo & rp::PREVIEW_SURFACE_TEXTURE_FLAG_SRGB) != 0);
+
+  uint32_t diffuseBindingOffset = rp::PREVIEW_SURFACE_OFFSET_TEXTURES;
+  CHECK(_ReadFloat(argBlock, diffuseBindingOffset + rp::PREVIEW_SURFACE_TEXTURE_OFFSET_SCALE) == 2.0f);
+  CHECK(_ReadFloat(argBlock, diffuseBindingOffset + rp::PREVIEW_SURFACE_TEXTURE_OFFSET_SCALE + 4) == 1.0f);
+  CHECK(_ReadFloat(argBlock, diffuseBindingOffset + rp::PREVIEW_SURFACE_TEXTURE_OFFSET_BIAS) == 0.0f);
+
+  uint32_t roughnessInfo = readInfo(GiPreviewSurfaceInput::Roughness);
+  CHECK((roughnessInfo & rp::PREVIEW_SURFACE_TEXTURE_INDEX_MASK) == 2);
+  CHECK(((roughnessInfo >> rp::PREVIEW_SURFACE_TEXTURE_CHANNEL_SHIFT) & 0x7) == rp::PREVIEW_SURFACE_CHANNEL_G);
+  CHECK(((roughnessInfo >> rp::PREVIEW_SURFACE_TEXTURE_WRAP_S_SHIFT) & 0x3) == 2); // mirror
+  CHECK(((roughnessInfo >> rp::PREVIEW_SURFACE_TEXTURE_WRAP_T_SHIFT) & 0x3) == 3); // clip
+  CHECK((roughnessInfo & rp::PREVIEW_SURFACE_TEXTURE_FLAG_SRGB) == 0);
+
+  uint32_t metallicInfo = readInfo(GiPreviewSurfaceInput::Metallic);
+  CHECK((metallicInfo & rp::PREVIEW_SURFACE_TEXTURE_INDEX_MASK) == 2);
+  CHECK(((metallicInfo >> rp::PREVIEW_SURFACE_TEXTURE_CHANNEL_SHIFT) & 0x7) == rp::PREVIEW_SURFACE_CHANNEL_B);
+
+  CHECK(readInfo(GiPreviewSurfaceInput::Opacity) == 0);
+  CHECK(readInfo(GiPreviewSurfaceInput::Normal) == 0);
+}
+
+TEST_CASE("PreviewSurface.TextureUsages")
+{
+  namespace rp = shader_interface::rp_main;
+
+  GiPreviewSurfaceDesc desc;
+  desc.textures[size_t(GiPreviewSurfaceInput::DiffuseColor)].filePath = "albedo.png";
+  desc.textures[size_t(GiPreviewSurfaceInput::Roughness)].filePath = "rough.png"; // RGB, but only red is read
+  desc.textures[size_t(GiPreviewSurfaceInput::Metallic)].filePath = "rough.png";
+  desc.textures[size_t(GiPreviewSurfaceInput::Metallic)].channel = GiTextureChannel::R;
+  desc.textures[size_t(GiPreviewSurfaceInput::Normal)].filePath = "normal.png";
+
+  std::vector<uint8_t> argBlock;
+  std::vector<std::string> texturePaths;
+  std::vector<GiTextureUsage> textureUsages;
+
+  uint32_t normalInfoOffset = rp::PREVIEW_SURFACE_OFFSET_TEXTURES + uint32_t(GiPreviewSurfaceInput::Normal) * rp::PREVIEW_SURFACE_TEXTURE_STRIDE +
+                              rp::PREVIEW_SURFACE_TEXTURE_OFFSET_INFO;
+
+  giPackPreviewSurface(desc, argBlock, texturePaths, &textureUsages, true);
+  REQUIRE(textureUsages.size() == 3);
+  CHECK(textureUsages[0] == GiTextureUsage::Color);
+  CHECK(textureUsages[1] == GiTextureUsage::Scalar);
+  CHECK(textureUsages[2] == GiTextureUsage::Normal);
+  CHECK((_ReadUint(argBlock, normalInfoOffset) & rp::PREVIEW_SURFACE_TEXTURE_FLAG_RECONSTRUCT_Z) != 0);
+
+  giPackPreviewSurface(desc, argBlock, texturePaths, &textureUsages, false);
+  CHECK((_ReadUint(argBlock, normalInfoOffset) & rp::PREVIEW_SURFACE_TEXTURE_FLAG_RECONSTRUCT_Z) == 0);
+
+  // Files read in different ways keep all channels.
+  desc.textures[size_t(GiPreviewSurfaceInput::Metallic)].channel = GiTextureChannel::G;
+  desc.textures[size_t(GiPreviewSurfaceInput::EmissiveColor)].filePath = "normal.png";
+
+  giPackPreviewSurface(desc, argBlock, texturePaths, &textureUsages, true);
+  REQUIRE(textureUsages.size() == 3);
+  CHECK(textureUsages[1] == GiTextureUsage::Color);
+  CHECK(textureUsages[2] == GiTextureUsage::Color);
+  CHECK((_ReadUint(argBlock, normalInfoOffset) & rp::PREVIEW_SURFACE_TEXTURE_FLAG_RECONSTRUCT_Z) == 0);
+}
+
+TEST_CASE("PreviewSurface.ShareHitGroup")
+{
+  GiPreviewSurfaceDesc descA;
+  descA.textures[size_t(GiPreviewSurfaceInput::DiffuseColor)].filePath = "albedo.png";
+  descA.textures[size_t(GiPreviewSurfaceInput::Normal)].filePath = "normal.png";
+
+  GiPreviewSurfaceDesc descB = descA;
+  descB.roughness = 0.1f;
+  descB.textures[size_t(GiPreviewSurfaceInput::DiffuseColor)].scale[0] = 0.5f;
+  CHECK(giPreviewSurfacesShareHitGroup(descA, descB, true));
+
+  // Reading a single channel allows the file to be loaded as a scalar texture.
+  descB = descA;
+  descB.textures[size_t(GiPreviewSurfaceInput::DiffuseColor)].channel = GiTextureChannel::R;
+  CHECK(!giPreviewSurfacesShareHitGroup(descA, descB, true));
+
+  // Using the normal map for another input prevents Z reconstruction.
+  descB = descA;
+  descB.textures[size_t(GiPreviewSurfaceInput::EmissiveColor)].filePath = "normal.png";
+  CHECK(!giPreviewSurfacesShareHitGroup(descA, descB, true));
+
+  descB = descA;
+  descB.textures[size_t(GiPreviewSurfaceInput::DiffuseColor)].filePath = "albedo2.png";
+  CHECK(!giPreviewSurfacesShareHitGroup(descA, descB));
+}
+
+TEST_CASE("PreviewSurface.HashIgnoresUnusedTextureParams")
+{
+  GiPreviewSurfaceDesc descA;
+  GiPreviewSurfaceDesc descB;
+  descB.textures[size_t(GiPreviewSurfaceInput::Opacity)].scale[0] = 3.0f; // no file, so not packed
+  CHECK(giHashPreviewSurface(descA) == giHashPreviewSurface(descB));
+
+  descB.textures[size_t(GiPreviewSurfaceInput::Opacity)].filePath = "mask.png";
+  CHECK(giHashPreviewSurface(descA) != giHashPreviewSurface(descB));
+
+  descA.metallic = 1.0f;
+  CHECK(giHashPreviewSurface(descA) != giHashPreviewSurface(GiPreviewSurfaceDesc{}));
+}
+
+TEST_CASE("ShaderDependencyGraph.TransitiveIncludes")
+{
+  GiShaderDependencyGraph graph;
+
+  const GiShaderDependencyGraph::ShaderId closestHitShaders[] = { 1, 2, 3 };
+  const GiShaderDependencyGraph::ShaderId missShader = 4;
+
+  for (GiShaderDependencyGraph::ShaderId shader : closestHitShaders)
+  {
+    graph.setShaderFiles(shader, { "rp_main.chit", "rp_main_descriptors.glsl" });
+  }
+  graph.setShaderFiles(missShader, { "rp_main.miss", "common.glsl" });
+
+  graph.addInclude("rp_main_descriptors.glsl", "interface/rp_main.h");
+  graph.addInclude("interface/rp_main.h", "interface/gtl.h");
+  graph.addInclude("common.glsl", "interface/gtl.h");
+
+  // Changing the miss shader must not affect closest hit shaders.
+  CHECK(graph.findDependentShaders("rp_main.miss") == std::unordered_set<GiShaderDependencyGraph::ShaderId>{ missShader });
+  CHECK_EQ(graph.findDependentShaders("rp_main.chit").size(), 3);
+  CHECK_EQ(graph.findDependentShaders("interface/rp_main.h").size(), 3);
+  CHECK_EQ(graph.findDependentShaders("interface/gtl.h").size(), 4);
+  CHECK(graph.findDependentShaders("unused.glsl").empty());
+
+  // Files of recompiled shaders replace the previous ones.
+  graph.setShaderFiles(missShader, { "rp_main.miss" });
+  CHECK(graph.findDependentShaders("common.glsl").empty());
+  CHECK_EQ(graph.findDependentShaders("interface/gtl.h").size(), 3);
+
+  graph.clear();
+  CHECK(graph.findDependentShaders("rp_main.chit").empty());
+}
+
+TEST_CASE("ShaderDependencyGraph.IncludeCycle")
+{
+  GiShaderDependencyGraph graph;
+  graph.setShaderFiles(1, { "a.glsl" });
+  graph.addInclude("a.glsl", "b.glsl");
+  graph.addInclude("b.glsl", "a.glsl");
+
+  CHECK_EQ(graph.findDependentShaders("b.glsl").size(), 1);
+}
+
+TEST_CASE("SpirvOptimizer.Stats")
+{
+  const uint32_t opFunction = 54;
+  const uint32_t opFunctionEnd = 56;
+  const uint32_t opReturn = 253;
+
+  std::vector<uint32_t> words = {
+    0x07230203, 0x00010400, 0, 10, 0, // header
+    (5u << 16) | opFunction, 1, 2, 0, 3,
+    (1u << 16) | opReturn,
+    (1u << 16) | opFunctionEnd
+  };
+
+  GiSpirvStats stats;
+  REQUIRE(giGetSpirvStats(_MakeSpirv(words), stats));
+  CHECK_EQ(stats.instructionCount, 3);
+  CHECK_EQ(stats.functionCount, 1);
+  CHECK_EQ(stats.moduleSize, words.size() * sizeof(uint32_t));
+
+  // Truncated instruction
+  words.back() = (2u << 16) | opFunctionEnd;
+  CHECK_FALSE(giGetSpirvStats(_MakeSpirv(words), stats));
+
+  // Invalid magic
+  words[0] = 0;
+  CHECK_FALSE(giGetSpirvStats(_MakeSpirv(words), stats));
+}
+
+TEST_CASE("SpirvOptimizer.SizeRecipe")
+{
+  gbLogInit();
+
+  auto sourceCache = std::make_shared<GiShaderSourceCache>();
+  GiGlslShaderCompiler compiler(GI_SHADER_SOURCE_DIR, sourceCache, GiShaderOptimization::None);
+
+  std::vector<uint8_t> spv;
+  REQUIRE(compiler.compileGlslToSpv(GiGlslShaderCompiler::ShaderStage::Compute, SPIRV_TEST_SHADER, "test", spv));
+
+  std::vector<uint8_t> optimizedSpv;
+  REQUIRE(giOptimizeSpirv(GiShaderOptimization::Size, spv, optimizedSpv));
+
+  GiSpirvStats stats, optimizedStats;
+  REQUIRE(giGetSpirvStats(spv, stats));
+  REQUIRE(giGetSpirvStats(optimizedSpv, optimizedStats));
+
+  MESSAGE("instructions: ", stats.instructionCount, " -> ", optimizedStats.instructionCount);
+  MESSAGE("bytes: ", stats.moduleSize, " -> ", optimizedStats.moduleSize);
+
+  CHECK_EQ(stats.functionCount, 3);
+  CHECK_EQ(optimizedStats.functionCount, 1); // helpers inlined
+  CHECK_LT(optimizedStats.instructionCount, stats.instructionCount);
+  CHECK_LT(optimizedStats.moduleSize, stats.moduleSize);
+}
+
+TEST_CASE("GlslShaderCompiler.IncludeChangeInvalidatesResult")
+{
+  gbLogInit();
+
+  fs::path shaderPath = fs::temp_directory_path() / "gi_test_include_change";
+  fs::create_directories(shaderPath);
+
+  auto sourceCache = std::make_shared<GiShaderSourceCache>();
+  GiGlslShaderCompiler compiler(shaderPath, sourceCache, GiShaderOptimization::Size);
+
+  _WriteTextFile(shaderPath / "scale.glsl", "float scale(float x) { return x * 2.0; }\n");
+
+  std::vector<uint8_t> spv;
+  REQUIRE(compiler.compileGlslToSpv(GiGlslShaderCompiler::ShaderStage::Compute, INCLUDE_TEST_SHADER, "test", spv));
+
+  std::vector<uint8_t> cachedSpv;
+  REQUIRE(compiler.compileGlslToSpv(GiGlslShaderCompiler::ShaderStage::Compute, INCLUDE_TEST_SHADER, "test", cachedSpv));
+  CHECK_EQ(cachedSpv, spv);
+
+  // Same top-level source, different include.
+  _WriteTextFile(shaderPath / "scale.glsl", "float scale(float x) { return x * 3.0; }\n");
+  sourceCache->clear();
+
+  std::vector<uint8_t> newSpv;
+  REQUIRE(compiler.compileGlslToSpv(GiGlslShaderCompiler::ShaderStage::Compute, INCLUDE_TEST_SHADER, "test", newSpv));
+  CHECK_NE(newSpv, spv);
+
+  fs::remove_all(shaderPath);
+}
+
+TEST_CASE("StageTimeline.Utilization")
+{
+  using Ms = std::chrono::milliseconds;
+
+  GiStageTimeline timeline({ "first", "second" });
+
+  // Two workers in the first stage during the first half, one in the second stage after that.
+  GiStageTimeline::Clock::time_point t0 = GiStageTimeline::Clock::now();
+  timeline.record(0, t0, t0 + Ms(50));
+  timeline.record(0, t0, t0 + Ms(50));
+  timeline.record(1, t0 + Ms(50), t0 + Ms(100));
+
+  CHECK_EQ(timeline.durationMs(), doctest::Approx(100.0f));
+  CHECK_EQ(timeline.busyMs(0), doctest::Approx(100.0f));
+  CHECK_EQ(timeline.busyMs(1), doctest::Approx(50.0f));
+
+  std::vector<float> first = timeline.utilization(0, 4);
+  std::vector<float> second = timeline.utilization(1, 4);
+  REQUIRE_EQ(first.size(), 4);
+  REQUIRE_EQ(second.size(), 4);
+
+  for (int i = 0; i < 4; i++)
+  {
+    CHECK_EQ(first[i], doctest::Approx(i < 2 ? 2.0f : 0.0f));
+    CHECK_EQ(second[i], doctest::Approx(i < 2 ? 0.0f : 1.0f));
+  }
+
+  // Intervals partially covered by recorded work.
+  first = timeline.utilization(0, 3);
+  second = timeline.utilization(1, 3);
+  CHECK_EQ(first[0], doctest::Approx(2.0f));
+  CHECK_EQ(first[1], doctest::Approx(1.0f));
+  CHECK_EQ(first[2], doctest::Approx(0.0f));
+  CHECK_EQ(second[0], doctest::Approx(0.0f));
+  CHECK_EQ(second[1], doctest::Approx(0.5f));
+  CHECK_EQ(second[2], doctest::Approx(1.0f));
+
+  CHECK_EQ(timeline.formatUtilization(4).size(), 2);
+}
+
+TEST_CASE("TextureCache.Hits")
+{
+  _MockImageAllocator allocator;
+  GiTextureCache cache(0, allocator.destroyFunc());
+
+  CHECK_EQ(cache.acquire("a.png"), 0);
+
+  uint64_t a = allocator.allocate();
+  cache.insert("a.png", a, 100);
+  CHECK(cache.contains(a));
+
+  CHECK_EQ(cache.acquire("a.png"), a);
+  CHECK_EQ(cache.acquire("a.png"), a);
+
+  const GiTextureCacheStats& stats = cache.stats();
+  CHECK_EQ(stats.hitCount, 2);
+  CHECK_EQ(stats.missCount, 1);
+  CHECK_EQ(stats.residentCount, 1);
+  CHECK_EQ(stats.residentBytes, 100);
+
+  // Unreferenced images stay resident without a budget.
+  CHECK(cache.release(a));
+  CHECK(cache.release(a));
+  CHECK(cache.release(a));
+  CHECK(cache.contains(a));
+  CHECK(allocator.destroyedHandles.empty());
+
+  CHECK_FALSE(cache.release(allocator.allocate()));
+
+  cache.clear();
+  CHECK_EQ(allocator.destroyedHandles, std::vector<uint64_t>{ a });
+  CHECK_EQ(stats.residentBytes, 0);
+}
+
+TEST_CASE("TextureCache.LruEviction")
+{
+  _MockImageAllocator allocator;
+  GiTextureCache cache(300, allocator.destroyFunc());
+
+  uint64_t a = allocator.allocate();
+  uint64_t b = allocator.allocate();
+  uint64_t c = allocator.allocate();
+  cache.insert("a", a, 100);
+  cache.insert("b", b, 100);
+  cache.insert("c", c, 100);
+
+  // Released in the order b, a, c; 'b' is least recently used.
+  cache.release(b);
+  cache.release(a);
+  cache.release(c);
+  CHECK(allocator.destroyedHandles.empty());
+
+  // A reacquired image is no longer evictable.
+  CHECK_EQ(cache.acquire("b"), b);
+
+  uint64_t d = allocator.allocate();
+  cache.insert("d", d, 150);
+  CHECK_EQ(allocator.destroyedHandles, (std::vector<uint64_t>{ a, c }));
+  CHECK_EQ(cache.acquire("a"), 0);
+
+  const GiTextureCacheStats& stats = cache.stats();
+  CHECK_EQ(stats.evictionCount, 2);
+  CHECK_EQ(stats.residentCount, 2);
+  CHECK_EQ(stats.residentBytes, 250);
+
+  cache.release(b);
+  cache.release(d);
+  cache.clear();
+}
+
+TEST_CASE("TextureCache.ReferencedImagesExceedBudget")
+{
+  _MockImageAllocator allocator;
+  GiTextureCache cache(100, allocator.destroyFunc());
+
+  uint64_t a = allocator.allocate();
+  uint64_t b = allocator.allocate();
+  cache.insert("a", a, 100);
+  cache.insert("b", b, 100);
+
+  // Both images are in use, so neither can be evicted.
+  CHECK(allocator.destroyedHandles.empty());
+  CHECK_EQ(cache.stats().residentBytes, 200);
+
+  // Eviction happens as soon as an image is released.
+  cache.release(a);
+  CHECK_EQ(allocator.destroyedHandles, std::vector<uint64_t>{ a });
+  CHECK_FALSE(cache.contains(a));
+
+  // Lowering the budget evicts unreferenced images immediately.
+  cache.release(b);
+  CHECK(cache.contains(b));
+  cache.setBudget(50);
+  CHECK_EQ(allocator.destroyedHandles, (std::vector<uint64_t>{ a, b }));
+  CHECK_EQ(cache.stats().residentCount, 0);
+}
+
+TEST_CASE("TextureCache.MultipleKeys")
+{
+  _MockImageAllocator allocator;
+  GiTextureCache cache(100, allocator.destroyFunc());
+
+  uint64_t a = allocator.allocate();
+  cache.insert("content", a, 100);
+  cache.addKey("path/a.png", a);
+  cache.addKey("path/copy_of_a.png", a);
+  CHECK(cache.containsKey("path/a.png"));
+
+  CHECK_EQ(cache.acquire("path/copy_of_a.png"), a);
+  CHECK_EQ(cache.stats().residentCount, 1);
+
+  // Evicting an image removes all of its keys.
+  cache.release(a);
+  cache.release(a);
+  cache.insert("other", allocator.allocate(), 100);
+  CHECK_EQ(allocator.destroyedHandles, std::vector<uint64_t>{ a });
+  CHECK_FALSE(cache.containsKey("content"));
+  CHECK_FALSE(cache.containsKey("path/a.png"));
+  CHECK_FALSE(cache.containsKey("path/copy_of_a.png"));
+
+  cache.clear();
+}
+
+TEST_CASE("TextureLoader.PathCanonicalization")
+{
+  fs::path tmpDir = fs::temp_directory_path() / "gi_test_texture_paths";
+  fs::remove_all(tmpDir);
+  fs::create_directories(tmpDir / "tex");
+  _WriteFile(tmpDir / "tex" / "a.png", "a");
+
+  fs::path prevWorkingDir = fs::current_path();
+  fs::current_path(tmpDir);
+
+  std::string canonicalPath = giCanonicalizeTexturePath((tmpDir / "tex" / "a.png").string().c_str());
+  CHECK_EQ(giCanonicalizeTexturePath("tex/a.png"), canonicalPath);
+  CHECK_EQ(giCanonicalizeTexturePath("./tex/a.png"), canonicalPath);
+  CHECK_EQ(giCanonicalizeTexturePath("tex/../tex/./a.png"), canonicalPath);
+  CHECK_NE(giCanonicalizeTexturePath("tex/b.png"), canonicalPath);
+
+  // Creating symlinks may require privileges on Windows.
+  std::error_code errorCode;
+  fs::create_symlink(tmpDir / "tex" / "a.png", tmpDir / "link.png", errorCode);
+  if (!errorCode)
+  {
+    CHECK_EQ(giCanonicalizeTexturePath("link.png"), canonicalPath);
+  }
+
+  fs::current_path(prevWorkingDir);
+  fs::remove_all(tmpDir);
+}
+
+TEST_CASE("TextureLoader.ContentHash")
+{
+  fs::path tmpDir = fs::temp_directory_path() / "gi_test_texture_content";
+  fs::remove_all(tmpDir);
+  fs::create_directories(tmpDir / "package_a");
+  fs::create_directories(tmpDir / "package_b");
+
+  std::string content(1001, 0);
+  for (size_t i = 0; i < content.size(); i++)
+  {
+    content[i] = char(i * 7);
+  }
+  std::string modifiedContent = content;
+  modifiedContent.back() ^= 1; // in the unaligned tail
+
+  _WriteFile(tmpDir / "package_a" / "albedo.png", content);
+  _WriteFile(tmpDir / "package_b" / "albedo_copy.png", content);
+  _WriteFile(tmpDir / "package_b" / "albedo_modified.png", modifiedContent);
+
+  CHECK_EQ(giHashTextureContent(content.data(), content.size()), giHashTextureContent(content.data(), content.size()));
+  CHECK_NE(giHashTextureContent(content.data(), content.size()), giHashTextureContent(modifiedContent.data(), modifiedContent.size()));
+  CHECK_NE(giHashTextureContent(content.data(), content.size()), giHashTextureContent(content.data(), content.size() - 1));
+
+  // The hash is computed while the file is mapped; decoding is skipped for known content.
+  GiMmapAssetReader assetReader;
+  GiTextureDecodeParams decodeParams;
+
+  auto readContentHash = [&](const fs::path& path) -> uint64_t
+  {
+    GiDecodedTexture texture;
+    bool skipped = false;
+    CHECK(giDecodeTexture(assetReader, path.string().c_str(), decodeParams, texture, [&](uint64_t) { skipped = true; return true; }));
+    CHECK(skipped);
+    CHECK(texture.levels.empty());
+    return texture.contentHash;
+  };
+
+  uint64_t hash = readContentHash(tmpDir / "package_a" / "albedo.png");
+  CHECK_EQ(hash, giHashTextureContent(content.data(), content.size()));
+  CHECK_EQ(readContentHash(tmpDir / "package_b" / "albedo_copy.png"), hash);
+  CHECK_NE(readContentHash(tmpDir / "package_b" / "albedo_modified.png"), hash);
+
+  fs::remove_all(tmpDir);
+}
+
+TEST_CASE("TextureLoader.Pipeline")
+{
+  const size_t count = 100;
+  const uint64_t textureSize = 10;
+  const uint64_t maxInFlightBytes = 30;
+
+  std::thread::id callingThreadId = std::this_thread::get_id();
+
+  std::mutex mutex;
+  std::vector<int> decodeCounts(count, 0);
+  std::vector<size_t> consumedIndices;
+  uint64_t inFlightBytes = 0;
+  uint64_t maxObservedInFlightBytes = 0;
+  bool consumedOnOtherThread = false;
+
+  giRunTexturePipeline(count, maxInFlightBytes,
+    [&](size_t index) -> uint64_t
+    {
+      std::lock_guard lock(mutex);
+      decodeCounts[index]++;
+      inFlightBytes += textureSize;
+      maxObservedInFlightBytes = std::max(maxObservedInFlightBytes, inFlightBytes);
+      return textureSize;
+    },
+    [&](size_t index)
+    {
+      std::lock_guard lock(mutex);
+      consumedIndices.push_back(index);
+      inFlightBytes -= textureSize;
+      consumedOnOtherThread |= std::this_thread::get_id() != callingThreadId;
+    }
+  );
+
+  CHECK_EQ(consumedIndices.size(), count);
+  CHECK_FALSE(consumedOnOtherThread);
+  for (size_t i = 0; i < count; i++)
+  {
+    CHECK_EQ(decodeCounts[i], 1);
+  }
+
+  // Workers only start decoding below the limit, so it is exceeded by at most one texture each.
+  uint32_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+  CHECK_LE(maxObservedInFlightBytes, maxInFlightBytes + threadCount * textureSize);
+}
+
+TEST_CASE("TextureLoader.Benchmark")
+{
+  gbLogInit();
+
+  // Set the environment variable to a directory of production textures for meaningful numbers.
+  const char* benchmarkDir = getenv("GI_TEXTURE_BENCHMARK_DIR");
+  fs::path textureDir = benchmarkDir ? fs::path(benchmarkDir) : fs::path(GI_TEXTURE_TESTENV_DIR);
+  int repetitions = benchmarkDir ? 1 : BENCHMARK_TEXTURE_REPETITIONS;
+
+  std::vector<std::string> filePaths;
+  for (int i = 0; i < repetitions; i++)
+  {
+    for (const fs::directory_entry& entry : fs::directory_iterator(textureDir))
+    {
+      std::string extension = entry.path().extension().string();
+      if (extension == ".png" || extension == ".jpg" || extension == ".jpeg" || extension == ".exr")
+      {
+        filePaths.push_back(entry.path().string());
+      }
+    }
+  }
+  REQUIRE(!filePaths.empty());
+
+  GiMmapAssetReader assetReader;
+  GiTextureDecodeParams decodeParams;
+
+  std::vector<GiDecodedTexture> textures(filePaths.size());
+  std::atomic_uint64_t fileBytes = 0;
+  uint64_t decodedBytes = 0;
+  int failedCount = 0;
+
+  auto startTime = std::chrono::steady_clock::now();
+
+  giRunTexturePipeline(filePaths.size(), 256 * 1024 * 1024,
+    [&](size_t index) -> uint64_t
+    {
+      const std::string& filePath = filePaths[index];
+      fileBytes += fs::file_size(filePath);
+
+      if (!giDecodeTexture(assetReader, filePath.c_str(), decodeParams, textures[index]))
+      {
+        textures[index].levels.clear();
+      }
+      return giGetDecodedTextureSize(textures[index]);
+    },
+    [&](size_t index)
+    {
+      // Stands in for staging; the decoded data is released right away.
+      GiDecodedTexture texture = std::move(textures[index]);
+      failedCount += texture.levels.empty() ? 1 : 0;
+      decodedBytes += giGetDecodedTextureSize(texture);
+    }
+  );
+
+  std::chrono::duration<double> duration = std::chrono::steady_clock::now() - startTime;
+  double seconds = std::max(duration.count(), 1e-9);
+
+  MESSAGE("loaded ", filePaths.size(), " textures in ", duration.count() * 1000.0, "ms");
+  MESSAGE("file throughput: ", fileBytes / (1000.0 * 1000.0) / seconds, " MB/s");
+  MESSAGE("decoded throughput: ", decodedBytes / (1000.0 * 1000.0) / seconds, " MB/s");
+  MESSAGE("peak RSS: ", _GetPeakRss() / (1024.0 * 1024.0), " MiB");
+
+  CHECK_EQ(failedCount, 0);
+}
+
+TEST_CASE("TextureManager.SharedBsdfData")
+{
+  gbLogInit();
+
+  REQUIRE(cgpuInitialize("gi_test", 0, 0, 0));
+
+  CgpuDevice device;
+  REQUIRE(cgpuCreateDevice(&device));
+
+  {
+    GgpuStager stager(device);
+    REQUIRE(stager.allocate());
+
+    GiMmapAssetReader assetReader;
+    GiTextureManager textureManager(device, assetReader, stager);
+
+    McTextureDescription table = {
+      .binding = 0,
+      .is3dImage = true,
+      .isFloat = true,
+      .width = 4,
+      .height = 4,
+      .depth = 4,
+      .data = _MakeBlock(4 * 4 * 4 * sizeof(float), 0),
+      .bsdfDataKey = 1
+    };
+
+    // Same key but different content, as if the hashes of two tables collided.
+    McTextureDescription collidingTable = table;
+    collidingTable.data = _MakeBlock(4 * 4 * 4 * sizeof(float), 1);
+
+    std::vector<McTextureDescription> textureDescriptions(BSDF_DATA_MATERIAL_COUNT, table);
+    textureDescriptions.push_back(collidingTable);
+
+    std::vector<GiTextureUsage> textureUsages;
+    std::vector<CgpuImage> images2d;
+    std::vector<CgpuImage> images3d;
+    std::vector<GiTextureLoadRequest> requests = {
+      GiTextureLoadRequest{ textureDescriptions, textureUsages, images2d, images3d }
+    };
+    REQUIRE(textureManager.loadTextureDescriptions(requests));
+
+    // Each distinct table is uploaded once, regardless of the number of materials using it.
+    CHECK_EQ(textureManager.getPayloadUploadCount(), 2);
+    REQUIRE_EQ(images3d.size(), textureDescriptions.size());
+    CHECK_EQ(images3d.front().handle, images3d[BSDF_DATA_MATERIAL_COUNT - 1].handle);
+    CHECK_NE(images3d.front().handle, images3d.back().handle);
+
+    textureManager.releaseImages(images3d);
+    textureManager.destroy();
+
+    stager.free();
+  }
+
+  cgpuDestroyDevice(device);
+  cgpuTerminate();
+}
+
+TEST_CASE("Shaders.LightCountIndependence")
+{
+  // Light counts must not be baked into shader sources. Otherwise adding or
+  // removing a light would require all materials to be recompiled.
+  GiShaderSourceCache sourceCache;
+
+  int fileCount = 0;
+  for (const fs::directory_entry& entry : fs::recursive_directory_iterator(GI_SHADER_SOURCE_DIR))
+  {
+    if (!entry.is_regular_file())
+    {
+      continue;
+    }
+
+    GiShaderSourceCache::Source source = sourceCache.get(entry.path());
+    REQUIRE(source);
+
+    INFO("shader file: ", entry.path().string());
+    CHECK_EQ(source->find("LIGHT_COUNT"), std::string::npos);
+    fileCount++;
+  }
+
+  CHECK_GT(fileCount, 0);
+}
+
+TEST_CASE("Shaders.MaterialIndependence")
+{
+  // Texture and argument block offsets of a material are passed at runtime. If they were baked
+  // into shader sources, changing one material would require other materials to be recompiled.
+  GiShaderSourceCache sourceCache;
+
+  int fileCount = 0;
+  for (const fs::directory_entry& entry : fs::recursive_directory_iterator(GI_SHADER_SOURCE_DIR))
+  {
+    if (!entry.is_regular_file())
+    {
+      continue;
+    }
+
+    GiShaderSourceCache::Source source = sourceCache.get(entry.path());
+    REQUIRE(source);
+
+    INFO("shader file: ", entry.path().string());
+    CHECK_EQ(source->find("TEXTURE_INDEX_OFFSET"), std::string::npos);
+    CHECK_EQ(source->find("MDL_ARG_BLOCK_OFFSET"), std::string::npos);
+    fileCount++;
+  }
+
+  CHECK_GT(fileCount, 0);
+}
+
+TEST_CASE("Gi.AddMaterialToHitGroupCache")
+{
+  mx::DocumentPtr mtlxStdLib = mx::createDocument();
+  mx::loadLibraries({}, mx::FileSearchPath(GI_MTLX_STDLIB_DIR), mtlxStdLib);
+
+  // For the MaterialX fallback material.
+  std::vector<std::string> mdlSearchPaths = { GB_FMT("{}/mdl", GI_MTLX_STDLIB_DIR) };
+
+  GiInitParams initParams = {
+    .shaderPath = GI_SHADER_SOURCE_DIR,
+    .mdlRuntimePath = GI_MDL_LIB_DIR,
+    .mdlSearchPaths = mdlSearchPaths,
+    .mtlxStdLib = mtlxStdLib
+  };
+  REQUIRE_EQ(giInitialize(initParams), GiStatus::Ok);
+
+  fs::path mdlPath = fs::temp_directory_path() / "gi_test_hit_group_cache";
+  fs::create_directories(mdlPath);
+
+  GiScene* scene = giCreateScene();
+  REQUIRE(scene);
+
+  GiRenderBuffer* renderBuffer = giCreateRenderBuffer(4, 4, GiRenderBufferFormat::Float32Vec4);
+  REQUIRE(renderBuffer);
+
+  // A triangle in front of the camera per material.
+  std::vector<GiVertex> vertices = {
+    GiVertex{ .pos = { -1.0f, -1.0f, 0.0f }, .norm = { 0.0f, 0.0f, 1.0f } },
+    GiVertex{ .pos = {  1.0f, -1.0f, 0.0f }, .norm = { 0.0f, 0.0f, 1.0f } },
+    GiVertex{ .pos = {  0.0f,  1.0f, 0.0f }, .norm = { 0.0f, 0.0f, 1.0f } }
+  };
+  std::vector<GiFace> faces = { GiFace{ .v_i = { 0, 1, 2 } } };
+  std::vector<int> faceIds = { 0 };
+  std::vector<GiPrimvarData> primvars;
+
+  std::vector<GiMaterial*> materials;
+  std::vector<GiMesh*> meshes;
+
+  auto addMaterial = [&](float value)
+  {
+    // Distinct file modules, so that the materials don't share hit groups.
+    std::string name = GB_FMT("gi_test_material_{}", materials.size());
+    fs::path filePath = mdlPath / (name + ".mdl");
+    _WriteTextFile(filePath, _MakeDiffuseMdl(value, 1.0f - value, 0.5f));
+
+    GiMaterial* material = giCreateMaterialFromMdlFile(name.c_str(), filePath.string().c_str(), "test_material");
+    REQUIRE(material);
+    materials.push_back(material);
+
+    GiMeshDesc meshDesc = {
+      .faceCount = uint32_t(faces.size()),
+      .faces = faces,
+      .faceIds = faceIds,
+      .id = int(meshes.size()),
+      .isLeftHanded = false,
+      .name = name.c_str(),
+      .maxFaceId = 0,
+      .primvars = primvars,
+      .vertexCount = uint32_t(vertices.size()),
+      .vertices = vertices
+    };
+
+    GiMesh* mesh = giCreateMesh(scene, meshDesc);
+    REQUIRE(mesh);
+    giSetMeshMaterial(mesh, material);
+    meshes.push_back(mesh);
+  };
+
+  auto render = [&]()
+  {
+    GiRenderParams renderParams = {
+      .aovBindings = { GiAovBinding{ .aovId = GiAovId::Color, .clearValue = {}, .renderBuffer = renderBuffer } },
+      .camera = {
+        .position = { 0.0f, 0.0f, 5.0f },
+        .forward = { 0.0f, 0.0f, -1.0f },
+        .up = { 0.0f, 1.0f, 0.0f },
+        .vfov = 0.8f,
+        .fStop = 0.0f,
+        .focusDistance = 5.0f,
+        .focalLength = 50.0f,
+        .clipStart = 0.1f,
+        .clipEnd = 100.0f,
+        .exposure = 0.0f
+      },
+      .domeLight = nullptr,
+      .renderSettings = {
+        .asyncShaderCompilation = false,
+        .lightIntensityMultiplier = 1.0f,
+        .maxBounces = 1,
+        .maxSampleValue = 10.0f,
+        .maxVolumeWalkLength = 1,
+        .mediumStackSize = 1,
+        .rrInvMinTermProb = 1.0f,
+        .spp = 1
+      },
+      .scene = scene
+    };
+    REQUIRE_EQ(giRender(renderParams), GiStatus::Ok);
+  };
+
+  for (int i = 0; i < HIT_GROUP_CACHE_MATERIAL_COUNT; i++)
+  {
+    addMaterial(float(i) / HIT_GROUP_CACHE_MATERIAL_COUNT);
+  }
+  render();
+
+  uint64_t compileCount = giGetHitGroupCompileCount(scene);
+  CHECK_GE(compileCount, HIT_GROUP_CACHE_MATERIAL_COUNT);
+
+  // Only the hit group of the new material is compiled, and only once.
+  addMaterial(1.0f);
+  render();
+  CHECK_EQ(giGetHitGroupCompileCount(scene) - compileCount, 1);
+
+  // Nothing changed.
+  compileCount = giGetHitGroupCompileCount(scene);
+  render();
+  CHECK_EQ(giGetHitGroupCompileCount(scene), compileCount);
+
+  for (GiMesh* mesh : meshes)
+  {
+    giDestroyMesh(mesh);
+  }
+  for (GiMaterial* material : materials)
+  {
+    giDestroyMaterial(material);
+  }
+  giDestroyRenderBuffer(renderBuffer);
+  giDestroyScene(scene);
+  giTerminate();
+
+  fs::remove_all(mdlPath);
+}
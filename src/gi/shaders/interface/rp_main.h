@@ -100,16 +100,73 @@ struct PushConstants
   GI_UINT  clipRangePacked;
   GI_FLOAT sensorExposure;
   GI_UINT  maxVolumeWalkLength; // NOTE: can be quantized
-  /* 2 floats free */
+  GI_UINT  sphereAndDistantLightCounts; // 16 bits each
+  GI_UINT  rectAndDiskLightCounts;      // 16 bits each
 };
 
 const GI_UINT BLAS_PAYLOAD_BITFLAG_FLIP_FACING = (1 << 0);
 
+const GI_UINT MDL_RESOURCE_SLOT_SHADING = 0;
+const GI_UINT MDL_RESOURCE_SLOT_OPACITY = 1;
+
+// Argument block layout of UsdPreviewSurface materials (see preview_surface.glsl). Offsets are in bytes.
+const GI_UINT PREVIEW_SURFACE_INPUT_DIFFUSE_COLOR       = 0;
+const GI_UINT PREVIEW_SURFACE_INPUT_EMISSIVE_COLOR      = 1;
+const GI_UINT PREVIEW_SURFACE_INPUT_SPECULAR_COLOR      = 2;
+const GI_UINT PREVIEW_SURFACE_INPUT_METALLIC            = 3;
+const GI_UINT PREVIEW_SURFACE_INPUT_ROUGHNESS           = 4;
+const GI_UINT PREVIEW_SURFACE_INPUT_CLEARCOAT           = 5;
+const GI_UINT PREVIEW_SURFACE_INPUT_CLEARCOAT_ROUGHNESS = 6;
+const GI_UINT PREVIEW_SURFACE_INPUT_OPACITY             = 7;
+const GI_UINT PREVIEW_SURFACE_INPUT_NORMAL              = 8;
+const GI_UINT PREVIEW_SURFACE_INPUT_COUNT               = 9;
+
+const GI_UINT PREVIEW_SURFACE_OFFSET_DIFFUSE_COLOR       = 0;  // vec3
+const GI_UINT PREVIEW_SURFACE_OFFSET_ROUGHNESS           = 12;
+const GI_UINT PREVIEW_SURFACE_OFFSET_EMISSIVE_COLOR      = 16; // vec3
+const GI_UINT PREVIEW_SURFACE_OFFSET_METALLIC            = 28;
+const GI_UINT PREVIEW_SURFACE_OFFSET_SPECULAR_COLOR      = 32; // vec3
+const GI_UINT PREVIEW_SURFACE_OFFSET_CLEARCOAT           = 44;
+const GI_UINT PREVIEW_SURFACE_OFFSET_NORMAL              = 48; // vec3, tangent space
+const GI_UINT PREVIEW_SURFACE_OFFSET_CLEARCOAT_ROUGHNESS = 60;
+const GI_UINT PREVIEW_SURFACE_OFFSET_OPACITY             = 64;
+const GI_UINT PREVIEW_SURFACE_OFFSET_OPACITY_THRESHOLD   = 68;
+const GI_UINT PREVIEW_SURFACE_OFFSET_IOR                 = 72;
+const GI_UINT PREVIEW_SURFACE_OFFSET_FLAGS               = 76;
+const GI_UINT PREVIEW_SURFACE_OFFSET_TEXTURES            = 80; // one binding per input
+
+const GI_UINT PREVIEW_SURFACE_FLAG_SPECULAR_WORKFLOW = (1 << 0);
+
+// Texture binding: f32 scale[4], f32 bias[4], u32 info, u32 padding[3]
+const GI_UINT PREVIEW_SURFACE_TEXTURE_OFFSET_SCALE = 0;
+const GI_UINT PREVIEW_SURFACE_TEXTURE_OFFSET_BIAS  = 16;
+const GI_UINT PREVIEW_SURFACE_TEXTURE_OFFSET_INFO  = 32;
+const GI_UINT PREVIEW_SURFACE_TEXTURE_STRIDE       = 48;
+
+const GI_UINT PREVIEW_SURFACE_ARG_BLOCK_SIZE = PREVIEW_SURFACE_OFFSET_TEXTURES + PREVIEW_SURFACE_INPUT_COUNT * PREVIEW_SURFACE_TEXTURE_STRIDE;
+
+// Info bits: 16 bit texture index (one-based, 0 if untextured), 3 bit channel, 2 bit wrap modes (TEX_WRAP_*), sRGB flag,
+// flag for normal maps with two channels (e.g. BC5)
+const GI_UINT PREVIEW_SURFACE_TEXTURE_INDEX_MASK         = 0xFFFFu;
+const GI_UINT PREVIEW_SURFACE_TEXTURE_CHANNEL_SHIFT      = 16;
+const GI_UINT PREVIEW_SURFACE_TEXTURE_WRAP_S_SHIFT       = 19;
+const GI_UINT PREVIEW_SURFACE_TEXTURE_WRAP_T_SHIFT       = 21;
+const GI_UINT PREVIEW_SURFACE_TEXTURE_FLAG_SRGB          = (1 << 23);
+const GI_UINT PREVIEW_SURFACE_TEXTURE_FLAG_RECONSTRUCT_Z = (1 << 24);
+
+const GI_UINT PREVIEW_SURFACE_CHANNEL_R   = 0;
+const GI_UINT PREVIEW_SURFACE_CHANNEL_G   = 1;
+const GI_UINT PREVIEW_SURFACE_CHANNEL_B   = 2;
+const GI_UINT PREVIEW_SURFACE_CHANNEL_A   = 3;
+const GI_UINT PREVIEW_SURFACE_CHANNEL_RGB = 4;
+
 struct BlasPayload
 {
   GI_UINT64 bufferAddress;
   GI_UINT   vertexOffset;
   GI_UINT   bitfield;
+  GI_UINT   textureIndexOffsets[2]; // per MDL resource slot; 2d and 3d, 16 bits each
+  GI_INT    argBlockOffsets[2];     // per MDL resource slot; in bytes, -1 if none
 };
 
 const GI_UINT FACE_ID_MASK = 0x3FFFFFFF;
@@ -165,6 +222,8 @@ GI_BINDING_INDEX(AOV_DEPTH,        24)
 GI_BINDING_INDEX(AOV_FACE_ID,      25)
 GI_BINDING_INDEX(AOV_INSTANCE_ID,  26)
 
+GI_BINDING_INDEX(ARG_BLOCKS,       27)
+
 GI_INTERFACE_END()
 
 #endif
@@ -3,6 +3,23 @@
 
 #include "common.glsl"
 
+// Texture and argument block offsets of the material are read from the instance payload, so
+// that the generated code does not depend on the resources of other materials.
+
+uint mdl_texture_index_offset_2d()
+{
+    return blas_payloads[gl_InstanceCustomIndexEXT].textureIndexOffsets[MDL_RESOURCE_SLOT] & 0xFFFFu;
+}
+
+uint mdl_texture_index_offset_3d()
+{
+    return blas_payloads[gl_InstanceCustomIndexEXT].textureIndexOffsets[MDL_RESOURCE_SLOT] >> 16;
+}
+
+// Texture LOD of the current hit, excluding the resolution of the texture. Set by the closest-hit
+// shader from the ray cone footprint; the default selects the base level.
+float tex_lod_footprint = -128.0;
+
 // See also: https://github.com/NVIDIA/MDL-SDK/blob/master/examples/mdl_sdk/dxr/content/mdl_renderer_runtime.hlsl
 
 float apply_wrap_and_crop(float coord, int wrap, vec2 crop, int res)
@@ -37,6 +54,41 @@ float apply_wrap_and_crop(float coord, int wrap, vec2 crop, int res)
     return coord * (crop.y - crop.x) + crop.x;
 }
 
+#ifdef MDL_ARG_BLOCKS
+// Parameters of class-compiled materials. Offsets are in bytes.
+
+int mdl_arg_block_offset()
+{
+    return blas_payloads[gl_InstanceCustomIndexEXT].argBlockOffsets[MDL_RESOURCE_SLOT];
+}
+
+uint mdl_read_argblock_as_uint(int offs)
+{
+    return ArgBlocks[(mdl_arg_block_offset() + offs) >> 2];
+}
+
+int mdl_read_argblock_as_int(int offs)
+{
+    return int(mdl_read_argblock_as_uint(offs));
+}
+
+float mdl_read_argblock_as_float(int offs)
+{
+    return uintBitsToFloat(mdl_read_argblock_as_uint(offs));
+}
+
+double mdl_read_argblock_as_double(int offs)
+{
+    return packDouble2x32(uvec2(mdl_read_argblock_as_uint(offs), mdl_read_argblock_as_uint(offs + 4)));
+}
+
+bool mdl_read_argblock_as_bool(int offs)
+{
+    uint val = mdl_read_argblock_as_uint(offs);
+    return (val & (0xffu << (8 * ((mdl_arg_block_offset() + offs) & 3)))) != 0u;
+}
+#endif
+
 bool tex_texture_isvalid(int tex)
 {
     return tex != 0;
@@ -53,7 +105,7 @@ vec4 tex_lookup_float4_3d(int tex, vec3 coord, int wrap_u, int wrap_v, int wrap_
         return vec4(0, 0, 0, 0);
     }
 
-    uint array_idx = TEXTURE_INDEX_OFFSET_3D + tex - 1;
+    uint array_idx = mdl_texture_index_offset_3d() + tex - 1;
 
     int mipmap_level = 0;
     ivec3 res = textureSize(textures_3d[nonuniformEXT(array_idx)], mipmap_level);
@@ -97,7 +149,7 @@ vec4 tex_texel_float4_3d(int tex, ivec3 coord, float frame)
         return vec4(0, 0, 0, 0);
     }
 
-    uint array_idx = TEXTURE_INDEX_OFFSET_3D + tex - 1;
+    uint array_idx = mdl_texture_index_offset_3d() + tex - 1;
 
     int mipmap_level = 0;
     ivec3 res = textureSize(textures_3d[nonuniformEXT(array_idx)], mipmap_level);
@@ -144,15 +196,18 @@ vec4 tex_lookup_float4_2d(int tex, vec2 coord, int wrap_u, int wrap_v, vec2 crop
         return vec4(0, 0, 0, 0);
     }
 
-    uint array_idx = TEXTURE_INDEX_OFFSET_2D + tex - 1;
+    uint array_idx = mdl_texture_index_offset_2d() + tex - 1;
 
     int mipmap_level = 0;
     ivec2 res = textureSize(textures_2d[nonuniformEXT(array_idx)], mipmap_level);
     coord.x = apply_wrap_and_crop(coord.x, wrap_u, crop_u, res.x);
     coord.y = apply_wrap_and_crop(coord.y, wrap_v, crop_v, res.y);
 
+    // Ray tracing stages have no implicit derivatives, so the level is selected explicitly.
+    float lod = tex_lod_footprint + 0.5 * log2(float(res.x) * float(res.y));
+
     ASSERT(array_idx < TEXTURE_COUNT_2D, "Error: invalid texture index\n");
-    return texture(sampler2D(textures_2d[nonuniformEXT(array_idx)], tex_sampler), coord);
+    return textureLod(sampler2D(textures_2d[nonuniformEXT(array_idx)], tex_sampler), coord, lod);
 #else
     ASSERT(tex == 0, "Error: invalid texture index\n");
     return vec4(0, 0, 0, 0);
@@ -187,7 +242,7 @@ vec4 tex_texel_float4_2d(int tex, ivec2 coord, ivec2 uv_tile, float frame)
         return vec4(0, 0, 0, 0);
     }
 
-    uint array_idx = TEXTURE_INDEX_OFFSET_2D + tex - 1;
+    uint array_idx = mdl_texture_index_offset_2d() + tex - 1;
 
     int mipmap_level = 0;
     ivec2 res = textureSize(textures_2d[nonuniformEXT(array_idx)], mipmap_level);
@@ -232,7 +287,7 @@ ivec2 tex_resolution_2d(int tex, ivec2 uv_tile, float frame)
         return ivec2(0, 0);
     }
 
-    uint array_idx = TEXTURE_INDEX_OFFSET_2D + tex - 1;
+    uint array_idx = mdl_texture_index_offset_2d() + tex - 1;
 
     ASSERT(array_idx < TEXTURE_COUNT_2D, "Error: invalid texture index\n");
 
@@ -95,4 +95,32 @@ void setup_mdl_shading_state(in vec2 hit_bc, out State state, out bool isFrontFa
 #endif
 }
 
+// Texture LOD of a hit for a ray cone of the given width, excluding the texture resolution.
+// See "Texture Level of Detail Strategies for Real-Time Ray Tracing", Ray Tracing Gems, ch. 20.
+float compute_tex_lod_footprint(float coneWidth, vec3 normal)
+{
+    BlasPayload payload = blas_payloads[gl_InstanceCustomIndexEXT];
+    IndexBuffer indices = IndexBuffer(payload.bufferAddress);
+    VertexBuffer vertices = VertexBuffer(payload.bufferAddress);
+
+    Face f = indices.data[gl_PrimitiveID];
+    uint vertexOffset = payload.vertexOffset;
+    FVertex v_0 = vertices.data[vertexOffset + f.v_0];
+    FVertex v_1 = vertices.data[vertexOffset + f.v_1];
+    FVertex v_2 = vertices.data[vertexOffset + f.v_2];
+
+    vec3 e_1 = vec3(gl_ObjectToWorldEXT * vec4(v_1.field1.xyz - v_0.field1.xyz, 0.0));
+    vec3 e_2 = vec3(gl_ObjectToWorldEXT * vec4(v_2.field1.xyz - v_0.field1.xyz, 0.0));
+    float worldArea = length(cross(e_1, e_2));
+
+    vec2 t_1 = v_1.field2.zw - v_0.field2.zw;
+    vec2 t_2 = v_2.field2.zw - v_0.field2.zw;
+    float uvArea = abs(t_1.x * t_2.y - t_1.y * t_2.x);
+
+    float lodConstant = 0.5 * log2(max(uvArea, 1e-20) / max(worldArea, 1e-20));
+    float cosTheta = max(abs(dot(gl_WorldRayDirectionEXT, normal)), 1e-5);
+
+    return lodConstant + log2(max(coneWidth, 1e-20) / cosTheta);
+}
+
 #endif
@@ -0,0 +1,382 @@
+#ifndef H_PREVIEW_SURFACE
+#define H_PREVIEW_SURFACE
+
+// Hand-written UsdPreviewSurface implementation of the functions that are otherwise generated
+// from MDL. All preview surface materials share this code; their parameters and texture bindings
+// are read from the argument block (see PREVIEW_SURFACE_* in rp_main.h).
+//
+// The BSDF is a clearcoat GGX lobe layered over a GGX specular lobe and a Lambertian diffuse
+// lobe, following the UsdPreviewSurface specification:
+// https://openusd.org/release/spec_usdpreviewsurface.html
+
+#define PS_MIN_ALPHA 0.001
+
+struct PreviewSurface
+{
+    vec3 diffuseColor;
+    vec3 specularColor;
+    float metallic;
+    float roughness;
+    float clearcoat;
+    float clearcoatRoughness;
+    float ior;
+    bool useSpecularWorkflow;
+};
+
+PreviewSurface ps_surface;
+vec3 ps_emissive_color;
+
+vec3 ps_read_vec3(uint offs)
+{
+    return vec3(mdl_read_argblock_as_float(int(offs)),
+                mdl_read_argblock_as_float(int(offs + 4)),
+                mdl_read_argblock_as_float(int(offs + 8)));
+}
+
+vec4 ps_read_vec4(uint offs)
+{
+    return vec4(ps_read_vec3(offs), mdl_read_argblock_as_float(int(offs + 12)));
+}
+
+vec3 ps_srgb_to_linear(vec3 c)
+{
+    return mix(c / 12.92, pow((c + 0.055) / 1.055, vec3(2.4)), greaterThan(c, vec3(0.04045)));
+}
+
+// Returns false if the input is not connected to a texture.
+bool ps_lookup_texture(uint input_idx, vec2 uv, out vec4 value, out uint channel)
+{
+    uint binding = PREVIEW_SURFACE_OFFSET_TEXTURES + input_idx * PREVIEW_SURFACE_TEXTURE_STRIDE;
+    uint info = mdl_read_argblock_as_uint(int(binding + PREVIEW_SURFACE_TEXTURE_OFFSET_INFO));
+
+    int tex = int(info & PREVIEW_SURFACE_TEXTURE_INDEX_MASK);
+    if (tex == 0)
+    {
+        value = vec4(0.0);
+        channel = 0;
+        return false;
+    }
+
+    int wrap_s = int((info >> PREVIEW_SURFACE_TEXTURE_WRAP_S_SHIFT) & 0x3u);
+    int wrap_t = int((info >> PREVIEW_SURFACE_TEXTURE_WRAP_T_SHIFT) & 0x3u);
+    channel = (info >> PREVIEW_SURFACE_TEXTURE_CHANNEL_SHIFT) & 0x7u;
+
+    value = tex_lookup_float4_2d(tex, uv, wrap_s, wrap_t, vec2(0.0, 1.0), vec2(0.0, 1.0), 0.0);
+
+    if ((info & PREVIEW_SURFACE_TEXTURE_FLAG_SRGB) != 0)
+    {
+        value.rgb = ps_srgb_to_linear(value.rgb);
+    }
+
+    vec4 scale = ps_read_vec4(binding + PREVIEW_SURFACE_TEXTURE_OFFSET_SCALE);
+    vec4 bias = ps_read_vec4(binding + PREVIEW_SURFACE_TEXTURE_OFFSET_BIAS);
+    value = value * scale + bias;
+
+    if ((info & PREVIEW_SURFACE_TEXTURE_FLAG_RECONSTRUCT_Z) != 0)
+    {
+        value.z = sqrt(max(0.0, 1.0 - dot(value.xy, value.xy)));
+    }
+    return true;
+}
+
+float ps_eval_float(uint input_idx, uint offs, vec2 uv)
+{
+    vec4 value;
+    uint channel;
+    if (!ps_lookup_texture(input_idx, uv, value, channel))
+    {
+        return mdl_read_argblock_as_float(int(offs));
+    }
+    return (channel == PREVIEW_SURFACE_CHANNEL_RGB) ? value.r : value[channel];
+}
+
+vec3 ps_eval_vec3(uint input_idx, uint offs, vec2 uv)
+{
+    vec4 value;
+    uint channel;
+    if (!ps_lookup_texture(input_idx, uv, value, channel))
+    {
+        return ps_read_vec3(offs);
+    }
+    return (channel == PREVIEW_SURFACE_CHANNEL_RGB) ? value.rgb : vec3(value[channel]);
+}
+
+float ps_luminance(vec3 c)
+{
+    return dot(c, vec3(0.2126, 0.7152, 0.0722));
+}
+
+vec3 ps_schlick(vec3 f0, float cos_theta)
+{
+    float m = 1.0 - clamp(cos_theta, 0.0, 1.0);
+    float m2 = m * m;
+    return f0 + (vec3(1.0) - f0) * (m2 * m2 * m);
+}
+
+float ps_ggx_d(float n_dot_h, float alpha)
+{
+    float a2 = alpha * alpha;
+    float t = n_dot_h * n_dot_h * (a2 - 1.0) + 1.0;
+    return a2 / (PI * t * t);
+}
+
+float ps_ggx_g1(float n_dot_x, float alpha)
+{
+    float a2 = alpha * alpha;
+    return 2.0 * n_dot_x / (n_dot_x + sqrt(a2 + (1.0 - a2) * n_dot_x * n_dot_x));
+}
+
+// Heitz 2018. Sampling the GGX Distribution of Visible Normals. JCGT.
+vec3 ps_sample_ggx_vndf(vec3 v, float alpha, vec2 xi)
+{
+    vec3 vh = normalize(vec3(alpha * v.x, alpha * v.y, v.z));
+
+    float lensq = vh.x * vh.x + vh.y * vh.y;
+    vec3 t1 = (lensq > 0.0) ? vec3(-vh.y, vh.x, 0.0) * inversesqrt(lensq) : vec3(1.0, 0.0, 0.0);
+    vec3 t2 = cross(vh, t1);
+
+    float r = sqrt(xi.x);
+    float phi = 2.0 * PI * xi.y;
+    float p1 = r * cos(phi);
+    float p2 = r * sin(phi);
+    float s = 0.5 * (1.0 + vh.z);
+    p2 = (1.0 - s) * sqrt(1.0 - p1 * p1) + s * p2;
+
+    vec3 nh = p1 * t1 + p2 * t2 + sqrt(max(0.0, 1.0 - p1 * p1 - p2 * p2)) * vh;
+    return normalize(vec3(alpha * nh.x, alpha * nh.y, max(0.0, nh.z)));
+}
+
+struct PsLobes
+{
+    vec3 diffuseAlbedo;
+    vec3 specularF0;
+    float specularAlpha;
+    float clearcoatWeight;
+    float clearcoatAlpha;
+    float baseWeight; // attenuation of the base layer by the clearcoat
+    float probDiffuse;
+    float probSpecular;
+    float probClearcoat;
+};
+
+PsLobes ps_setup_lobes(float n_dot_v)
+{
+    PreviewSurface s = ps_surface;
+
+    PsLobes l;
+    if (s.useSpecularWorkflow)
+    {
+        l.diffuseAlbedo = s.diffuseColor;
+        l.specularF0 = s.specularColor;
+    }
+    else
+    {
+        float r = (1.0 - s.ior) / (1.0 + s.ior);
+        l.diffuseAlbedo = s.diffuseColor * (1.0 - s.metallic);
+        l.specularF0 = mix(vec3(r * r), s.diffuseColor, s.metallic);
+    }
+    l.specularAlpha = max(s.roughness * s.roughness, PS_MIN_ALPHA);
+    l.clearcoatAlpha = max(s.clearcoatRoughness * s.clearcoatRoughness, PS_MIN_ALPHA);
+
+    // Clearcoat has an IOR of 1.5 (F0 = 0.04).
+    l.clearcoatWeight = s.clearcoat;
+    float clearcoatFresnel = s.clearcoat * ps_schlick(vec3(0.04), n_dot_v).x;
+    l.baseWeight = 1.0 - clearcoatFresnel;
+
+    vec3 specularFresnel = ps_schlick(l.specularF0, n_dot_v);
+    l.diffuseAlbedo *= vec3(1.0) - specularFresnel;
+
+    float wd = l.baseWeight * ps_luminance(l.diffuseAlbedo);
+    float ws = l.baseWeight * ps_luminance(specularFresnel);
+    float wc = clearcoatFresnel;
+    float wsum = wd + ws + wc;
+
+    l.probDiffuse = safe_div(wd, wsum);
+    l.probSpecular = safe_div(ws, wsum);
+    l.probClearcoat = safe_div(wc, wsum);
+    return l;
+}
+
+// Returns BSDF * cos split into diffuse and glossy parts, and the mixture pdf.
+void ps_eval_lobes(PsLobes l, vec3 n, vec3 k1, vec3 k2, out vec3 bsdf_diffuse, out vec3 bsdf_glossy, out float pdf)
+{
+    float n_dot_v = max(dot(n, k1), 1e-4);
+    float n_dot_l = dot(n, k2);
+
+    bsdf_diffuse = vec3(0.0);
+    bsdf_glossy = vec3(0.0);
+    pdf = 0.0;
+
+    if (n_dot_l <= 0.0)
+    {
+        return;
+    }
+
+    vec3 h = normalize(k1 + k2);
+    float n_dot_h = max(dot(n, h), 0.0);
+    float v_dot_h = max(dot(k1, h), 0.0);
+
+    bsdf_diffuse = l.baseWeight * l.diffuseAlbedo * (n_dot_l / PI);
+    pdf += l.probDiffuse * (n_dot_l / PI);
+
+    {
+        float d = ps_ggx_d(n_dot_h, l.specularAlpha);
+        float g1v = ps_ggx_g1(n_dot_v, l.specularAlpha);
+        float g = g1v * ps_ggx_g1(n_dot_l, l.specularAlpha);
+        bsdf_glossy += l.baseWeight * ps_schlick(l.specularF0, v_dot_h) * (d * g / (4.0 * n_dot_v));
+        pdf += l.probSpecular * (g1v * d / (4.0 * n_dot_v));
+    }
+
+    if (l.clearcoatWeight > 0.0)
+    {
+        float d = ps_ggx_d(n_dot_h, l.clearcoatAlpha);
+        float g1v = ps_ggx_g1(n_dot_v, l.clearcoatAlpha);
+        float g = g1v * ps_ggx_g1(n_dot_l, l.clearcoatAlpha);
+        bsdf_glossy += l.clearcoatWeight * ps_schlick(vec3(0.04), v_dot_h) * (d * g / (4.0 * n_dot_v));
+        pdf += l.probClearcoat * (g1v * d / (4.0 * n_dot_v));
+    }
+}
+
+void mdl_bsdf_scattering_init(inout State state)
+{
+    vec2 uv = state.text_coords[0].xy;
+
+    ps_surface.diffuseColor = ps_eval_vec3(PREVIEW_SURFACE_INPUT_DIFFUSE_COLOR, PREVIEW_SURFACE_OFFSET_DIFFUSE_COLOR, uv);
+    ps_surface.specularColor = ps_eval_vec3(PREVIEW_SURFACE_INPUT_SPECULAR_COLOR, PREVIEW_SURFACE_OFFSET_SPECULAR_COLOR, uv);
+    ps_surface.metallic = clamp(ps_eval_float(PREVIEW_SURFACE_INPUT_METALLIC, PREVIEW_SURFACE_OFFSET_METALLIC, uv), 0.0, 1.0);
+    ps_surface.roughness = clamp(ps_eval_float(PREVIEW_SURFACE_INPUT_ROUGHNESS, PREVIEW_SURFACE_OFFSET_ROUGHNESS, uv), 0.0, 1.0);
+    ps_surface.clearcoat = clamp(ps_eval_float(PREVIEW_SURFACE_INPUT_CLEARCOAT, PREVIEW_SURFACE_OFFSET_CLEARCOAT, uv), 0.0, 1.0);
+    ps_surface.clearcoatRoughness = clamp(ps_eval_float(PREVIEW_SURFACE_INPUT_CLEARCOAT_ROUGHNESS, PREVIEW_SURFACE_OFFSET_CLEARCOAT_ROUGHNESS, uv), 0.0, 1.0);
+    ps_surface.ior = mdl_read_argblock_as_float(int(PREVIEW_SURFACE_OFFSET_IOR));
+    ps_surface.useSpecularWorkflow = (mdl_read_argblock_as_uint(int(PREVIEW_SURFACE_OFFSET_FLAGS)) & PREVIEW_SURFACE_FLAG_SPECULAR_WORKFLOW) != 0;
+
+    vec4 texNormal;
+    uint channel;
+    if (ps_lookup_texture(PREVIEW_SURFACE_INPUT_NORMAL, uv, texNormal, channel))
+    {
+        vec3 n = texNormal.xyz;
+        vec3 mappedNormal = normalize(n.x * state.tangent_u[0] + n.y * state.tangent_v[0] + n.z * state.normal);
+        state.normal = mdl_adapt_normal(state, mappedNormal);
+    }
+}
+
+void mdl_bsdf_scattering_sample(inout Bsdf_sample_data sret_ptr, in State state)
+{
+    vec3 n = state.normal;
+    vec3 k1 = sret_ptr.k1;
+    float n_dot_v = max(dot(n, k1), 1e-4);
+
+    PsLobes l = ps_setup_lobes(n_dot_v);
+
+    vec3 t, b;
+    orthonormal_basis(n, t, b);
+
+    vec3 k2;
+    int eventType;
+    float xi = sret_ptr.xi.z;
+
+    if (xi < l.probDiffuse)
+    {
+        vec3 d = sample_hemisphere(sret_ptr.xi.xy);
+        k2 = d.x * t + d.y * b + d.z * n;
+        eventType = BSDF_EVENT_DIFFUSE_REFLECTION;
+    }
+    else if (xi < l.probDiffuse + l.probSpecular || l.probClearcoat == 0.0)
+    {
+        vec3 vl = vec3(dot(k1, t), dot(k1, b), n_dot_v);
+        vec3 hl = ps_sample_ggx_vndf(vl, l.specularAlpha, sret_ptr.xi.xy);
+        k2 = reflect(-k1, hl.x * t + hl.y * b + hl.z * n);
+        eventType = BSDF_EVENT_GLOSSY_REFLECTION;
+    }
+    else
+    {
+        vec3 vl = vec3(dot(k1, t), dot(k1, b), n_dot_v);
+        vec3 hl = ps_sample_ggx_vndf(vl, l.clearcoatAlpha, sret_ptr.xi.xy);
+        k2 = reflect(-k1, hl.x * t + hl.y * b + hl.z * n);
+        eventType = BSDF_EVENT_GLOSSY_REFLECTION;
+    }
+
+    vec3 bsdf_diffuse, bsdf_glossy;
+    float pdf;
+    ps_eval_lobes(l, n, k1, k2, bsdf_diffuse, bsdf_glossy, pdf);
+
+    if (pdf <= 0.0 || dot(k2, state.geom_normal) <= 0.0)
+    {
+        sret_ptr.pdf = 0.0;
+        sret_ptr.bsdf_over_pdf = vec3(0.0);
+        sret_ptr.event_type = BSDF_EVENT_ABSORB;
+        return;
+    }
+
+    sret_ptr.k2 = k2;
+    sret_ptr.pdf = pdf;
+    sret_ptr.bsdf_over_pdf = (bsdf_diffuse + bsdf_glossy) / pdf;
+    sret_ptr.event_type = eventType;
+    sret_ptr.handle = 0;
+}
+
+void mdl_bsdf_scattering_evaluate(inout Bsdf_evaluate_data sret_ptr, in State state)
+{
+    vec3 n = state.normal;
+    PsLobes l = ps_setup_lobes(max(dot(n, sret_ptr.k1), 1e-4));
+
+    if (dot(sret_ptr.k2, state.geom_normal) <= 0.0)
+    {
+        sret_ptr.bsdf_diffuse = vec3(0.0);
+        sret_ptr.bsdf_glossy = vec3(0.0);
+        sret_ptr.pdf = 0.0;
+        return;
+    }
+
+    ps_eval_lobes(l, n, sret_ptr.k1, sret_ptr.k2, sret_ptr.bsdf_diffuse, sret_ptr.bsdf_glossy, sret_ptr.pdf);
+}
+
+void mdl_edf_emission_init(inout State state)
+{
+    vec2 uv = state.text_coords[0].xy;
+    ps_emissive_color = ps_eval_vec3(PREVIEW_SURFACE_INPUT_EMISSIVE_COLOR, PREVIEW_SURFACE_OFFSET_EMISSIVE_COLOR, uv);
+}
+
+// Diffuse EDF. The emissive color is the emitted radiance.
+void mdl_edf_emission_evaluate(inout Edf_evaluate_data sret_ptr, in State state)
+{
+    float cos_theta = dot(state.normal, sret_ptr.k1);
+    sret_ptr.cos = cos_theta;
+    sret_ptr.edf = vec3(1.0);
+    sret_ptr.pdf = max(cos_theta, 0.0) / PI;
+}
+
+vec3 mdl_edf_emission_intensity(in State state)
+{
+    return ps_emissive_color;
+}
+
+vec3 mdl_volume_absorption_coefficient(in State state)
+{
+    return vec3(0.0);
+}
+
+vec3 mdl_volume_scattering_coefficient(in State state)
+{
+    return vec3(0.0);
+}
+
+vec3 mdl_ior(in State state)
+{
+    return vec3(mdl_read_argblock_as_float(int(PREVIEW_SURFACE_OFFSET_IOR)));
+}
+
+float mdl_cutout_opacity(in State state)
+{
+    vec2 uv = state.text_coords[0].xy;
+    float opacity = ps_eval_float(PREVIEW_SURFACE_INPUT_OPACITY, PREVIEW_SURFACE_OFFSET_OPACITY, uv);
+    float threshold = mdl_read_argblock_as_float(int(PREVIEW_SURFACE_OFFSET_OPACITY_THRESHOLD));
+
+    if (threshold > 0.0)
+    {
+        return (opacity < threshold) ? 0.0 : 1.0;
+    }
+    return clamp(opacity, 0.0, 1.0);
+}
+
+#endif
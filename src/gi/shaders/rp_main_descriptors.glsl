@@ -1,21 +1,10 @@
 #include "interface/rp_main.h"
 #include "common.glsl"
 
-#if SPHERE_LIGHT_COUNT > 0
 layout(binding = BINDING_INDEX_SPHERE_LIGHTS, std430) readonly buffer SphereLightBuffer { SphereLight sphereLights[]; };
-#endif
-
-#if DISTANT_LIGHT_COUNT > 0
 layout(binding = BINDING_INDEX_DISTANT_LIGHTS, std430) readonly buffer DistantLightBuffer { DistantLight distantLights[]; };
-#endif
-
-#if RECT_LIGHT_COUNT > 0
 layout(binding = BINDING_INDEX_RECT_LIGHTS, std430) readonly buffer RectLightBuffer { RectLight rectLights[]; };
-#endif
-
-#if DISK_LIGHT_COUNT > 0
 layout(binding = BINDING_INDEX_DISK_LIGHTS, std430) readonly buffer DiskLightBuffer { DiskLight diskLights[]; };
-#endif
 
 #if (TEXTURE_COUNT_2D > 0) || (TEXTURE_COUNT_3D > 0)
 layout(binding = BINDING_INDEX_SAMPLER) uniform sampler tex_sampler;
@@ -37,6 +26,10 @@ layout(binding = BINDING_INDEX_BLAS_PAYLOADS, std430) readonly buffer BlasPayloa
 
 layout(binding = BINDING_INDEX_INSTANCE_IDS, std430) readonly buffer InstanceIdsBuffer { int InstanceIds[]; };
 
+#ifdef MDL_ARG_BLOCKS
+layout(binding = BINDING_INDEX_ARG_BLOCKS, std430) readonly buffer ArgBlockBuffer { uint ArgBlocks[]; };
+#endif
+
 layout(binding = BINDING_INDEX_AOV_CLEAR_VALUES_F, std430) readonly buffer ClearValueBufferF { vec4 ClearValuesF[]; };
 layout(binding = BINDING_INDEX_AOV_CLEAR_VALUES_I, std430) readonly buffer ClearValueBufferI { ivec4 ClearValuesI[]; };
 
@@ -99,3 +92,14 @@ layout(buffer_reference, std430, buffer_reference_align = 32/* largest type: ver
 layout(buffer_reference, std430, buffer_reference_align = 4) buffer RawIntBuffer { int data[]; };
 
 layout(push_constant) uniform PushConstantBlock { PushConstants PC; };
+
+// Light counts are dynamic so that adding or removing lights does not require new shaders.
+uint get_sphere_light_count()  { return PC.sphereAndDistantLightCounts & 0xFFFFu; }
+uint get_distant_light_count() { return PC.sphereAndDistantLightCounts >> 16; }
+uint get_rect_light_count()    { return PC.rectAndDiskLightCounts & 0xFFFFu; }
+uint get_disk_light_count()    { return PC.rectAndDiskLightCounts >> 16; }
+
+uint get_total_light_count()
+{
+  return get_sphere_light_count() + get_distant_light_count() + get_rect_light_count() + get_disk_light_count();
+}
@@ -30,6 +30,8 @@ struct ShadeRayPayload
 
     /* inout */ vec3 radiance;
 
+    /* inout */ float coneWidth; // of the ray cone at the ray origin, for texture LOD selection
+
     /* inout */ RNG_STATE_TYPE rng_state;
 
 #if MEDIUM_STACK_SIZE > 0
@@ -15,6 +15,7 @@
 // along with this program. If not, see <https://www.gnu.org/licenses/>.
 //
 
+#include "materialCache.h"
 #include "tokens.h"
 
 #define DOCTEST_CONFIG_IMPLEMENT
@@ -29,14 +30,17 @@
 #include <pxr/base/plug/plugin.h>
 #include <pxr/base/plug/registry.h>
 #include <pxr/base/tf/getenv.h>
+#include <pxr/base/tf/stl.h>
 #include <pxr/base/tf/setenv.h>
 #include <pxr/imaging/hd/camera.h>
 #include <pxr/imaging/hd/engine.h>
+#include <pxr/imaging/hd/material.h>
 #include <pxr/imaging/hd/renderBuffer.h>
 #include <pxr/imaging/hd/renderDelegate.h>
 #include <pxr/imaging/hd/renderIndex.h>
 #include <pxr/imaging/hd/renderPass.h>
 #include <pxr/imaging/hd/renderPassState.h>
+#include <pxr/imaging/hd/sceneDelegate.h>
 #include <pxr/imaging/hd/rendererPlugin.h>
 #include <pxr/imaging/hd/rendererPluginHandle.h>
 #include <pxr/imaging/hd/rendererPluginRegistry.h>
@@ -47,12 +51,14 @@
 #include <pxr/imaging/hio/image.h>
 #include <pxr/imaging/hio/imageRegistry.h>
 #include <pxr/imaging/hio/types.h>
+#include <pxr/usd/sdf/assetPath.h>
 #include <pxr/usd/usd/stage.h>
 #include <pxr/usd/usdGeom/camera.h>
 #include <pxr/usd/usdRender/settings.h>
 #include <pxr/usd/usdRender/spec.h>
 #include <pxr/usdImaging/usdImaging/delegate.h>
 
+#include <chrono>
 #include <filesystem>
 
 namespace fs = std::filesystem;
@@ -160,6 +166,68 @@ namespace
     fs::path diffImg;
   };
 
+  HdMaterialNetwork2 _MakeTexturedPreviewSurfaceNetwork(const SdfPath& materialPath, float roughness)
+  {
+    SdfPath surfacePath = materialPath.AppendChild(TfToken("Surface"));
+    SdfPath texturePath = materialPath.AppendChild(TfToken("Texture"));
+
+    HdMaterialNode2 textureNode;
+    textureNode.nodeTypeId = TfToken("UsdUVTexture");
+    textureNode.parameters[TfToken("file")] = VtValue(SdfAssetPath("albedo.png"));
+
+    HdMaterialNode2 surfaceNode;
+    surfaceNode.nodeTypeId = TfToken("UsdPreviewSurface");
+    surfaceNode.parameters[TfToken("roughness")] = VtValue(roughness);
+    surfaceNode.inputConnections[TfToken("diffuseColor")] = { HdMaterialConnection2{ texturePath, TfToken("rgb") } };
+
+    HdMaterialNetwork2 network;
+    network.nodes[texturePath] = textureNode;
+    network.nodes[surfacePath] = surfaceNode;
+    network.terminals[HdMaterialTerminalTokens->surface] = HdMaterialConnection2{ surfacePath, TfToken("surface") };
+    return network;
+  }
+
+  // Provides a single UsdPreviewSurface network, for syncing material prims without a stage.
+  class _PreviewSurfaceSceneDelegate final : public HdSceneDelegate
+  {
+  public:
+    explicit _PreviewSurfaceSceneDelegate(HdRenderIndex* renderIndex)
+      : HdSceneDelegate(renderIndex, SdfPath::AbsoluteRootPath())
+    {
+    }
+
+  public:
+    VtValue GetMaterialResource(const SdfPath& id) override
+    {
+      HdMaterialNode surfaceNode;
+      surfaceNode.path = id.AppendChild(TfToken("Surface"));
+      surfaceNode.identifier = TfToken("UsdPreviewSurface");
+      surfaceNode.parameters[TfToken("roughness")] = VtValue(m_roughness);
+
+      HdMaterialNetworkMap networkMap;
+      networkMap.map[HdMaterialTerminalTokens->surface].nodes.push_back(surfaceNode);
+      networkMap.terminals.push_back(surfaceNode.path);
+      return VtValue(networkMap);
+    }
+
+    void setRoughness(float roughness)
+    {
+      m_roughness = roughness;
+    }
+
+  private:
+    float m_roughness = 0.5f;
+  };
+
+  size_t _GetMaterialCount(const HdRenderDelegate& renderDelegate)
+  {
+    VtDictionary stats = renderDelegate.GetRenderStats();
+    const VtValue* value = TfMapLookupPtr(stats, HdGatlingRenderStatsTokens->materialCount.GetString());
+    REQUIRE(value);
+    REQUIRE(value->IsHolding<size_t>());
+    return value->UncheckedGet<size_t>();
+  }
+
   _GraphicalTestPaths _MakeGraphicalTestPaths(const std::string& name)
   {
     std::string testImgName = "test";
@@ -191,6 +259,7 @@ TF_DEFINE_PRIVATE_TOKENS(
   _nsTokens,
   ((spp, "gtl:spp"))
   ((errorPixelThreshold, "gtl:errorPixelThreshold"))
+  ((errorTolerance, "gtl:errorTolerance"))
   ((jitteredSampling, "gtl:jitteredSampling"))
   ((clippingPlanes, "gtl:clippingPlanes"))
 );
@@ -231,6 +300,7 @@ private:
   {
     uint32_t spp = 1;
     uint32_t errorPixelThreshold = 0;
+    uint32_t errorTolerance = 0; // per 8-bit channel
     bool jitteredSampling = true;
     bool clippingPlanes = false;
   };
@@ -300,6 +370,14 @@ private:
         settings.errorPixelThreshold = it->second.UncheckedGet<int>();
       }
     }
+    {
+      auto it = ns.find(_nsTokens->errorTolerance);
+      if (it != ns.end())
+      {
+        REQUIRE(it->second.IsHolding<int>());
+        settings.errorTolerance = it->second.UncheckedGet<int>();
+      }
+    }
     {
       auto it = ns.find(_nsTokens->jitteredSampling);
       if (it != ns.end())
@@ -322,10 +400,8 @@ private:
                       uint32_t width, uint32_t height,
                       const fs::path& refPath,
                       const fs::path& diffPath,
-                      uint32_t errorPixelThreshold)
+                      const NamespacedSettings& settings)
   {
-    fs::remove(diffPath);
-
     HioImageSharedPtr refImage = HioImage::OpenForReading(refPath.string());
     REQUIRE(refImage);
 
@@ -339,12 +415,26 @@ private:
     HioImage::StorageSpec refStorage = _MakeStorageSpec(width, height, refValues.data());
     REQUIRE(refImage->Read(refStorage));
 
+    diffImages(refValues, testValues, width, height, diffPath, settings);
+  }
+
+  void diffImages(const std::vector<uint8_t>& refValues,
+                  const std::vector<uint8_t>& testValues,
+                  uint32_t width, uint32_t height,
+                  const fs::path& diffPath,
+                  const NamespacedSettings& settings)
+  {
+    fs::remove(diffPath);
+
+    int byteCount = width * height * 4;
+
+    // Channels within the tolerance are not counted, but still show up in the diff image.
     int errorPixelCount = 0;
     std::vector<uint8_t> diffValues(byteCount);
     for (uint32_t i = 0; i < byteCount; i++)
     {
       int diff = std::abs(int(refValues[i]) - int(testValues[i]));
-      errorPixelCount += (diff > 0) ? 1 : 0;
+      errorPixelCount += (diff > int(settings.errorTolerance)) ? 1 : 0;
       diffValues[i] = 255 - uint8_t(diff);
     }
 
@@ -354,17 +444,24 @@ private:
       return;
     }
 
-    CHECK_LE(errorPixelCount, errorPixelThreshold);
+    CHECK_LE(errorPixelCount, settings.errorPixelThreshold);
 
-    HioImageSharedPtr diffImage = HioImage::OpenForWriting(diffPath.string());
-    REQUIRE(diffImage);
+    writeImage(diffPath, width, height, diffValues);
+  }
+
+  void writeImage(const fs::path& path, uint32_t width, uint32_t height, std::vector<uint8_t>& values)
+  {
+    fs::create_directories(path.parent_path());
+    HioImageSharedPtr image = HioImage::OpenForWriting(path.string());
+    REQUIRE(image);
 
     VtDictionary metadata;
-    HioImage::StorageSpec diffStorage = _MakeStorageSpec(width, height, diffValues.data());
-    REQUIRE(diffImage->Write(diffStorage, metadata));
+    HioImage::StorageSpec storage = _MakeStorageSpec(width, height, values.data());
+    REQUIRE(image->Write(storage, metadata));
   }
 
-  void produceProduct(const UsdRenderSpec::Product& product)
+  // Returns 8-bit RGBA values of the product's render var.
+  std::vector<uint8_t> renderProduct(const UsdRenderSpec::Product& product, NamespacedSettings& namespacedSettings)
   {
     const auto& renderVarIndices = product.renderVarIndices;
     REQUIRE_EQ(renderVarIndices.size(), 1);
@@ -374,7 +471,6 @@ private:
     const UsdRenderSpec::RenderVar& renderVar = renderVars[renderVarIndices[0]];
 
     // Set render settings.
-    NamespacedSettings namespacedSettings;
     readNamespacedSettings(product.namespacedSettings, namespacedSettings);
 
     setRenderSetting(HdGatlingSettingsTokens->spp, VtValue(namespacedSettings.spp));
@@ -469,24 +565,27 @@ private:
 
     renderBuffer->Unmap();
 
-    std::string productName = product.name.GetString();
-    auto paths = _MakeGraphicalTestPaths(productName);
-
-    fs::create_directories(paths.testImg.parent_path());
-    HioImageSharedPtr image = HioImage::OpenForWriting(paths.testImg.string());
-    REQUIRE(image);
-
-    VtDictionary metadata;
-    HioImage::StorageSpec testStorage = _MakeStorageSpec(width, height, byteValues.data());
-    REQUIRE(image->Write(testStorage, metadata));
-
-    diffAgainstRef(byteValues, width, height, paths.refImg, paths.diffImg, namespacedSettings.errorPixelThreshold);
-
     // Dispose of resources.
     HdRenderParam* renderParam = m_renderDelegate->GetRenderParam();
     REQUIRE(renderParam);
     renderBuffer->Finalize(renderParam);
     m_renderDelegate->DestroyBprim(renderBuffer);
+
+    return byteValues;
+  }
+
+  void produceProduct(const UsdRenderSpec::Product& product)
+  {
+    NamespacedSettings namespacedSettings;
+    std::vector<uint8_t> byteValues = renderProduct(product, namespacedSettings);
+
+    uint32_t width = product.resolution[0];
+    uint32_t height = product.resolution[1];
+
+    auto paths = _MakeGraphicalTestPaths(product.name.GetString());
+    writeImage(paths.testImg, width, height, byteValues);
+
+    diffAgainstRef(byteValues, width, height, paths.refImg, paths.diffImg, namespacedSettings);
   }
 
 public:
@@ -498,6 +597,31 @@ public:
     }
   }
 
+  // Renders each product with two values of a render setting and compares the images, instead
+  // of comparing against stored references. The reference render is written next to the test image.
+  void performComparisonTest(const TfToken& settingName, const VtValue& refValue, const VtValue& testValue)
+  {
+    for (const UsdRenderSpec::Product product : m_renderSpec.products)
+    {
+      NamespacedSettings namespacedSettings;
+
+      setRenderSetting(settingName, refValue);
+      std::vector<uint8_t> refValues = renderProduct(product, namespacedSettings);
+
+      setRenderSetting(settingName, testValue);
+      std::vector<uint8_t> testValues = renderProduct(product, namespacedSettings);
+
+      uint32_t width = product.resolution[0];
+      uint32_t height = product.resolution[1];
+
+      auto paths = _MakeGraphicalTestPaths(product.name.GetString());
+      writeImage(paths.testImg, width, height, testValues);
+      writeImage(_GetTestOutputDir() / paths.refImg.filename(), width, height, refValues);
+
+      diffImages(refValues, testValues, width, height, paths.diffImg, namespacedSettings);
+    }
+  }
+
   const UsdStageRefPtr& getStage()
   {
     return m_stage;
@@ -545,6 +669,13 @@ TEST_SUITE("Graphical")
   {
   }
 
+  // The native UsdPreviewSurface implementation has to match the MDL one.
+  TEST_CASE_FIXTURE(GraphicalTestFixture, "Materials.PreviewSurfaceFastPath")
+  {
+    GraphicalTestContext context(_GetTestInputDir() / "scene.usd");
+    context.performComparisonTest(HdGatlingSettingsTokens->previewSurfaceFastPath, VtValue(false), VtValue(true));
+  }
+
   TEST_CASE_FIXTURE(SimpleGraphicalTestFixture, "Mesh.PrimvarInterpolation")
   {
   }
@@ -557,3 +688,187 @@ TEST_SUITE("Graphical")
   {
   }
 }
+
+TEST_CASE("MaterialCache.DuplicateNetworks")
+{
+  HdMaterialNetwork2 network1 = _MakeTexturedPreviewSurfaceNetwork(SdfPath("/Variant1/Material"), 0.5f);
+  HdMaterialNetwork2 network2 = _MakeTexturedPreviewSurfaceNetwork(SdfPath("/Variant2/Looks/Material"), 0.5f);
+
+  size_t hash1 = MaterialCache::HashNetwork(network1);
+  size_t hash2 = MaterialCache::HashNetwork(network2);
+  REQUIRE_EQ(hash1, hash2);
+
+  // Fake materials; the cache never dereferences them.
+  uint8_t materialStorage[2];
+  uint32_t compileCount = 0;
+  uint32_t destroyCount = 0;
+
+  MaterialCache cache([&](GiMaterial*) { destroyCount++; });
+
+  auto compileFunc = [&]() { return (GiMaterial*) &materialStorage[compileCount++]; };
+
+  GiMaterial* material1 = cache.Acquire(hash1, network1, compileFunc);
+  GiMaterial* material2 = cache.Acquire(hash2, network2, compileFunc);
+  CHECK_EQ(compileCount, 1);
+  CHECK_EQ(material1, material2);
+  CHECK_FALSE(cache.IsExclusive(material1));
+
+  cache.Release(material1);
+  CHECK_EQ(destroyCount, 0);
+  CHECK(cache.IsExclusive(material2));
+
+  cache.Release(material2);
+  CHECK_EQ(destroyCount, 1);
+
+  // A released material has to be compiled again.
+  GiMaterial* material3 = cache.Acquire(hash1, network1, compileFunc);
+  CHECK_EQ(compileCount, 2);
+  cache.Release(material3);
+  CHECK_EQ(destroyCount, 2);
+}
+
+TEST_CASE("MaterialCache.HashCollision")
+{
+  HdMaterialNetwork2 network1 = _MakeTexturedPreviewSurfaceNetwork(SdfPath("/Material1"), 0.5f);
+  HdMaterialNetwork2 network2 = _MakeTexturedPreviewSurfaceNetwork(SdfPath("/Material2"), 0.25f);
+  CHECK(MaterialCache::NetworksMatch(network1, _MakeTexturedPreviewSurfaceNetwork(SdfPath("/Other"), 0.5f)));
+  CHECK_FALSE(MaterialCache::NetworksMatch(network1, network2));
+
+  uint8_t materialStorage[2];
+  uint32_t compileCount = 0;
+  uint32_t destroyCount = 0;
+
+  MaterialCache cache([&](GiMaterial*) { destroyCount++; });
+
+  auto compileFunc = [&]() { return (GiMaterial*) &materialStorage[compileCount++]; };
+
+  // Simulate a collision by passing the same hash for different networks.
+  const size_t hash = 42;
+  GiMaterial* material1 = cache.Acquire(hash, network1, compileFunc);
+  GiMaterial* material2 = cache.Acquire(hash, network2, compileFunc);
+  CHECK_EQ(compileCount, 2);
+  CHECK_NE(material1, material2);
+  CHECK(cache.IsExclusive(material1));
+  CHECK(cache.IsExclusive(material2));
+
+  CHECK_EQ(cache.Acquire(hash, network2, compileFunc), material2);
+  CHECK_EQ(compileCount, 2);
+
+  cache.Release(material2);
+  cache.Release(material2);
+  cache.Release(material1);
+  CHECK_EQ(destroyCount, 2);
+}
+
+TEST_CASE("MaterialCache.NetworkHashDifferences")
+{
+  SdfPath materialPath("/Material");
+  HdMaterialNetwork2 network = _MakeTexturedPreviewSurfaceNetwork(materialPath, 0.5f);
+  size_t hash = MaterialCache::HashNetwork(network);
+
+  SUBCASE("Parameter value")
+  {
+    HdMaterialNetwork2 otherNetwork = _MakeTexturedPreviewSurfaceNetwork(materialPath, 0.25f);
+    CHECK_NE(hash, MaterialCache::HashNetwork(otherNetwork));
+  }
+
+  SUBCASE("Upstream parameter value")
+  {
+    HdMaterialNetwork2 otherNetwork = network;
+    HdMaterialNode2& textureNode = otherNetwork.nodes[materialPath.AppendChild(TfToken("Texture"))];
+    textureNode.parameters[TfToken("file")] = VtValue(SdfAssetPath("roughness.png"));
+    CHECK_NE(hash, MaterialCache::HashNetwork(otherNetwork));
+  }
+
+  SUBCASE("Connection")
+  {
+    HdMaterialNetwork2 otherNetwork = network;
+    HdMaterialNode2& surfaceNode = otherNetwork.nodes[materialPath.AppendChild(TfToken("Surface"))];
+    surfaceNode.inputConnections[TfToken("emissiveColor")] = surfaceNode.inputConnections[TfToken("diffuseColor")];
+    surfaceNode.inputConnections.erase(TfToken("diffuseColor"));
+    CHECK_NE(hash, MaterialCache::HashNetwork(otherNetwork));
+  }
+
+  SUBCASE("Upstream output")
+  {
+    HdMaterialNetwork2 otherNetwork = network;
+    HdMaterialNode2& surfaceNode = otherNetwork.nodes[materialPath.AppendChild(TfToken("Surface"))];
+    surfaceNode.inputConnections[TfToken("diffuseColor")][0].upstreamOutputName = TfToken("r");
+    CHECK_NE(hash, MaterialCache::HashNetwork(otherNetwork));
+  }
+}
+
+TEST_CASE("Material.ResyncReleasesPreviousMaterial")
+{
+  HdRendererPluginRegistry& pluginRegistry = HdRendererPluginRegistry::GetInstance();
+  HdRendererPluginHandle plugin = pluginRegistry.GetOrCreateRendererPlugin(_tokens->HdGatlingRendererPlugin);
+  REQUIRE(plugin);
+  REQUIRE(plugin->IsSupported());
+
+  HdRenderDelegate* renderDelegate = plugin->CreateRenderDelegate();
+  REQUIRE(renderDelegate);
+
+  HdRenderIndex* renderIndex = HdRenderIndex::New(renderDelegate, HdDriverVector());
+  REQUIRE(renderIndex);
+
+  {
+    _PreviewSurfaceSceneDelegate sceneDelegate(renderIndex);
+
+    size_t baseMaterialCount = _GetMaterialCount(*renderDelegate);
+
+    HdSprim* material = renderDelegate->CreateSprim(HdPrimTypeTokens->material, SdfPath("/Material"));
+    REQUIRE(material);
+
+    // Each edit replaces the network; the material of the previous one must not stay alive.
+    for (int i = 0; i < 16; i++)
+    {
+      sceneDelegate.setRoughness(float(i) / 16.0f);
+
+      HdDirtyBits dirtyBits = HdMaterial::DirtyParams;
+      material->Sync(&sceneDelegate, renderDelegate->GetRenderParam(), &dirtyBits);
+
+      CHECK_EQ(_GetMaterialCount(*renderDelegate), baseMaterialCount + 1);
+    }
+
+    renderDelegate->DestroySprim(material);
+    CHECK_EQ(_GetMaterialCount(*renderDelegate), baseMaterialCount);
+  }
+
+  delete renderIndex;
+  plugin->DeleteRenderDelegate(renderDelegate);
+}
+
+TEST_CASE("RendererPlugin.LazyInitialization")
+{
+  using Clock = std::chrono::steady_clock;
+  using Ms = std::chrono::duration<double, std::milli>;
+
+  HdRendererPluginRegistry& pluginRegistry = HdRendererPluginRegistry::GetInstance();
+
+  // Plugin discovery, as done by tools that list the available renderers.
+  Clock::time_point discoveryStart = Clock::now();
+
+  HfPluginDescVector pluginDescs;
+  pluginRegistry.GetPluginDescs(&pluginDescs);
+
+  HdRendererPluginHandle plugin = pluginRegistry.GetOrCreateRendererPlugin(_tokens->HdGatlingRendererPlugin);
+  REQUIRE(plugin);
+  CHECK(plugin->IsSupported());
+
+  Ms discoveryDuration = Clock::now() - discoveryStart;
+
+  // Renderer initialization is deferred to the first delegate.
+  Clock::time_point delegateStart = Clock::now();
+
+  HdRenderDelegate* renderDelegate = plugin->CreateRenderDelegate();
+  REQUIRE(renderDelegate);
+
+  Ms delegateDuration = Clock::now() - delegateStart;
+
+  plugin->DeleteRenderDelegate(renderDelegate);
+
+  MESSAGE("plugin discovery took ", discoveryDuration.count(), "ms");
+  MESSAGE("first delegate creation took ", delegateDuration.count(), "ms");
+
+  CHECK_LT(discoveryDuration.count(), delegateDuration.count());
+}
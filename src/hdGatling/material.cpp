@@ -35,7 +35,7 @@ HdGatlingMaterial::~HdGatlingMaterial()
 {
   if (_giMaterial)
   {
-    giDestroyMaterial(_giMaterial);
+    _materialNetworkCompiler.ReleaseMaterial(_giMaterial);
     _giMaterial = nullptr;
   }
 }
@@ -67,7 +67,7 @@ void HdGatlingMaterial::Sync(HdSceneDelegate* sceneDelegate,
   {
     if (_giMaterial)
     {
-      giDestroyMaterial(_giMaterial);
+      _materialNetworkCompiler.ReleaseMaterial(_giMaterial);
       _giMaterial = nullptr;
     }
     return;
@@ -83,13 +83,34 @@ void HdGatlingMaterial::Sync(HdSceneDelegate* sceneDelegate,
 
     if (_giMaterial)
     {
-      giDestroyMaterial(_giMaterial);
+      _materialNetworkCompiler.ReleaseMaterial(_giMaterial);
       _giMaterial = nullptr;
     }
     return;
   }
 
-  _giMaterial = _materialNetworkCompiler.CompileNetwork(id, network);
+  GiMaterial* newMaterial = _materialNetworkCompiler.CompileNetwork(id, network);
+
+  // The network is unchanged, so we received our own material from the cache.
+  if (newMaterial && newMaterial == _giMaterial)
+  {
+    _materialNetworkCompiler.ReleaseMaterial(newMaterial);
+    return;
+  }
+
+  // Parameter edits of class-compiled materials are applied in-place; no shader rebuild is needed.
+  if (_giMaterial && newMaterial && _materialNetworkCompiler.UpdateMaterialParameters(_giMaterial, newMaterial))
+  {
+    return;
+  }
+
+  // Meshes keep the previous material alive until they are synced and pick up the new one.
+  if (_giMaterial)
+  {
+    _materialNetworkCompiler.ReleaseMaterial(_giMaterial);
+  }
+
+  _giMaterial = newMaterial;
 }
 
 const GiMaterial* HdGatlingMaterial::GetGiMaterial() const
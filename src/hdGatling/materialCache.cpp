@@ -0,0 +1,315 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include "materialCache.h"
+
+#include <pxr/base/tf/hash.h>
+#include <pxr/imaging/hd/material.h>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+namespace
+{
+  using _NodeHashes = std::unordered_map<SdfPath, size_t, SdfPath::Hash>;
+
+  size_t _HashNode(const HdMaterialNetwork2& network, const SdfPath& path, _NodeHashes& nodeHashes)
+  {
+    auto hashIt = nodeHashes.find(path);
+    if (hashIt != nodeHashes.end())
+    {
+      return hashIt->second;
+    }
+
+    auto nodeIt = network.nodes.find(path);
+    if (nodeIt == network.nodes.end())
+    {
+      return 0; // dangling connection
+    }
+
+    // Guards against cycles in malformed networks.
+    nodeHashes[path] = 0;
+
+    const HdMaterialNode2& node = nodeIt->second;
+
+    // Instead of the node path, upstream nodes are identified by their own hash. Parameters and
+    // inputs are stored in ordered maps, so the result does not depend on the authoring order.
+    size_t hash = TfHash()(node.nodeTypeId);
+
+    for (const auto& [name, value] : node.parameters)
+    {
+      hash = TfHash::Combine(hash, name, value.GetHash());
+    }
+
+    for (const auto& [name, connections] : node.inputConnections)
+    {
+      hash = TfHash::Combine(hash, name, connections.size());
+
+      for (const HdMaterialConnection2& connection : connections)
+      {
+        size_t upstreamHash = _HashNode(network, connection.upstreamNode, nodeHashes);
+        hash = TfHash::Combine(hash, upstreamHash, connection.upstreamOutputName);
+      }
+    }
+
+    nodeHashes[path] = hash;
+    return hash;
+  }
+
+  // Maps node paths of the first network to the ones of the second.
+  using _NodeMapping = std::unordered_map<SdfPath, SdfPath, SdfPath::Hash>;
+
+  bool _NodesMatch(const HdMaterialNetwork2& a, const SdfPath& pathA,
+                   const HdMaterialNetwork2& b, const SdfPath& pathB,
+                   _NodeMapping& mapping)
+  {
+    auto mappingIt = mapping.find(pathA);
+    if (mappingIt != mapping.end())
+    {
+      return mappingIt->second == pathB;
+    }
+
+    // Also guards against cycles in malformed networks.
+    mapping[pathA] = pathB;
+
+    auto nodeItA = a.nodes.find(pathA);
+    auto nodeItB = b.nodes.find(pathB);
+    if (nodeItA == a.nodes.end() || nodeItB == b.nodes.end())
+    {
+      return (nodeItA == a.nodes.end()) == (nodeItB == b.nodes.end()); // dangling connections
+    }
+
+    const HdMaterialNode2& nodeA = nodeItA->second;
+    const HdMaterialNode2& nodeB = nodeItB->second;
+
+    if (nodeA.nodeTypeId != nodeB.nodeTypeId ||
+        nodeA.parameters != nodeB.parameters ||
+        nodeA.inputConnections.size() != nodeB.inputConnections.size())
+    {
+      return false;
+    }
+
+    // Inputs are stored in ordered maps, so they can be compared pairwise.
+    auto inputItB = nodeB.inputConnections.begin();
+    for (const auto& [name, connectionsA] : nodeA.inputConnections)
+    {
+      const auto& [nameB, connectionsB] = *(inputItB++);
+
+      if (name != nameB || connectionsA.size() != connectionsB.size())
+      {
+        return false;
+      }
+
+      for (size_t i = 0; i < connectionsA.size(); i++)
+      {
+        if (connectionsA[i].upstreamOutputName != connectionsB[i].upstreamOutputName ||
+            !_NodesMatch(a, connectionsA[i].upstreamNode, b, connectionsB[i].upstreamNode, mapping))
+        {
+          return false;
+        }
+      }
+    }
+
+    return true;
+  }
+}
+
+MaterialCache::MaterialCache(const DestroyFunc& destroyFunc)
+  : _destroyFunc(destroyFunc)
+{
+}
+
+size_t MaterialCache::HashNetwork(const HdMaterialNetwork2& network)
+{
+  _NodeHashes nodeHashes;
+
+  // Unconnected nodes don't contribute to the material, but MDL networks must consist of a single node.
+  size_t hash = TfHash()(network.nodes.size());
+
+  for (const auto& [name, connection] : network.terminals)
+  {
+    size_t upstreamHash = _HashNode(network, connection.upstreamNode, nodeHashes);
+    hash = TfHash::Combine(hash, name, upstreamHash, connection.upstreamOutputName);
+  }
+
+  for (const TfToken& primvar : network.primvars)
+  {
+    hash = TfHash::Combine(hash, primvar);
+  }
+
+  return hash;
+}
+
+bool MaterialCache::NetworksMatch(const HdMaterialNetwork2& a, const HdMaterialNetwork2& b)
+{
+  if (a.nodes.size() != b.nodes.size() ||
+      a.terminals.size() != b.terminals.size() ||
+      a.primvars != b.primvars)
+  {
+    return false;
+  }
+
+  _NodeMapping mapping;
+
+  auto terminalItB = b.terminals.begin();
+  for (const auto& [name, connectionA] : a.terminals)
+  {
+    const auto& [nameB, connectionB] = *(terminalItB++);
+
+    if (name != nameB ||
+        connectionA.upstreamOutputName != connectionB.upstreamOutputName ||
+        !_NodesMatch(a, connectionA.upstreamNode, b, connectionB.upstreamNode, mapping))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+GiMaterial* MaterialCache::Acquire(size_t networkHash, const HdMaterialNetwork2& network, const CompileFunc& compileFunc)
+{
+  {
+    std::lock_guard guard(_mutex);
+
+    auto it = _FindEntry(networkHash, network);
+    if (it != _entries.end())
+    {
+      it->second.useCount++;
+      return it->second.material;
+    }
+  }
+
+  // Compile without holding the lock, so that different networks can be compiled concurrently.
+  GiMaterial* material = compileFunc();
+  if (!material)
+  {
+    return nullptr;
+  }
+
+  std::lock_guard guard(_mutex);
+
+  auto it = _FindEntry(networkHash, network);
+  if (it != _entries.end())
+  {
+    // The same network was compiled concurrently.
+    _destroyFunc(material);
+  }
+  else
+  {
+    it = _entries.emplace(networkHash, _Entry{ network, material, 0 });
+    _networkHashes[material] = networkHash;
+  }
+
+  it->second.useCount++;
+  return it->second.material;
+}
+
+void MaterialCache::Release(GiMaterial* material)
+{
+  std::lock_guard guard(_mutex);
+
+  auto it = _FindEntry(material);
+  if (!TF_VERIFY(it != _entries.end()))
+  {
+    return;
+  }
+
+  if (--it->second.useCount > 0)
+  {
+    return;
+  }
+
+  _entries.erase(it);
+  _networkHashes.erase(material);
+  _destroyFunc(material);
+}
+
+bool MaterialCache::IsExclusive(const GiMaterial* material) const
+{
+  std::lock_guard guard(_mutex);
+
+  auto it = const_cast<MaterialCache*>(this)->_FindEntry(material);
+
+  return it != _entries.end() && it->second.useCount == 1;
+}
+
+void MaterialCache::Supersede(GiMaterial* material, GiMaterial* paramMaterial)
+{
+  std::lock_guard guard(_mutex);
+
+  auto it = _FindEntry(material);
+  auto paramIt = _FindEntry(paramMaterial);
+  if (!TF_VERIFY(it != _entries.end() && paramIt != _entries.end()))
+  {
+    return;
+  }
+
+  // The material now represents the parameter network.
+  paramIt->second.material = material;
+  _networkHashes[material] = paramIt->first;
+  _networkHashes.erase(paramMaterial);
+  _entries.erase(it);
+
+  _destroyFunc(paramMaterial);
+}
+
+MaterialCache::_EntryMap::iterator MaterialCache::_FindEntry(size_t networkHash, const HdMaterialNetwork2& network)
+{
+  auto [begin, end] = _entries.equal_range(networkHash);
+
+  // Colliding hashes of different networks must not share a material.
+  for (auto it = begin; it != end; ++it)
+  {
+    if (NetworksMatch(it->second.network, network))
+    {
+      return it;
+    }
+  }
+
+  return _entries.end();
+}
+
+MaterialCache::_EntryMap::iterator MaterialCache::_FindEntry(const GiMaterial* material)
+{
+  auto hashIt = _networkHashes.find(material);
+  if (hashIt == _networkHashes.end())
+  {
+    return _entries.end();
+  }
+
+  auto [begin, end] = _entries.equal_range(hashIt->second);
+
+  for (auto it = begin; it != end; ++it)
+  {
+    if (it->second.material == material)
+    {
+      return it;
+    }
+  }
+
+  return _entries.end();
+}
+
+size_t MaterialCache::GetMaterialCount() const
+{
+  std::lock_guard guard(_mutex);
+
+  return _entries.size();
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,94 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <pxr/pxr.h>
+#include <pxr/imaging/hd/material.h>
+
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+namespace gtl
+{
+  struct GiMaterial;
+}
+
+using namespace gtl;
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+// Shares materials between identical networks, which variant-driven assets often have
+// hundreds of under different prim paths. Materials are ref-counted per network; the
+// hash only selects candidates, which are compared structurally.
+class MaterialCache
+{
+public:
+  using CompileFunc = std::function<GiMaterial*()>;
+  using DestroyFunc = std::function<void(GiMaterial*)>;
+
+  // Materials that are still in use when the cache is destroyed are not destroyed.
+  explicit MaterialCache(const DestroyFunc& destroyFunc);
+
+public:
+  // Independent of node paths, but respects node types, parameter values and connections.
+  static size_t HashNetwork(const HdMaterialNetwork2& network);
+
+  // True if the networks only differ in node paths.
+  static bool NetworksMatch(const HdMaterialNetwork2& a, const HdMaterialNetwork2& b);
+
+  // Returns the material of the network and increments its use count. The material is only
+  // compiled if it is not cached. Failed compilations are not cached.
+  GiMaterial* Acquire(size_t networkHash, const HdMaterialNetwork2& network, const CompileFunc& compileFunc);
+
+  void Release(GiMaterial* material);
+
+  // True if the material is used once, so that it may be modified in-place.
+  bool IsExclusive(const GiMaterial* material) const;
+
+  // Lets 'material' take the place of 'paramMaterial', after its parameters have been
+  // applied in-place. Both must be exclusive. The parameter material is destroyed.
+  void Supersede(GiMaterial* material, GiMaterial* paramMaterial);
+
+  // Number of distinct materials that are currently in use.
+  size_t GetMaterialCount() const;
+
+private:
+  struct _Entry
+  {
+    HdMaterialNetwork2 network;
+    GiMaterial* material;
+    uint32_t useCount;
+  };
+
+  using _EntryMap = std::unordered_multimap<size_t, _Entry>;
+
+  _EntryMap::iterator _FindEntry(size_t networkHash, const HdMaterialNetwork2& network);
+
+  _EntryMap::iterator _FindEntry(const GiMaterial* material);
+
+private:
+  DestroyFunc _destroyFunc;
+
+  mutable std::mutex _mutex;
+  _EntryMap _entries;
+  std::unordered_map<const GiMaterial*, size_t> _networkHashes;
+};
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -24,6 +24,10 @@
 #include <pxr/usd/sdr/registry.h>
 #include <pxr/usd/sdr/shaderProperty.h>
 #include <pxr/usd/sdf/schema.h>
+#include <pxr/usd/sdf/assetPath.h>
+#include <pxr/usd/usdUtils/pipeline.h>
+#include <pxr/base/gf/vec3f.h>
+#include <pxr/base/gf/vec4f.h>
 #include <pxr/imaging/hdMtlx/hdMtlx.h>
 
 #include <MaterialXCore/Document.h>
@@ -71,6 +75,28 @@ TF_DEFINE_PRIVATE_TOKENS(
   (result)
   (out)
   ((_auto, "auto"))
+  (file)
+  (st)
+  (varname)
+  (scale)
+  (bias)
+  (r)
+  (g)
+  (b)
+  (a)
+  (diffuseColor)
+  (emissiveColor)
+  (specularColor)
+  (metallic)
+  (roughness)
+  (clearcoat)
+  (clearcoatRoughness)
+  (opacity)
+  (opacityThreshold)
+  (ior)
+  (useSpecularWorkflow)
+  (displacement)
+  (occlusion)
   // MaterialX tokens
   (ND_UsdPreviewSurface_surfaceshader)
   (ND_UsdPrimvarReader_integer)
@@ -417,26 +443,339 @@ bool _GetMaterialNetworkSurfaceTerminal(const HdMaterialNetwork2& network2, HdMa
   return true;
 }
 
+template<typename T>
+bool _GetValue(const VtValue& value, T& result)
+{
+  VtValue castValue = VtValue::Cast<T>(value);
+  if (castValue.IsEmpty())
+  {
+    return false;
+  }
+
+  result = castValue.UncheckedGet<T>();
+  return true;
+}
+
+bool _GetPreviewSurfaceInput(const TfToken& name, GiPreviewSurfaceInput& input)
+{
+  static const std::unordered_map<TfToken, GiPreviewSurfaceInput, TfToken::HashFunctor> inputs = {
+    { _tokens->diffuseColor,       GiPreviewSurfaceInput::DiffuseColor       },
+    { _tokens->emissiveColor,      GiPreviewSurfaceInput::EmissiveColor      },
+    { _tokens->specularColor,      GiPreviewSurfaceInput::SpecularColor      },
+    { _tokens->metallic,           GiPreviewSurfaceInput::Metallic           },
+    { _tokens->roughness,          GiPreviewSurfaceInput::Roughness          },
+    { _tokens->clearcoat,          GiPreviewSurfaceInput::Clearcoat          },
+    { _tokens->clearcoatRoughness, GiPreviewSurfaceInput::ClearcoatRoughness },
+    { _tokens->opacity,            GiPreviewSurfaceInput::Opacity            },
+    { _tokens->normal,             GiPreviewSurfaceInput::Normal             }
+  };
+
+  auto it = inputs.find(name);
+  if (it == inputs.end())
+  {
+    return false;
+  }
+
+  input = it->second;
+  return true;
+}
+
+bool _ReadPreviewSurfaceParam(const TfToken& name, const VtValue& value, GiPreviewSurfaceDesc& desc)
+{
+  auto readColor = [&](float* color)
+  {
+    GfVec3f vec;
+    if (!_GetValue(value, vec))
+    {
+      return false;
+    }
+    color[0] = vec[0];
+    color[1] = vec[1];
+    color[2] = vec[2];
+    return true;
+  };
+
+  if (name == _tokens->diffuseColor) return readColor(desc.diffuseColor);
+  if (name == _tokens->emissiveColor) return readColor(desc.emissiveColor);
+  if (name == _tokens->specularColor) return readColor(desc.specularColor);
+  if (name == _tokens->normal) return readColor(desc.normal);
+  if (name == _tokens->metallic) return _GetValue(value, desc.metallic);
+  if (name == _tokens->roughness) return _GetValue(value, desc.roughness);
+  if (name == _tokens->clearcoat) return _GetValue(value, desc.clearcoat);
+  if (name == _tokens->clearcoatRoughness) return _GetValue(value, desc.clearcoatRoughness);
+  if (name == _tokens->opacity) return _GetValue(value, desc.opacity);
+  if (name == _tokens->opacityThreshold) return _GetValue(value, desc.opacityThreshold);
+  if (name == _tokens->ior) return _GetValue(value, desc.ior);
+
+  if (name == _tokens->useSpecularWorkflow)
+  {
+    int useSpecularWorkflow;
+    if (!_GetValue(value, useSpecularWorkflow))
+    {
+      return false;
+    }
+    desc.useSpecularWorkflow = (useSpecularWorkflow != 0);
+    return true;
+  }
+
+  // Not rendered by the MaterialX path either.
+  return name == _tokens->displacement || name == _tokens->occlusion;
+}
+
+bool _ReadUsdUVTextureWrapMode(const std::map<TfToken, VtValue>& params, const TfToken& name, GiTextureWrapMode& mode)
+{
+  auto paramIt = params.find(name);
+  if (paramIt == params.end())
+  {
+    return true; // MaterialX defaults to 'periodic'
+  }
+
+  TfToken wrapToken;
+  if (!_GetValue(paramIt->second, wrapToken))
+  {
+    return false;
+  }
+
+  if (wrapToken == _tokens->black) mode = GiTextureWrapMode::Black;
+  else if (wrapToken == _tokens->clamp) mode = GiTextureWrapMode::Clamp;
+  else if (wrapToken == _tokens->mirror) mode = GiTextureWrapMode::Mirror;
+  else mode = GiTextureWrapMode::Repeat;
+
+  return true;
+}
+
+// The fast path reads the mesh's primary texture coordinates, which is what an unconnected
+// 'st' input or a reader of the primary UV set results in.
+bool _IsPrimaryTexcoordConnection(const HdMaterialNetwork2& network, const std::vector<HdMaterialConnection2>& connections)
+{
+  if (connections.size() != 1)
+  {
+    return false;
+  }
+
+  auto nodeIt = network.nodes.find(connections[0].upstreamNode);
+  if (nodeIt == network.nodes.end() || nodeIt->second.nodeTypeId != _tokens->UsdPrimvarReader_float2)
+  {
+    return false;
+  }
+
+  const auto& params = nodeIt->second.parameters;
+  auto varnameIt = params.find(_tokens->varname);
+  if (varnameIt == params.end())
+  {
+    return false;
+  }
+
+  const VtValue& varname = varnameIt->second;
+  if (varname.IsHolding<TfToken>())
+  {
+    return varname.UncheckedGet<TfToken>() == UsdUtilsGetPrimaryUVSetName();
+  }
+  if (varname.IsHolding<std::string>())
+  {
+    return varname.UncheckedGet<std::string>() == UsdUtilsGetPrimaryUVSetName().GetString();
+  }
+  return false;
+}
+
+bool _ReadUsdUVTexture(const HdMaterialNetwork2& network,
+                       const HdMaterialConnection2& connection,
+                       bool isColorInput,
+                       bool isVectorInput,
+                       GiPreviewSurfaceTexture& texture)
+{
+  auto nodeIt = network.nodes.find(connection.upstreamNode);
+  if (nodeIt == network.nodes.end() || nodeIt->second.nodeTypeId != _tokens->UsdUVTexture)
+  {
+    return false;
+  }
+
+  const HdMaterialNode2& node = nodeIt->second;
+
+  for (const auto& [inputName, connections] : node.inputConnections)
+  {
+    if (inputName != _tokens->st || !_IsPrimaryTexcoordConnection(network, connections))
+    {
+      return false;
+    }
+  }
+
+  const TfToken& outputName = connection.upstreamOutputName;
+  if (isVectorInput)
+  {
+    if (outputName != _tokens->rgb)
+    {
+      return false;
+    }
+    texture.channel = GiTextureChannel::Rgb;
+  }
+  else if (outputName == _tokens->r) texture.channel = GiTextureChannel::R;
+  else if (outputName == _tokens->g) texture.channel = GiTextureChannel::G;
+  else if (outputName == _tokens->b) texture.channel = GiTextureChannel::B;
+  else if (outputName == _tokens->a) texture.channel = GiTextureChannel::A;
+  else return false;
+
+  const auto& params = node.parameters;
+
+  auto fileIt = params.find(_tokens->file);
+  if (fileIt == params.end() || !fileIt->second.IsHolding<SdfAssetPath>())
+  {
+    return false;
+  }
+
+  const SdfAssetPath& assetPath = fileIt->second.UncheckedGet<SdfAssetPath>();
+  texture.filePath = assetPath.GetResolvedPath();
+  if (texture.filePath.empty())
+  {
+    texture.filePath = assetPath.GetAssetPath();
+  }
+  if (texture.filePath.empty())
+  {
+    return false;
+  }
+
+  auto readVec4Param = [&](const TfToken& name, float* values)
+  {
+    auto paramIt = params.find(name);
+    if (paramIt == params.end())
+    {
+      return true;
+    }
+
+    GfVec4f vec;
+    if (!_GetValue(paramIt->second, vec))
+    {
+      return false;
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+      values[i] = vec[i];
+    }
+    return true;
+  };
+
+  if (!readVec4Param(_tokens->scale, texture.scale) ||
+      !readVec4Param(_tokens->bias, texture.bias))
+  {
+    return false;
+  }
+
+  texture.sRgb = isColorInput;
+
+  auto colorSpaceIt = params.find(_tokens->sourceColorSpace);
+  if (colorSpaceIt != params.end())
+  {
+    TfToken colorSpace;
+    if (!_GetValue(colorSpaceIt->second, colorSpace))
+    {
+      return false;
+    }
+
+    if (colorSpace == _tokens->sRGB) texture.sRgb = true;
+    else if (colorSpace == _tokens->raw) texture.sRgb = false;
+  }
+
+  return _ReadUsdUVTextureWrapMode(params, _tokens->wrapS, texture.wrapS) &&
+         _ReadUsdUVTextureWrapMode(params, _tokens->wrapT, texture.wrapT);
+}
+
+// Reads the inputs of networks that the native UsdPreviewSurface implementation can render
+// (see GiRenderSettings::previewSurfaceFastPath). Fails for networks with other node types,
+// such as UsdTransform2d.
+bool _ReadPreviewSurfaceDesc(const HdMaterialNetwork2& network, GiPreviewSurfaceDesc& desc)
+{
+  HdMaterialNode2 terminalNode;
+  SdfPath terminalPath;
+  if (!_GetMaterialNetworkSurfaceTerminal(network, terminalNode, terminalPath) ||
+      terminalNode.nodeTypeId != _tokens->UsdPreviewSurface)
+  {
+    return false;
+  }
+
+  for (const auto& [name, value] : terminalNode.parameters)
+  {
+    if (!_ReadPreviewSurfaceParam(name, value, desc))
+    {
+      return false;
+    }
+  }
+
+  for (const auto& [name, connections] : terminalNode.inputConnections)
+  {
+    GiPreviewSurfaceInput input;
+    if (!_GetPreviewSurfaceInput(name, input) || connections.size() != 1)
+    {
+      return false;
+    }
+
+    bool isColorInput = (input == GiPreviewSurfaceInput::DiffuseColor ||
+                         input == GiPreviewSurfaceInput::EmissiveColor ||
+                         input == GiPreviewSurfaceInput::SpecularColor);
+    bool isVectorInput = isColorInput || (input == GiPreviewSurfaceInput::Normal);
+
+    if (!_ReadUsdUVTexture(network, connections[0], isColorInput, isVectorInput, desc.textures[size_t(input)]))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 MaterialNetworkCompiler::MaterialNetworkCompiler(const mx::DocumentPtr mtlxStdLib)
   : _mtlxStdLib(mtlxStdLib)
+  , _materialCache(giDestroyMaterial)
 {
 }
 
 GiMaterial* MaterialNetworkCompiler::CompileNetwork(const SdfPath& id, const HdMaterialNetwork2& network) const
 {
-  GiMaterial* result = _TryCompileMdlNetwork(id, network);
+  HdMaterialNetwork2 patchedNetwork = network;
+
+  PreviewSurfaceNetworkPatcher patcher;
+  patcher.Patch(patchedNetwork);
 
-  if (!result)
+  // MDL networks consist of a single node, which the patcher leaves untouched.
+  size_t networkHash = MaterialCache::HashNetwork(patchedNetwork);
+
+  return _materialCache.Acquire(networkHash, patchedNetwork, [&]()
   {
-    HdMaterialNetwork2 patchedNetwork = network;
+    GiMaterial* result = _TryCompileMdlNetwork(id, network);
+
+    if (!result)
+    {
+      result = _TryCompileMtlxNetwork(id, patchedNetwork);
+    }
+
+    return result;
+  });
+}
+
+void MaterialNetworkCompiler::ReleaseMaterial(GiMaterial* material) const
+{
+  _materialCache.Release(material);
+}
+
+size_t MaterialNetworkCompiler::GetMaterialCount() const
+{
+  return _materialCache.GetMaterialCount();
+}
 
-    PreviewSurfaceNetworkPatcher patcher;
-    patcher.Patch(patchedNetwork);
+bool MaterialNetworkCompiler::UpdateMaterialParameters(GiMaterial* material, GiMaterial* paramMaterial) const
+{
+  if (!_materialCache.IsExclusive(material) || !_materialCache.IsExclusive(paramMaterial))
+  {
+    return false;
+  }
 
-    result = _TryCompileMtlxNetwork(id, patchedNetwork);
+  if (!giUpdateMaterialParameters(material, paramMaterial))
+  {
+    return false;
   }
 
-  return result;
+  _materialCache.Supersede(material, paramMaterial);
+  return true;
 }
 
 GiMaterial* MaterialNetworkCompiler::_TryCompileMdlNetwork(const SdfPath& id, const HdMaterialNetwork2& network) const
@@ -468,6 +807,10 @@ GiMaterial* MaterialNetworkCompiler::_TryCompileMdlNetwork(const SdfPath& id, co
 
 GiMaterial* MaterialNetworkCompiler::_TryCompileMtlxNetwork(const SdfPath& id, const HdMaterialNetwork2& network) const
 {
+  // The MDL material is created regardless, so that the fast path can be toggled.
+  GiPreviewSurfaceDesc previewSurface;
+  bool isPreviewSurface = _ReadPreviewSurfaceDesc(network, previewSurface);
+
   HdMaterialNetwork2 mtlxNetwork = network;
   if (!_ConvertUsdNodesToMtlxNodes(mtlxNetwork))
   {
@@ -482,7 +825,7 @@ GiMaterial* MaterialNetworkCompiler::_TryCompileMtlxNetwork(const SdfPath& id, c
     return nullptr;
   }
 
-  return giCreateMaterialFromMtlxDoc(id.GetText(), doc);
+  return giCreateMaterialFromMtlxDoc(id.GetText(), doc, isPreviewSurface ? &previewSurface : nullptr);
 }
 
 mx::DocumentPtr MaterialNetworkCompiler::_CreateMaterialXDocumentFromNetwork(const SdfPath& id,
@@ -17,6 +17,8 @@
 
 #pragma once
 
+#include "materialCache.h"
+
 #include <pxr/usd/sdf/path.h>
 
 #include <MaterialXCore/Document.h>
@@ -37,8 +39,17 @@ class MaterialNetworkCompiler
 public:
   MaterialNetworkCompiler(const MaterialX::DocumentPtr mtlxStdLib);
 
+  // Identical networks share one material, which has to be returned with ReleaseMaterial.
   GiMaterial* CompileNetwork(const SdfPath& id, const HdMaterialNetwork2& network) const;
 
+  void ReleaseMaterial(GiMaterial* material) const;
+
+  // Applies the parameters of 'paramMaterial' in-place and releases it. Only possible if neither
+  // material is shared.
+  bool UpdateMaterialParameters(GiMaterial* material, GiMaterial* paramMaterial) const;
+
+  size_t GetMaterialCount() const;
+
 private:
   GiMaterial* _TryCompileMdlNetwork(const SdfPath& id, const HdMaterialNetwork2& network) const;
 
@@ -49,6 +60,7 @@ private:
 
 private:
   MaterialX::DocumentPtr _mtlxStdLib;
+  mutable MaterialCache _materialCache;
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
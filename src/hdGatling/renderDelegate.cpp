@@ -31,6 +31,7 @@
 #include <pxr/base/gf/vec4f.h>
 
 #include <memory>
+#include <stdlib.h>
 
 PXR_NAMESPACE_OPEN_SCOPE
 
@@ -58,6 +59,15 @@ namespace
     HdPrimTypeTokens->renderBuffer
   };
 
+  constexpr static const char* _envvarTextureMemoryBudget = "HDGATLING_TEXTURE_MEMORY_BUDGET";
+
+  // In MiB; zero derives the budget from the device memory size.
+  uint32_t _GetDefaultTextureMemoryBudget()
+  {
+    const char* value = getenv(_envvarTextureMemoryBudget);
+    return value ? uint32_t(strtoul(value, nullptr, 10)) : 0;
+  }
+
   // By default, we visualize the display color if it exists (otherwise grey).
   static const char* _defaultMaterialXMaterial = R"(
     <?xml version="1.0"?>
@@ -101,6 +111,9 @@ HdGatlingRenderDelegate::HdGatlingRenderDelegate(const HdRenderSettingsMap& sett
   _settingDescriptors.push_back(HdRenderSettingDescriptor{ "Medium stack size", HdGatlingSettingsTokens->mediumStackSize, VtValue{0} });
   _settingDescriptors.push_back(HdRenderSettingDescriptor{ "Max volume walk length", HdGatlingSettingsTokens->maxVolumeWalkLength, VtValue{7} });
   _settingDescriptors.push_back(HdRenderSettingDescriptor{ "Jittered sampling", HdGatlingSettingsTokens->jitteredSampling, VtValue{true} });
+  _settingDescriptors.push_back(HdRenderSettingDescriptor{ "UsdPreviewSurface fast path", HdGatlingSettingsTokens->previewSurfaceFastPath, VtValue{false} });
+  _settingDescriptors.push_back(HdRenderSettingDescriptor{ "Distilled materials (preview)", HdGatlingSettingsTokens->distilledMaterials, VtValue{false} });
+  _settingDescriptors.push_back(HdRenderSettingDescriptor{ "Texture memory budget (MiB)", HdGatlingSettingsTokens->textureMemoryBudget, VtValue{_GetDefaultTextureMemoryBudget()} });
 
   _debugSettingDescriptors.push_back(HdRenderSettingDescriptor{ "Progressive accumulation", HdGatlingSettingsTokens->progressiveAccumulation, VtValue{true} });
 
@@ -189,6 +202,13 @@ bool HdGatlingRenderDelegate::InvokeCommand(const TfToken& command, [[maybe_unus
   return false;
 }
 
+VtDictionary HdGatlingRenderDelegate::GetRenderStats() const
+{
+  VtDictionary stats;
+  stats[HdGatlingRenderStatsTokens->materialCount.GetString()] = VtValue(_materialNetworkCompiler.GetMaterialCount());
+  return stats;
+}
+
 HdRenderPassSharedPtr HdGatlingRenderDelegate::CreateRenderPass(HdRenderIndex* index,
                                                                 const HdRprimCollection& collection)
 {
@@ -48,6 +48,8 @@ public:
 
   bool InvokeCommand(const TfToken& command, const HdCommandArgs& args = HdCommandArgs()) override;
 
+  VtDictionary GetRenderStats() const override;
+
 public:
   HdRenderPassSharedPtr CreateRenderPass(HdRenderIndex* index,
                                          const HdRprimCollection& collection) override;
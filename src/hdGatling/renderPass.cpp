@@ -217,13 +217,17 @@ void HdGatlingRenderPass::_Execute(const HdRenderPassStateSharedPtr& renderPassS
   GiCameraDesc giCamera;
   _ConstructGiCamera(*camera, giCamera);
 
+  bool isInteractive = _IsInteractive(_settings);
+
   GiRenderParams renderParams = {
     .aovBindings = aovBindings,
     .camera = giCamera,
     .domeLight = renderParam->ActiveDomeLight(),
     .renderSettings = {
+      .asyncShaderCompilation = isInteractive,
       .clippingPlanes = clippingPlanes,
       .depthOfField = _settings.find(HdGatlingSettingsTokens->depthOfField)->second.Get<bool>(),
+      .distilledMaterials = _settings.find(HdGatlingSettingsTokens->distilledMaterials)->second.Get<bool>(),
       .domeLightCameraVisible = (domeLightCameraVisibilityValueIt == _settings.end()) || domeLightCameraVisibilityValueIt->second.GetWithDefault<bool>(true),
       .filterImportanceSampling = _settings.find(HdGatlingSettingsTokens->filterImportanceSampling)->second.Get<bool>(),
       .jitteredSampling = _settings.find(HdGatlingSettingsTokens->jitteredSampling)->second.Get<bool>(),
@@ -233,10 +237,12 @@ void HdGatlingRenderPass::_Execute(const HdRenderPassStateSharedPtr& renderPassS
       .maxVolumeWalkLength = VtValue::Cast<uint32_t>(_settings.find(HdGatlingSettingsTokens->maxVolumeWalkLength)->second).Get<uint32_t>(),
       .mediumStackSize = VtValue::Cast<uint32_t>(_settings.find(HdGatlingSettingsTokens->mediumStackSize)->second).Get<uint32_t>(),
       .nextEventEstimation = _settings.find(HdGatlingSettingsTokens->nextEventEstimation)->second.Get<bool>(),
+      .previewSurfaceFastPath = _settings.find(HdGatlingSettingsTokens->previewSurfaceFastPath)->second.Get<bool>(),
       .progressiveAccumulation = _settings.find(HdGatlingSettingsTokens->progressiveAccumulation)->second.Get<bool>(),
       .rrBounceOffset = VtValue::Cast<uint32_t>(_settings.find(HdGatlingSettingsTokens->rrBounceOffset)->second).Get<uint32_t>(),
       .rrInvMinTermProb = VtValue::Cast<float>(_settings.find(HdGatlingSettingsTokens->rrInvMinTermProb)->second).Get<float>(),
-      .spp = VtValue::Cast<uint32_t>(_settings.find(HdGatlingSettingsTokens->spp)->second).Get<uint32_t>()
+      .spp = VtValue::Cast<uint32_t>(_settings.find(HdGatlingSettingsTokens->spp)->second).Get<uint32_t>(),
+      .textureMemoryBudget = VtValue::Cast<uint32_t>(_settings.find(HdGatlingSettingsTokens->textureMemoryBudget)->second).Get<uint32_t>()
     },
     .scene = _scene
   };
@@ -245,7 +251,8 @@ void HdGatlingRenderPass::_Execute(const HdRenderPassStateSharedPtr& renderPassS
 
   TF_VERIFY(result == GiStatus::Ok, "Unable to render scene.");
 
-  _isConverged = !_IsInteractive(_settings);
+  // Images rendered with fallback materials must not be taken as final.
+  _isConverged = !isInteractive && !giAreShadersPending(_scene);
 
   for (const auto& aovBinding : hdAovBindings)
   {
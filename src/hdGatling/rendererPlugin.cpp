@@ -35,6 +35,10 @@
 #include <gtl/gb/Fmt.h>
 #include <gtl/gi/Gi.h>
 
+#include <string.h>
+
+#include <filesystem>
+
 using namespace gtl;
 namespace mx = MaterialX;
 
@@ -42,6 +46,46 @@ PXR_NAMESPACE_OPEN_SCOPE
 
 namespace
 {
+  constexpr static const char* _envvarEnableMdlClassCompilation = "HDGATLING_MDL_CLASS_COMPILATION";
+  constexpr static const char* _envvarShaderOptimization = "HDGATLING_SHADER_OPTIMIZATION";
+  constexpr static const char* _envvarMdlDistillTarget = "HDGATLING_MDL_DISTILL_TARGET";
+  constexpr static const char* _envvarTextureCompression = "HDGATLING_TEXTURE_COMPRESSION";
+  constexpr static const char* _envvarTextureCachePath = "HDGATLING_TEXTURE_CACHE_PATH";
+
+  GiShaderOptimization _GetShaderOptimization()
+  {
+    const char* value = getenv(_envvarShaderOptimization);
+
+    if (!value)
+    {
+      return GiShaderOptimization::None;
+    }
+    else if (strcmp(value, "performance") == 0)
+    {
+      return GiShaderOptimization::Performance;
+    }
+    else if (strcmp(value, "size") == 0)
+    {
+      return GiShaderOptimization::Size;
+    }
+
+    TF_WARN("Unknown %s value '%s' (expected 'performance' or 'size')", _envvarShaderOptimization, value);
+    return GiShaderOptimization::None;
+  }
+
+  std::string _GetTextureCachePath()
+  {
+    const char* value = getenv(_envvarTextureCachePath);
+    if (value)
+    {
+      return value; // may be empty to disable the cache
+    }
+
+    std::error_code errorCode;
+    std::filesystem::path tmpPath = std::filesystem::temp_directory_path(errorCode);
+    return errorCode ? std::string() : (tmpPath / "gatling-textures").string();
+  }
+
   bool _TryInitGi(const mx::DocumentPtr mtlxStdLib)
   {
     PlugPluginPtr plugin = PLUG_THIS_PLUGIN;
@@ -60,11 +104,19 @@ namespace
       s = GB_FMT("{}/mdl", s);
     }
 
+    bool textureCompression = getenv(_envvarTextureCompression) != nullptr;
+    std::string textureCachePath = textureCompression ? _GetTextureCachePath() : std::string();
+
     GiInitParams params = {
       .shaderPath = shaderPath.c_str(),
       .mdlRuntimePath = resourcePath.c_str(),
       .mdlSearchPaths = mdlSearchPaths,
-      .mtlxStdLib = mtlxStdLib
+      .mtlxStdLib = mtlxStdLib,
+      .mdlClassCompilation = getenv(_envvarEnableMdlClassCompilation) != nullptr,
+      .mdlDistillTarget = getenv(_envvarMdlDistillTarget) ? getenv(_envvarMdlDistillTarget) : "",
+      .shaderOptimization = _GetShaderOptimization(),
+      .textureCompression = textureCompression,
+      .textureCachePath = textureCachePath
     };
     return giInitialize(params) == GiStatus::Ok;
   }
@@ -146,34 +198,54 @@ TF_REGISTRY_FUNCTION(TfType)
 
 HdGatlingRendererPlugin::HdGatlingRendererPlugin()
 {
+  // Plugins are instantiated by tools that only query them, so the costly renderer
+  // initialization is deferred to the creation of the first render delegate. The
+  // MaterialX and MDL libraries are loaded in the background until then.
+  _mtlxStdLibFuture = std::async(std::launch::async, []()
+  {
 #if PXR_VERSION > 2311
-  mx::DocumentPtr mtlxStdLib = HdMtlxStdLibraries();
+    return HdMtlxStdLibraries();
 #else
-  mx::DocumentPtr mtlxStdLib = _LoadMtlxStdLib();
+    return _LoadMtlxStdLib();
 #endif
+  });
 
-  _isSupported = _TryInitGi(mtlxStdLib);
+  PlugPluginPtr plugin = PLUG_THIS_PLUGIN;
+  giPreloadMdlRuntime(plugin->GetResourcePath());
+}
+
+HdGatlingRendererPlugin::~HdGatlingRendererPlugin()
+{
+  _arAssetReader.reset();
+
+  // Also releases the MDL runtime if it was preloaded but never used.
+  giTerminate();
+}
+
+bool HdGatlingRendererPlugin::_Initialize()
+{
+  std::lock_guard guard(_initMutex);
+
+  if (_isInitialized || !_isSupported)
+  {
+    return _isInitialized;
+  }
+
+  mx::DocumentPtr mtlxStdLib = _mtlxStdLibFuture.get();
 
-  if (!_isSupported)
+  if (!_TryInitGi(mtlxStdLib))
   {
-    return;
+    _isSupported = false;
+    return false;
   }
 
   _materialNetworkCompiler = std::make_unique<MaterialNetworkCompiler>(mtlxStdLib);
 
   _arAssetReader = std::make_unique<ArAssetReader>();
   giRegisterAssetReader(_arAssetReader.get());
-}
 
-HdGatlingRendererPlugin::~HdGatlingRendererPlugin()
-{
-  if (!_isSupported)
-  {
-    return;
-  }
-
-  _arAssetReader.reset();
-  giTerminate();
+  _isInitialized = true;
+  return true;
 }
 
 HdRenderDelegate* HdGatlingRendererPlugin::CreateRenderDelegate()
@@ -185,7 +257,7 @@ HdRenderDelegate* HdGatlingRendererPlugin::CreateRenderDelegate()
 
 HdRenderDelegate* HdGatlingRendererPlugin::CreateRenderDelegate(const HdRenderSettingsMap& settingsMap)
 {
-  if (!_isSupported)
+  if (!_Initialize())
   {
     return nullptr;
   }
@@ -208,6 +280,7 @@ bool HdGatlingRendererPlugin::IsSupported([[maybe_unused]] bool gpuEnabled) cons
 bool HdGatlingRendererPlugin::IsSupported() const
 #endif
 {
+  // Cheap by design: failures only become known once the first delegate is created.
   return _isSupported;
 }
 
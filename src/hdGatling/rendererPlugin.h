@@ -19,7 +19,12 @@
 
 #include <pxr/imaging/hd/rendererPlugin.h>
 
+#include <MaterialXCore/Document.h>
+
+#include <atomic>
+#include <future>
 #include <memory>
+#include <mutex>
 
 PXR_NAMESPACE_OPEN_SCOPE
 
@@ -44,9 +49,16 @@ public:
 #endif
 
 private:
+  bool _Initialize();
+
+private:
+  // Loaded in the background, as it's only needed once the first delegate is created.
+  std::future<MaterialX::DocumentPtr> _mtlxStdLibFuture;
   std::unique_ptr<class MaterialNetworkCompiler> _materialNetworkCompiler;
   std::unique_ptr<class ArAssetReader> _arAssetReader;
-  bool _isSupported;
+  std::mutex _initMutex;
+  bool _isInitialized = false;
+  std::atomic_bool _isSupported = true; // until initialization fails
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
@@ -28,5 +28,6 @@ TF_DEFINE_PUBLIC_TOKENS(HdGatlingNodeContexts, HD_GATLING_NODE_CONTEXT_TOKENS);
 TF_DEFINE_PUBLIC_TOKENS(HdGatlingNodeMetadata, HD_GATLING_NODE_METADATA_TOKENS);
 TF_DEFINE_PUBLIC_TOKENS(HdGatlingAovTokens, HD_GATLING_AOV_TOKENS);
 TF_DEFINE_PUBLIC_TOKENS(HdGatlingCommandTokens, HD_GATLING_COMMAND_TOKENS);
+TF_DEFINE_PUBLIC_TOKENS(HdGatlingRenderStatsTokens, HD_GATLING_RENDER_STATS_TOKENS);
 
 PXR_NAMESPACE_CLOSE_SCOPE
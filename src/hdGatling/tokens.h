@@ -35,7 +35,10 @@ PXR_NAMESPACE_OPEN_SCOPE
   ((mediumStackSize, "medium-stack-size"))                   \
   ((maxVolumeWalkLength, "max-volume-walk-length"))          \
   ((jitteredSampling, "jittered-sampling"))                  \
-  ((clippingPlanes, "clipping-planes"))
+  ((clippingPlanes, "clipping-planes"))                      \
+  ((previewSurfaceFastPath, "preview-surface-fast-path"))    \
+  ((distilledMaterials, "distilled-materials"))              \
+  ((textureMemoryBudget, "texture-memory-budget"))
 
 // mtlx node identifier is given by UsdMtlx.
 #define HD_GATLING_NODE_IDENTIFIER_TOKENS            \
@@ -75,6 +78,9 @@ PXR_NAMESPACE_OPEN_SCOPE
 #define HD_GATLING_COMMAND_TOKENS                    \
   (printLicenses)
 
+#define HD_GATLING_RENDER_STATS_TOKENS               \
+  (materialCount)
+
 TF_DECLARE_PUBLIC_TOKENS(HdGatlingSettingsTokens, HD_GATLING_SETTINGS_TOKENS);
 TF_DECLARE_PUBLIC_TOKENS(HdGatlingNodeIdentifiers, HD_GATLING_NODE_IDENTIFIER_TOKENS);
 TF_DECLARE_PUBLIC_TOKENS(HdGatlingSourceTypes, HD_GATLING_SOURCE_TYPE_TOKENS);
@@ -84,5 +90,6 @@ TF_DECLARE_PUBLIC_TOKENS(HdGatlingNodeContexts, HD_GATLING_NODE_CONTEXT_TOKENS);
 TF_DECLARE_PUBLIC_TOKENS(HdGatlingNodeMetadata, HD_GATLING_NODE_METADATA_TOKENS);
 TF_DECLARE_PUBLIC_TOKENS(HdGatlingAovTokens, HD_GATLING_AOV_TOKENS);
 TF_DECLARE_PUBLIC_TOKENS(HdGatlingCommandTokens, HD_GATLING_COMMAND_TOKENS);
+TF_DECLARE_PUBLIC_TOKENS(HdGatlingRenderStatsTokens, HD_GATLING_RENDER_STATS_TOKENS);
 
 PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,44 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include "Image.h"
+
+#include <vector>
+
+namespace gtl
+{
+  enum class ImgioBlockFormat
+  {
+    BC1,  // RGB, 4 bits per texel
+    BC4,  // R, 4 bits per texel
+    BC5,  // RG, 8 bits per texel
+    BC6H, // unsigned half-float RGB, 8 bits per texel
+    BC7   // RGBA, 8 bits per texel
+  };
+
+  // Size of an encoded 4x4 block in bytes.
+  uint32_t ImgioGetBlockSize(ImgioBlockFormat format);
+
+  // Size of an encoded image. Blocks at the right and top borders are padded.
+  size_t ImgioGetBlockCompressedSize(ImgioBlockFormat format, uint32_t width, uint32_t height);
+
+  // Encodes an image of any format into rows of 4x4 blocks. All formats but BC6H clamp values
+  // to [0, 1]; BC6H clamps negative values to zero. Blocks are encoded in parallel.
+  void ImgioEncodeBlocks(const ImgioImage& image, ImgioBlockFormat format, std::vector<uint8_t>& blocks);
+}
@@ -24,11 +24,32 @@
 
 namespace gtl
 {
+  // Images are always RGBA; formats differ in their channel type only.
+  enum class ImgioFormat
+  {
+    RGBA8_UNORM,
+    RGBA16_UNORM,
+    RGBA16_FLOAT,
+    RGBA32_FLOAT
+  };
+
   struct ImgioImage
   {
     uint32_t width;
     uint32_t height;
+    ImgioFormat format = ImgioFormat::RGBA8_UNORM;
     size_t size;
     std::vector<uint8_t> data;
   };
+
+  inline uint32_t ImgioGetTexelSize(ImgioFormat format)
+  {
+    switch (format)
+    {
+    case ImgioFormat::RGBA16_UNORM:
+    case ImgioFormat::RGBA16_FLOAT: return 8;
+    case ImgioFormat::RGBA32_FLOAT: return 16;
+    default: return 4;
+    }
+  }
 }
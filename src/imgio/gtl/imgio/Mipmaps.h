@@ -0,0 +1,48 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include "Image.h"
+
+#include <vector>
+
+namespace gtl
+{
+  enum class ImgioMipFilter
+  {
+    Box,   // averages the covered texels
+    Kaiser // Kaiser-windowed sinc; sharper, but may ring
+  };
+
+  // Number of levels of a full mip chain, including the base level.
+  uint32_t ImgioGetMipLevelCount(uint32_t width, uint32_t height);
+
+  // Generates levels 1 to n of the mip chain of an 8-bit RGBA image. If the image is sRGB-encoded,
+  // color channels are filtered in linear space; alpha is always treated as linear.
+  void ImgioGenerateMipChainRgba8(const ImgioImage& image, ImgioMipFilter filter, bool isSrgb,
+                                  std::vector<ImgioImage>& levels);
+
+  // Generates levels 1 to n of the mip chain of an RGBA image, keeping its format. The sRGB flag
+  // only applies to 8-bit images; wider formats are assumed to be linear.
+  void ImgioGenerateMipChain(const ImgioImage& image, ImgioMipFilter filter, bool isSrgb,
+                             std::vector<ImgioImage>& levels);
+
+  // Generates levels 1 to n of the mip chain of a single-channel 32-bit float image.
+  void ImgioGenerateMipChainR32f(const ImgioImage& image, ImgioMipFilter filter,
+                                 std::vector<ImgioImage>& levels);
+}
@@ -0,0 +1,649 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "BlockCompression.h"
+#include "Half.h"
+
+#include <algorithm>
+#include <array>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+namespace
+{
+  using namespace gtl;
+
+  constexpr static uint32_t BLOCK_TEXEL_COUNT = 16;
+  constexpr static uint32_t POWER_ITERATION_COUNT = 8;
+  constexpr static uint32_t REFINEMENT_ITERATION_COUNT = 2;
+
+  // Interpolation weights of 4-bit indices in BC6H and BC7, in 64ths.
+  constexpr static int INDEX_WEIGHTS_4BIT[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+  constexpr static float MAX_HALF_VALUE = 65504.0f;
+
+  template<uint32_t N>
+  using _Vec = std::array<float, N>;
+
+  // RGBA texels of a block, row by row.
+  using _Block = std::array<_Vec<4>, BLOCK_TEXEL_COUNT>;
+
+  // Blocks are little-endian bit streams.
+  class _BitWriter
+  {
+  public:
+    void write(uint64_t value, uint32_t bitCount)
+    {
+      for (uint32_t i = 0; i < bitCount; i++, m_pos++)
+      {
+        m_words[m_pos / 64] |= ((value >> i) & 1) << (m_pos % 64);
+      }
+    }
+
+    void store(uint8_t* dst, uint32_t size) const
+    {
+      memcpy(dst, m_words, size);
+    }
+
+  private:
+    uint64_t m_words[2] = {};
+    uint32_t m_pos = 0;
+  };
+
+  float _LoadValue(const ImgioImage& image, size_t index)
+  {
+    switch (image.format)
+    {
+    case ImgioFormat::RGBA16_UNORM: return float(((const uint16_t*) image.data.data())[index]) / 65535.0f;
+    case ImgioFormat::RGBA16_FLOAT: return ImgioHalfToFloat(((const uint16_t*) image.data.data())[index]);
+    case ImgioFormat::RGBA32_FLOAT: return ((const float*) image.data.data())[index];
+    default: return float(image.data[index]) / 255.0f;
+    }
+  }
+
+  // Texels outside of the image replicate the border.
+  void _LoadBlock(const ImgioImage& image, uint32_t blockX, uint32_t blockY, _Block& block)
+  {
+    for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+    {
+      uint32_t x = std::min(blockX * 4 + i % 4, image.width - 1);
+      uint32_t y = std::min(blockY * 4 + i / 4, image.height - 1);
+      size_t offset = (size_t(y) * image.width + x) * 4;
+
+      for (uint32_t c = 0; c < 4; c++)
+      {
+        block[i][c] = _LoadValue(image, offset + c);
+      }
+    }
+  }
+
+  template<uint32_t N>
+  float _DistanceSquared(const _Vec<N>& a, const _Vec<N>& b)
+  {
+    float sum = 0.0f;
+    for (uint32_t c = 0; c < N; c++)
+    {
+      float d = a[c] - b[c];
+      sum += d * d;
+    }
+    return sum;
+  }
+
+  // Initial endpoints: the extremes of the points projected onto their principal axis.
+  template<uint32_t N>
+  void _FitLine(const _Vec<N>* points, _Vec<N>& e0, _Vec<N>& e1)
+  {
+    _Vec<N> mean = {};
+    for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+    {
+      for (uint32_t c = 0; c < N; c++)
+      {
+        mean[c] += points[i][c] / float(BLOCK_TEXEL_COUNT);
+      }
+    }
+
+    float covariance[N][N] = {};
+    for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+    {
+      for (uint32_t a = 0; a < N; a++)
+      {
+        for (uint32_t b = 0; b < N; b++)
+        {
+          covariance[a][b] += (points[i][a] - mean[a]) * (points[i][b] - mean[b]);
+        }
+      }
+    }
+
+    // Power iteration, starting with the row of the largest variance.
+    uint32_t maxRow = 0;
+    for (uint32_t c = 1; c < N; c++)
+    {
+      maxRow = (covariance[c][c] > covariance[maxRow][maxRow]) ? c : maxRow;
+    }
+
+    _Vec<N> axis;
+    for (uint32_t c = 0; c < N; c++)
+    {
+      axis[c] = covariance[maxRow][c];
+    }
+
+    for (uint32_t k = 0; k < POWER_ITERATION_COUNT; k++)
+    {
+      _Vec<N> next = {};
+      float maxComponent = 0.0f;
+      for (uint32_t a = 0; a < N; a++)
+      {
+        for (uint32_t b = 0; b < N; b++)
+        {
+          next[a] += covariance[a][b] * axis[b];
+        }
+        maxComponent = std::max(maxComponent, fabsf(next[a]));
+      }
+
+      if (maxComponent < FLT_MIN)
+      {
+        break;
+      }
+
+      for (uint32_t c = 0; c < N; c++)
+      {
+        axis[c] = next[c] / maxComponent;
+      }
+    }
+
+    float length = sqrtf(_DistanceSquared<N>(axis, _Vec<N>{}));
+    for (uint32_t c = 0; c < N; c++)
+    {
+      axis[c] = (length > FLT_MIN) ? (axis[c] / length) : 0.0f;
+    }
+
+    float minT = FLT_MAX;
+    float maxT = -FLT_MAX;
+    for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+    {
+      float t = 0.0f;
+      for (uint32_t c = 0; c < N; c++)
+      {
+        t += (points[i][c] - mean[c]) * axis[c];
+      }
+      minT = std::min(minT, t);
+      maxT = std::max(maxT, t);
+    }
+
+    for (uint32_t c = 0; c < N; c++)
+    {
+      e0[c] = mean[c] + axis[c] * minT;
+      e1[c] = mean[c] + axis[c] * maxT;
+    }
+  }
+
+  // Least squares endpoints for fixed interpolation weights 't' (zero for e0, one for e1).
+  template<uint32_t N>
+  bool _SolveEndpoints(const _Vec<N>* points, const float* t, _Vec<N>& e0, _Vec<N>& e1)
+  {
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    _Vec<N> ap = {}, bp = {};
+
+    for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+    {
+      float a = 1.0f - t[i];
+      float b = t[i];
+      aa += a * a;
+      ab += a * b;
+      bb += b * b;
+      for (uint32_t c = 0; c < N; c++)
+      {
+        ap[c] += a * points[i][c];
+        bp[c] += b * points[i][c];
+      }
+    }
+
+    float det = aa * bb - ab * ab;
+    if (fabsf(det) < 1e-6f)
+    {
+      return false;
+    }
+
+    for (uint32_t c = 0; c < N; c++)
+    {
+      e0[c] = (ap[c] * bb - bp[c] * ab) / det;
+      e1[c] = (bp[c] * aa - ap[c] * ab) / det;
+    }
+    return true;
+  }
+
+  template<uint32_t N>
+  uint32_t _FindClosest(const _Vec<N>& point, const _Vec<N>* palette, uint32_t paletteSize, float& error)
+  {
+    uint32_t closest = 0;
+    error = FLT_MAX;
+    for (uint32_t k = 0; k < paletteSize; k++)
+    {
+      float d = _DistanceSquared<N>(point, palette[k]);
+      if (d < error)
+      {
+        error = d;
+        closest = k;
+      }
+    }
+    return closest;
+  }
+
+  uint16_t _QuantizeRgb565(const _Vec<3>& color)
+  {
+    auto quantize = [](float value, int maxValue) {
+      return uint16_t(std::clamp(int(value * float(maxValue) / 255.0f + 0.5f), 0, maxValue));
+    };
+    return uint16_t(quantize(color[0], 31) << 11) | uint16_t(quantize(color[1], 63) << 5) | quantize(color[2], 31);
+  }
+
+  _Vec<3> _ExpandRgb565(uint16_t color)
+  {
+    uint32_t r = (color >> 11) & 0x1F;
+    uint32_t g = (color >> 5) & 0x3F;
+    uint32_t b = color & 0x1F;
+    return { float((r << 3) | (r >> 2)), float((g << 2) | (g >> 4)), float((b << 3) | (b >> 2)) };
+  }
+
+  // Four-color mode only; color0 > color1.
+  void _EncodeBc1(const _Block& block, uint8_t* dst)
+  {
+    constexpr static float PALETTE_WEIGHTS[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+    _Vec<3> points[BLOCK_TEXEL_COUNT];
+    for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+    {
+      for (uint32_t c = 0; c < 3; c++)
+      {
+        points[i][c] = std::clamp(block[i][c], 0.0f, 1.0f) * 255.0f;
+      }
+    }
+
+    _Vec<3> e0, e1;
+    _FitLine<3>(points, e0, e1);
+
+    uint16_t bestColors[2] = {};
+    uint32_t bestIndices = 0;
+    float bestError = FLT_MAX;
+
+    for (uint32_t iteration = 0; iteration <= REFINEMENT_ITERATION_COUNT; iteration++)
+    {
+      uint16_t colors[2] = { _QuantizeRgb565(e0), _QuantizeRgb565(e1) };
+
+      _Vec<3> palette[4];
+      palette[0] = _ExpandRgb565(colors[0]);
+      palette[1] = _ExpandRgb565(colors[1]);
+      for (uint32_t c = 0; c < 3; c++)
+      {
+        palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+        palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+      }
+
+      uint32_t indices = 0;
+      float error = 0.0f;
+      float t[BLOCK_TEXEL_COUNT];
+      for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+      {
+        float texelError;
+        uint32_t index = _FindClosest<3>(points[i], palette, 4, texelError);
+        indices |= index << (i * 2);
+        error += texelError;
+        t[i] = PALETTE_WEIGHTS[index];
+      }
+
+      if (error < bestError)
+      {
+        bestError = error;
+        bestColors[0] = colors[0];
+        bestColors[1] = colors[1];
+        bestIndices = indices;
+      }
+
+      if (!_SolveEndpoints<3>(points, t, e0, e1))
+      {
+        break;
+      }
+    }
+
+    if (bestColors[0] < bestColors[1])
+    {
+      std::swap(bestColors[0], bestColors[1]);
+      bestIndices ^= 0x55555555u; // 0 <-> 1, 2 <-> 3
+    }
+    else if (bestColors[0] == bestColors[1])
+    {
+      bestIndices = 0; // three-color mode; index 0 is still color0
+    }
+
+    _BitWriter writer;
+    writer.write(bestColors[0], 16);
+    writer.write(bestColors[1], 16);
+    writer.write(bestIndices, 32);
+    writer.store(dst, 8);
+  }
+
+  // Eight-value mode, or a constant block.
+  void _EncodeBc4(const _Block& block, uint32_t channel, uint8_t* dst)
+  {
+    float values[BLOCK_TEXEL_COUNT];
+    float minValue = 255.0f;
+    float maxValue = 0.0f;
+    for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+    {
+      values[i] = std::clamp(block[i][channel], 0.0f, 1.0f) * 255.0f;
+      minValue = std::min(minValue, values[i]);
+      maxValue = std::max(maxValue, values[i]);
+    }
+
+    uint32_t red0 = uint32_t(maxValue + 0.5f);
+    uint32_t red1 = uint32_t(minValue + 0.5f);
+
+    _BitWriter writer;
+    writer.write(red0, 8);
+    writer.write(red1, 8);
+
+    if (red0 != red1)
+    {
+      _Vec<1> palette[8] = { { float(red0) }, { float(red1) } };
+      for (uint32_t k = 2; k < 8; k++)
+      {
+        palette[k][0] = (float(8 - k) * float(red0) + float(k - 1) * float(red1)) / 7.0f;
+      }
+
+      for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+      {
+        float error;
+        writer.write(_FindClosest<1>({ values[i] }, palette, 8, error), 3);
+      }
+    }
+
+    writer.store(dst, 8);
+  }
+
+  // Mode 6: one subset, RGBA, 7-bit endpoints with unique p-bits and 4-bit indices.
+  void _EncodeBc7(const _Block& block, uint8_t* dst)
+  {
+    _Vec<4> points[BLOCK_TEXEL_COUNT];
+    for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+    {
+      for (uint32_t c = 0; c < 4; c++)
+      {
+        points[i][c] = std::clamp(block[i][c], 0.0f, 1.0f) * 255.0f;
+      }
+    }
+
+    _Vec<4> e0, e1;
+    _FitLine<4>(points, e0, e1);
+
+    struct Endpoint
+    {
+      uint32_t quantized[4];
+      uint32_t pBit;
+      _Vec<4> value;
+    };
+
+    auto quantizeEndpoint = [](const _Vec<4>& e) {
+      Endpoint best;
+      float bestError = FLT_MAX;
+      for (uint32_t pBit = 0; pBit < 2; pBit++)
+      {
+        Endpoint endpoint;
+        endpoint.pBit = pBit;
+        for (uint32_t c = 0; c < 4; c++)
+        {
+          endpoint.quantized[c] = uint32_t(std::clamp(int((e[c] - float(pBit)) * 0.5f + 0.5f), 0, 127));
+          endpoint.value[c] = float((endpoint.quantized[c] << 1) | pBit);
+        }
+        float error = _DistanceSquared<4>(e, endpoint.value);
+        if (error < bestError)
+        {
+          bestError = error;
+          best = endpoint;
+        }
+      }
+      return best;
+    };
+
+    Endpoint bestEndpoints[2];
+    uint32_t bestIndices[BLOCK_TEXEL_COUNT];
+    float bestError = FLT_MAX;
+
+    for (uint32_t iteration = 0; iteration <= REFINEMENT_ITERATION_COUNT; iteration++)
+    {
+      Endpoint endpoints[2] = { quantizeEndpoint(e0), quantizeEndpoint(e1) };
+
+      _Vec<4> palette[16];
+      for (uint32_t k = 0; k < 16; k++)
+      {
+        int w = INDEX_WEIGHTS_4BIT[k];
+        for (uint32_t c = 0; c < 4; c++)
+        {
+          palette[k][c] = float(((64 - w) * int(endpoints[0].value[c]) + w * int(endpoints[1].value[c]) + 32) >> 6);
+        }
+      }
+
+      uint32_t indices[BLOCK_TEXEL_COUNT];
+      float error = 0.0f;
+      float t[BLOCK_TEXEL_COUNT];
+      for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+      {
+        float texelError;
+        indices[i] = _FindClosest<4>(points[i], palette, 16, texelError);
+        error += texelError;
+        t[i] = float(INDEX_WEIGHTS_4BIT[indices[i]]) / 64.0f;
+      }
+
+      if (error < bestError)
+      {
+        bestError = error;
+        bestEndpoints[0] = endpoints[0];
+        bestEndpoints[1] = endpoints[1];
+        memcpy(bestIndices, indices, sizeof(indices));
+      }
+
+      if (!_SolveEndpoints<4>(points, t, e0, e1))
+      {
+        break;
+      }
+    }
+
+    // The most significant bit of the anchor index is implicitly zero.
+    if (bestIndices[0] & 8)
+    {
+      std::swap(bestEndpoints[0], bestEndpoints[1]);
+      for (uint32_t& index : bestIndices)
+      {
+        index = 15 - index;
+      }
+    }
+
+    _BitWriter writer;
+    writer.write(1 << 6, 7);
+    for (uint32_t c = 0; c < 4; c++)
+    {
+      writer.write(bestEndpoints[0].quantized[c], 7);
+      writer.write(bestEndpoints[1].quantized[c], 7);
+    }
+    writer.write(bestEndpoints[0].pBit, 1);
+    writer.write(bestEndpoints[1].pBit, 1);
+    writer.write(bestIndices[0], 3);
+    for (uint32_t i = 1; i < BLOCK_TEXEL_COUNT; i++)
+    {
+      writer.write(bestIndices[i], 4);
+    }
+    writer.store(dst, 16);
+  }
+
+  // Inverse of the BC6H unquantization of unsigned 10-bit endpoints, followed by the final
+  // scaling to half-float bits: h = ((e * 64 + 32) * 31) >> 6.
+  uint32_t _QuantizeBc6hEndpoint(float halfBits)
+  {
+    return uint32_t(std::clamp(int((halfBits - 15.5f) / 31.0f + 0.5f), 0, 1023));
+  }
+
+  int _UnquantizeBc6hEndpoint(uint32_t e)
+  {
+    if (e == 0)
+    {
+      return 0;
+    }
+    if (e == 1023)
+    {
+      return 0xFFFF;
+    }
+    return int(((e << 16) + 0x8000) >> 10);
+  }
+
+  // Mode 11: one region, untransformed 10-bit endpoints and 4-bit indices. Fitting happens on
+  // half-float bit patterns, which the hardware interpolates, so errors are roughly relative.
+  void _EncodeBc6h(const _Block& block, uint8_t* dst)
+  {
+    _Vec<3> points[BLOCK_TEXEL_COUNT];
+    for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+    {
+      for (uint32_t c = 0; c < 3; c++)
+      {
+        float value = block[i][c];
+        value = (value > 0.0f) ? std::min(value, MAX_HALF_VALUE) : 0.0f; // also catches NaN
+        points[i][c] = float(ImgioFloatToHalf(value));
+      }
+    }
+
+    _Vec<3> e0, e1;
+    _FitLine<3>(points, e0, e1);
+
+    uint32_t bestEndpoints[2][3] = {};
+    uint32_t bestIndices[BLOCK_TEXEL_COUNT] = {};
+    float bestError = FLT_MAX;
+
+    for (uint32_t iteration = 0; iteration <= REFINEMENT_ITERATION_COUNT; iteration++)
+    {
+      uint32_t endpoints[2][3];
+      int unquantized[2][3];
+      for (uint32_t c = 0; c < 3; c++)
+      {
+        endpoints[0][c] = _QuantizeBc6hEndpoint(e0[c]);
+        endpoints[1][c] = _QuantizeBc6hEndpoint(e1[c]);
+        unquantized[0][c] = _UnquantizeBc6hEndpoint(endpoints[0][c]);
+        unquantized[1][c] = _UnquantizeBc6hEndpoint(endpoints[1][c]);
+      }
+
+      _Vec<3> palette[16];
+      for (uint32_t k = 0; k < 16; k++)
+      {
+        int w = INDEX_WEIGHTS_4BIT[k];
+        for (uint32_t c = 0; c < 3; c++)
+        {
+          int value = ((64 - w) * unquantized[0][c] + w * unquantized[1][c] + 32) >> 6;
+          palette[k][c] = float((value * 31) >> 6);
+        }
+      }
+
+      uint32_t indices[BLOCK_TEXEL_COUNT];
+      float error = 0.0f;
+      float t[BLOCK_TEXEL_COUNT];
+      for (uint32_t i = 0; i < BLOCK_TEXEL_COUNT; i++)
+      {
+        float texelError;
+        indices[i] = _FindClosest<3>(points[i], palette, 16, texelError);
+        error += texelError;
+        t[i] = float(INDEX_WEIGHTS_4BIT[indices[i]]) / 64.0f;
+      }
+
+      if (error < bestError)
+      {
+        bestError = error;
+        memcpy(bestEndpoints, endpoints, sizeof(endpoints));
+        memcpy(bestIndices, indices, sizeof(indices));
+      }
+
+      if (!_SolveEndpoints<3>(points, t, e0, e1))
+      {
+        break;
+      }
+    }
+
+    if (bestIndices[0] & 8)
+    {
+      for (uint32_t c = 0; c < 3; c++)
+      {
+        std::swap(bestEndpoints[0][c], bestEndpoints[1][c]);
+      }
+      for (uint32_t& index : bestIndices)
+      {
+        index = 15 - index;
+      }
+    }
+
+    _BitWriter writer;
+    writer.write(0x03, 5);
+    for (uint32_t e = 0; e < 2; e++)
+    {
+      for (uint32_t c = 0; c < 3; c++)
+      {
+        writer.write(bestEndpoints[e][c], 10);
+      }
+    }
+    writer.write(bestIndices[0], 3);
+    for (uint32_t i = 1; i < BLOCK_TEXEL_COUNT; i++)
+    {
+      writer.write(bestIndices[i], 4);
+    }
+    writer.store(dst, 16);
+  }
+}
+
+namespace gtl
+{
+  uint32_t ImgioGetBlockSize(ImgioBlockFormat format)
+  {
+    return (format == ImgioBlockFormat::BC1 || format == ImgioBlockFormat::BC4) ? 8 : 16;
+  }
+
+  size_t ImgioGetBlockCompressedSize(ImgioBlockFormat format, uint32_t width, uint32_t height)
+  {
+    return size_t((width + 3) / 4) * ((height + 3) / 4) * ImgioGetBlockSize(format);
+  }
+
+  void ImgioEncodeBlocks(const ImgioImage& image, ImgioBlockFormat format, std::vector<uint8_t>& blocks)
+  {
+    uint32_t blockCountX = (image.width + 3) / 4;
+    uint32_t blockCountY = (image.height + 3) / 4;
+    uint32_t blockSize = ImgioGetBlockSize(format);
+
+    blocks.resize(ImgioGetBlockCompressedSize(format, image.width, image.height));
+
+#pragma omp parallel for
+    for (int64_t b = 0; b < int64_t(blockCountX) * blockCountY; b++)
+    {
+      _Block block;
+      _LoadBlock(image, uint32_t(b % blockCountX), uint32_t(b / blockCountX), block);
+
+      uint8_t* dst = &blocks[b * blockSize];
+
+      switch (format)
+      {
+      case ImgioBlockFormat::BC1: _EncodeBc1(block, dst); break;
+      case ImgioBlockFormat::BC4: _EncodeBc4(block, 0, dst); break;
+      case ImgioBlockFormat::BC5: _EncodeBc4(block, 0, dst); _EncodeBc4(block, 1, dst + 8); break;
+      case ImgioBlockFormat::BC6H: _EncodeBc6h(block, dst); break;
+      case ImgioBlockFormat::BC7: _EncodeBc7(block, dst); break;
+      }
+    }
+  }
+}
@@ -24,8 +24,8 @@
 #include <ImfArray.h>
 #include <ImfRgba.h>
 
-#include <algorithm>
 #include <assert.h>
+#include <string.h>
 
 namespace
 {
@@ -67,12 +67,6 @@ namespace
       m_pos = pos;
     }
   };
-
-  uint8_t _FloatToByte(float value)
-  {
-    int result = (int) std::floor(255 * value);
-    return std::min(255, std::max(0, result));
-  }
 }
 
 namespace gtl
@@ -101,25 +95,20 @@ namespace gtl
       const Imath::Box2i& dw = file.dataWindow();
       img->width = (dw.max.x - dw.min.x + 1);
       img->height = (dw.max.y - dw.min.y + 1);
-      img->size = img->width * img->height * 4;
+      img->format = ImgioFormat::RGBA16_FLOAT;
+      img->size = img->width * img->height * sizeof(Imf::Rgba);
       img->data.resize(img->size);
 
       Imf::Array2D<Imf::Rgba> tmpPixels(img->height, img->width); // values are 16-bit floats
       file.setFrameBuffer(&tmpPixels[0][0] - dw.min.x - dw.min.y * img->width, 1, img->width);
       file.readPixels(dw.min.y, dw.max.y);
 
+      // Rows are flipped, values are stored as-is.
+      static_assert(sizeof(Imf::Rgba) == 8);
+      size_t rowSize = img->width * sizeof(Imf::Rgba);
       for (long h = 0; h < tmpPixels.height(); h++)
       {
-        for (long w = 0; w < tmpPixels.width(); w++)
-        {
-          const Imf::Rgba& value = tmpPixels[img->height - h - 1][w];
-
-          uint64_t offset = (w + h * img->width) * 4;
-          img->data[offset + 0] = _FloatToByte(value.r);
-          img->data[offset + 1] = _FloatToByte(value.g);
-          img->data[offset + 2] = _FloatToByte(value.b);
-          img->data[offset + 3] = _FloatToByte(value.a);
-        }
+        memcpy(&img->data[h * rowSize], &tmpPixels[img->height - h - 1][0], rowSize);
       }
     }
     catch (std::exception&)
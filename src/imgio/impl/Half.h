@@ -0,0 +1,79 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+namespace gtl
+{
+  inline float ImgioHalfToFloat(uint16_t value)
+  {
+    uint32_t sign = uint32_t(value & 0x8000u) << 16;
+    uint32_t exponent = (value >> 10) & 0x1Fu;
+    uint32_t mantissa = value & 0x3FFu;
+
+    uint32_t bits;
+    if (exponent == 0x1Fu) // inf, nan
+    {
+      bits = sign | 0x7F800000u | (mantissa << 13);
+    }
+    else if (exponent != 0) // normal
+    {
+      bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    else // zero, subnormal
+    {
+      float result = ldexpf(float(mantissa), -24);
+      return sign ? -result : result;
+    }
+
+    float result;
+    memcpy(&result, &bits, sizeof(float));
+    return result;
+  }
+
+  // Rounds to nearest even; values out of range become inf.
+  inline uint16_t ImgioFloatToHalf(float value)
+  {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(float));
+
+    uint16_t sign = uint16_t((bits >> 16) & 0x8000u);
+    uint32_t absBits = bits & 0x7FFFFFFFu;
+
+    if (absBits >= 0x7F800000u) // inf, nan
+    {
+      return sign | 0x7C00u | ((absBits > 0x7F800000u) ? 0x200u : 0u);
+    }
+    if (absBits >= 0x477FF000u) // rounds to >= 65520
+    {
+      return sign | 0x7C00u;
+    }
+    if (absBits < 0x38800000u) // subnormal
+    {
+      float absValue;
+      memcpy(&absValue, &absBits, sizeof(float));
+      return sign | uint16_t(nearbyintf(ldexpf(absValue, 24)));
+    }
+
+    uint32_t rounded = absBits + 0xFFFu + ((absBits >> 13) & 1u);
+    return sign | uint16_t((rounded - 0x38000000u) >> 13);
+  }
+}
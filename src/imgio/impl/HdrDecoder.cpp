@@ -24,12 +24,10 @@
 #define STBI_ONLY_HDR
 #include <stb_image.h>
 
-#include <algorithm>
-#include <float.h>
+#include <string.h>
 
 namespace gtl
 {
-  // FIXME: don't downcast to uint8_t; store as RGBA16F / E5B9G9R9_UFLOAT_PACK32 / ASTC_HDR
   ImgioError ImgioHdrDecoder::decode(size_t size, const void* data, ImgioImage* img)
   {
     if (!stbi_is_hdr_from_memory((const stbi_uc*) data, (int) size))
@@ -46,22 +44,12 @@ namespace gtl
       return ImgioError::Decode;
     }
 
-    img->size = img->width * img->height * 4;
+    img->format = ImgioFormat::RGBA32_FLOAT;
+    img->size = img->width * img->height * 4 * sizeof(float);
     img->data.resize(img->size);
+    memcpy(&img->data[0], hdrData, img->size);
 
-    for (uint32_t i = 0; i < img->width; i++)
-    {
-      for (uint32_t j = 0; j < img->height; j++)
-      {
-        for (uint32_t k = 0; k < 4; k++)
-        {
-          uint32_t cIndex = (i + j * img->width) * 4 + k;
-          img->data[cIndex] = uint8_t(std::min(int(hdrData[cIndex] * 255.0f), 255));
-        }
-      }
-    }
-
-    delete hdrData;
+    stbi_image_free(hdrData);
     return ImgioError::None;
   }
 }
@@ -43,6 +43,7 @@ namespace gtl
     }
 
     int pixelFormat = TJPF_RGBA;
+    img->format = ImgioFormat::RGBA8_UNORM;
     img->size = img->width * img->height * tjPixelSize[pixelFormat];
     img->data.resize(img->size);
 
@@ -0,0 +1,400 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "Mipmaps.h"
+#include "Half.h"
+
+#include <algorithm>
+#include <array>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+namespace
+{
+  using namespace gtl;
+
+  constexpr static float KAISER_ALPHA = 4.0f;
+  constexpr static float KAISER_WIDTH = 3.0f; // in texels of the smaller level
+
+  // Taps of a separable filter, for each texel of the smaller level.
+  struct _FilterTaps
+  {
+    std::vector<uint32_t> offsets; // into indices & weights; one more than texels
+    std::vector<uint32_t> indices;
+    std::vector<float> weights;
+  };
+
+  float _BesselI0(float x)
+  {
+    float sum = 1.0f;
+    float term = 1.0f;
+    float halfX = x * 0.5f;
+    for (int k = 1; term > sum * 1e-8f; k++)
+    {
+      float factor = halfX / float(k);
+      term *= factor * factor;
+      sum += term;
+    }
+    return sum;
+  }
+
+  float _Sinc(float x)
+  {
+    if (fabsf(x) < 1e-5f)
+    {
+      return 1.0f;
+    }
+    float px = float(M_PI) * x;
+    return sinf(px) / px;
+  }
+
+  float _KaiserSinc(float x)
+  {
+    float t = x / KAISER_WIDTH;
+    if (fabsf(t) >= 1.0f)
+    {
+      return 0.0f;
+    }
+    return _Sinc(x) * _BesselI0(KAISER_ALPHA * sqrtf(1.0f - t * t)) / _BesselI0(KAISER_ALPHA);
+  }
+
+  _FilterTaps _MakeFilterTaps(uint32_t srcSize, uint32_t dstSize, ImgioMipFilter filter)
+  {
+    _FilterTaps taps;
+    taps.offsets.reserve(dstSize + 1);
+    taps.offsets.push_back(0);
+
+    float scale = float(srcSize) / float(dstSize);
+    float radius = (filter == ImgioMipFilter::Box) ? (scale * 0.5f) : (KAISER_WIDTH * scale);
+
+    for (uint32_t i = 0; i < dstSize; i++)
+    {
+      float center = (float(i) + 0.5f) * scale;
+      int first = int(floorf(center - radius));
+      int last = int(ceilf(center + radius)) - 1;
+
+      size_t begin = taps.weights.size();
+      float weightSum = 0.0f;
+
+      for (int j = first; j <= last; j++)
+      {
+        float weight;
+        if (filter == ImgioMipFilter::Box)
+        {
+          weight = std::min(float(j + 1), center + radius) - std::max(float(j), center - radius);
+        }
+        else
+        {
+          weight = _KaiserSinc((float(j) + 0.5f - center) / scale);
+        }
+
+        if (weight == 0.0f)
+        {
+          continue;
+        }
+
+        // Borders are clamped.
+        taps.indices.push_back(uint32_t(std::clamp(j, 0, int(srcSize) - 1)));
+        taps.weights.push_back(weight);
+        weightSum += weight;
+      }
+
+      for (size_t t = begin; t < taps.weights.size(); t++)
+      {
+        taps.weights[t] /= weightSum;
+      }
+
+      taps.offsets.push_back(uint32_t(taps.weights.size()));
+    }
+
+    return taps;
+  }
+
+  template<uint32_t ChannelCount>
+  void _Downsample(const std::vector<float>& src, uint32_t srcWidth, uint32_t srcHeight,
+                   uint32_t dstWidth, uint32_t dstHeight, ImgioMipFilter filter, std::vector<float>& dst)
+  {
+    _FilterTaps xTaps = _MakeFilterTaps(srcWidth, dstWidth, filter);
+    _FilterTaps yTaps = _MakeFilterTaps(srcHeight, dstHeight, filter);
+
+    // Horizontal pass
+    std::vector<float> tmp(size_t(dstWidth) * srcHeight * ChannelCount);
+
+#pragma omp parallel for
+    for (int y = 0; y < int(srcHeight); y++)
+    {
+      const float* srcRow = &src[size_t(y) * srcWidth * ChannelCount];
+      float* tmpRow = &tmp[size_t(y) * dstWidth * ChannelCount];
+
+      for (uint32_t x = 0; x < dstWidth; x++)
+      {
+        float sum[ChannelCount] = {};
+
+        for (uint32_t t = xTaps.offsets[x]; t < xTaps.offsets[x + 1]; t++)
+        {
+          const float* in = &srcRow[xTaps.indices[t] * ChannelCount];
+          float weight = xTaps.weights[t];
+
+          for (uint32_t c = 0; c < ChannelCount; c++)
+          {
+            sum[c] += in[c] * weight;
+          }
+        }
+
+        for (uint32_t c = 0; c < ChannelCount; c++)
+        {
+          tmpRow[x * ChannelCount + c] = sum[c];
+        }
+      }
+    }
+
+    // Vertical pass; operates on whole rows, which vectorizes well.
+    size_t rowLength = size_t(dstWidth) * ChannelCount;
+    dst.assign(rowLength * dstHeight, 0.0f);
+
+#pragma omp parallel for
+    for (int y = 0; y < int(dstHeight); y++)
+    {
+      float* dstRow = &dst[size_t(y) * rowLength];
+
+      for (uint32_t t = yTaps.offsets[y]; t < yTaps.offsets[y + 1]; t++)
+      {
+        const float* tmpRow = &tmp[size_t(yTaps.indices[t]) * rowLength];
+        float weight = yTaps.weights[t];
+
+#pragma omp simd
+        for (size_t i = 0; i < rowLength; i++)
+        {
+          dstRow[i] += tmpRow[i] * weight;
+        }
+      }
+    }
+  }
+
+  // Each level is filtered from the previous one, keeping full precision in between.
+  template<uint32_t ChannelCount, typename EncodeFunc>
+  void _GenerateMipChain(std::vector<float> texels, uint32_t width, uint32_t height, ImgioFormat format,
+                         ImgioMipFilter filter, EncodeFunc encodeFunc, std::vector<ImgioImage>& levels)
+  {
+    uint32_t levelCount = ImgioGetMipLevelCount(width, height);
+
+    levels.clear();
+    levels.reserve(levelCount - 1);
+
+    // Negative lobes of the Kaiser filter over- and undershoot at edges. Clamping to the value
+    // range of the base level removes the ringing before it is encoded or filtered further.
+    std::array<float, ChannelCount> minValues;
+    std::array<float, ChannelCount> maxValues;
+    minValues.fill(FLT_MAX);
+    maxValues.fill(-FLT_MAX);
+
+    if (filter == ImgioMipFilter::Kaiser)
+    {
+      for (size_t i = 0; i < texels.size(); i++)
+      {
+        minValues[i % ChannelCount] = std::min(minValues[i % ChannelCount], texels[i]);
+        maxValues[i % ChannelCount] = std::max(maxValues[i % ChannelCount], texels[i]);
+      }
+    }
+
+    std::vector<float> levelTexels;
+
+    for (uint32_t l = 1; l < levelCount; l++)
+    {
+      uint32_t levelWidth = std::max(width / 2, 1u);
+      uint32_t levelHeight = std::max(height / 2, 1u);
+
+      _Downsample<ChannelCount>(texels, width, height, levelWidth, levelHeight, filter, levelTexels);
+
+      if (filter == ImgioMipFilter::Kaiser)
+      {
+#pragma omp parallel for
+        for (int64_t i = 0; i < int64_t(levelTexels.size()); i++)
+        {
+          uint32_t c = uint32_t(i % ChannelCount);
+          levelTexels[i] = std::clamp(levelTexels[i], minValues[c], maxValues[c]);
+        }
+      }
+
+      ImgioImage& level = levels.emplace_back();
+      level.width = levelWidth;
+      level.height = levelHeight;
+      level.format = format;
+      encodeFunc(levelTexels, level);
+      level.size = level.data.size();
+
+      std::swap(texels, levelTexels);
+      width = levelWidth;
+      height = levelHeight;
+    }
+  }
+
+  float _SrgbToLinear(float value)
+  {
+    return (value <= 0.04045f) ? (value / 12.92f) : powf((value + 0.055f) / 1.055f, 2.4f);
+  }
+
+  float _LinearToSrgb(float value)
+  {
+    return (value <= 0.0031308f) ? (value * 12.92f) : (powf(value, 1.0f / 2.4f) * 1.055f - 0.055f);
+  }
+
+  uint8_t _QuantizeUnorm8(float value)
+  {
+    return uint8_t(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+  }
+
+  uint16_t _QuantizeUnorm16(float value)
+  {
+    return uint16_t(std::clamp(value, 0.0f, 1.0f) * 65535.0f + 0.5f);
+  }
+}
+
+namespace gtl
+{
+  uint32_t ImgioGetMipLevelCount(uint32_t width, uint32_t height)
+  {
+    uint32_t levelCount = 1;
+    for (uint32_t size = std::max(width, height); size > 1; size /= 2)
+    {
+      levelCount++;
+    }
+    return levelCount;
+  }
+
+  void ImgioGenerateMipChainRgba8(const ImgioImage& image, ImgioMipFilter filter, bool isSrgb,
+                                  std::vector<ImgioImage>& levels)
+  {
+    static const std::array<float, 256> SRGB_TO_LINEAR = []()
+    {
+      std::array<float, 256> table;
+      for (size_t i = 0; i < table.size(); i++)
+      {
+        table[i] = _SrgbToLinear(float(i) / 255.0f);
+      }
+      return table;
+    }();
+
+    size_t texelCount = size_t(image.width) * image.height;
+    std::vector<float> texels(texelCount * 4);
+
+#pragma omp parallel for
+    for (int64_t i = 0; i < int64_t(texelCount); i++)
+    {
+      const uint8_t* in = &image.data[i * 4];
+      float* out = &texels[i * 4];
+      for (uint32_t c = 0; c < 3; c++)
+      {
+        out[c] = isSrgb ? SRGB_TO_LINEAR[in[c]] : (float(in[c]) / 255.0f);
+      }
+      out[3] = float(in[3]) / 255.0f;
+    }
+
+    auto encodeFunc = [isSrgb](const std::vector<float>& texels, ImgioImage& level)
+    {
+      level.data.resize(texels.size());
+
+#pragma omp parallel for
+      for (int64_t i = 0; i < int64_t(texels.size() / 4); i++)
+      {
+        const float* in = &texels[i * 4];
+        uint8_t* out = &level.data[i * 4];
+        for (uint32_t c = 0; c < 3; c++)
+        {
+          out[c] = _QuantizeUnorm8(isSrgb ? _LinearToSrgb(std::max(in[c], 0.0f)) : in[c]);
+        }
+        out[3] = _QuantizeUnorm8(in[3]);
+      }
+    };
+
+    _GenerateMipChain<4>(std::move(texels), image.width, image.height, image.format, filter, encodeFunc, levels);
+  }
+
+  void ImgioGenerateMipChainR32f(const ImgioImage& image, ImgioMipFilter filter,
+                                 std::vector<ImgioImage>& levels)
+  {
+    size_t texelCount = size_t(image.width) * image.height;
+    std::vector<float> texels(texelCount);
+    memcpy(texels.data(), image.data.data(), texelCount * sizeof(float));
+
+    auto encodeFunc = [](const std::vector<float>& texels, ImgioImage& level)
+    {
+      level.data.resize(texels.size() * sizeof(float));
+      memcpy(level.data.data(), texels.data(), level.data.size());
+    };
+
+    _GenerateMipChain<1>(std::move(texels), image.width, image.height, image.format, filter, encodeFunc, levels);
+  }
+
+  void ImgioGenerateMipChain(const ImgioImage& image, ImgioMipFilter filter, bool isSrgb,
+                             std::vector<ImgioImage>& levels)
+  {
+    if (image.format == ImgioFormat::RGBA8_UNORM)
+    {
+      ImgioGenerateMipChainRgba8(image, filter, isSrgb, levels);
+      return;
+    }
+
+    // Wide formats are stored linearly. Negative values are clamped since they are
+    // not meaningful as colors and would be amplified by the filter.
+    ImgioFormat format = image.format;
+    size_t valueCount = size_t(image.width) * image.height * 4;
+    std::vector<float> texels(valueCount);
+
+#pragma omp parallel for
+    for (int64_t i = 0; i < int64_t(valueCount); i++)
+    {
+      float value;
+      if (format == ImgioFormat::RGBA16_UNORM)
+      {
+        value = float(((const uint16_t*) image.data.data())[i]) / 65535.0f;
+      }
+      else if (format == ImgioFormat::RGBA16_FLOAT)
+      {
+        value = ImgioHalfToFloat(((const uint16_t*) image.data.data())[i]);
+      }
+      else
+      {
+        value = ((const float*) image.data.data())[i];
+      }
+      texels[i] = std::max(value, 0.0f);
+    }
+
+    auto encodeFunc = [format](const std::vector<float>& texels, ImgioImage& level)
+    {
+      level.data.resize(texels.size() * (ImgioGetTexelSize(format) / 4));
+
+      if (format == ImgioFormat::RGBA32_FLOAT)
+      {
+        memcpy(level.data.data(), texels.data(), level.data.size());
+        return;
+      }
+
+      uint16_t* out = (uint16_t*) level.data.data();
+      bool isUnorm = (format == ImgioFormat::RGBA16_UNORM);
+
+#pragma omp parallel for
+      for (int64_t i = 0; i < int64_t(texels.size()); i++)
+      {
+        out[i] = isUnorm ? _QuantizeUnorm16(texels[i]) : ImgioFloatToHalf(texels[i]);
+      }
+    };
+
+    _GenerateMipChain<4>(std::move(texels), image.width, image.height, format, filter, encodeFunc, levels);
+  }
+}
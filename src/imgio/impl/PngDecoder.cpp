@@ -20,20 +20,21 @@
 #include "Image.h"
 
 #include <stdlib.h>
+#include <algorithm>
 #include <spng.h>
 
 namespace gtl
 {
   static void _FlipImage(ImgioImage* img)
   {
+    size_t rowSize = size_t(img->width) * ImgioGetTexelSize(img->format);
+
     for (uint32_t i = 0; i < img->height / 2; i++)
-    for (uint32_t j = 0; j < img->width; j++)
-    for (uint32_t k = 0; k < 4; k++)
     {
-      uint32_t ipix = (i * img->width + j) * 4;
-      uint32_t opix = ((img->height - i - 1) * img->width + j) * 4;
+      uint8_t* row = &img->data[i * rowSize];
+      uint8_t* oppositeRow = &img->data[(img->height - i - 1) * rowSize];
 
-      std::swap(img->data[ipix + k], img->data[opix + k]);
+      std::swap_ranges(row, row + rowSize, oppositeRow);
     }
   }
 
@@ -49,22 +50,26 @@ namespace gtl
       goto fail;
     }
 
-    err = spng_decoded_image_size(ctx, SPNG_FMT_RGBA8, &img->size);
+    spng_ihdr ihdr;
+    err = spng_get_ihdr(ctx, &ihdr);
     if (err != SPNG_OK)
     {
       goto fail;
     }
 
-    img->data.resize(img->size);
+    // 16-bit images keep their precision; values are in host byte order.
+    spng_format format;
+    format = (ihdr.bit_depth == 16) ? SPNG_FMT_RGBA16 : SPNG_FMT_RGBA8;
 
-    err = spng_decode_image(ctx, &img->data[0], img->size, SPNG_FMT_RGBA8, 0);
+    err = spng_decoded_image_size(ctx, format, &img->size);
     if (err != SPNG_OK)
     {
       goto fail;
     }
 
-    spng_ihdr ihdr;
-    err = spng_get_ihdr(ctx, &ihdr);
+    img->data.resize(img->size);
+
+    err = spng_decode_image(ctx, &img->data[0], img->size, format, 0);
     if (err != SPNG_OK)
     {
       goto fail;
@@ -72,6 +77,7 @@ namespace gtl
 
     img->width = ihdr.width;
     img->height = ihdr.height;
+    img->format = (format == SPNG_FMT_RGBA16) ? ImgioFormat::RGBA16_UNORM : ImgioFormat::RGBA8_UNORM;
 
     spng_ctx_free(ctx);
 
@@ -23,6 +23,73 @@
 #include <tiffio.hxx>
 
 #include <sstream>
+#include <utility>
+#include <vector>
+
+namespace
+{
+  using namespace gtl;
+
+  // Maps a stored texel to its position in the displayed image, with the bottom row first.
+  size_t _GetOrientedTexelIndex(uint16_t orientation, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+  {
+    // Column and row of the displayed image, counted from the top left.
+    uint32_t dx, dy;
+    switch (orientation)
+    {
+    case ORIENTATION_TOPRIGHT: dx = width - x - 1; dy = y; break;
+    case ORIENTATION_BOTRIGHT: dx = width - x - 1; dy = height - y - 1; break;
+    case ORIENTATION_BOTLEFT: dx = x; dy = height - y - 1; break;
+    // Rows and columns are transposed in the remaining orientations.
+    case ORIENTATION_LEFTTOP: dx = y; dy = x; break;
+    case ORIENTATION_RIGHTTOP: dx = height - y - 1; dy = x; break;
+    case ORIENTATION_RIGHTBOT: dx = height - y - 1; dy = width - x - 1; break;
+    case ORIENTATION_LEFTBOT: dx = y; dy = width - x - 1; break;
+    default: dx = x; dy = y; break; // ORIENTATION_TOPLEFT
+    }
+
+    bool isTransposed = orientation >= ORIENTATION_LEFTTOP && orientation <= ORIENTATION_LEFTBOT;
+    uint32_t displayWidth = isTransposed ? height : width;
+    uint32_t displayHeight = isTransposed ? width : height;
+
+    return size_t(displayHeight - dy - 1) * displayWidth + dx;
+  }
+
+  // Expands RGB(A) scanlines of 16-bit or float images to RGBA, oriented like the displayed
+  // image and bottom row first. 'width' and 'height' are the dimensions as stored.
+  template<typename T>
+  bool _ReadScanlines(TIFF* tiff, uint16_t samplesPerPixel, uint16_t orientation, uint32_t width, uint32_t height,
+                      T alphaOne, ImgioImage* img)
+  {
+    std::vector<T> scanline(TIFFScanlineSize(tiff) / sizeof(T));
+    if (scanline.size() < size_t(width) * samplesPerPixel)
+    {
+      return false;
+    }
+
+    T* texels = (T*) &img->data[0];
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+      if (TIFFReadScanline(tiff, scanline.data(), y) < 0)
+      {
+        return false;
+      }
+
+      for (uint32_t x = 0; x < width; x++)
+      {
+        const T* in = &scanline[size_t(x) * samplesPerPixel];
+        T* out = &texels[_GetOrientedTexelIndex(orientation, x, y, width, height) * 4];
+        out[0] = in[0];
+        out[1] = in[1];
+        out[2] = in[2];
+        out[3] = (samplesPerPixel == 4) ? in[3] : alphaOne;
+      }
+    }
+
+    return true;
+  }
+}
 
 namespace gtl
 {
@@ -40,10 +107,47 @@ namespace gtl
     TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &img->width);
     TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &img->height);
 
-    img->size = img->width * img->height * 4;
+    uint16_t bitsPerSample, samplesPerPixel, sampleFormat, planarConfig, orientation, photometric = 0;
+    TIFFGetFieldDefaulted(tiff, TIFFTAG_BITSPERSAMPLE, &bitsPerSample);
+    TIFFGetFieldDefaulted(tiff, TIFFTAG_SAMPLESPERPIXEL, &samplesPerPixel);
+    TIFFGetFieldDefaulted(tiff, TIFFTAG_SAMPLEFORMAT, &sampleFormat);
+    TIFFGetFieldDefaulted(tiff, TIFFTAG_PLANARCONFIG, &planarConfig);
+    TIFFGetFieldDefaulted(tiff, TIFFTAG_ORIENTATION, &orientation);
+    TIFFGetField(tiff, TIFFTAG_PHOTOMETRIC, &photometric);
+
+    // Contiguous 16-bit and float RGB(A) images keep their precision. Everything else is
+    // converted to 8-bit by libtiff.
+    bool isRgbScanlineImage = photometric == PHOTOMETRIC_RGB && planarConfig == PLANARCONFIG_CONTIG &&
+                              !TIFFIsTiled(tiff) && (samplesPerPixel == 3 || samplesPerPixel == 4);
+    bool is16Bit = isRgbScanlineImage && bitsPerSample == 16 && sampleFormat == SAMPLEFORMAT_UINT;
+    bool isFloat = isRgbScanlineImage && bitsPerSample == 32 && sampleFormat == SAMPLEFORMAT_IEEEFP;
+
+    uint32_t width = img->width;
+    uint32_t height = img->height;
+
+    // Images with transposed orientations are displayed with swapped dimensions.
+    if ((is16Bit || isFloat) && orientation >= ORIENTATION_LEFTTOP && orientation <= ORIENTATION_LEFTBOT)
+    {
+      std::swap(img->width, img->height);
+    }
+
+    img->format = is16Bit ? ImgioFormat::RGBA16_UNORM : (isFloat ? ImgioFormat::RGBA32_FLOAT : ImgioFormat::RGBA8_UNORM);
+    img->size = img->width * img->height * ImgioGetTexelSize(img->format);
     img->data.resize(img->size);
 
-    int result = TIFFReadRGBAImageOriented(tiff, img->width, img->height, (uint32_t*) &img->data[0], ORIENTATION_BOTLEFT, 1);
+    bool result;
+    if (is16Bit)
+    {
+      result = _ReadScanlines<uint16_t>(tiff, samplesPerPixel, orientation, width, height, UINT16_MAX, img);
+    }
+    else if (isFloat)
+    {
+      result = _ReadScanlines<float>(tiff, samplesPerPixel, orientation, width, height, 1.0f, img);
+    }
+    else
+    {
+      result = TIFFReadRGBAImageOriented(tiff, img->width, img->height, (uint32_t*) &img->data[0], ORIENTATION_BOTLEFT, 1);
+    }
 
     TIFFClose(tiff);
 
@@ -20,8 +20,14 @@
 
 #include <filesystem>
 #include <array>
+#include <chrono>
+#include <math.h>
+#include <string.h>
 
+#include "BlockCompression.h"
+#include "Half.h"
 #include "Imgio.h"
+#include "Mipmaps.h"
 
 namespace fs = std::filesystem;
 using namespace gtl;
@@ -40,14 +46,20 @@ bool _ReadFile(const fs::path& filePath, std::vector<uint8_t>& data)
   return file.good() && data.size() > 0;
 }
 
-void _LoadOriented(const char* fileName, const std::vector<uint8_t>& ref)
+template<typename T>
+void _LoadOriented(const char* fileName, ImgioFormat format, const std::vector<T>& ref)
 {
   ImgioImage img;
   std::vector<uint8_t> fileData;
 
   REQUIRE(_ReadFile(fs::path(IMGIO_TESTENV_DIR) / fileName, fileData));
   CHECK_EQ(ImgioLoadImage(&fileData[0], fileData.size(), &img), ImgioError::None);
-  CHECK_EQ(img.data, ref);
+  CHECK_EQ(img.format, format);
+  REQUIRE_EQ(img.data.size(), ref.size() * sizeof(T));
+
+  std::vector<T> values(ref.size());
+  memcpy(values.data(), img.data.data(), img.data.size());
+  CHECK_EQ(values, ref);
 }
 
 static const std::vector<uint8_t> REF_4C = {255,   0,   0, 255,  // red
@@ -55,6 +67,18 @@ static const std::vector<uint8_t> REF_4C = {255,   0,   0, 255,  // red
                                             255, 255, 255, 255,  // white
                                               0, 255,   0, 255}; // green
 
+static const uint16_t HALF_ONE = 0x3C00;
+
+static const std::vector<uint16_t> REF_4C_HALF = {HALF_ONE,        0,        0, HALF_ONE,  // red
+                                                         0,        0, HALF_ONE, HALF_ONE,  // blue
+                                                  HALF_ONE, HALF_ONE, HALF_ONE, HALF_ONE,  // white
+                                                         0, HALF_ONE,        0, HALF_ONE}; // green
+
+static const std::vector<float> REF_4C_FLOAT = {1.0f, 0.0f, 0.0f, 1.0f,  // red
+                                                0.0f, 0.0f, 1.0f, 1.0f,  // blue
+                                                1.0f, 1.0f, 1.0f, 1.0f,  // white
+                                                0.0f, 1.0f, 0.0f, 1.0f}; // green
+
 static const std::vector<uint8_t> REF_4C_JPG = {254,   0,   0, 255,  // red
                                                   0,   0, 254, 255,  // blue
                                                 255, 255, 255, 255,  // white
@@ -62,25 +86,755 @@ static const std::vector<uint8_t> REF_4C_JPG = {254,   0,   0, 255,  // red
 
 TEST_CASE("LoadOriented.Png")
 {
-  _LoadOriented("4c.png", REF_4C);
+  _LoadOriented("4c.png", ImgioFormat::RGBA8_UNORM, REF_4C);
 }
 
 TEST_CASE("LoadOriented.Tiff")
 {
-  _LoadOriented("4c.tiff", REF_4C);
+  _LoadOriented("4c.tiff", ImgioFormat::RGBA8_UNORM, REF_4C);
 }
 
 TEST_CASE("LoadOriented.Exr")
 {
-  _LoadOriented("4c.exr", REF_4C);
+  _LoadOriented("4c.exr", ImgioFormat::RGBA16_FLOAT, REF_4C_HALF);
 }
 
 TEST_CASE("LoadOriented.Hdr")
 {
-  _LoadOriented("4c.hdr", REF_4C);
+  _LoadOriented("4c.hdr", ImgioFormat::RGBA32_FLOAT, REF_4C_FLOAT);
 }
 
 TEST_CASE("LoadOriented.Jpg")
 {
-  _LoadOriented("4c.jpg", REF_4C_JPG);
+  _LoadOriented("4c.jpg", ImgioFormat::RGBA8_UNORM, REF_4C_JPG);
+}
+
+// Uncompressed little-endian RGB TIFF with 16 bits per sample.
+static std::vector<uint8_t> _MakeTiff16(uint32_t width, uint32_t height, uint16_t orientation,
+                                        const std::vector<uint16_t>& values)
+{
+  std::vector<uint8_t> data;
+  auto write16 = [&data](uint16_t value) { data.push_back(uint8_t(value)); data.push_back(uint8_t(value >> 8)); };
+  auto write32 = [&](uint32_t value) { write16(uint16_t(value)); write16(uint16_t(value >> 16)); };
+
+  const uint16_t entryCount = 11;
+  const uint32_t bitsPerSampleOffset = 8 + 2 + entryCount * 12 + 4;
+  const uint32_t imageDataOffset = bitsPerSampleOffset + 3 * 2;
+
+  auto writeEntry = [&](uint16_t tag, uint16_t type, uint32_t count, uint32_t value)
+  {
+    write16(tag);
+    write16(type);
+    write32(count);
+    write32(value); // shorts are stored in the lower bytes
+  };
+
+  const uint16_t SHORT = 3;
+  const uint16_t LONG = 4;
+
+  data.push_back('I');
+  data.push_back('I');
+  write16(42);
+  write32(8);
+
+  write16(entryCount);
+  writeEntry(256, LONG, 1, width);
+  writeEntry(257, LONG, 1, height);
+  writeEntry(258, SHORT, 3, bitsPerSampleOffset);
+  writeEntry(259, SHORT, 1, 1); // no compression
+  writeEntry(262, SHORT, 1, 2); // RGB
+  writeEntry(273, LONG, 1, imageDataOffset);
+  writeEntry(274, SHORT, 1, orientation);
+  writeEntry(277, SHORT, 1, 3); // samples per pixel
+  writeEntry(278, LONG, 1, height); // rows per strip
+  writeEntry(279, LONG, 1, uint32_t(values.size() * 2));
+  writeEntry(284, SHORT, 1, 1); // contiguous
+  write32(0);
+
+  for (int i = 0; i < 3; i++)
+  {
+    write16(16);
+  }
+
+  for (uint16_t value : values)
+  {
+    write16(value);
+  }
+  return data;
+}
+
+TEST_CASE("LoadOriented.TiffOrientation16Bit")
+{
+  // Texels are identified by their red channel; alpha is opaque.
+  const uint16_t A = 1000;
+  const uint16_t B = 2000;
+
+  struct TestCase
+  {
+    uint32_t width;
+    uint32_t height;
+    uint16_t orientation;
+    uint32_t displayWidth;
+    std::vector<uint16_t> reds; // bottom row first
+  };
+
+  const std::vector<TestCase> testCases = {
+    { 2, 1, 1, 2, { A, B } }, // top left
+    { 2, 1, 2, 2, { B, A } }, // top right
+    { 1, 2, 1, 1, { B, A } }, // top left; stored rows are flipped
+    { 1, 2, 4, 1, { A, B } }, // bottom left
+    { 1, 2, 3, 1, { A, B } }, // bottom right
+    { 2, 1, 5, 1, { B, A } }, // left top; transposed
+    { 2, 1, 6, 1, { B, A } }, // right top
+    { 2, 1, 7, 1, { A, B } }, // right bottom
+    { 2, 1, 8, 1, { A, B } }  // left bottom
+  };
+
+  for (const TestCase& testCase : testCases)
+  {
+    INFO("orientation: ", testCase.orientation);
+
+    std::vector<uint16_t> values = { A, 0, 0, B, 0, 0 };
+    std::vector<uint8_t> fileData = _MakeTiff16(testCase.width, testCase.height, testCase.orientation, values);
+
+    ImgioImage img;
+    REQUIRE_EQ(ImgioLoadImage(&fileData[0], fileData.size(), &img), ImgioError::None);
+    CHECK_EQ(img.format, ImgioFormat::RGBA16_UNORM);
+    CHECK_EQ(img.width, testCase.displayWidth);
+    CHECK_EQ(img.width * img.height, 2);
+    REQUIRE_EQ(img.data.size(), 2 * 4 * sizeof(uint16_t));
+
+    const uint16_t* texels = (const uint16_t*) img.data.data();
+    CHECK_EQ(texels[0], testCase.reds[0]);
+    CHECK_EQ(texels[4], testCase.reds[1]);
+    CHECK_EQ(texels[3], UINT16_MAX);
+  }
+}
+
+TEST_CASE("HdrRange.Rgbe")
+{
+  // Uncompressed 2x1 Radiance image. Mantissas scaled by powers of two are exactly representable.
+  std::string header = "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y 1 +X 2\n";
+  std::vector<uint8_t> fileData(header.begin(), header.end());
+  for (uint8_t byte : { 128, 192, 64, 130,    // (2, 3, 1) * 2^-6 * 2^2
+                        160, 200, 136, 140 }) // (160, 200, 136) * 2^4
+  {
+    fileData.push_back(byte);
+  }
+
+  const std::vector<float> ref = {    2.0f,    3.0f,    1.0f, 1.0f,
+                                   2560.0f, 3200.0f, 2176.0f, 1.0f };
+
+  ImgioImage img;
+  REQUIRE_EQ(ImgioLoadImage(&fileData[0], fileData.size(), &img), ImgioError::None);
+  CHECK_EQ(img.format, ImgioFormat::RGBA32_FLOAT);
+  REQUIRE_EQ(img.size, ref.size() * sizeof(float));
+
+  std::vector<float> values(ref.size());
+  memcpy(values.data(), img.data.data(), img.size);
+  CHECK_EQ(values, ref);
+}
+
+// Straightforward 2x2 average, as a reference for the box filter on power-of-two images.
+static std::vector<uint8_t> _BoxDownsampleReference(const std::vector<uint8_t>& data, uint32_t width, uint32_t height, bool isSrgb)
+{
+  auto toLinear = [](double v) { return v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4); };
+  auto toSrgb = [](double v) { return v <= 0.0031308 ? v * 12.92 : pow(v, 1.0 / 2.4) * 1.055 - 0.055; };
+
+  std::vector<uint8_t> result((width / 2) * (height / 2) * 4);
+  for (uint32_t y = 0; y < height / 2; y++)
+  {
+    for (uint32_t x = 0; x < width / 2; x++)
+    {
+      for (uint32_t c = 0; c < 4; c++)
+      {
+        bool convert = isSrgb && c != 3;
+        double sum = 0.0;
+        for (uint32_t i = 0; i < 4; i++)
+        {
+          double value = data[(((y * 2 + i / 2) * width) + (x * 2 + i % 2)) * 4 + c] / 255.0;
+          sum += convert ? toLinear(value) : value;
+        }
+        double average = sum / 4.0;
+        result[(y * (width / 2) + x) * 4 + c] = uint8_t((convert ? toSrgb(average) : average) * 255.0 + 0.5);
+      }
+    }
+  }
+  return result;
+}
+
+static ImgioImage _MakeRandomImage(uint32_t width, uint32_t height)
+{
+  ImgioImage image;
+  image.width = width;
+  image.height = height;
+  image.size = width * height * 4;
+  image.data.resize(image.size);
+
+  uint32_t state = 42;
+  for (uint8_t& value : image.data)
+  {
+    state = state * 1664525u + 1013904223u;
+    value = uint8_t(state >> 24);
+  }
+  return image;
+}
+
+TEST_CASE("Mipmaps.LevelCount")
+{
+  CHECK_EQ(ImgioGetMipLevelCount(1, 1), 1);
+  CHECK_EQ(ImgioGetMipLevelCount(4, 4), 3);
+  CHECK_EQ(ImgioGetMipLevelCount(5, 3), 3);
+  CHECK_EQ(ImgioGetMipLevelCount(1024, 1), 11);
+
+  ImgioImage image = _MakeRandomImage(5, 3);
+  std::vector<ImgioImage> levels;
+  ImgioGenerateMipChainRgba8(image, ImgioMipFilter::Box, false, levels);
+
+  REQUIRE_EQ(levels.size(), 2);
+  CHECK_EQ(levels[0].width, 2);
+  CHECK_EQ(levels[0].height, 1);
+  CHECK_EQ(levels[1].width, 1);
+  CHECK_EQ(levels[1].height, 1);
+  CHECK_EQ(levels[1].size, 4);
+}
+
+TEST_CASE("Mipmaps.BoxReference")
+{
+  const uint32_t size = 16;
+  ImgioImage image = _MakeRandomImage(size, size);
+
+  for (bool isSrgb : { false, true })
+  {
+    std::vector<ImgioImage> levels;
+    ImgioGenerateMipChainRgba8(image, ImgioMipFilter::Box, isSrgb, levels);
+    REQUIRE_EQ(levels.size(), 4);
+
+    std::vector<uint8_t> ref = _BoxDownsampleReference(image.data, size, size, isSrgb);
+    REQUIRE_EQ(levels[0].data.size(), ref.size());
+
+    for (size_t i = 0; i < ref.size(); i++)
+    {
+      CHECK_LE(abs(int(levels[0].data[i]) - int(ref[i])), 1);
+    }
+  }
+}
+
+TEST_CASE("Mipmaps.SrgbCorrect")
+{
+  ImgioImage image;
+  image.width = 2;
+  image.height = 1;
+  image.data = { 0, 0, 0, 0, 255, 255, 255, 255 };
+  image.size = image.data.size();
+
+  const std::vector<uint8_t> srgbRef = { 188, 188, 188, 128 }; // alpha is linear
+  const std::vector<uint8_t> linearRef = { 128, 128, 128, 128 };
+
+  std::vector<ImgioImage> levels;
+  ImgioGenerateMipChainRgba8(image, ImgioMipFilter::Box, true, levels);
+  REQUIRE_EQ(levels.size(), 1);
+  CHECK_EQ(levels[0].data, srgbRef);
+
+  ImgioGenerateMipChainRgba8(image, ImgioMipFilter::Box, false, levels);
+  CHECK_EQ(levels[0].data, linearRef);
+}
+
+TEST_CASE("Mipmaps.Kaiser")
+{
+  const uint32_t size = 32;
+
+  // Highest-frequency checkerboard; should be filtered to its average.
+  ImgioImage image;
+  image.width = size;
+  image.height = size;
+  image.size = size * size * sizeof(float);
+  image.data.resize(image.size);
+
+  std::vector<float> values(size * size);
+  for (uint32_t i = 0; i < values.size(); i++)
+  {
+    values[i] = ((i % size + i / size) % 2) ? 4.0f : 0.0f;
+  }
+  memcpy(image.data.data(), values.data(), image.size);
+
+  std::vector<ImgioImage> levels;
+  ImgioGenerateMipChainR32f(image, ImgioMipFilter::Kaiser, levels);
+  REQUIRE_EQ(levels.size(), 5);
+
+  for (const ImgioImage& level : levels)
+  {
+    REQUIRE_EQ(level.size, level.width * level.height * sizeof(float));
+
+    std::vector<float> levelValues(level.width * level.height);
+    memcpy(levelValues.data(), level.data.data(), level.size);
+
+    for (float value : levelValues)
+    {
+      // Not clamped to [0, 1]; clamped borders cause slight deviations in the corners.
+      CHECK_EQ(value, doctest::Approx(2.0f).epsilon(0.05));
+    }
+  }
+}
+
+TEST_CASE("Mipmaps.KaiserRinging")
+{
+  // A hard edge makes the negative lobes of the filter over- and undershoot.
+  const uint32_t size = 32;
+  const float lowValue = -1.0f;
+  const float highValue = 3.0f;
+
+  ImgioImage image;
+  image.width = size;
+  image.height = size;
+  image.size = size * size * sizeof(float);
+  image.data.resize(image.size);
+
+  std::vector<float> values(size * size);
+  for (uint32_t i = 0; i < values.size(); i++)
+  {
+    values[i] = (i % size < size / 2 + 1) ? lowValue : highValue;
+  }
+  memcpy(image.data.data(), values.data(), image.size);
+
+  std::vector<ImgioImage> levels;
+  ImgioGenerateMipChainR32f(image, ImgioMipFilter::Kaiser, levels);
+  REQUIRE_EQ(levels.size(), 5);
+
+  for (const ImgioImage& level : levels)
+  {
+    std::vector<float> levelValues(level.width * level.height);
+    memcpy(levelValues.data(), level.data.data(), level.size);
+
+    // Values stay within the range of the base level, which may be negative.
+    for (float value : levelValues)
+    {
+      CHECK_GE(value, lowValue);
+      CHECK_LE(value, highValue);
+    }
+  }
+}
+
+TEST_CASE("Mipmaps.Throughput")
+{
+  const uint32_t size = 2048;
+  ImgioImage image = _MakeRandomImage(size, size);
+
+  for (ImgioMipFilter filter : { ImgioMipFilter::Box, ImgioMipFilter::Kaiser })
+  {
+    std::vector<ImgioImage> levels;
+
+    auto startTime = std::chrono::steady_clock::now();
+    ImgioGenerateMipChainRgba8(image, filter, true, levels);
+    std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - startTime;
+
+    double megapixels = double(size) * size / 1e6;
+    MESSAGE((filter == ImgioMipFilter::Box ? "box" : "kaiser"), " filter: ", megapixels / (duration.count() / 1000.0), " MP/s");
+
+    CHECK_EQ(levels.size(), ImgioGetMipLevelCount(size, size) - 1);
+    CHECK_EQ(levels.back().width, 1);
+  }
+}
+
+TEST_CASE("Mipmaps.HdrRange")
+{
+  // Constant images must keep values above 1.0 exactly through all levels.
+  const uint32_t size = 8;
+  const uint16_t halfValue = 0x4C40; // 17.0
+  const float floatValue = 4096.5f;
+
+  ImgioImage halfImage;
+  halfImage.width = size;
+  halfImage.height = size;
+  halfImage.format = ImgioFormat::RGBA16_FLOAT;
+  halfImage.size = size * size * 8;
+  halfImage.data.resize(halfImage.size);
+  std::vector<uint16_t> halfValues(size * size * 4, halfValue);
+  memcpy(halfImage.data.data(), halfValues.data(), halfImage.size);
+
+  ImgioImage floatImage;
+  floatImage.width = size;
+  floatImage.height = size;
+  floatImage.format = ImgioFormat::RGBA32_FLOAT;
+  floatImage.size = size * size * 16;
+  floatImage.data.resize(floatImage.size);
+  std::vector<float> floatValues(size * size * 4, floatValue);
+  memcpy(floatImage.data.data(), floatValues.data(), floatImage.size);
+
+  std::vector<ImgioImage> levels;
+  ImgioGenerateMipChain(halfImage, ImgioMipFilter::Box, true, levels);
+  REQUIRE_EQ(levels.size(), 3);
+
+  for (const ImgioImage& level : levels)
+  {
+    CHECK_EQ(level.format, ImgioFormat::RGBA16_FLOAT);
+    REQUIRE_EQ(level.size, level.width * level.height * 8);
+
+    std::vector<uint16_t> levelValues(level.width * level.height * 4);
+    memcpy(levelValues.data(), level.data.data(), level.size);
+    CHECK_EQ(levelValues, std::vector<uint16_t>(levelValues.size(), halfValue));
+  }
+
+  ImgioGenerateMipChain(floatImage, ImgioMipFilter::Box, false, levels);
+  REQUIRE_EQ(levels.size(), 3);
+
+  for (const ImgioImage& level : levels)
+  {
+    CHECK_EQ(level.format, ImgioFormat::RGBA32_FLOAT);
+    REQUIRE_EQ(level.size, level.width * level.height * 16);
+
+    std::vector<float> levelValues(level.width * level.height * 4);
+    memcpy(levelValues.data(), level.data.data(), level.size);
+    CHECK_EQ(levelValues, std::vector<float>(levelValues.size(), floatValue));
+  }
+}
+
+// Reads blocks as little-endian bit streams.
+class _BitReader
+{
+public:
+  _BitReader(const uint8_t* block)
+  {
+    memcpy(m_words, block, sizeof(m_words));
+  }
+
+  uint32_t read(uint32_t bitCount)
+  {
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < bitCount; i++, m_pos++)
+    {
+      value |= uint32_t((m_words[m_pos / 64] >> (m_pos % 64)) & 1) << i;
+    }
+    return value;
+  }
+
+private:
+  uint64_t m_words[2];
+  uint32_t m_pos = 0;
+};
+
+static const int BC_INDEX_WEIGHTS_4BIT[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Reference decoders, following the format specifications. BC6H and BC7 only support the
+// modes the encoder emits. Outputs RGBA values; LDR formats are normalized to [0, 1].
+static void _DecodeBc1(const uint8_t* block, float texels[16][4])
+{
+  _BitReader reader(block);
+  uint32_t colors[2] = { reader.read(16), reader.read(16) };
+
+  float palette[4][3];
+  for (uint32_t e = 0; e < 2; e++)
+  {
+    uint32_t r = colors[e] >> 11, g = (colors[e] >> 5) & 0x3F, b = colors[e] & 0x1F;
+    palette[e][0] = float((r << 3) | (r >> 2));
+    palette[e][1] = float((g << 2) | (g >> 4));
+    palette[e][2] = float((b << 3) | (b >> 2));
+  }
+  for (uint32_t c = 0; c < 3; c++)
+  {
+    bool fourColors = colors[0] > colors[1];
+    palette[2][c] = fourColors ? (2.0f * palette[0][c] + palette[1][c]) / 3.0f : (palette[0][c] + palette[1][c]) / 2.0f;
+    palette[3][c] = fourColors ? (palette[0][c] + 2.0f * palette[1][c]) / 3.0f : 0.0f;
+  }
+
+  for (uint32_t i = 0; i < 16; i++)
+  {
+    uint32_t index = reader.read(2);
+    for (uint32_t c = 0; c < 3; c++)
+    {
+      texels[i][c] = palette[index][c] / 255.0f;
+    }
+    texels[i][3] = 1.0f;
+  }
+}
+
+static void _DecodeBc4(const uint8_t* block, float texels[16][4], uint32_t channel)
+{
+  _BitReader reader(block);
+  float red0 = float(reader.read(8));
+  float red1 = float(reader.read(8));
+
+  float palette[8] = { red0, red1 };
+  for (uint32_t k = 2; k < 8; k++)
+  {
+    if (red0 > red1)
+    {
+      palette[k] = (float(8 - k) * red0 + float(k - 1) * red1) / 7.0f;
+    }
+    else
+    {
+      palette[k] = (k < 6) ? (float(6 - k) * red0 + float(k - 1) * red1) / 5.0f : ((k == 6) ? 0.0f : 255.0f);
+    }
+  }
+
+  for (uint32_t i = 0; i < 16; i++)
+  {
+    texels[i][channel] = palette[reader.read(3)] / 255.0f;
+  }
+}
+
+static void _DecodeBc7(const uint8_t* block, float texels[16][4])
+{
+  _BitReader reader(block);
+  REQUIRE_EQ(reader.read(7), 1 << 6); // mode 6
+
+  uint32_t endpoints[2][4];
+  for (uint32_t c = 0; c < 4; c++)
+  {
+    endpoints[0][c] = reader.read(7) << 1;
+    endpoints[1][c] = reader.read(7) << 1;
+  }
+  for (uint32_t e = 0; e < 2; e++)
+  {
+    uint32_t pBit = reader.read(1);
+    for (uint32_t c = 0; c < 4; c++)
+    {
+      endpoints[e][c] |= pBit;
+    }
+  }
+
+  for (uint32_t i = 0; i < 16; i++)
+  {
+    int w = BC_INDEX_WEIGHTS_4BIT[reader.read(i == 0 ? 3 : 4)];
+    for (uint32_t c = 0; c < 4; c++)
+    {
+      texels[i][c] = float(((64 - w) * int(endpoints[0][c]) + w * int(endpoints[1][c]) + 32) >> 6) / 255.0f;
+    }
+  }
+}
+
+static void _DecodeBc6h(const uint8_t* block, float texels[16][4])
+{
+  _BitReader reader(block);
+  REQUIRE_EQ(reader.read(5), 0x03); // mode 11
+
+  int endpoints[2][3];
+  for (uint32_t e = 0; e < 2; e++)
+  {
+    for (uint32_t c = 0; c < 3; c++)
+    {
+      int value = int(reader.read(10));
+      endpoints[e][c] = (value == 0) ? 0 : ((value == 1023) ? 0xFFFF : (((value << 16) + 0x8000) >> 10));
+    }
+  }
+
+  for (uint32_t i = 0; i < 16; i++)
+  {
+    int w = BC_INDEX_WEIGHTS_4BIT[reader.read(i == 0 ? 3 : 4)];
+    for (uint32_t c = 0; c < 3; c++)
+    {
+      int value = ((64 - w) * endpoints[0][c] + w * endpoints[1][c] + 32) >> 6;
+      texels[i][c] = ImgioHalfToFloat(uint16_t((value * 31) >> 6));
+    }
+    texels[i][3] = 1.0f;
+  }
+}
+
+static std::vector<float> _DecodeBlocks(const std::vector<uint8_t>& blocks, ImgioBlockFormat format, uint32_t width, uint32_t height)
+{
+  std::vector<float> result(size_t(width) * height * 4, 0.0f);
+
+  uint32_t blockCountX = (width + 3) / 4;
+  uint32_t blockSize = ImgioGetBlockSize(format);
+
+  for (size_t b = 0; b < blocks.size() / blockSize; b++)
+  {
+    const uint8_t* block = &blocks[b * blockSize];
+
+    float texels[16][4] = {};
+    switch (format)
+    {
+    case ImgioBlockFormat::BC1: _DecodeBc1(block, texels); break;
+    case ImgioBlockFormat::BC4: _DecodeBc4(block, texels, 0); break;
+    case ImgioBlockFormat::BC5: _DecodeBc4(block, texels, 0); _DecodeBc4(block + 8, texels, 1); break;
+    case ImgioBlockFormat::BC6H: _DecodeBc6h(block, texels); break;
+    case ImgioBlockFormat::BC7: _DecodeBc7(block, texels); break;
+    }
+
+    for (uint32_t i = 0; i < 16; i++)
+    {
+      uint32_t x = uint32_t(b % blockCountX) * 4 + i % 4;
+      uint32_t y = uint32_t(b / blockCountX) * 4 + i / 4;
+      if (x < width && y < height)
+      {
+        memcpy(&result[(size_t(y) * width + x) * 4], texels[i], sizeof(texels[i]));
+      }
+    }
+  }
+
+  return result;
+}
+
+// Slowly varying colors modulated by finer detail and noise, which is closer to real
+// textures than white noise.
+static ImgioImage _MakeTextureLikeImage(uint32_t width, uint32_t height)
+{
+  ImgioImage image;
+  image.width = width;
+  image.height = height;
+  image.size = width * height * 4;
+  image.data.resize(image.size);
+
+  uint32_t state = 1337;
+  for (uint32_t y = 0; y < height; y++)
+  {
+    for (uint32_t x = 0; x < width; x++)
+    {
+      state = state * 1664525u + 1013904223u;
+      float noise = float(state >> 24) / 255.0f - 0.5f;
+      float detail = 0.85f + 0.15f * sinf(float(x) * 0.4f) * sinf(float(y) * 0.3f) + noise * 0.04f;
+
+      uint8_t* texel = &image.data[(y * width + x) * 4];
+      for (uint32_t c = 0; c < 3; c++)
+      {
+        float base = 0.5f + 0.3f * sinf(float(x) * 0.05f * float(c + 1) + float(y) * 0.03f);
+        texel[c] = uint8_t(std::clamp(base * detail, 0.0f, 1.0f) * 255.0f + 0.5f);
+      }
+      texel[3] = uint8_t((0.6f + 0.3f * sinf(float(x + y) * 0.04f)) * 255.0f + 0.5f);
+    }
+  }
+
+  return image;
+}
+
+static double _Psnr(const ImgioImage& image, const std::vector<float>& decoded, uint32_t channelCount)
+{
+  double squaredErrorSum = 0.0;
+  size_t texelCount = size_t(image.width) * image.height;
+  for (size_t i = 0; i < texelCount; i++)
+  {
+    for (uint32_t c = 0; c < channelCount; c++)
+    {
+      double d = double(image.data[i * 4 + c]) / 255.0 - double(decoded[i * 4 + c]);
+      squaredErrorSum += d * d;
+    }
+  }
+  double mse = squaredErrorSum / double(texelCount * channelCount);
+  return 10.0 * log10(1.0 / std::max(mse, 1e-12));
+}
+
+TEST_CASE("BlockCompression.Size")
+{
+  CHECK_EQ(ImgioGetBlockCompressedSize(ImgioBlockFormat::BC1, 6, 5), 2 * 2 * 8);
+  CHECK_EQ(ImgioGetBlockCompressedSize(ImgioBlockFormat::BC7, 1, 1), 16);
+
+  ImgioImage image = _MakeTextureLikeImage(6, 5);
+  std::vector<uint8_t> blocks;
+  ImgioEncodeBlocks(image, ImgioBlockFormat::BC5, blocks);
+  CHECK_EQ(blocks.size(), 2 * 2 * 16);
+}
+
+TEST_CASE("BlockCompression.Ldr")
+{
+  // Partial blocks at the borders.
+  ImgioImage image = _MakeTextureLikeImage(126, 66);
+
+  struct
+  {
+    ImgioBlockFormat format;
+    uint32_t channelCount;
+    double minPsnr;
+  } cases[] = {
+    { ImgioBlockFormat::BC1, 3, 35.0 },
+    { ImgioBlockFormat::BC4, 1, 47.0 },
+    { ImgioBlockFormat::BC5, 2, 47.0 },
+    { ImgioBlockFormat::BC7, 4, 38.0 } // alpha is not correlated with color
+  };
+
+  for (const auto& c : cases)
+  {
+    std::vector<uint8_t> blocks;
+    ImgioEncodeBlocks(image, c.format, blocks);
+    REQUIRE_EQ(blocks.size(), ImgioGetBlockCompressedSize(c.format, image.width, image.height));
+
+    double psnr = _Psnr(image, _DecodeBlocks(blocks, c.format, image.width, image.height), c.channelCount);
+    MESSAGE("format ", int(c.format), ": ", psnr, " dB");
+    CHECK_GT(psnr, c.minPsnr);
+  }
+}
+
+TEST_CASE("BlockCompression.ConstantBlocks")
+{
+  // BC4 and BC5 store single values exactly. BC7 mode 6 shares the endpoint LSB between
+  // channels, which may cost one step.
+  ImgioImage image;
+  image.width = 4;
+  image.height = 4;
+  image.size = 4 * 4 * 4;
+  image.data.resize(image.size);
+  for (uint32_t i = 0; i < 16; i++)
+  {
+    image.data[i * 4 + 0] = 200;
+    image.data[i * 4 + 1] = 17;
+    image.data[i * 4 + 2] = 96;
+    image.data[i * 4 + 3] = 255;
+  }
+
+  for (ImgioBlockFormat format : { ImgioBlockFormat::BC4, ImgioBlockFormat::BC5, ImgioBlockFormat::BC7 })
+  {
+    std::vector<uint8_t> blocks;
+    ImgioEncodeBlocks(image, format, blocks);
+    std::vector<float> decoded = _DecodeBlocks(blocks, format, 4, 4);
+
+    uint32_t channelCount = (format == ImgioBlockFormat::BC4) ? 1 : ((format == ImgioBlockFormat::BC5) ? 2 : 4);
+    for (uint32_t i = 0; i < 16; i++)
+    {
+      for (uint32_t c = 0; c < channelCount; c++)
+      {
+        int error = int(decoded[i * 4 + c] * 255.0f + 0.5f) - int(image.data[i * 4 + c]);
+        CHECK_LE(abs(error), (format == ImgioBlockFormat::BC7) ? 1 : 0);
+      }
+    }
+  }
+}
+
+TEST_CASE("BlockCompression.Bc6h")
+{
+  const uint32_t width = 64;
+  const uint32_t height = 40;
+
+  // Smooth colors with intensities spanning several orders of magnitude, like a sky with a sun.
+  std::vector<float> values(width * height * 4);
+  for (uint32_t y = 0; y < height; y++)
+  {
+    for (uint32_t x = 0; x < width; x++)
+    {
+      float intensity = exp2f(float(x + y) / 8.0f - 4.0f); // up to 2^8
+      float* texel = &values[(y * width + x) * 4];
+      for (uint32_t c = 0; c < 3; c++)
+      {
+        texel[c] = intensity * (0.6f + 0.3f * sinf(float(x) * 0.05f * float(c + 1) + float(y) * 0.03f));
+      }
+      texel[3] = 1.0f;
+    }
+  }
+
+  ImgioImage image;
+  image.width = width;
+  image.height = height;
+  image.format = ImgioFormat::RGBA32_FLOAT;
+  image.size = values.size() * sizeof(float);
+  image.data.resize(image.size);
+  memcpy(image.data.data(), values.data(), image.size);
+
+  std::vector<uint8_t> blocks;
+  ImgioEncodeBlocks(image, ImgioBlockFormat::BC6H, blocks);
+  std::vector<float> decoded = _DecodeBlocks(blocks, ImgioBlockFormat::BC6H, width, height);
+
+  double relativeErrorSum = 0.0;
+  float maxValue = 0.0f;
+  for (size_t i = 0; i < values.size(); i++)
+  {
+    if (i % 4 == 3)
+    {
+      continue;
+    }
+    relativeErrorSum += fabs(double(decoded[i]) - double(values[i])) / double(values[i]);
+    maxValue = std::max(maxValue, decoded[i]);
+  }
+
+  double meanRelativeError = relativeErrorSum / double(width * height * 3);
+  MESSAGE("BC6H mean relative error: ", meanRelativeError);
+  CHECK_LT(meanRelativeError, 0.03);
+  CHECK_GT(maxValue, 100.0f); // not clamped to [0, 1]
 }
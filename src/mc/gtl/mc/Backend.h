@@ -39,12 +39,29 @@ namespace gtl
     uint32_t depth;
     std::vector<uint8_t> data;
     std::string filePath;
+    // Hash of the kind and content of BSDF lookup tables, so that they can be
+    // shared between materials. Zero for all other textures. Not unique; users
+    // have to compare the payloads of tables with equal keys.
+    uint64_t bsdfDataKey = 0;
   };
 
   struct McGlslGenResult
   {
     std::string source;
     std::vector<McTextureDescription> textureDescriptions;
+    // Only for class-compiled materials. The layout ID identifies the generated
+    // code, against which argument blocks of other instances can be created.
+    // It has to be released with McBackend::releaseArgBlockLayout.
+    std::vector<uint8_t> argBlock;
+    uint32_t argBlockLayoutId = 0;
+  };
+
+  struct McCodeGenStats
+  {
+    uint32_t hitCount = 0;
+    uint32_t missCount = 0;
+    // Time spent in MDL SDK code generation, excluding cache hits.
+    float generationTimeMs = 0.0f;
   };
 
   enum class McDfFlags
@@ -73,6 +90,19 @@ namespace gtl
                  McDfFlags dfFlags,
                  McGlslGenResult& result);
 
+    // Creates the argument block of a material that shares its class with the one the layout
+    // was generated for. Fails if the generated code can not be reused for the material, e.g.
+    // because it references other textures.
+    bool genArgBlock(const McMdlMaterial& material,
+                     uint32_t argBlockLayoutId,
+                     std::vector<uint8_t>& argBlock);
+
+    // Layouts are reference counted by the genGlsl results they were returned with. The
+    // generated code is dropped once the last one is released. Ignores layout ID 0.
+    void releaseArgBlockLayout(uint32_t argBlockLayoutId);
+
+    McCodeGenStats getCodeGenStats() const;
+
   private:
     class _Impl;
     std::shared_ptr<_Impl> m_impl;
@@ -20,6 +20,7 @@
 #include <MaterialXCore/Document.h>
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace gtl
@@ -34,7 +35,9 @@ namespace gtl
   public:
     McFrontend(const std::vector<std::string>& mdlSearchPaths,
                const MaterialX::DocumentPtr mtlxStdLib,
-               McRuntime& mdlRuntime);
+               McRuntime& mdlRuntime,
+               bool classCompilation,
+               std::string_view distillTarget);
 
   private:
     McMaterial* createFromMdlStr(std::string_view mdlSrc, std::string_view subIdentifier, bool isOpaque);
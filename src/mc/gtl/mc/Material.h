@@ -17,6 +17,7 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <string>
 #include <memory>
 #include <vector>
@@ -40,5 +41,22 @@ namespace gtl
     bool requiresSceneTransforms;
     std::vector<const char*> sceneDataNames;
     int cameraPositionSceneDataIndex;
+    // Simplified variant for preview rendering, if distilling is enabled and succeeded.
+    std::shared_ptr<McMaterial> distilledMaterial;
   };
+
+  // Returns true if the material is class-compiled with parameters, which are not part of the
+  // generated code but passed in an argument block.
+  bool McMaterialHasParameters(const McMaterial& material);
+
+  // Returns true if both materials result in the same generated code and only differ in
+  // their argument blocks. This can only be the case for class-compiled materials.
+  bool McMaterialsShareClass(const McMaterial& a, const McMaterial& b);
+
+  // Returns true if both materials are instance-compiled to the same code, e.g. copies
+  // of a network bound to different prims. Such materials can share their shaders.
+  bool McMaterialsAreIdentical(const McMaterial& a, const McMaterial& b);
+
+  // Hash over the compiled MDL material and the properties compared above.
+  uint64_t McHashMaterial(const McMaterial& material);
 }
@@ -33,6 +33,9 @@ namespace gtl
 
     McMdlRuntime& getMdlRuntime() const;
 
+    // Number of MDL database elements that were generated for materials which are still alive.
+    size_t getMdlElementCount() const;
+
   private:
     McMdlRuntime* m_mdlRuntime = nullptr;
   };
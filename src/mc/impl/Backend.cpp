@@ -21,11 +21,16 @@
 
 #include <cassert>
 #include <array>
+#include <chrono>
 #include <filesystem>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
 
 #include <gtl/gb/SmallVector.h>
 #include <gtl/gb/Fmt.h>
 
+#include "CodeGenCache.h"
 #include "MdlMaterial.h"
 #include "MdlLogger.h"
 #include "MdlRuntime.h"
@@ -49,31 +54,351 @@ namespace gtl
     mi::neuraylib::Target_function_description("backface.emission.intensity", "mdl_backface_edf_emission_intensity")
   };
 
+  const static std::array<std::pair<const char*, const char*>, 2> BACKEND_OPTIONS = {{
+    { "enable_exceptions", "off" },
+    { "use_renderer_adapt_normal", "on" }
+  }};
+
+  static uint64_t _HashBsdfData(mi::neuraylib::Df_data_kind kind, const std::vector<uint8_t>& data)
+  {
+    uint64_t hash = std::hash<std::string_view>{}(std::string_view((const char*) data.data(), data.size()));
+    hash ^= uint64_t(kind) + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+    return (hash != 0) ? hash : 1;
+  }
+
+  const char* ENVVAR_CODEGEN_CACHE_DIR = "GATLING_MDL_CODEGEN_CACHE_DIR";
+
+  std::string _MakeOptionsDigest()
+  {
+    std::string digest = MI_NEURAYLIB_PRODUCT_VERSION_STRING;
+    for (const auto& [name, value] : BACKEND_OPTIONS)
+    {
+      digest += GB_FMT(";{}={}", name, value);
+    }
+    return digest;
+  }
+
+  McCodeGenCacheKey _MakeCodeGenCacheKey(const mi::base::Handle<mi::neuraylib::ICompiled_material>& compiledMaterial, McDfFlags dfFlags)
+  {
+    mi::base::Uuid materialHash = compiledMaterial->get_hash();
+
+    return McCodeGenCacheKey{
+      .materialHash = { materialHash.m_id1, materialHash.m_id2, materialHash.m_id3, materialHash.m_id4 },
+      .dfFlags = uint32_t(dfFlags)
+    };
+  }
+
+  // Maps the resources and strings referenced by material arguments to the indices
+  // of the target code they were generated for.
+  class _ArgBlockResourceCallback : public mi::base::Interface_implement<mi::neuraylib::ITarget_resource_callback>
+  {
+  public:
+    explicit _ArgBlockResourceCallback(const mi::neuraylib::ITarget_code* targetCode)
+      : m_targetCode(targetCode)
+    {
+    }
+
+  public:
+    mi::Uint32 get_resource_index(const mi::neuraylib::IValue_resource* resource) override
+    {
+      const char* filePath = resource->get_file_path();
+
+      if (!filePath || strlen(filePath) == 0)
+      {
+        return 0; // invalid resource
+      }
+
+      if (resource->get_kind() == mi::neuraylib::IValue::VK_TEXTURE)
+      {
+#if MI_NEURAYLIB_API_VERSION < 51
+        size_t texCount = m_targetCode->get_body_texture_count();
+#else
+        size_t texCount = m_targetCode->get_texture_count();
+#endif
+        for (size_t i = 1; i < texCount; i++)
+        {
+          const char* url = m_targetCode->get_texture_url(i);
+
+          if (url && strcmp(url, filePath) == 0)
+          {
+            return mi::Uint32(i);
+          }
+        }
+      }
+
+      m_hasUnknownResources = true;
+      return 0;
+    }
+
+    mi::Uint32 get_string_index(const mi::neuraylib::IValue_string* s) override
+    {
+      const char* value = s->get_value();
+
+      for (mi::Size i = 1; i < m_targetCode->get_string_constant_count(); i++)
+      {
+        if (strcmp(m_targetCode->get_string_constant(i), value) == 0)
+        {
+          return mi::Uint32(i);
+        }
+      }
+
+      return 0;
+    }
+
+    bool hasUnknownResources() const
+    {
+      return m_hasUnknownResources;
+    }
+
+  private:
+    const mi::neuraylib::ITarget_code* m_targetCode;
+    bool m_hasUnknownResources = false;
+  };
+
   class McBackend::_Impl
   {
   public:
     _Impl(McMdlRuntime& runtime, mi::base::Handle<mi::neuraylib::IMdl_backend> backend)
+      : m_cache(_MakeOptionsDigest(), getenv(ENVVAR_CODEGEN_CACHE_DIR) ? getenv(ENVVAR_CODEGEN_CACHE_DIR) : "")
+      , m_runtime(runtime)
     {
       m_backend = backend;
-      m_backend->set_option("enable_exceptions", "off");
-      m_backend->set_option("use_renderer_adapt_normal", "on");
+      for (const auto& [name, value] : BACKEND_OPTIONS)
+      {
+        m_backend->set_option(name, value);
+      }
 
       m_logger = mi::base::Handle<McMdlLogger>(runtime.getLogger());
-      m_database = mi::base::Handle<mi::neuraylib::IDatabase>(runtime.getDatabase());
-      m_transaction = mi::base::Handle<mi::neuraylib::ITransaction>(runtime.getTransaction());
+      m_factory = mi::base::Handle<mi::neuraylib::IMdl_factory>(runtime.getFactory());
+    }
+
+    bool genGlsl(mi::base::Handle<mi::neuraylib::ICompiled_material> compiledMaterial,
+                 McDfFlags dfFlags,
+                 McGlslGenResult& result)
+    {
+      McCodeGenCacheKey key = _MakeCodeGenCacheKey(compiledMaterial, dfFlags);
+
+      // Code generation may run on multiple threads, each with its own transaction and context.
+      mi::base::Handle<mi::neuraylib::ITransaction> transaction(m_runtime.createTransaction());
+      mi::base::Handle<mi::neuraylib::IMdl_execution_context> context(m_factory->create_execution_context());
+      context->set_option("resolve_resources", false);
+
+      // Class-compiled materials can only reuse code if we are able to create an argument block for
+      // them, which requires the target code to reference the same resources. Since target code can't
+      // be persisted, they bypass the code cache.
+      bool isClassCompiled = compiledMaterial->get_parameter_count() > 0;
+
+      std::shared_ptr<const McCodeGenCacheEntry> entry;
+
+      if (isClassCompiled)
+      {
+        result.argBlockLayoutId = findArgBlockLayout(key, entry);
+
+        if (entry && !genArgBlock(compiledMaterial, result.argBlockLayoutId, result.argBlock))
+        {
+          releaseArgBlockLayout(result.argBlockLayoutId);
+          entry = nullptr;
+        }
+      }
+      else
+      {
+        entry = m_cache.find(key);
+      }
+
+      if (entry)
+      {
+        std::lock_guard guard(m_statsMutex);
+        m_stats.hitCount++;
+      }
+      else
+      {
+        auto generationStartTime = std::chrono::steady_clock::now();
+
+        GbSmallVector<mi::neuraylib::Target_function_description, size_t(McDfFlags::FLAG_COUNT)> fDescs;
+
+        for (size_t i = 0; i < size_t(McDfFlags::FLAG_COUNT); i++)
+        {
+          if (size_t(dfFlags) & (1 << i))
+          {
+            fDescs.push_back(FUNC_DESCS[i]);
+          }
+        }
 
-      mi::base::Handle<mi::neuraylib::IMdl_factory> factory(runtime.getFactory());
-      m_context = mi::base::Handle<mi::neuraylib::IMdl_execution_context>(factory->create_execution_context());
-      m_context->set_option("resolve_resources", false);
+        auto newEntry = std::make_shared<McCodeGenCacheEntry>();
+        mi::base::Handle<const mi::neuraylib::ITarget_code> targetCode;
+        if (!generateGlslWithDfs(transaction.get(), context.get(), compiledMaterial, fDescs, isClassCompiled, *newEntry, targetCode))
+        {
+          transaction->commit();
+          return false;
+        }
+
+        result.argBlock.clear();
+        result.argBlockLayoutId = 0;
+
+        if (isClassCompiled)
+        {
+          if (targetCode->get_argument_block_count() > 0)
+          {
+            mi::base::Handle<const mi::neuraylib::ITarget_argument_block> argBlock(targetCode->get_argument_block(0));
+            const uint8_t* argBlockData = (const uint8_t*) argBlock->get_data();
+            result.argBlock.assign(argBlockData, argBlockData + argBlock->get_size());
+          }
+
+          result.argBlockLayoutId = addArgBlockLayout(key, targetCode, newEntry);
+        }
+        else
+        {
+          m_cache.insert(key, newEntry);
+        }
+
+        entry = newEntry;
+
+        std::chrono::duration<float, std::milli> generationDuration = std::chrono::steady_clock::now() - generationStartTime;
+
+        std::lock_guard guard(m_statsMutex);
+        m_stats.missCount++;
+        m_stats.generationTimeMs += generationDuration.count();
+      }
+
+      result.source = entry->source;
+      result.textureDescriptions = entry->textureDescriptions;
+
+      for (size_t i = 0; i < result.textureDescriptions.size(); i++)
+      {
+        McTextureDescription& textureDescription = result.textureDescriptions[i];
+
+        if (!textureDescription.filePath.empty())
+        {
+          textureDescription.filePath = resolveTextureFilePath(transaction.get(), textureDescription.filePath, entry->textureOwnerModules[i]);
+        }
+      }
+
+      transaction->commit();
+
+      return true;
+    }
+
+    bool genArgBlock(mi::base::Handle<mi::neuraylib::ICompiled_material> compiledMaterial,
+                     uint32_t argBlockLayoutId,
+                     std::vector<uint8_t>& argBlock)
+    {
+      mi::base::Handle<const mi::neuraylib::ITarget_code> targetCode;
+      {
+        std::lock_guard guard(m_argBlockLayoutMutex);
+
+        auto it = m_argBlockLayouts.find(argBlockLayoutId);
+        if (it == m_argBlockLayouts.end())
+        {
+          return false;
+        }
+
+        targetCode = it->second.targetCode;
+      }
+
+      argBlock.clear();
+
+      if (targetCode->get_argument_block_count() == 0)
+      {
+        return true;
+      }
+
+      mi::base::Handle<_ArgBlockResourceCallback> resourceCallback(new _ArgBlockResourceCallback(targetCode.get()));
+
+      mi::base::Handle<mi::neuraylib::ITarget_argument_block> newArgBlock(
+        targetCode->create_argument_block(0, compiledMaterial.get(), resourceCallback.get())
+      );
+
+      if (!newArgBlock || resourceCallback->hasUnknownResources())
+      {
+        return false;
+      }
+
+      const uint8_t* argBlockData = (const uint8_t*) newArgBlock->get_data();
+      argBlock.assign(argBlockData, argBlockData + newArgBlock->get_size());
+
+      return true;
+    }
+
+    void releaseArgBlockLayout(uint32_t argBlockLayoutId)
+    {
+      if (argBlockLayoutId == 0)
+      {
+        return;
+      }
+
+      std::lock_guard guard(m_argBlockLayoutMutex);
+
+      auto it = m_argBlockLayouts.find(argBlockLayoutId);
+      assert(it != m_argBlockLayouts.end());
+
+      if (--it->second.refCount > 0)
+      {
+        return;
+      }
+
+      // Superseded layouts are no longer registered for their class.
+      auto classIt = m_classArgBlockLayouts.find(it->second.key);
+      if (classIt != m_classArgBlockLayouts.end() && classIt->second == argBlockLayoutId)
+      {
+        m_classArgBlockLayouts.erase(classIt);
+      }
+
+      m_argBlockLayouts.erase(it);
+    }
+
+    McCodeGenStats getStats()
+    {
+      std::lock_guard guard(m_statsMutex);
+      return m_stats;
+    }
+
+  private:
+    // Target code is kept alive while layouts are referenced, since argument blocks of
+    // other instances can only be created as long as the code they belong to exists.
+    // The returned layout is retained for the caller.
+    uint32_t addArgBlockLayout(const McCodeGenCacheKey& key,
+                               mi::base::Handle<const mi::neuraylib::ITarget_code> targetCode,
+                               std::shared_ptr<const McCodeGenCacheEntry> entry)
+    {
+      std::lock_guard guard(m_argBlockLayoutMutex);
+
+      uint32_t layoutId = ++m_argBlockLayoutCounter;
+      m_argBlockLayouts[layoutId] = _ArgBlockLayout{ .targetCode = targetCode, .entry = entry, .key = key, .refCount = 1 };
+
+      // A previous layout of the class stays alive until its last user releases it.
+      m_classArgBlockLayouts[key] = layoutId;
+
+      return layoutId;
+    }
+
+    // Returns the most recent layout generated for the class, retained for the caller.
+    uint32_t findArgBlockLayout(const McCodeGenCacheKey& key, std::shared_ptr<const McCodeGenCacheEntry>& entry)
+    {
+      std::lock_guard guard(m_argBlockLayoutMutex);
+
+      auto it = m_classArgBlockLayouts.find(key);
+      if (it == m_classArgBlockLayouts.end())
+      {
+        return 0;
+      }
+
+      _ArgBlockLayout& layout = m_argBlockLayouts[it->second];
+      layout.refCount++;
+
+      entry = layout.entry;
+      return it->second;
     }
 
-    bool generateGlslWithDfs(mi::base::Handle<mi::neuraylib::ICompiled_material> compiledMaterial,
+    bool generateGlslWithDfs(mi::neuraylib::ITransaction* transaction,
+                             mi::neuraylib::IMdl_execution_context* context,
+                             mi::base::Handle<mi::neuraylib::ICompiled_material> compiledMaterial,
                              std::vector<mi::neuraylib::Target_function_description>& genFunctions,
-                             std::string& glslSrc,
-                             std::vector<McTextureDescription>& textureDescriptions)
+                             bool isClassCompiled,
+                             McCodeGenCacheEntry& entry,
+                             mi::base::Handle<const mi::neuraylib::ITarget_code>& targetCode)
     {
-      mi::base::Handle<mi::neuraylib::ILink_unit> linkUnit(m_backend->create_link_unit(m_transaction.get(), m_context.get()));
-      m_logger->flushContextMessages(m_context.get());
+      mi::base::Handle<mi::neuraylib::ILink_unit> linkUnit(m_backend->create_link_unit(transaction, context));
+      m_logger->flushContextMessages(context);
 
       if (!linkUnit)
       {
@@ -84,17 +409,17 @@ namespace gtl
         compiledMaterial.get(),
         genFunctions.data(),
         genFunctions.size(),
-        m_context.get()
+        context
       );
-      m_logger->flushContextMessages(m_context.get());
+      m_logger->flushContextMessages(context);
 
       if (linkResult)
       {
         return false;
       }
 
-      mi::base::Handle<const mi::neuraylib::ITarget_code> targetCode(m_backend->translate_link_unit(linkUnit.get(), m_context.get()));
-      m_logger->flushContextMessages(m_context.get());
+      targetCode = mi::base::Handle<const mi::neuraylib::ITarget_code>(m_backend->translate_link_unit(linkUnit.get(), context));
+      m_logger->flushContextMessages(context);
 
       if (!targetCode)
       {
@@ -103,14 +428,16 @@ namespace gtl
 
       assert(targetCode->get_ro_data_segment_count() == 0);
 
-      extractTextureInfos(targetCode, textureDescriptions);
-      glslSrc = targetCode->get_code();
+      extractTextureInfos(targetCode, isClassCompiled, entry.textureDescriptions, entry.textureOwnerModules);
+      entry.source = targetCode->get_code();
 
       return true;
     }
 
     void extractTextureInfos(mi::base::Handle<const mi::neuraylib::ITarget_code> targetCode,
-                             std::vector<McTextureDescription>& textureDescriptions)
+                             bool includeArgumentTextures,
+                             std::vector<McTextureDescription>& textureDescriptions,
+                             std::vector<std::string>& textureOwnerModules)
     {
 #if MI_NEURAYLIB_API_VERSION < 51
       size_t texCount = targetCode->get_body_texture_count();
@@ -118,6 +445,7 @@ namespace gtl
       size_t texCount = targetCode->get_texture_count();
 #endif
       textureDescriptions.reserve(texCount);
+      textureOwnerModules.reserve(texCount);
 
       uint32_t binding = 0;
 
@@ -125,7 +453,8 @@ namespace gtl
       for (size_t i = 1; i < texCount; i++)
       {
 #if MI_NEURAYLIB_API_VERSION >= 51
-        if (!targetCode->get_texture_is_body_resource(i))
+        // Textures of class-compiled materials may only be referenced by the argument block.
+        if (!includeArgumentTextures && !targetCode->get_texture_is_body_resource(i))
         {
           continue;
         }
@@ -143,16 +472,21 @@ namespace gtl
           .filePath = ""
         };
 
+        std::string ownerModule;
+
         switch (targetCode->get_texture_shape(i))
         {
         case mi::neuraylib::ITarget_code::Texture_shape_2d: {
-          std::string filePath = extractTargetCodeTextureFilePath(targetCode, i);
-          if (filePath.empty())
+          const char* url = targetCode->get_texture_url(i);
+          if (!url || strlen(url) == 0)
           {
             m_logger->message(mi::base::MESSAGE_SEVERITY_ERROR, "2d texture has no URL");
             break;
           }
-          textureResource.filePath = filePath;
+          textureResource.filePath = url;
+
+          const char* owner = targetCode->get_texture_owner_module(i);
+          ownerModule = owner ? owner : "";
           break;
         }
         case mi::neuraylib::ITarget_code::Texture_shape_bsdf_data: {
@@ -170,6 +504,9 @@ namespace gtl
           std::vector<uint8_t>& data = textureResource.data;
           data.resize(size);
           memcpy(&data[0], dataPtr, data.size());
+
+          mi::neuraylib::Df_data_kind kind = targetCode->get_texture_df_data_kind(i);
+          textureResource.bsdfDataKey = _HashBsdfData(kind, data);
           break;
         }
         case mi::neuraylib::ITarget_code::Texture_shape_3d:
@@ -190,26 +527,20 @@ namespace gtl
         }
 
         textureDescriptions.push_back(textureResource);
+        textureOwnerModules.push_back(ownerModule);
       }
     }
 
-    std::string extractTargetCodeTextureFilePath(mi::base::Handle<const mi::neuraylib::ITarget_code> targetCode, size_t i)
+    std::string resolveTextureFilePath(mi::neuraylib::ITransaction* transaction, const std::string& url, const std::string& ownerModule)
     {
-      const char* url = targetCode->get_texture_url(i);
-      if (!url)
-      {
-        return "";
-      }
-
       std::string path(url);
 
       // If the MDL code is not generated but from a file, we need to convert relative to absolute file paths.
-      const char* ownerModule = targetCode->get_texture_owner_module(i);
-      if (ownerModule && strlen(ownerModule) > 0)
+      if (!ownerModule.empty())
       {
         auto moduleDbName = GB_FMT("mdl{}", ownerModule);
 
-        mi::base::Handle<const mi::neuraylib::IModule> module(m_transaction->access<const mi::neuraylib::IModule>(moduleDbName.c_str()));
+        mi::base::Handle<const mi::neuraylib::IModule> module(transaction->access<const mi::neuraylib::IModule>(moduleDbName.c_str()));
 
         if (module)
         {
@@ -232,12 +563,28 @@ namespace gtl
       return path;
     }
 
-  public:
+  private:
+    McCodeGenCache m_cache;
+    McMdlRuntime& m_runtime;
     mi::base::Handle<McMdlLogger> m_logger;
     mi::base::Handle<mi::neuraylib::IMdl_backend> m_backend;
-    mi::base::Handle<mi::neuraylib::IDatabase> m_database;
-    mi::base::Handle<mi::neuraylib::ITransaction> m_transaction;
-    mi::base::Handle<mi::neuraylib::IMdl_execution_context> m_context;
+    mi::base::Handle<mi::neuraylib::IMdl_factory> m_factory;
+
+    struct _ArgBlockLayout
+    {
+      mi::base::Handle<const mi::neuraylib::ITarget_code> targetCode;
+      std::shared_ptr<const McCodeGenCacheEntry> entry;
+      McCodeGenCacheKey key;
+      uint32_t refCount = 0; // of genGlsl results
+    };
+
+    std::mutex m_statsMutex;
+    McCodeGenStats m_stats;
+
+    std::mutex m_argBlockLayoutMutex;
+    uint32_t m_argBlockLayoutCounter = 0;
+    std::unordered_map<uint32_t, _ArgBlockLayout> m_argBlockLayouts;
+    std::unordered_map<McCodeGenCacheKey, uint32_t, McCodeGenCacheKeyHasher> m_classArgBlockLayouts;
   };
 
   bool McBackend::init(McRuntime& runtime)
@@ -260,16 +607,21 @@ namespace gtl
 
   bool McBackend::genGlsl(const McMdlMaterial& material, McDfFlags dfFlags, McGlslGenResult& result)
   {
-    GbSmallVector<mi::neuraylib::Target_function_description, size_t(McDfFlags::FLAG_COUNT)> fDescs;
+    return m_impl->genGlsl(material.compiledMaterial, dfFlags, result);
+  }
 
-    for (size_t i = 0; i < size_t(McDfFlags::FLAG_COUNT); i++)
-    {
-      if (size_t(dfFlags) & (1 << i))
-      {
-        fDescs.push_back(FUNC_DESCS[i]);
-      }
-    }
+  bool McBackend::genArgBlock(const McMdlMaterial& material, uint32_t argBlockLayoutId, std::vector<uint8_t>& argBlock)
+  {
+    return m_impl->genArgBlock(material.compiledMaterial, argBlockLayoutId, argBlock);
+  }
 
-    return m_impl->generateGlslWithDfs(material.compiledMaterial, fDescs, result.source, result.textureDescriptions);
+  void McBackend::releaseArgBlockLayout(uint32_t argBlockLayoutId)
+  {
+    m_impl->releaseArgBlockLayout(argBlockLayoutId);
+  }
+
+  McCodeGenStats McBackend::getCodeGenStats() const
+  {
+    return m_impl->getStats();
   }
 }
@@ -0,0 +1,293 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "CodeGenCache.h"
+
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+#include <gtl/gb/Fmt.h>
+#include <gtl/gb/Log.h>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+  const uint32_t FILE_MAGIC = 0x4347434d; // 'MCGC'
+  const uint32_t FILE_VERSION = 2;
+
+  uint64_t _Fnv1a(std::string_view str)
+  {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (char c : str)
+    {
+      hash ^= uint64_t(uint8_t(c));
+      hash *= 0x100000001b3ull;
+    }
+    return hash;
+  }
+
+  class _BinaryWriter
+  {
+  public:
+    explicit _BinaryWriter(std::ofstream& stream)
+      : m_stream(stream)
+    {
+    }
+
+    void writeU32(uint32_t value)
+    {
+      m_stream.write((const char*) &value, sizeof(value));
+    }
+
+    void writeBytes(const void* data, size_t size)
+    {
+      writeU32(uint32_t(size));
+      m_stream.write((const char*) data, size);
+    }
+
+    void writeString(std::string_view str)
+    {
+      writeBytes(str.data(), str.size());
+    }
+
+  private:
+    std::ofstream& m_stream;
+  };
+
+  class _BinaryReader
+  {
+  public:
+    explicit _BinaryReader(std::ifstream& stream)
+      : m_stream(stream)
+    {
+    }
+
+    bool readU32(uint32_t& value)
+    {
+      return bool(m_stream.read((char*) &value, sizeof(value)));
+    }
+
+    template<typename T>
+    bool readBytes(T& container)
+    {
+      uint32_t size;
+      if (!readU32(size))
+      {
+        return false;
+      }
+      container.resize(size);
+      return size == 0 || bool(m_stream.read((char*) container.data(), size));
+    }
+
+  private:
+    std::ifstream& m_stream;
+  };
+}
+
+namespace gtl
+{
+  size_t McCodeGenCacheKeyHasher::operator()(const McCodeGenCacheKey& key) const
+  {
+    uint64_t hash = (uint64_t(key.materialHash[0]) << 32) | key.materialHash[1];
+    hash ^= ((uint64_t(key.materialHash[2]) << 32) | key.materialHash[3]) * 0x9e3779b97f4a7c15ull;
+    hash ^= uint64_t(key.dfFlags) * 0xff51afd7ed558ccdull;
+    return size_t(hash);
+  }
+
+  McCodeGenCache::McCodeGenCache(std::string_view optionsDigest, std::string_view diskCacheDir)
+    : m_optionsHash(_Fnv1a(optionsDigest))
+    , m_diskCacheDir(diskCacheDir)
+  {
+    if (m_diskCacheDir.empty())
+    {
+      return;
+    }
+
+    std::error_code errorCode;
+    fs::create_directories(m_diskCacheDir, errorCode);
+
+    if (errorCode)
+    {
+      GB_ERROR("unable to create MDL code cache directory {}: {}", m_diskCacheDir, errorCode.message());
+      m_diskCacheDir.clear();
+    }
+  }
+
+  std::shared_ptr<const McCodeGenCacheEntry> McCodeGenCache::find(const McCodeGenCacheKey& key)
+  {
+    {
+      std::lock_guard guard(m_mutex);
+
+      auto it = m_entries.find(key);
+      if (it != m_entries.end())
+      {
+        return it->second;
+      }
+    }
+
+    if (m_diskCacheDir.empty())
+    {
+      return nullptr;
+    }
+
+    std::shared_ptr<const McCodeGenCacheEntry> entry = readFromDisk(key);
+    if (!entry)
+    {
+      return nullptr;
+    }
+
+    std::lock_guard guard(m_mutex);
+    m_entries[key] = entry;
+
+    return entry;
+  }
+
+  void McCodeGenCache::insert(const McCodeGenCacheKey& key, std::shared_ptr<const McCodeGenCacheEntry> entry)
+  {
+    {
+      std::lock_guard guard(m_mutex);
+      m_entries[key] = entry;
+    }
+
+    if (!m_diskCacheDir.empty())
+    {
+      writeToDisk(key, *entry);
+    }
+  }
+
+  std::string McCodeGenCache::makeFilePath(const McCodeGenCacheKey& key) const
+  {
+    auto fileName = GB_FMT("{:08x}{:08x}{:08x}{:08x}_{:03x}_{:016x}.bin",
+      key.materialHash[0], key.materialHash[1], key.materialHash[2], key.materialHash[3],
+      key.dfFlags, m_optionsHash);
+
+    return (fs::path(m_diskCacheDir) / fileName).string();
+  }
+
+  std::shared_ptr<const McCodeGenCacheEntry> McCodeGenCache::readFromDisk(const McCodeGenCacheKey& key) const
+  {
+    std::string filePath = makeFilePath(key);
+
+    std::ifstream stream(filePath, std::ios::in | std::ios::binary);
+    if (!stream.is_open())
+    {
+      return nullptr;
+    }
+
+    _BinaryReader reader(stream);
+
+    uint32_t magic, version, textureCount;
+    if (!reader.readU32(magic) || magic != FILE_MAGIC ||
+        !reader.readU32(version) || version != FILE_VERSION)
+    {
+      GB_WARN("ignoring incompatible MDL code cache file {}", filePath);
+      return nullptr;
+    }
+
+    auto entry = std::make_shared<McCodeGenCacheEntry>();
+
+    if (!reader.readBytes(entry->source) || !reader.readU32(textureCount))
+    {
+      goto fail;
+    }
+
+    entry->textureDescriptions.resize(textureCount);
+    entry->textureOwnerModules.resize(textureCount);
+
+    for (uint32_t i = 0; i < textureCount; i++)
+    {
+      McTextureDescription& desc = entry->textureDescriptions[i];
+
+      uint32_t is3dImage, isFloat, bsdfDataKeyLo, bsdfDataKeyHi;
+      if (!reader.readU32(desc.binding) ||
+          !reader.readU32(is3dImage) ||
+          !reader.readU32(isFloat) ||
+          !reader.readU32(desc.width) ||
+          !reader.readU32(desc.height) ||
+          !reader.readU32(desc.depth) ||
+          !reader.readBytes(desc.data) ||
+          !reader.readBytes(desc.filePath) ||
+          !reader.readU32(bsdfDataKeyLo) ||
+          !reader.readU32(bsdfDataKeyHi) ||
+          !reader.readBytes(entry->textureOwnerModules[i]))
+      {
+        goto fail;
+      }
+
+      desc.is3dImage = bool(is3dImage);
+      desc.isFloat = bool(isFloat);
+      desc.bsdfDataKey = uint64_t(bsdfDataKeyLo) | (uint64_t(bsdfDataKeyHi) << 32);
+    }
+
+    GB_DEBUG("read MDL code cache file {}", filePath);
+    return entry;
+
+fail:
+    GB_WARN("ignoring corrupt MDL code cache file {}", filePath);
+    return nullptr;
+  }
+
+  void McCodeGenCache::writeToDisk(const McCodeGenCacheKey& key, const McCodeGenCacheEntry& entry) const
+  {
+    std::string filePath = makeFilePath(key);
+
+    // Write to a temporary file first so that concurrent readers never see partial data.
+    std::string tmpFilePath = GB_FMT("{}.{}.tmp", filePath, std::hash<std::thread::id>{}(std::this_thread::get_id()));
+
+    {
+      std::ofstream stream(tmpFilePath, std::ios::out | std::ios::binary | std::ios::trunc);
+      if (!stream.is_open())
+      {
+        GB_ERROR("unable to write MDL code cache file {}", tmpFilePath);
+        return;
+      }
+
+      _BinaryWriter writer(stream);
+      writer.writeU32(FILE_MAGIC);
+      writer.writeU32(FILE_VERSION);
+      writer.writeString(entry.source);
+      writer.writeU32(uint32_t(entry.textureDescriptions.size()));
+
+      for (size_t i = 0; i < entry.textureDescriptions.size(); i++)
+      {
+        const McTextureDescription& desc = entry.textureDescriptions[i];
+        writer.writeU32(desc.binding);
+        writer.writeU32(desc.is3dImage);
+        writer.writeU32(desc.isFloat);
+        writer.writeU32(desc.width);
+        writer.writeU32(desc.height);
+        writer.writeU32(desc.depth);
+        writer.writeBytes(desc.data.data(), desc.data.size());
+        writer.writeString(desc.filePath);
+        writer.writeU32(uint32_t(desc.bsdfDataKey));
+        writer.writeU32(uint32_t(desc.bsdfDataKey >> 32));
+        writer.writeString(entry.textureOwnerModules[i]);
+      }
+    }
+
+    std::error_code errorCode;
+    fs::rename(tmpFilePath, filePath, errorCode);
+
+    if (errorCode)
+    {
+      GB_ERROR("unable to write MDL code cache file {}: {}", filePath, errorCode.message());
+      fs::remove(tmpFilePath, errorCode);
+    }
+  }
+}
@@ -0,0 +1,81 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include "Backend.h"
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace gtl
+{
+  struct McCodeGenCacheKey
+  {
+    std::array<uint32_t, 4> materialHash; // ICompiled_material::get_hash()
+    uint32_t dfFlags;
+
+    bool operator==(const McCodeGenCacheKey& o) const = default;
+  };
+
+  struct McCodeGenCacheKeyHasher
+  {
+    size_t operator()(const McCodeGenCacheKey& key) const;
+  };
+
+  // Texture file paths are stored unresolved (as MDL URLs), together with their
+  // owner modules, because resolving them depends on the module search paths.
+  struct McCodeGenCacheEntry
+  {
+    std::string source;
+    std::vector<McTextureDescription> textureDescriptions;
+    std::vector<std::string> textureOwnerModules;
+  };
+
+  // Memoizes MDL->GLSL code generation results. Entries live in memory for the
+  // lifetime of the cache; if a directory is given, they are persisted to disk too.
+  class McCodeGenCache
+  {
+  public:
+    // The options digest has to change whenever the generated code would differ
+    // for the same compiled material (backend options, SDK version, ...).
+    McCodeGenCache(std::string_view optionsDigest, std::string_view diskCacheDir);
+
+  public:
+    std::shared_ptr<const McCodeGenCacheEntry> find(const McCodeGenCacheKey& key);
+
+    void insert(const McCodeGenCacheKey& key, std::shared_ptr<const McCodeGenCacheEntry> entry);
+
+  private:
+    std::string makeFilePath(const McCodeGenCacheKey& key) const;
+
+    std::shared_ptr<const McCodeGenCacheEntry> readFromDisk(const McCodeGenCacheKey& key) const;
+
+    void writeToDisk(const McCodeGenCacheKey& key, const McCodeGenCacheEntry& entry) const;
+
+  private:
+    uint64_t m_optionsHash;
+    std::string m_diskCacheDir;
+    std::mutex m_mutex;
+    std::unordered_map<McCodeGenCacheKey, std::shared_ptr<const McCodeGenCacheEntry>, McCodeGenCacheKeyHasher> m_entries;
+  };
+}
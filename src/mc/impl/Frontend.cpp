@@ -24,11 +24,16 @@
 #include "MtlxMdlCodeGen.h"
 #include "Runtime.h"
 
+#include <gtl/gb/Log.h>
+
 #include <filesystem>
+#include <string.h>
 #include <assert.h>
 
 namespace
 {
+  using namespace gtl;
+
   bool _IsExpressionBlackColor(mi::base::Handle<const mi::neuraylib::IExpression> expr)
   {
     if (expr->get_kind() != mi::neuraylib::IExpression::Kind::EK_CONSTANT)
@@ -181,28 +186,14 @@ namespace
     }
     return 0;
   }
-}
-
-namespace gtl
-{
-  McFrontend::McFrontend(const std::vector<std::string>& mdlSearchPaths,
-                         const MaterialX::DocumentPtr mtlxStdLib,
-                         McRuntime& runtime)
-  {
-    McMdlRuntime& mdlRuntime = runtime.getMdlRuntime();
-    m_mdlMaterialCompiler = std::make_shared<McMdlMaterialCompiler>(mdlRuntime, mdlSearchPaths);
-    m_mtlxMdlCodeGen = std::make_shared<McMtlxMdlCodeGen>(mtlxStdLib);
-  }
 
-  McMaterial* McFrontend::createFromMdlStr(std::string_view mdlSrc, std::string_view subIdentifier, bool hasCutoutTransparency)
+  McMaterial* _MakeMaterial(mi::base::Handle<mi::neuraylib::ICompiled_material> compiledMaterial,
+                            std::shared_ptr<McMdlGeneratedModule> generatedModule,
+                            bool hasCutoutTransparency,
+                            std::string_view resourcePathPrefix)
   {
-    mi::base::Handle<mi::neuraylib::ICompiled_material> compiledMaterial;
-    if (!m_mdlMaterialCompiler->compileFromString(mdlSrc, subIdentifier, compiledMaterial))
-    {
-      return nullptr;
-    }
-
     auto mdlMaterial = std::make_shared<McMdlMaterial>();
+    mdlMaterial->generatedModule = generatedModule;
     mdlMaterial->compiledMaterial = compiledMaterial;
 
     return new McMaterial{
@@ -214,7 +205,7 @@ namespace gtl
       .isEmissive = _IsCompiledMaterialEmissive(compiledMaterial),
       .isThinWalled = _IsCompiledMaterialThinWalled(compiledMaterial),
       .directionalBias = _GetCompiledMaterialDirectionalBias(compiledMaterial),
-      .resourcePathPrefix = "", // no source file
+      .resourcePathPrefix = std::string(resourcePathPrefix),
       .mdlMaterial = mdlMaterial,
       .requiresSceneTransforms = compiledMaterial->depends_on_state_transform(),
       .sceneDataNames = _ExtractSceneDataNames(compiledMaterial),
@@ -222,6 +213,82 @@ namespace gtl
     };
   }
 
+  bool _SceneDataNamesEqual(const McMaterial& a, const McMaterial& b)
+  {
+    if (a.sceneDataNames.size() != b.sceneDataNames.size())
+    {
+      return false;
+    }
+
+    for (size_t i = 0; i < a.sceneDataNames.size(); i++)
+    {
+      if (strcmp(a.sceneDataNames[i], b.sceneDataNames[i]) != 0)
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  // Also creates the distilled variant of the material, if distilling is enabled.
+  McMaterial* _CreateMaterial(McMdlMaterialCompiler& compiler,
+                              mi::base::Handle<mi::neuraylib::ICompiled_material> compiledMaterial,
+                              std::shared_ptr<McMdlGeneratedModule> generatedModule,
+                              bool hasCutoutTransparency,
+                              std::string_view resourcePathPrefix)
+  {
+    McMaterial* material = _MakeMaterial(compiledMaterial, generatedModule, hasCutoutTransparency, resourcePathPrefix);
+
+    mi::base::Handle<mi::neuraylib::ICompiled_material> distilledMaterial;
+    if (!compiler.distill(compiledMaterial.get(), distilledMaterial))
+    {
+      return material;
+    }
+
+    // The cutout opacity is not affected by distilling. We keep the flag of the full material
+    // because it is also used for the BVH build, which does not depend on the shading variant.
+    // The distilled material may still reference definitions of the module.
+    auto distilled = std::shared_ptr<McMaterial>(_MakeMaterial(distilledMaterial, generatedModule, material->hasCutoutTransparency, resourcePathPrefix));
+
+    // Scene data is provided per mesh for the full material, so the distilled material must not
+    // read other primvars (or in a different order).
+    if (!_SceneDataNamesEqual(*material, *distilled))
+    {
+      GB_DEBUG("distilled material reads different scene data - ignoring");
+      return material;
+    }
+
+    material->distilledMaterial = distilled;
+    return material;
+  }
+}
+
+namespace gtl
+{
+  McFrontend::McFrontend(const std::vector<std::string>& mdlSearchPaths,
+                         const MaterialX::DocumentPtr mtlxStdLib,
+                         McRuntime& runtime,
+                         bool classCompilation,
+                         std::string_view distillTarget)
+  {
+    McMdlRuntime& mdlRuntime = runtime.getMdlRuntime();
+    m_mdlMaterialCompiler = std::make_shared<McMdlMaterialCompiler>(mdlRuntime, mdlSearchPaths, classCompilation, distillTarget);
+    m_mtlxMdlCodeGen = std::make_shared<McMtlxMdlCodeGen>(mtlxStdLib);
+  }
+
+  McMaterial* McFrontend::createFromMdlStr(std::string_view mdlSrc, std::string_view subIdentifier, bool hasCutoutTransparency)
+  {
+    mi::base::Handle<mi::neuraylib::ICompiled_material> compiledMaterial;
+    std::shared_ptr<McMdlGeneratedModule> generatedModule;
+    if (!m_mdlMaterialCompiler->compileFromString(mdlSrc, subIdentifier, compiledMaterial, generatedModule))
+    {
+      return nullptr;
+    }
+
+    return _CreateMaterial(*m_mdlMaterialCompiler, compiledMaterial, generatedModule, hasCutoutTransparency, ""); // no source file
+  }
+
   McMaterial* McFrontend::createFromMtlxStr(std::string_view docStr)
   {
     std::string mdlSrc;
@@ -259,23 +326,6 @@ namespace gtl
     namespace fs = std::filesystem;
     std::string resourcePathPrefix = fs::path(filePath).parent_path().string();
 
-    auto mdlMaterial = std::make_shared<McMdlMaterial>();
-    mdlMaterial->compiledMaterial = compiledMaterial;
-
-    return new McMaterial{
-      .hasBackfaceBsdf = _HasCompiledMaterialBackfaceBsdf(compiledMaterial),
-      .hasBackfaceEdf = _HasCompiledMaterialBackfaceEdf(compiledMaterial),
-      .hasVolumeAbsorptionCoeff = _HasCompiledMaterialVolumeAbsorptionCoefficient(compiledMaterial),
-      .hasVolumeScatteringCoeff = _HasCompiledMaterialVolumeScatteringCoefficient(compiledMaterial),
-      .hasCutoutTransparency = _HasCompiledMaterialCutoutTransparency(compiledMaterial),
-      .isEmissive = _IsCompiledMaterialEmissive(compiledMaterial),
-      .isThinWalled = _IsCompiledMaterialThinWalled(compiledMaterial),
-      .directionalBias = _GetCompiledMaterialDirectionalBias(compiledMaterial),
-      .resourcePathPrefix = resourcePathPrefix,
-      .mdlMaterial = mdlMaterial,
-      .requiresSceneTransforms = compiledMaterial->depends_on_state_transform(),
-      .sceneDataNames = _ExtractSceneDataNames(compiledMaterial),
-      .cameraPositionSceneDataIndex = _FindCameraPositionSceneDataIndex(compiledMaterial)
-    };
+    return _CreateMaterial(*m_mdlMaterialCompiler, compiledMaterial, nullptr, _HasCompiledMaterialCutoutTransparency(compiledMaterial), resourcePathPrefix);
   }
 }
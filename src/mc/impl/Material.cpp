@@ -16,3 +16,117 @@
 //
 
 #include "Material.h"
+
+#include "MdlMaterial.h"
+
+#include <functional>
+#include <string.h>
+#include <string_view>
+
+namespace
+{
+  using namespace gtl;
+
+  bool _PropertiesEqual(const McMaterial& a, const McMaterial& b)
+  {
+    if (a.hasBackfaceBsdf != b.hasBackfaceBsdf ||
+        a.hasBackfaceEdf != b.hasBackfaceEdf ||
+        a.hasVolumeAbsorptionCoeff != b.hasVolumeAbsorptionCoeff ||
+        a.hasVolumeScatteringCoeff != b.hasVolumeScatteringCoeff ||
+        a.hasCutoutTransparency != b.hasCutoutTransparency ||
+        a.isEmissive != b.isEmissive ||
+        a.isThinWalled != b.isThinWalled ||
+        a.directionalBias != b.directionalBias ||
+        a.resourcePathPrefix != b.resourcePathPrefix ||
+        a.requiresSceneTransforms != b.requiresSceneTransforms ||
+        a.sceneDataNames.size() != b.sceneDataNames.size() ||
+        a.cameraPositionSceneDataIndex != b.cameraPositionSceneDataIndex)
+    {
+      return false;
+    }
+
+    for (size_t i = 0; i < a.sceneDataNames.size(); i++)
+    {
+      if (strcmp(a.sceneDataNames[i], b.sceneDataNames[i]) != 0)
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  void _HashCombine(uint64_t& hash, uint64_t value)
+  {
+    hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+  }
+}
+
+namespace gtl
+{
+  bool McMaterialHasParameters(const McMaterial& material)
+  {
+    return material.mdlMaterial->compiledMaterial->get_parameter_count() > 0;
+  }
+
+  bool McMaterialsShareClass(const McMaterial& a, const McMaterial& b)
+  {
+    if (!_PropertiesEqual(a, b))
+    {
+      return false;
+    }
+
+    // Instance-compiled materials have their arguments folded into the body.
+    if (!McMaterialHasParameters(a) || !McMaterialHasParameters(b))
+    {
+      return false;
+    }
+
+    // The hash does not include argument values.
+    return a.mdlMaterial->compiledMaterial->get_hash() == b.mdlMaterial->compiledMaterial->get_hash();
+  }
+
+  bool McMaterialsAreIdentical(const McMaterial& a, const McMaterial& b)
+  {
+    if (!_PropertiesEqual(a, b))
+    {
+      return false;
+    }
+
+    // Class-compiled materials keep per-material argument blocks which can be edited individually.
+    if (McMaterialHasParameters(a) || McMaterialHasParameters(b))
+    {
+      return false;
+    }
+
+    return a.mdlMaterial->compiledMaterial->get_hash() == b.mdlMaterial->compiledMaterial->get_hash();
+  }
+
+  uint64_t McHashMaterial(const McMaterial& material)
+  {
+    mi::base::Uuid mdlHash = material.mdlMaterial->compiledMaterial->get_hash();
+
+    uint64_t hash = (uint64_t(mdlHash.m_id1) << 32) | mdlHash.m_id2;
+    _HashCombine(hash, (uint64_t(mdlHash.m_id3) << 32) | mdlHash.m_id4);
+
+    uint64_t flags = uint64_t(material.hasBackfaceBsdf) |
+                     (uint64_t(material.hasBackfaceEdf) << 1) |
+                     (uint64_t(material.hasVolumeAbsorptionCoeff) << 2) |
+                     (uint64_t(material.hasVolumeScatteringCoeff) << 3) |
+                     (uint64_t(material.hasCutoutTransparency) << 4) |
+                     (uint64_t(material.isEmissive) << 5) |
+                     (uint64_t(material.isThinWalled) << 6) |
+                     (uint64_t(material.requiresSceneTransforms) << 7);
+    _HashCombine(hash, flags);
+    _HashCombine(hash, std::hash<float>{}(material.directionalBias));
+    _HashCombine(hash, std::hash<std::string>{}(material.resourcePathPrefix));
+    _HashCombine(hash, uint64_t(int64_t(material.cameraPositionSceneDataIndex)));
+
+    for (const char* name : material.sceneDataNames)
+    {
+      _HashCombine(hash, std::hash<std::string_view>{}(name));
+    }
+
+    return hash;
+  }
+}
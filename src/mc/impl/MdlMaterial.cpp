@@ -16,3 +16,25 @@
 //
 
 #include "MdlMaterial.h"
+
+#include "MdlRuntime.h"
+
+namespace gtl
+{
+  McMdlGeneratedModule::McMdlGeneratedModule(McMdlRuntime& runtime, std::vector<std::string> elementNames)
+    : m_runtime(runtime)
+    , m_elementNames(std::move(elementNames))
+  {
+    m_runtime.trackElements(m_elementNames.size());
+  }
+
+  McMdlGeneratedModule::~McMdlGeneratedModule()
+  {
+    m_runtime.removeElements(m_elementNames);
+  }
+
+  const std::vector<std::string>& McMdlGeneratedModule::getElementNames() const
+  {
+    return m_elementNames;
+  }
+}
@@ -19,12 +19,39 @@
 
 #include <mi/neuraylib/icompiled_material.h>
 
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace gtl
 {
+  class McMdlRuntime;
+
+  // The database elements of a module that was generated for a single material (and its
+  // distilled variant). They are removed once the last material referencing them is destroyed.
+  class McMdlGeneratedModule
+  {
+  public:
+    McMdlGeneratedModule(McMdlRuntime& runtime, std::vector<std::string> elementNames);
+
+    ~McMdlGeneratedModule();
+
+    McMdlGeneratedModule(const McMdlGeneratedModule&) = delete;
+    McMdlGeneratedModule& operator=(const McMdlGeneratedModule&) = delete;
+
+  public:
+    const std::vector<std::string>& getElementNames() const;
+
+  private:
+    McMdlRuntime& m_runtime;
+    std::vector<std::string> m_elementNames;
+  };
+
   struct McMdlMaterial
   {
+    // Null for modules loaded from files, as these are shared. Declared first so that the
+    // compiled material is released before the module is removed.
+    std::shared_ptr<McMdlGeneratedModule> generatedModule;
     mi::base::Handle<mi::neuraylib::ICompiled_material> compiledMaterial;
   };
 }
@@ -17,6 +17,7 @@
 
 #include "MdlMaterialCompiler.h"
 
+#include "MdlMaterial.h"
 #include "MdlRuntime.h"
 
 #include <gtl/gb/Fmt.h>
@@ -42,35 +43,52 @@ namespace
 
 namespace gtl
 {
-  McMdlMaterialCompiler::McMdlMaterialCompiler(McMdlRuntime& runtime, const std::vector<std::string>& mdlSearchPaths)
-    : m_mdlSearchPaths(mdlSearchPaths)
+  McMdlMaterialCompiler::McMdlMaterialCompiler(McMdlRuntime& runtime,
+                                               const std::vector<std::string>& mdlSearchPaths,
+                                               bool classCompilation,
+                                               std::string_view distillTarget)
+    : m_classCompilation(classCompilation)
+    , m_distillTarget(distillTarget)
+    , m_runtime(runtime)
   {
     m_logger = mi::base::Handle<McMdlLogger>(runtime.getLogger());
-    m_database = mi::base::Handle<mi::neuraylib::IDatabase>(runtime.getDatabase());
-    m_transaction = mi::base::Handle<mi::neuraylib::ITransaction>(runtime.getTransaction());
-    m_config = mi::base::Handle<mi::neuraylib::IMdl_configuration>(runtime.getConfig());
     m_factory = mi::base::Handle<mi::neuraylib::IMdl_factory>(runtime.getFactory());
     m_impExpApi = mi::base::Handle<mi::neuraylib::IMdl_impexp_api>(runtime.getImpExpApi());
+    m_distillerApi = mi::base::Handle<mi::neuraylib::IMdl_distiller_api>(runtime.getDistillerApi());
+
+    if (!m_distillTarget.empty() && m_distillerApi && !isDistillTargetSupported())
+    {
+      auto logMsg = GB_FMT("unknown MDL distilling target \"{}\"", m_distillTarget);
+      m_logger->message(mi::base::MESSAGE_SEVERITY_WARNING, logMsg.c_str());
+      m_distillerApi = nullptr;
+    }
+
+    // The search paths are registered with the runtime once instead of per compilation,
+    // so that compilations from strings don't need to be serialized.
+    m_runtime.addSearchPaths(mdlSearchPaths);
   }
 
   bool McMdlMaterialCompiler::compileFromString(std::string_view srcStr,
                                                 std::string_view identifier,
-                                                mi::base::Handle<mi::neuraylib::ICompiled_material>& compiledMaterial)
+                                                mi::base::Handle<mi::neuraylib::ICompiled_material>& compiledMaterial,
+                                                std::shared_ptr<McMdlGeneratedModule>& generatedModule)
   {
-    std::lock_guard<std::mutex> guard(m_mutex); // Serialize since the search path is global...
-
     std::string moduleName = _MakeModuleName(identifier);
 
-    addStandardSearchPaths();
-
-    auto modCreateFunc = [&](mi::neuraylib::IMdl_execution_context* context)
+    auto modCreateFunc = [&](mi::neuraylib::ITransaction* transaction, mi::neuraylib::IMdl_execution_context* context)
     {
-      return m_impExpApi->load_module_from_string(m_transaction.get(), moduleName.c_str(), srcStr.data(), context);
+      return m_impExpApi->load_module_from_string(transaction, moduleName.c_str(), srcStr.data(), context);
     };
 
-    bool result = compile(identifier, moduleName, modCreateFunc, compiledMaterial);
+    std::vector<std::string> elementNames;
+    bool result;
+    {
+      auto guard = m_runtime.lockSearchPaths();
+      result = compile(identifier, moduleName, modCreateFunc, compiledMaterial, &elementNames);
+    }
 
-    m_config->clear_mdl_paths();
+    // Also on failure, so that the module of a material that could not be compiled is removed right away.
+    generatedModule = std::make_shared<McMdlGeneratedModule>(m_runtime, std::move(elementNames));
 
     return result;
   }
@@ -79,72 +97,128 @@ namespace gtl
                                               std::string_view identifier,
                                               mi::base::Handle<mi::neuraylib::ICompiled_material>& compiledMaterial)
   {
-    std::lock_guard<std::mutex> guard(m_mutex); // Serialize since the search path is global...
-
     std::string fileDir = fs::path(filePath).parent_path().string();
     std::string moduleName = GB_FMT("::{}", fs::path(filePath).stem().string());
 
-    if (m_config->add_mdl_path(fileDir.c_str()))
+    auto modCreateFunc = [&](mi::neuraylib::ITransaction* transaction, mi::neuraylib::IMdl_execution_context* context)
     {
-      m_logger->message(mi::base::MESSAGE_SEVERITY_WARNING, "unable to add asset MDL files");
-    }
+      return m_impExpApi->load_module(transaction, moduleName.c_str(), context);
+    };
 
-    // The free TurboSquid USD+MDL models, and possibly thousand paid ones too, come with some of the required Omni* files,
-    // but some others are referenced and missing. If we include the directory of the asset as an MDL path after our own Omni*
-    // MDL files, the Omni* files that come with the asset will be loaded instead of ours. They link to the other files that do
-    // not exist, causing compilation to fail. By changing the load order, our complete Omni*-file suite will be used instead.
-    addStandardSearchPaths();
+    // File modules are shared between materials and are not removed. Their directory is only
+    // searched while they are loaded, which serializes file compilations.
+    return m_runtime.runWithAssetSearchPath(fileDir, [&]()
+    {
+      return compile(identifier, moduleName, modCreateFunc, compiledMaterial, nullptr);
+    });
+  }
 
-    auto modCreateFunc = [&](mi::neuraylib::IMdl_execution_context* context)
+  bool McMdlMaterialCompiler::distill(const mi::neuraylib::ICompiled_material* compiledMaterial,
+                                      mi::base::Handle<mi::neuraylib::ICompiled_material>& distilledMaterial)
+  {
+    if (m_distillTarget.empty() || !m_distillerApi)
     {
-      return m_impExpApi->load_module(m_transaction.get(), moduleName.c_str(), context);
-    };
+      return false;
+    }
 
-    bool result = compile(identifier, moduleName, modCreateFunc, compiledMaterial);
+    mi::Sint32 result = 0;
+    const mi::neuraylib::ICompiled_material* material = m_distillerApi->distill_material(compiledMaterial, m_distillTarget.c_str(), nullptr, &result);
 
-    m_config->clear_mdl_paths();
+    // Compiled materials are immutable; the handle type is non-const only for consistency with the compiler output.
+    distilledMaterial = mi::base::Handle<mi::neuraylib::ICompiled_material>(const_cast<mi::neuraylib::ICompiled_material*>(material));
 
-    return result;
+    if (result != 0 || !distilledMaterial)
+    {
+      auto logMsg = GB_FMT("failed to distill material to \"{}\" (error {})", m_distillTarget, result);
+      m_logger->message(mi::base::MESSAGE_SEVERITY_WARNING, logMsg.c_str());
+      distilledMaterial = nullptr;
+      return false;
+    }
+
+    return true;
   }
 
-  void McMdlMaterialCompiler::addStandardSearchPaths()
+  bool McMdlMaterialCompiler::isDistillTargetSupported() const
   {
-    for (const std::string& s : m_mdlSearchPaths)
+    for (mi::Size i = 0; i < m_distillerApi->get_target_count(); i++)
     {
-      if (m_config->add_mdl_path(s.c_str()))
+      if (m_distillTarget == m_distillerApi->get_target_name(i))
       {
-        auto logMsg = GB_FMT("MDL search path could not be added: \"{}\"", s);
-        m_logger->message(mi::base::MESSAGE_SEVERITY_WARNING, logMsg.c_str());
+        return true;
       }
     }
+    return false;
   }
 
   bool McMdlMaterialCompiler::compile(std::string_view identifier,
                                       std::string_view moduleName,
-                                      std::function<mi::Sint32(mi::neuraylib::IMdl_execution_context*)> modCreateFunc,
-                                      mi::base::Handle<mi::neuraylib::ICompiled_material>& compiledMaterial)
+                                      std::function<mi::Sint32(mi::neuraylib::ITransaction*, mi::neuraylib::IMdl_execution_context*)> modCreateFunc,
+                                      mi::base::Handle<mi::neuraylib::ICompiled_material>& compiledMaterial,
+                                      std::vector<std::string>* elementNames)
   {
+    // Each compilation has its own transaction and context so that compilations can run concurrently.
+    mi::base::Handle<mi::neuraylib::ITransaction> transaction(m_runtime.createTransaction());
     mi::base::Handle<mi::neuraylib::IMdl_execution_context> context(m_factory->create_execution_context());
     context->set_option("resolve_resources", false);
 
-    mi::Sint32 modCreateResult = modCreateFunc(context.get());
+    if (m_classCompilation)
+    {
+      // Bool and enum parameters usually switch between BSDFs or toggle properties like
+      // thin-walledness, which we need to know at compile time.
+      context->set_option("fold_all_bool_parameters", true);
+      context->set_option("fold_all_enum_parameters", true);
+    }
+
+    mi::Sint32 modCreateResult = modCreateFunc(transaction.get(), context.get());
+
+    // A result of 1 means that the module already existed and is not ours to remove.
+    if (modCreateResult == 0 && elementNames)
+    {
+      collectModuleElements(transaction.get(), moduleName, *elementNames);
+    }
 
     bool compResult = (modCreateResult == 0 || modCreateResult == 1) &&
-      createCompiledMaterial(context.get(), moduleName.data(), identifier, compiledMaterial);
+      createCompiledMaterial(transaction.get(), context.get(), moduleName.data(), identifier, compiledMaterial);
 
     m_logger->flushContextMessages(context.get());
 
+    // Make the loaded modules visible to code generation, which uses its own transactions.
+    transaction->commit();
+
     return compResult;
   }
 
-  bool McMdlMaterialCompiler::createCompiledMaterial(mi::neuraylib::IMdl_execution_context* context,
+  void McMdlMaterialCompiler::collectModuleElements(mi::neuraylib::ITransaction* transaction,
+                                                    std::string_view moduleName,
+                                                    std::vector<std::string>& elementNames)
+  {
+    mi::base::Handle<const mi::IString> moduleDbName(m_factory->get_db_module_name(moduleName.data()));
+    assert(moduleDbName);
+    mi::base::Handle<const mi::neuraylib::IModule> module(transaction->access<mi::neuraylib::IModule>(moduleDbName->get_c_str()));
+    if (!module)
+    {
+      return;
+    }
+
+    // Material definitions are function definitions as well.
+    for (mi::Size i = 0; i < module->get_function_count(); i++)
+    {
+      elementNames.push_back(module->get_function(i));
+    }
+
+    // The definitions reference the module, so it is removed last.
+    elementNames.push_back(moduleDbName->get_c_str());
+  }
+
+  bool McMdlMaterialCompiler::createCompiledMaterial(mi::neuraylib::ITransaction* transaction,
+                                                     mi::neuraylib::IMdl_execution_context* context,
                                                      std::string_view moduleName,
                                                      std::string_view identifier,
                                                      mi::base::Handle<mi::neuraylib::ICompiled_material>& compiledMaterial)
   {
     mi::base::Handle<const mi::IString> moduleDbName(m_factory->get_db_module_name(moduleName.data()));
     assert(moduleDbName);
-    mi::base::Handle<const mi::neuraylib::IModule> module(m_transaction->access<mi::neuraylib::IModule>(moduleDbName->get_c_str()));
+    mi::base::Handle<const mi::neuraylib::IModule> module(transaction->access<mi::neuraylib::IModule>(moduleDbName->get_c_str()));
     assert(module);
 
     std::string materialDbName = GB_FMT("{}::{}", moduleDbName->get_c_str(), identifier);
@@ -165,7 +239,7 @@ namespace gtl
     mi::base::Handle<const mi::IString> exactMaterialDbName(funcs->get_element<mi::IString>(0));
     assert(exactMaterialDbName);
 
-    mi::base::Handle<const mi::neuraylib::IFunction_definition> materialDefinition(m_transaction->access<mi::neuraylib::IFunction_definition>(exactMaterialDbName->get_c_str()));
+    mi::base::Handle<const mi::neuraylib::IFunction_definition> materialDefinition(transaction->access<mi::neuraylib::IFunction_definition>(exactMaterialDbName->get_c_str()));
     if (!materialDefinition)
     {
       return false;
@@ -184,7 +258,8 @@ namespace gtl
       return false;
     }
 
-    auto compileFlags = mi::neuraylib::IMaterial_instance::DEFAULT_OPTIONS; // Instance compilation, no class compilation.
+    auto compileFlags = m_classCompilation ? mi::neuraylib::IMaterial_instance::CLASS_COMPILATION
+                                           : mi::neuraylib::IMaterial_instance::DEFAULT_OPTIONS;
     compiledMaterial = mi::base::Handle<mi::neuraylib::ICompiled_material>(materialInstance2->create_compiled_material(compileFlags, context));
 
     return compiledMaterial != nullptr;
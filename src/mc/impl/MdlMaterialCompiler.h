@@ -19,15 +19,15 @@
 
 #include <string_view>
 #include <functional>
+#include <memory>
 #include <vector>
-#include <mutex>
 
 #include <mi/base/handle.h>
 #include <mi/neuraylib/icompiled_material.h>
 #include <mi/neuraylib/idatabase.h>
 #include <mi/neuraylib/itransaction.h>
 #include <mi/neuraylib/imaterial_instance.h>
-#include <mi/neuraylib/imdl_configuration.h>
+#include <mi/neuraylib/imdl_distiller_api.h>
 #include <mi/neuraylib/imdl_execution_context.h>
 #include <mi/neuraylib/imdl_factory.h>
 #include <mi/neuraylib/imdl_impexp_api.h>
@@ -36,45 +36,65 @@
 
 namespace gtl
 {
+  class McMdlGeneratedModule;
   class McMdlRuntime;
 
   class McMdlMaterialCompiler
   {
   public:
-    McMdlMaterialCompiler(McMdlRuntime& runtime, const std::vector<std::string>& mdlSearchPaths);
+    // With class compilation, material parameters are not folded into the compiled material
+    // but kept as arguments, so that materials differing only in parameter values share code.
+    // If a distilling target (e.g. 'ue4' or 'transmissive_pbr') is given, compiled materials can
+    // additionally be distilled to that simpler model for faster, lower-fidelity preview shading.
+    McMdlMaterialCompiler(McMdlRuntime& runtime,
+                          const std::vector<std::string>& mdlSearchPaths,
+                          bool classCompilation,
+                          std::string_view distillTarget);
 
   public:
+    // Each compilation generates a new module. It is removed from the database once all
+    // references to the returned module (and the compiled material) are dropped.
     bool compileFromString(std::string_view srcStr,
                            std::string_view identifier,
-                           mi::base::Handle<mi::neuraylib::ICompiled_material>& compiledMaterial);
+                           mi::base::Handle<mi::neuraylib::ICompiled_material>& compiledMaterial,
+                           std::shared_ptr<McMdlGeneratedModule>& generatedModule);
 
     bool compileFromFile(std::string_view filePath,
                          std::string_view identifier,
                          mi::base::Handle<mi::neuraylib::ICompiled_material>& compiledMaterial);
 
+    // Fails if no distilling target is set or the distiller plugin is not available.
+    bool distill(const mi::neuraylib::ICompiled_material* compiledMaterial,
+                 mi::base::Handle<mi::neuraylib::ICompiled_material>& distilledMaterial);
+
   private:
-    void addStandardSearchPaths();
+    bool isDistillTargetSupported() const;
 
+    // If 'elementNames' is given, the definitions and the module are appended if the module was created.
     bool compile(std::string_view identifier,
                  std::string_view moduleName,
-                 std::function<mi::Sint32(mi::neuraylib::IMdl_execution_context*)> modCreateFunc,
-                 mi::base::Handle<mi::neuraylib::ICompiled_material>& compiledMaterial);
+                 std::function<mi::Sint32(mi::neuraylib::ITransaction*, mi::neuraylib::IMdl_execution_context*)> modCreateFunc,
+                 mi::base::Handle<mi::neuraylib::ICompiled_material>& compiledMaterial,
+                 std::vector<std::string>* elementNames);
+
+    void collectModuleElements(mi::neuraylib::ITransaction* transaction,
+                               std::string_view moduleName,
+                               std::vector<std::string>& elementNames);
 
-    bool createCompiledMaterial(mi::neuraylib::IMdl_execution_context* context,
+    bool createCompiledMaterial(mi::neuraylib::ITransaction* transaction,
+                                mi::neuraylib::IMdl_execution_context* context,
                                 std::string_view moduleName,
                                 std::string_view identifier,
                                 mi::base::Handle<mi::neuraylib::ICompiled_material>& compiledMaterial);
 
   private:
-    const std::vector<std::string> m_mdlSearchPaths;
-
-    std::mutex m_mutex;
+    const bool m_classCompilation;
+    const std::string m_distillTarget;
 
+    McMdlRuntime& m_runtime;
     mi::base::Handle<McMdlLogger> m_logger;
-    mi::base::Handle<mi::neuraylib::IDatabase> m_database;
-    mi::base::Handle<mi::neuraylib::ITransaction> m_transaction;
-    mi::base::Handle<mi::neuraylib::IMdl_configuration> m_config;
     mi::base::Handle<mi::neuraylib::IMdl_factory> m_factory;
     mi::base::Handle<mi::neuraylib::IMdl_impexp_api> m_impExpApi;
+    mi::base::Handle<mi::neuraylib::IMdl_distiller_api> m_distillerApi;
   };
 }
@@ -22,6 +22,16 @@
 
 #include <mi/mdl_sdk.h>
 
+#include <gtl/gb/Fmt.h>
+
+#include <algorithm>
+
+namespace
+{
+  // Garbage collection runs synchronously, so we don't collect after every removal.
+  const uint32_t GC_REMOVAL_INTERVAL = 16;
+}
+
 namespace gtl
 {
   McMdlRuntime::McMdlRuntime()
@@ -30,10 +40,6 @@ namespace gtl
 
   McMdlRuntime::~McMdlRuntime()
   {
-    if (m_transaction)
-    {
-      m_transaction->commit();
-    }
   }
 
   bool McMdlRuntime::init(std::string_view libDir)
@@ -56,6 +62,16 @@ namespace gtl
     loggingConfig->set_receiving_logger(m_logger.get());
 #endif
 
+    // Plugins can only be loaded before startup. Distilling is optional, so we continue without it.
+    mi::base::Handle<mi::neuraylib::IPlugin_configuration> pluginConfig(m_neuray->get_api_component<mi::neuraylib::IPlugin_configuration>());
+    std::string distillerPath = GB_FMT("{}/mdl_distiller{}", libDir, MI_BASE_DLL_FILE_EXT);
+    bool distillerLoaded = pluginConfig->load_plugin_library(distillerPath.c_str()) == 0;
+
+    if (!distillerLoaded)
+    {
+      m_logger->message(mi::base::MESSAGE_SEVERITY_WARNING, "MDL distiller plugin not found - distilling unavailable");
+    }
+
     if (m_neuray->start() != 0)
     {
       m_logger->message(mi::base::MESSAGE_SEVERITY_FATAL, "Unable to start Neuray");
@@ -63,12 +79,15 @@ namespace gtl
     }
 
     m_database = mi::base::Handle<mi::neuraylib::IDatabase>(m_neuray->get_api_component<mi::neuraylib::IDatabase>());
-    mi::base::Handle<mi::neuraylib::IScope> scope(m_database->get_global_scope());
-    m_transaction = mi::base::Handle<mi::neuraylib::ITransaction>(scope->create_transaction());
 
     m_factory = mi::base::Handle<mi::neuraylib::IMdl_factory>(m_neuray->get_api_component<mi::neuraylib::IMdl_factory>());
     m_impExpApi = mi::base::Handle<mi::neuraylib::IMdl_impexp_api>(m_neuray->get_api_component<mi::neuraylib::IMdl_impexp_api>());
     m_backendApi = mi::base::Handle<mi::neuraylib::IMdl_backend_api>(m_neuray->get_api_component<mi::neuraylib::IMdl_backend_api>());
+
+    if (distillerLoaded)
+    {
+      m_distillerApi = mi::base::Handle<mi::neuraylib::IMdl_distiller_api>(m_neuray->get_api_component<mi::neuraylib::IMdl_distiller_api>());
+    }
     return true;
   }
 
@@ -82,9 +101,10 @@ namespace gtl
     return m_database;
   }
 
-  mi::base::Handle<mi::neuraylib::ITransaction> McMdlRuntime::getTransaction()
+  mi::base::Handle<mi::neuraylib::ITransaction> McMdlRuntime::createTransaction()
   {
-    return m_transaction;
+    mi::base::Handle<mi::neuraylib::IScope> scope(m_database->get_global_scope());
+    return mi::base::Handle<mi::neuraylib::ITransaction>(scope->create_transaction());
   }
 
   mi::base::Handle<mi::neuraylib::IMdl_factory> McMdlRuntime::getFactory()
@@ -106,4 +126,111 @@ namespace gtl
   {
     return m_backendApi;
   }
+
+  mi::base::Handle<mi::neuraylib::IMdl_distiller_api> McMdlRuntime::getDistillerApi()
+  {
+    return m_distillerApi;
+  }
+
+  void McMdlRuntime::addSearchPaths(const std::vector<std::string>& paths)
+  {
+    std::unique_lock guard(m_searchPathMutex);
+
+    for (const std::string& path : paths)
+    {
+      if (std::find(m_searchPaths.begin(), m_searchPaths.end(), path) != m_searchPaths.end())
+      {
+        continue;
+      }
+
+      if (m_config->add_mdl_path(path.c_str()))
+      {
+        auto logMsg = GB_FMT("MDL search path could not be added: \"{}\"", path);
+        m_logger->message(mi::base::MESSAGE_SEVERITY_WARNING, logMsg.c_str());
+        continue;
+      }
+
+      m_searchPaths.push_back(path);
+    }
+  }
+
+  std::shared_lock<std::shared_mutex> McMdlRuntime::lockSearchPaths()
+  {
+    return std::shared_lock(m_searchPathMutex);
+  }
+
+  bool McMdlRuntime::runWithAssetSearchPath(const std::string& path, const std::function<bool()>& func)
+  {
+    std::unique_lock guard(m_searchPathMutex);
+
+    // The free TurboSquid USD+MDL models, and possibly thousand paid ones too, come with some of the required Omni* files,
+    // but some others are referenced and missing. If we include the directory of the asset as an MDL path after our own Omni*
+    // MDL files, the Omni* files that come with the asset will be loaded instead of ours. They link to the other files that do
+    // not exist, causing compilation to fail. By changing the load order, our complete Omni*-file suite will be used instead.
+    m_config->clear_mdl_paths();
+
+    if (m_config->add_mdl_path(path.c_str()))
+    {
+      m_logger->message(mi::base::MESSAGE_SEVERITY_WARNING, "unable to add asset MDL files");
+    }
+
+    applySearchPaths();
+
+    bool result = func();
+
+    m_config->clear_mdl_paths();
+    applySearchPaths();
+
+    return result;
+  }
+
+  void McMdlRuntime::applySearchPaths()
+  {
+    for (const std::string& path : m_searchPaths)
+    {
+      m_config->add_mdl_path(path.c_str());
+    }
+  }
+
+  void McMdlRuntime::trackElements(size_t count)
+  {
+    m_elementCount += count;
+  }
+
+  void McMdlRuntime::removeElements(const std::vector<std::string>& names)
+  {
+    if (names.empty())
+    {
+      return;
+    }
+
+    mi::base::Handle<mi::neuraylib::ITransaction> transaction(createTransaction());
+
+    for (const std::string& name : names)
+    {
+      // Elements are only flagged for removal and stay alive while they are referenced.
+      if (transaction->remove(name.c_str()) == 0)
+      {
+        m_elementCount--;
+      }
+      else
+      {
+        auto logMsg = GB_FMT("unable to remove MDL database element {}", name);
+        m_logger->message(mi::base::MESSAGE_SEVERITY_WARNING, logMsg.c_str());
+      }
+    }
+
+    transaction->commit();
+
+    if (++m_removalsSinceGc >= GC_REMOVAL_INTERVAL)
+    {
+      m_removalsSinceGc = 0;
+      m_database->garbage_collection();
+    }
+  }
+
+  size_t McMdlRuntime::getElementCount() const
+  {
+    return m_elementCount;
+  }
 }
@@ -25,9 +25,15 @@
 #include <mi/neuraylib/imdl_backend_api.h>
 #include <mi/neuraylib/imdl_impexp_api.h>
 #include <mi/neuraylib/imdl_factory.h>
+#include <mi/neuraylib/imdl_distiller_api.h>
 
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <shared_mutex>
+#include <string>
 #include <string_view>
+#include <vector>
 
 #include "MdlLogger.h"
 
@@ -47,11 +53,40 @@ namespace gtl
 
     mi::base::Handle<McMdlLogger> getLogger();
     mi::base::Handle<mi::neuraylib::IDatabase> getDatabase();
-    mi::base::Handle<mi::neuraylib::ITransaction> getTransaction();
+    // Transactions are cheap to create; callers commit them once they are done so
+    // that their changes become visible to transactions created afterwards.
+    mi::base::Handle<mi::neuraylib::ITransaction> createTransaction();
     mi::base::Handle<mi::neuraylib::IMdl_factory> getFactory();
     mi::base::Handle<mi::neuraylib::IMdl_configuration> getConfig();
     mi::base::Handle<mi::neuraylib::IMdl_impexp_api> getImpExpApi();
     mi::base::Handle<mi::neuraylib::IMdl_backend_api> getBackendApi();
+    // Null if the distiller plugin is not available.
+    mi::base::Handle<mi::neuraylib::IMdl_distiller_api> getDistillerApi();
+
+  public:
+    // The MDL search path configuration is process-wide. Paths are only registered once,
+    // regardless of how many compilers request them.
+    void addSearchPaths(const std::vector<std::string>& paths);
+
+    // Compilations hold this lock in shared mode so that the search paths don't change under them.
+    std::shared_lock<std::shared_mutex> lockSearchPaths();
+
+    // Runs the function exclusively with the directory as an additional search path, which is
+    // removed afterwards so that later compilations don't resolve modules of unrelated assets.
+    bool runWithAssetSearchPath(const std::string& path, const std::function<bool()>& func);
+
+  public:
+    // Elements of modules generated at runtime are counted, so that leaks can be detected.
+    void trackElements(size_t count);
+
+    // Removes elements from the database. Their memory is reclaimed by periodic garbage collection.
+    void removeElements(const std::vector<std::string>& names);
+
+    // Number of tracked elements currently stored in the database.
+    size_t getElementCount() const;
+
+  private:
+    void applySearchPaths();
 
   private:
     std::shared_ptr<McMdlNeurayLoader> m_loader;
@@ -59,10 +94,16 @@ namespace gtl
     mi::base::Handle<McMdlLogger> m_logger;
     mi::base::Handle<mi::neuraylib::INeuray> m_neuray;
     mi::base::Handle<mi::neuraylib::IDatabase> m_database;
-    mi::base::Handle<mi::neuraylib::ITransaction> m_transaction;
     mi::base::Handle<mi::neuraylib::IMdl_configuration> m_config;
     mi::base::Handle<mi::neuraylib::IMdl_factory> m_factory;
     mi::base::Handle<mi::neuraylib::IMdl_backend_api> m_backendApi;
     mi::base::Handle<mi::neuraylib::IMdl_impexp_api> m_impExpApi;
+    mi::base::Handle<mi::neuraylib::IMdl_distiller_api> m_distillerApi;
+
+    std::shared_mutex m_searchPathMutex;
+    std::vector<std::string> m_searchPaths;
+
+    std::atomic_size_t m_elementCount = 0;
+    std::atomic_uint32_t m_removalsSinceGc = 0;
   };
 }
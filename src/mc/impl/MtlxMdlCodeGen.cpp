@@ -34,6 +34,9 @@
 #include <MaterialXGenMdl/MdlShaderGenerator.h>
 #include <gtl/gb/Log.h>
 
+#include <array>
+#include <unordered_set>
+
 namespace mx = MaterialX;
 
 namespace
@@ -137,6 +140,88 @@ namespace
 
     return nullptr;
   }
+
+  void _AttachDataLibrary(mx::DocumentPtr doc, mx::ConstDocumentPtr dataLibrary)
+  {
+#if (MATERIALX_MAJOR_VERSION > 1) || (MATERIALX_MAJOR_VERSION == 1 && MATERIALX_MINOR_VERSION > 38)
+    // Referenced, not copied.
+    doc->setDataLibrary(dataLibrary);
+#else
+    doc->importLibrary(dataLibrary);
+#endif
+  }
+
+  bool _IsRenamableElement(mx::ElementPtr elem)
+  {
+    return elem->isA<mx::Node>() || elem->isA<mx::NodeGraph>();
+  }
+
+  // Serializes the non-library elements of a document. Node and nodegraph names are
+  // replaced by ordinals so that networks that only differ in naming (for instance,
+  // because they were authored on different USD prims) produce the same key.
+  std::string _MakeCanonicalNetworkKey(mx::DocumentPtr doc)
+  {
+    static const std::unordered_set<std::string> REFERENCE_ATTRIBUTES = {
+      mx::PortElement::NODE_NAME_ATTRIBUTE,
+      mx::PortElement::NODE_GRAPH_ATTRIBUTE,
+      "material"
+    };
+    const char SEPARATOR = '\x1f';
+
+    std::unordered_map<std::string, std::string> nameIds;
+
+    auto forEachNetworkElement = [&](const std::function<void(mx::ElementPtr, size_t)>& func)
+    {
+      for (mx::TreeIterator it = doc->traverseTree().begin(); it != mx::TreeIterator::end(); ++it)
+      {
+        mx::ElementPtr elem = it.getElement();
+
+        if (elem != doc && elem->hasSourceUri())
+        {
+          it.setPruneSubtree(true);
+          continue;
+        }
+
+        func(elem, it.getElementDepth());
+      }
+    };
+
+    forEachNetworkElement([&](mx::ElementPtr elem, size_t depth)
+    {
+      if (_IsRenamableElement(elem) && !nameIds.count(elem->getName()))
+      {
+        nameIds[elem->getName()] = "#" + std::to_string(nameIds.size());
+      }
+    });
+
+    std::string key;
+
+    forEachNetworkElement([&](mx::ElementPtr elem, size_t depth)
+    {
+      key += std::to_string(depth);
+      key += SEPARATOR;
+      key += elem->getCategory();
+      key += SEPARATOR;
+      key += _IsRenamableElement(elem) ? nameIds[elem->getName()] : elem->getName();
+
+      for (const std::string& attrName : elem->getAttributeNames())
+      {
+        const std::string& attrValue = elem->getAttribute(attrName);
+
+        auto nameIdIt = nameIds.find(attrValue);
+        bool isReference = REFERENCE_ATTRIBUTES.count(attrName) && nameIdIt != nameIds.end();
+
+        key += SEPARATOR;
+        key += attrName;
+        key += '=';
+        key += isReference ? nameIdIt->second : attrValue;
+      }
+
+      key += '\n';
+    });
+
+    return key;
+  }
 }
 
 namespace gtl
@@ -148,47 +233,135 @@ namespace gtl
     std::string target = m_shaderGen->getTarget();
 
     // Import stdlib.
-    m_baseDoc = mx::createDocument();
-    m_baseDoc->importLibrary(mtlxStdLib);
+    mx::DocumentPtr baseDoc = mx::createDocument();
+    baseDoc->importLibrary(mtlxStdLib);
 
     // Color management.
     mx::DefaultColorManagementSystemPtr colorSystem = mx::DefaultColorManagementSystem::create(target);
-    colorSystem->loadLibrary(m_baseDoc);
+    colorSystem->loadLibrary(baseDoc);
     m_shaderGen->setColorManagementSystem(colorSystem);
 
     // Unit management.
     mx::UnitSystemPtr unitSystem = mx::UnitSystem::create(target);
-    unitSystem->loadLibrary(m_baseDoc);
+    unitSystem->loadLibrary(baseDoc);
 
     mx::UnitConverterRegistryPtr unitRegistry = mx::UnitConverterRegistry::create();
-    mx::UnitTypeDefPtr distanceTypeDef = m_baseDoc->getUnitTypeDef("distance");
+    mx::UnitTypeDefPtr distanceTypeDef = baseDoc->getUnitTypeDef("distance");
     unitRegistry->addUnitConverter(distanceTypeDef, mx::LinearUnitConverter::create(distanceTypeDef));
-    mx::UnitTypeDefPtr angleTypeDef = m_baseDoc->getUnitTypeDef("angle");
+    mx::UnitTypeDefPtr angleTypeDef = baseDoc->getUnitTypeDef("angle");
     unitRegistry->addUnitConverter(angleTypeDef, mx::LinearUnitConverter::create(angleTypeDef));
 
     unitSystem->setUnitConverterRegistry(unitRegistry);
     m_shaderGen->setUnitSystem(unitSystem);
+
+    m_baseDoc = baseDoc;
   }
 
   bool McMtlxMdlCodeGen::translate(std::string_view mtlxStr, std::string& mdlSrc, std::string& subIdentifier, bool& hasCutoutTransparency)
   {
+    mx::DocumentPtr doc;
+    std::string networkKey;
     try
     {
-      mx::DocumentPtr doc = mx::createDocument();
-      doc->importLibrary(m_baseDoc);
+      // The stdlib is only attached on a cache miss since the key does not depend on it.
+      doc = mx::createDocument();
       mx::readFromXmlString(doc, mtlxStr.data());
 
-      return translate(doc, mdlSrc, subIdentifier, hasCutoutTransparency);
+      networkKey = _MakeCanonicalNetworkKey(doc);
     }
     catch (const std::exception& ex)
     {
       GB_ERROR("exception creating MaterialX document: {}", ex.what());
       return false;
     }
+
+    auto translateFunc = [&]()
+    {
+      _AttachDataLibrary(doc, m_baseDoc);
+      return generate(doc);
+    };
+
+    return translateCached(networkKey, translateFunc, mdlSrc, subIdentifier, hasCutoutTransparency);
   }
 
   bool McMtlxMdlCodeGen::translate(MaterialX::DocumentPtr mtlxDoc, std::string& mdlSrc, std::string& subIdentifier, bool& hasCutoutTransparency)
   {
+    std::string networkKey;
+    try
+    {
+      networkKey = _MakeCanonicalNetworkKey(mtlxDoc);
+    }
+    catch (const std::exception& ex)
+    {
+      GB_ERROR("exception hashing MaterialX document: {}", ex.what());
+      return false;
+    }
+
+    auto translateFunc = [&]()
+    {
+      return generate(mtlxDoc);
+    };
+
+    return translateCached(networkKey, translateFunc, mdlSrc, subIdentifier, hasCutoutTransparency);
+  }
+
+  bool McMtlxMdlCodeGen::translateCached(const std::string& networkKey,
+                                         const std::function<_TranslationResult()>& translateFunc,
+                                         std::string& mdlSrc,
+                                         std::string& subIdentifier,
+                                         bool& hasCutoutTransparency)
+  {
+    std::shared_future<_TranslationResult> future;
+    std::promise<_TranslationResult> promise;
+    bool isOwner = false;
+
+    // Concurrent requests for the same network wait for the first one instead of translating again.
+    {
+      std::lock_guard guard(m_cacheMutex);
+
+      auto it = m_cache.find(networkKey);
+      if (it != m_cache.end())
+      {
+        future = it->second;
+      }
+      else
+      {
+        future = promise.get_future().share();
+        m_cache[networkKey] = future;
+        isOwner = true;
+      }
+    }
+
+    if (isOwner)
+    {
+      _TranslationResult result = translateFunc();
+
+      if (!result.success)
+      {
+        // Don't cache failures so that errors are reported for every material.
+        std::lock_guard guard(m_cacheMutex);
+        m_cache.erase(networkKey);
+      }
+
+      promise.set_value(std::move(result));
+    }
+
+    const _TranslationResult& result = future.get();
+    if (!result.success)
+    {
+      return false;
+    }
+
+    mdlSrc = result.mdlSrc;
+    subIdentifier = result.subIdentifier;
+    hasCutoutTransparency = result.hasCutoutTransparency;
+    return true;
+  }
+
+  McMtlxMdlCodeGen::_TranslationResult McMtlxMdlCodeGen::generate(MaterialX::DocumentPtr mtlxDoc)
+  {
+    _TranslationResult result;
+
     // Don't cache the context because it is thread-local.
     mx::GenContext context(m_shaderGen);
     context.registerSourceCodeSearchPath(m_mtlxSearchPath);
@@ -213,12 +386,12 @@ namespace gtl
       if (!element)
       {
         GB_ERROR("generation failed: surface shader not found");
-        return false;
+        return result;
       }
 
-      subIdentifier = element->getName();
-      hasCutoutTransparency = !_HasSurfaceShaderNoCutoutTransparency(element);
-      shader = m_shaderGen->generate(subIdentifier, element, context);
+      result.subIdentifier = element->getName();
+      result.hasCutoutTransparency = !_HasSurfaceShaderNoCutoutTransparency(element);
+      shader = m_shaderGen->generate(result.subIdentifier, element, context);
     }
     catch (const std::exception& ex)
     {
@@ -227,17 +400,18 @@ namespace gtl
 
     if (!shader)
     {
-      return false;
+      return result;
     }
 
     mx::ShaderStage pixelStage = shader->getStage(mx::Stage::PIXEL);
-    mdlSrc = pixelStage.getSourceCode();
+    result.mdlSrc = pixelStage.getSourceCode();
+    result.success = true;
 
     if (getenv("GATLING_DUMP_MDL"))
     {
-      GB_LOG("MDL source: \n{}", mdlSrc);
+      GB_LOG("MDL source: \n{}", result.mdlSrc);
     }
 
-    return true;
+    return result;
   }
 }
@@ -19,6 +19,10 @@
 
 #include <stdint.h>
 #include <string>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <unordered_map>
 
 #include <MaterialXCore/Document.h>
 #include <MaterialXFormat/File.h>
@@ -35,9 +39,30 @@ namespace gtl
     bool translate(MaterialX::DocumentPtr mtlxDoc, std::string& mdlSrc, std::string& subIdentifier, bool& hasCutoutTransparency);
     bool translate(std::string_view mtlxStr, std::string& mdlSrc, std::string& subIdentifier, bool& hasCutoutTransparency);
 
+  private:
+    struct _TranslationResult
+    {
+      bool success = false;
+      std::string mdlSrc;
+      std::string subIdentifier;
+      bool hasCutoutTransparency = false;
+    };
+
+    bool translateCached(const std::string& networkKey,
+                         const std::function<_TranslationResult()>& translateFunc,
+                         std::string& mdlSrc,
+                         std::string& subIdentifier,
+                         bool& hasCutoutTransparency);
+
+    _TranslationResult generate(MaterialX::DocumentPtr mtlxDoc);
+
   private:
     MaterialX::FileSearchPath m_mtlxSearchPath;
     MaterialX::ShaderGeneratorPtr m_shaderGen;
-    MaterialX::DocumentPtr m_baseDoc;
+    // Holds the standard library; never modified after construction.
+    MaterialX::ConstDocumentPtr m_baseDoc;
+
+    std::mutex m_cacheMutex;
+    std::unordered_map<std::string, std::shared_future<_TranslationResult>> m_cache;
   };
 }
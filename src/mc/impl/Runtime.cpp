@@ -36,6 +36,11 @@ namespace gtl
     return *m_mdlRuntime;
   }
 
+  size_t McRuntime::getMdlElementCount() const
+  {
+    return m_mdlRuntime->getElementCount();
+  }
+
   McRuntime* McLoadRuntime(std::string_view libDir)
   {
     McMdlRuntime* r = new McMdlRuntime();
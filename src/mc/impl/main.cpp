@@ -0,0 +1,473 @@
+//
+// Copyright (C) 2024 Pablo Delgado Krämer
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <MaterialXCore/Document.h>
+#include <MaterialXFormat/Util.h>
+#include <MaterialXFormat/XmlIo.h>
+
+#include <gtl/gb/Fmt.h>
+#include <gtl/gb/Log.h>
+#include <gtl/mc/Backend.h>
+#include <gtl/mc/Runtime.h>
+
+#include "MdlMaterial.h"
+#include "MdlMaterialCompiler.h"
+#include "MdlRuntime.h"
+#include "MtlxMdlCodeGen.h"
+
+namespace mx = MaterialX;
+using namespace gtl;
+
+namespace
+{
+  const static int BENCHMARK_MATERIAL_COUNT = 100;
+  const static int BENCHMARK_MDL_MATERIAL_COUNT = 500;
+  const static int GC_MDL_MATERIAL_COUNT = 1000;
+  const static int BSDF_DATA_MATERIAL_COUNT = 8;
+
+  McRuntime* _GetMcRuntime()
+  {
+    // The MDL SDK can only be started once per process.
+    static std::unique_ptr<McRuntime> s_runtime(McLoadRuntime(MC_MDL_LIB_DIR));
+    return s_runtime.get();
+  }
+
+  std::string _MakeDiffuseMdl(float r, float g, float b)
+  {
+    return GB_FMT("mdl 1.7;\n"
+                  "import ::df::*;\n"
+                  "export material test_material() = material(\n"
+                  "  surface: material_surface(\n"
+                  "    scattering: df::diffuse_reflection_bsdf(tint: color({}, {}, {}))\n"
+                  "  )\n"
+                  ");\n", r, g, b);
+  }
+
+  std::string _MakeParameterizedDiffuseMdl(float r, float g, float b)
+  {
+    return GB_FMT("mdl 1.7;\n"
+                  "import ::df::*;\n"
+                  "export material test_material(color tint = color({}, {}, {})) = material(\n"
+                  "  surface: material_surface(\n"
+                  "    scattering: df::diffuse_reflection_bsdf(tint: tint)\n"
+                  "  )\n"
+                  ");\n", r, g, b);
+  }
+
+  // Multiscattering GGX requires BSDF lookup tables.
+  std::string _MakeGlossyMdl(float roughness)
+  {
+    return GB_FMT("mdl 1.7;\n"
+                  "import ::df::*;\n"
+                  "export material test_material() = material(\n"
+                  "  surface: material_surface(\n"
+                  "    scattering: df::microfacet_ggx_vcavities_bsdf(\n"
+                  "      roughness_u: {},\n"
+                  "      multiscatter_tint: color(1.0)\n"
+                  "    )\n"
+                  "  )\n"
+                  ");\n", roughness);
+  }
+
+  mx::DocumentPtr _LoadMtlxStdLib()
+  {
+    mx::DocumentPtr stdLib = mx::createDocument();
+    mx::FileSearchPath searchPath(MC_MTLX_STDLIB_DIR);
+    mx::loadLibraries({}, searchPath, stdLib);
+    return stdLib;
+  }
+
+  std::string _MakeStandardSurfaceMtlx(const std::string& materialName, float roughness)
+  {
+    mx::DocumentPtr doc = mx::createDocument();
+    mx::NodePtr shader = doc->addNode("standard_surface", materialName + "_shader", mx::SURFACE_SHADER_TYPE_STRING);
+    shader->setInputValue("base_color", mx::Color3(0.8f, 0.2f, 0.2f));
+    shader->setInputValue("specular_roughness", roughness);
+    doc->addMaterialNode(materialName, shader);
+    return mx::writeToXmlString(doc);
+  }
+
+  struct _TranslationOutput
+  {
+    std::string mdlSrc;
+    std::string subIdentifier;
+    bool hasCutoutTransparency;
+  };
+
+  double _TranslateAll(McMtlxMdlCodeGen& codeGen, const std::vector<std::string>& mtlxSrcs, std::vector<_TranslationOutput>& outputs)
+  {
+    outputs.resize(mtlxSrcs.size());
+
+    auto startTime = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < mtlxSrcs.size(); i++)
+    {
+      _TranslationOutput& o = outputs[i];
+      REQUIRE(codeGen.translate(mtlxSrcs[i], o.mdlSrc, o.subIdentifier, o.hasCutoutTransparency));
+    }
+    std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - startTime;
+
+    return duration.count();
+  }
+}
+
+TEST_CASE("MtlxMdlCodeGen.TranslateCopies")
+{
+  gbLogInit();
+
+  McMtlxMdlCodeGen codeGen(_LoadMtlxStdLib());
+
+  // Identical networks that only differ in naming.
+  std::vector<std::string> mtlxSrcs;
+  for (int i = 0; i < BENCHMARK_MATERIAL_COUNT; i++)
+  {
+    mtlxSrcs.push_back(_MakeStandardSurfaceMtlx("Material" + std::to_string(i), 0.5f));
+  }
+
+  std::vector<_TranslationOutput> outputs;
+  double durationMs = _TranslateAll(codeGen, mtlxSrcs, outputs);
+  MESSAGE("translated ", BENCHMARK_MATERIAL_COUNT, " copies in ", durationMs, "ms");
+
+  for (const _TranslationOutput& o : outputs)
+  {
+    CHECK_EQ(o.mdlSrc, outputs[0].mdlSrc);
+    CHECK_EQ(o.subIdentifier, outputs[0].subIdentifier);
+  }
+}
+
+TEST_CASE("MtlxMdlCodeGen.TranslateVariants")
+{
+  gbLogInit();
+
+  McMtlxMdlCodeGen codeGen(_LoadMtlxStdLib());
+
+  std::vector<std::string> mtlxSrcs;
+  for (int i = 0; i < BENCHMARK_MATERIAL_COUNT; i++)
+  {
+    float roughness = float(i) / BENCHMARK_MATERIAL_COUNT;
+    mtlxSrcs.push_back(_MakeStandardSurfaceMtlx("Material", roughness));
+  }
+
+  std::vector<_TranslationOutput> outputs;
+  double durationMs = _TranslateAll(codeGen, mtlxSrcs, outputs);
+  MESSAGE("translated ", BENCHMARK_MATERIAL_COUNT, " variants in ", durationMs, "ms");
+
+  for (size_t i = 1; i < outputs.size(); i++)
+  {
+    CHECK_NE(outputs[i].mdlSrc, outputs[i - 1].mdlSrc);
+  }
+
+  // Second pass is served from the cache.
+  std::vector<_TranslationOutput> cachedOutputs;
+  double cachedDurationMs = _TranslateAll(codeGen, mtlxSrcs, cachedOutputs);
+  MESSAGE("translated ", BENCHMARK_MATERIAL_COUNT, " cached variants in ", cachedDurationMs, "ms");
+
+  for (size_t i = 0; i < outputs.size(); i++)
+  {
+    CHECK_EQ(outputs[i].mdlSrc, cachedOutputs[i].mdlSrc);
+  }
+}
+
+TEST_CASE("MtlxMdlCodeGen.TranslateConcurrently")
+{
+  gbLogInit();
+
+  McMtlxMdlCodeGen codeGen(_LoadMtlxStdLib());
+
+  std::string mtlxSrc = _MakeStandardSurfaceMtlx("Material", 0.5f);
+
+  const int threadCount = 8;
+  std::vector<std::thread> threads;
+  std::vector<std::string> mdlSrcs(threadCount);
+  std::atomic_int failureCount = 0;
+
+  for (int i = 0; i < threadCount; i++)
+  {
+    threads.push_back(std::thread([&, i]() {
+      std::string subIdentifier;
+      bool hasCutoutTransparency;
+      if (!codeGen.translate(mtlxSrc, mdlSrcs[i], subIdentifier, hasCutoutTransparency))
+      {
+        failureCount++;
+      }
+    }));
+  }
+
+  for (std::thread& t : threads)
+  {
+    t.join();
+  }
+
+  CHECK_EQ(failureCount, 0);
+  for (const std::string& mdlSrc : mdlSrcs)
+  {
+    CHECK_EQ(mdlSrc, mdlSrcs[0]);
+  }
+}
+
+TEST_CASE("MdlMaterialCompiler.CompileScaling")
+{
+  gbLogInit();
+
+  McRuntime* runtime = _GetMcRuntime();
+  REQUIRE(runtime);
+
+  McMdlMaterialCompiler compiler(runtime->getMdlRuntime(), {}, false, "");
+
+  for (int threadCount : { 1, 2, 4, 8 })
+  {
+    std::atomic_int nextIndex = 0;
+    std::atomic_int failureCount = 0;
+
+    auto compileFunc = [&]()
+    {
+      for (int i = nextIndex++; i < BENCHMARK_MDL_MATERIAL_COUNT; i = nextIndex++)
+      {
+        float value = float(i) / BENCHMARK_MDL_MATERIAL_COUNT;
+        std::string mdlSrc = _MakeDiffuseMdl(value, 1.0f - value, float(threadCount) / 8.0f);
+
+        mi::base::Handle<mi::neuraylib::ICompiled_material> compiledMaterial;
+        std::shared_ptr<McMdlGeneratedModule> generatedModule;
+        if (!compiler.compileFromString(mdlSrc, "test_material", compiledMaterial, generatedModule))
+        {
+          failureCount++;
+        }
+      }
+    };
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; t++)
+    {
+      threads.push_back(std::thread(compileFunc));
+    }
+    for (std::thread& t : threads)
+    {
+      t.join();
+    }
+
+    std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - startTime;
+    MESSAGE("compiled ", BENCHMARK_MDL_MATERIAL_COUNT, " MDL materials on ", threadCount, " threads in ", duration.count(), "ms");
+
+    CHECK_EQ(failureCount, 0);
+  }
+}
+
+TEST_CASE("MdlMaterialCompiler.ClassCompilation")
+{
+  gbLogInit();
+
+  McRuntime* runtime = _GetMcRuntime();
+  REQUIRE(runtime);
+
+  McMdlMaterialCompiler compiler(runtime->getMdlRuntime(), {}, true, "");
+
+  McBackend backend;
+  REQUIRE(backend.init(*runtime));
+
+  McMdlMaterial material0;
+  McMdlMaterial material1;
+  REQUIRE(compiler.compileFromString(_MakeParameterizedDiffuseMdl(1.0f, 0.0f, 0.0f), "test_material", material0.compiledMaterial, material0.generatedModule));
+  REQUIRE(compiler.compileFromString(_MakeParameterizedDiffuseMdl(0.0f, 0.5f, 1.0f), "test_material", material1.compiledMaterial, material1.generatedModule));
+
+  // Parameters are kept as arguments, so both materials share the same class.
+  CHECK_EQ(material0.compiledMaterial->get_parameter_count(), 1);
+  CHECK_EQ(material1.compiledMaterial->get_parameter_count(), 1);
+  CHECK_EQ(material0.compiledMaterial->get_hash(), material1.compiledMaterial->get_hash());
+
+  McGlslGenResult result0;
+  McGlslGenResult result1;
+  REQUIRE(backend.genGlsl(material0, McDfFlags::Scattering, result0));
+  REQUIRE(backend.genGlsl(material1, McDfFlags::Scattering, result1));
+
+  // The code generated for the first material is reused; only the argument blocks differ.
+  CHECK_EQ(backend.getCodeGenStats().missCount, 1);
+  CHECK_NE(result0.argBlockLayoutId, 0);
+  CHECK_EQ(result1.argBlockLayoutId, result0.argBlockLayoutId);
+  CHECK_EQ(result1.source, result0.source);
+  CHECK_FALSE(result0.argBlock.empty());
+  CHECK_EQ(result1.argBlock.size(), result0.argBlock.size());
+  CHECK_NE(result1.argBlock, result0.argBlock);
+
+  // The layout is kept until the last result that references it is released.
+  std::vector<uint8_t> argBlock;
+  backend.releaseArgBlockLayout(result0.argBlockLayoutId);
+  CHECK(backend.genArgBlock(material0, result1.argBlockLayoutId, argBlock));
+  backend.releaseArgBlockLayout(result1.argBlockLayoutId);
+  CHECK_FALSE(backend.genArgBlock(material0, result1.argBlockLayoutId, argBlock));
+
+  McGlslGenResult result2;
+  REQUIRE(backend.genGlsl(material0, McDfFlags::Scattering, result2));
+  CHECK_EQ(backend.getCodeGenStats().missCount, 2);
+  CHECK_NE(result2.argBlockLayoutId, result0.argBlockLayoutId);
+  backend.releaseArgBlockLayout(result2.argBlockLayoutId);
+}
+
+TEST_CASE("MdlMaterialCompiler.ModuleGarbageCollection")
+{
+  gbLogInit();
+
+  McRuntime* runtime = _GetMcRuntime();
+  REQUIRE(runtime);
+
+  McMdlRuntime& mdlRuntime = runtime->getMdlRuntime();
+  McMdlMaterialCompiler compiler(mdlRuntime, {}, false, "");
+
+  auto isStored = [&](const std::string& elementName)
+  {
+    mi::base::Handle<mi::neuraylib::ITransaction> transaction(mdlRuntime.createTransaction());
+    mi::base::Handle<const mi::base::IInterface> element(transaction->access(elementName.c_str()));
+    transaction->commit();
+    return element.is_valid_interface();
+  };
+
+  std::vector<std::string> removedElementNames;
+
+  for (int i = 0; i < GC_MDL_MATERIAL_COUNT; i++)
+  {
+    float value = float(i) / GC_MDL_MATERIAL_COUNT;
+
+    // Destroyed at the end of each iteration, like a material replaced by an edit.
+    mi::base::Handle<mi::neuraylib::ICompiled_material> compiledMaterial;
+    std::shared_ptr<McMdlGeneratedModule> generatedModule;
+    REQUIRE(compiler.compileFromString(_MakeDiffuseMdl(value, 1.0f - value, 0.5f), "test_material", compiledMaterial, generatedModule));
+
+    // The module and its material definition.
+    const std::vector<std::string>& elementNames = generatedModule->getElementNames();
+    REQUIRE_FALSE(elementNames.empty());
+
+    for (const std::string& elementName : elementNames)
+    {
+      CHECK(isStored(elementName));
+    }
+
+    removedElementNames.insert(removedElementNames.end(), elementNames.begin(), elementNames.end());
+  }
+
+  mi::base::Handle<mi::neuraylib::IDatabase> database(mdlRuntime.getDatabase());
+  database->garbage_collection();
+
+  size_t storedElementCount = std::count_if(removedElementNames.begin(), removedElementNames.end(), isStored);
+  CHECK_EQ(storedElementCount, 0);
+}
+
+TEST_CASE("Backend.CodeGenCache")
+{
+  gbLogInit();
+
+  McRuntime* runtime = _GetMcRuntime();
+  REQUIRE(runtime);
+
+  McMdlMaterialCompiler compiler(runtime->getMdlRuntime(), {}, false, "");
+
+  McBackend backend;
+  REQUIRE(backend.init(*runtime));
+
+  McMdlMaterial material;
+  REQUIRE(compiler.compileFromString(_MakeGlossyMdl(0.25f), "test_material", material.compiledMaterial, material.generatedModule));
+
+  auto genGlsl = [&](McDfFlags dfFlags, McGlslGenResult& result)
+  {
+    auto startTime = std::chrono::steady_clock::now();
+    CHECK(backend.genGlsl(material, dfFlags, result));
+    std::chrono::duration<float, std::milli> duration = std::chrono::steady_clock::now() - startTime;
+    return duration.count();
+  };
+
+  McGlslGenResult result;
+  float durationMs = genGlsl(McDfFlags::Scattering, result);
+
+  // A shader cache rebuild that is not caused by a material change requests the same code again.
+  McGlslGenResult cachedResult;
+  float cachedDurationMs = genGlsl(McDfFlags::Scattering, cachedResult);
+  MESSAGE("generated GLSL in ", durationMs, "ms, cached in ", cachedDurationMs, "ms");
+
+  McCodeGenStats stats = backend.getCodeGenStats();
+  CHECK_EQ(stats.missCount, 1);
+  CHECK_EQ(stats.hitCount, 1);
+  CHECK_GT(stats.generationTimeMs, 0.0f);
+  CHECK_LE(stats.generationTimeMs, durationMs);
+  CHECK_LT(cachedDurationMs, stats.generationTimeMs);
+
+  CHECK_EQ(cachedResult.source, result.source);
+  CHECK_EQ(cachedResult.textureDescriptions.size(), result.textureDescriptions.size());
+
+  // Different distribution functions require new code.
+  McGlslGenResult emissionResult;
+  genGlsl(McDfFlags::Scattering | McDfFlags::Emission, emissionResult);
+  CHECK_EQ(backend.getCodeGenStats().missCount, 2);
+}
+
+TEST_CASE("Backend.SharedBsdfData")
+{
+  gbLogInit();
+
+  McRuntime* runtime = _GetMcRuntime();
+  REQUIRE(runtime);
+
+  McMdlMaterialCompiler compiler(runtime->getMdlRuntime(), {}, false, "");
+
+  McBackend backend;
+  REQUIRE(backend.init(*runtime));
+
+  std::vector<McTextureDescription> firstTables;
+
+  for (int i = 0; i < BSDF_DATA_MATERIAL_COUNT; i++)
+  {
+    float roughness = float(i + 1) / BSDF_DATA_MATERIAL_COUNT;
+
+    McMdlMaterial material;
+    REQUIRE(compiler.compileFromString(_MakeGlossyMdl(roughness), "test_material", material.compiledMaterial, material.generatedModule));
+
+    McGlslGenResult result;
+    REQUIRE(backend.genGlsl(material, McDfFlags::Scattering, result));
+
+    std::vector<McTextureDescription> tables;
+    for (const McTextureDescription& desc : result.textureDescriptions)
+    {
+      if (desc.bsdfDataKey != 0)
+      {
+        tables.push_back(desc);
+      }
+    }
+
+    REQUIRE_GT(tables.size(), 0);
+
+    if (i == 0)
+    {
+      firstTables = tables;
+      continue;
+    }
+
+    // Tables don't depend on parameter values, so their keys and payloads are equal and the
+    // texture manager can share them (see the TextureManager.SharedBsdfData test of gi).
+    REQUIRE_EQ(tables.size(), firstTables.size());
+    for (size_t j = 0; j < tables.size(); j++)
+    {
+      CHECK_EQ(tables[j].bsdfDataKey, firstTables[j].bsdfDataKey);
+      CHECK(tables[j].data == firstTables[j].data);
+    }
+  }
+}